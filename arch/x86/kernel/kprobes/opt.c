@@ -16,6 +16,8 @@
 #include <linux/kallsyms.h>
 #include <linux/ftrace.h>
 #include <linux/frame.h>
+#include <linux/memory.h>
+#include <linux/sort.h>
 
 #include <asm/text-patching.h>
 #include <asm/cacheflush.h>
@@ -415,6 +417,50 @@ int arch_prepare_optimized_kprobe(struct optimized_kprobe *op,
 	goto out;
 }
 
+/*
+ * Optimizing and unoptimizing patch many probes at once: they're put in
+ * this vector and patched together, so that all of them share the three
+ * core syncs of text_poke_bp_batch(). Protected by text_mutex.
+ */
+#define OPTPROBE_TP_VEC_MAX	(PAGE_SIZE / sizeof(struct text_poke_loc))
+static struct text_poke_loc optprobe_tp_vec[OPTPROBE_TP_VEC_MAX];
+static unsigned int optprobe_tp_vec_nr;
+
+static int optprobe_tp_cmp(const void *a, const void *b)
+{
+	const struct text_poke_loc *tp_a = a, *tp_b = b;
+
+	if (tp_a->addr < tp_b->addr)
+		return -1;
+	if (tp_a->addr > tp_b->addr)
+		return 1;
+	return 0;
+}
+
+static void optprobe_tp_vec_flush(void)
+{
+	if (!optprobe_tp_vec_nr)
+		return;
+
+	/* poke_int3_handler() bsearch()es the vector by address */
+	sort(optprobe_tp_vec, optprobe_tp_vec_nr, sizeof(struct text_poke_loc),
+	     optprobe_tp_cmp, NULL);
+	text_poke_bp_batch(optprobe_tp_vec, optprobe_tp_vec_nr);
+	optprobe_tp_vec_nr = 0;
+}
+
+static void optprobe_tp_vec_add(void *addr, const void *opcode,
+				const void *emulate)
+{
+	lockdep_assert_held(&text_mutex);
+
+	if (optprobe_tp_vec_nr == OPTPROBE_TP_VEC_MAX)
+		optprobe_tp_vec_flush();
+
+	text_poke_loc_init(&optprobe_tp_vec[optprobe_tp_vec_nr++], addr,
+			   opcode, RELATIVEJUMP_SIZE, emulate);
+}
+
 /*
  * Replace breakpoints (int3) with relative jumps.
  * Caller must call with locking kprobe_mutex and text_mutex.
@@ -437,14 +483,15 @@ void arch_optimize_kprobes(struct list_head *oplist)
 		insn_buff[0] = RELATIVEJUMP_OPCODE;
 		*(s32 *)(&insn_buff[1]) = rel;
 
-		text_poke_bp(op->kp.addr, insn_buff, RELATIVEJUMP_SIZE, NULL);
+		optprobe_tp_vec_add(op->kp.addr, insn_buff, NULL);
 
 		list_del_init(&op->list);
 	}
+
+	optprobe_tp_vec_flush();
 }
 
-/* Replace a relative jump with a breakpoint (int3).  */
-void arch_unoptimize_kprobe(struct optimized_kprobe *op)
+static void __arch_unoptimize_kprobe(struct optimized_kprobe *op)
 {
 	u8 insn_buff[RELATIVEJUMP_SIZE];
 	u8 emulate_buff[RELATIVEJUMP_SIZE];
@@ -457,8 +504,14 @@ void arch_unoptimize_kprobe(struct optimized_kprobe *op)
 	*(s32 *)(&emulate_buff[1]) = (s32)((long)op->optinsn.insn -
 			((long)op->kp.addr + RELATIVEJUMP_SIZE));
 
-	text_poke_bp(op->kp.addr, insn_buff, RELATIVEJUMP_SIZE,
-		     emulate_buff);
+	optprobe_tp_vec_add(op->kp.addr, insn_buff, emulate_buff);
+}
+
+/* Replace a relative jump with a breakpoint (int3).  */
+void arch_unoptimize_kprobe(struct optimized_kprobe *op)
+{
+	__arch_unoptimize_kprobe(op);
+	optprobe_tp_vec_flush();
 }
 
 /*
@@ -471,9 +524,11 @@ extern void arch_unoptimize_kprobes(struct list_head *oplist,
 	struct optimized_kprobe *op, *tmp;
 
 	list_for_each_entry_safe(op, tmp, oplist, list) {
-		arch_unoptimize_kprobe(op);
+		__arch_unoptimize_kprobe(op);
 		list_move(&op->list, done_list);
 	}
+
+	optprobe_tp_vec_flush();
 }
 
 int setup_detour_execution(struct kprobe *p, struct pt_regs *regs, int reenter)
@@ -34,6 +34,7 @@
 #include <linux/reboot.h>
 #include <linux/security.h>
 #include <linux/xz.h>
+#include <linux/initrd.h>
 
 #include <generated/utsrelease.h>
 
@@ -469,6 +470,9 @@ fw_get_filesystem_firmware(struct device *device, struct fw_priv *fw_priv,
 	size_t msize = INT_MAX;
 	void *buffer = NULL;
 
+	/* Early firmware requests may be served from the initramfs. */
+	wait_for_initramfs();
+
 	/* Already populated data member means we're loading into a buffer */
 	if (!decompress && fw_priv->data) {
 		buffer = fw_priv->data;
@@ -42,6 +42,8 @@
 #include <linux/cred.h>
 #include <linux/dax.h>
 #include <linux/uaccess.h>
+#include <linux/hashtable.h>
+#include <linux/iversion.h>
 #include <asm/param.h>
 #include <asm/page.h>
 
@@ -415,6 +417,243 @@ static int elf_read(struct file *file, void *buf, size_t len, loff_t pos)
 	return 0;
 }
 
+/*
+ * Short-lived processes exec the same few binaries over and over again:
+ * keep the headers of recently executed ELF files and interpreters, and the
+ * interpreter path, so that exec does not need to read them every time.
+ *
+ * Files stay write-denied while exec reads them, so nothing can change
+ * them between reading the headers and sampling i_version.  Sampling
+ * queries i_version, so any later write, truncate or metadata change
+ * bumps it and the layout no longer matches.  That only holds for
+ * filesystems that maintain i_version (SB_I_VERSION), and whose changes
+ * all go through this kernel, so other files are not cached.
+ *
+ * Layouts are keyed by superblock, inode number and generation, never by
+ * the inode itself, which could be freed and reused for another file.
+ */
+#define ELF_LAYOUT_HASH_BITS	7
+#define ELF_LAYOUT_CACHE_MAX	256
+
+struct elf_layout {
+	struct hlist_node node;
+	struct list_head lru;
+	struct rcu_head rcu;
+	/* Only ever compared, never dereferenced */
+	const struct super_block *sb;
+	unsigned long ino;
+	u32 generation;
+	u64 iversion;
+	struct timespec64 mtime;
+	struct timespec64 ctime;
+	loff_t size;
+	bool referenced;
+	struct elfhdr ehdr;
+	char *interp;
+	loff_t interp_off;
+	unsigned int interp_len;
+	unsigned int phsize;
+	struct elf_phdr phdata[];
+};
+
+static DEFINE_HASHTABLE(elf_layout_hash, ELF_LAYOUT_HASH_BITS);
+static LIST_HEAD(elf_layout_lru);
+static DEFINE_SPINLOCK(elf_layout_lock);
+static unsigned int elf_layout_count;
+
+static bool elf_layout_cacheable(const struct inode *inode)
+{
+	return IS_I_VERSION(inode) &&
+	       (inode->i_sb->s_type->fs_flags & FS_REQUIRES_DEV);
+}
+
+static unsigned long elf_layout_key(const struct inode *inode)
+{
+	return (unsigned long)inode->i_sb ^ inode->i_ino;
+}
+
+static bool elf_layout_same_file(const struct elf_layout *layout,
+				 const struct inode *inode)
+{
+	return layout->sb == inode->i_sb &&
+	       layout->ino == inode->i_ino &&
+	       layout->generation == inode->i_generation;
+}
+
+static bool elf_layout_match(const struct elf_layout *layout,
+			     const struct inode *inode)
+{
+	return elf_layout_same_file(layout, inode) &&
+	       inode_eq_iversion(inode, layout->iversion) &&
+	       timespec64_equal(&layout->mtime, &inode->i_mtime) &&
+	       timespec64_equal(&layout->ctime, &inode->i_ctime) &&
+	       layout->size == i_size_read(inode);
+}
+
+/* Must be called under rcu_read_lock() */
+static struct elf_layout *elf_layout_find(struct file *file)
+{
+	const struct inode *inode = file_inode(file);
+	struct elf_layout *layout;
+
+	if (!elf_layout_cacheable(inode))
+		return NULL;
+
+	hash_for_each_possible_rcu(elf_layout_hash, layout, node,
+				   elf_layout_key(inode)) {
+		if (elf_layout_match(layout, inode)) {
+			if (!READ_ONCE(layout->referenced))
+				WRITE_ONCE(layout->referenced, true);
+			return layout;
+		}
+	}
+	return NULL;
+}
+
+static bool elf_layout_ehdr(struct file *file, struct elfhdr *elf_ex)
+{
+	struct elf_layout *layout;
+	bool found = false;
+
+	rcu_read_lock();
+	layout = elf_layout_find(file);
+	if (layout) {
+		*elf_ex = layout->ehdr;
+		found = true;
+	}
+	rcu_read_unlock();
+	return found;
+}
+
+static bool elf_layout_phdrs(struct file *file, const struct elfhdr *elf_ex,
+			     struct elf_phdr *elf_phdata, unsigned int size)
+{
+	struct elf_layout *layout;
+	bool found = false;
+
+	rcu_read_lock();
+	layout = elf_layout_find(file);
+	if (layout && layout->phsize == size &&
+	    !memcmp(&layout->ehdr, elf_ex, sizeof(*elf_ex))) {
+		memcpy(elf_phdata, layout->phdata, size);
+		found = true;
+	}
+	rcu_read_unlock();
+	return found;
+}
+
+static bool elf_layout_interp(struct file *file, const struct elf_phdr *phdr,
+			      char *elf_interpreter)
+{
+	struct elf_layout *layout;
+	bool found = false;
+
+	rcu_read_lock();
+	layout = elf_layout_find(file);
+	if (layout && layout->interp &&
+	    layout->interp_off == phdr->p_offset &&
+	    layout->interp_len == phdr->p_filesz) {
+		memcpy(elf_interpreter, layout->interp, layout->interp_len);
+		found = true;
+	}
+	rcu_read_unlock();
+	return found;
+}
+
+static void elf_layout_del(struct elf_layout *layout)
+{
+	hash_del_rcu(&layout->node);
+	list_del(&layout->lru);
+	elf_layout_count--;
+	kfree_rcu(layout, rcu);
+}
+
+/* Evict the oldest layout not used since it was last looked at */
+static void elf_layout_evict(void)
+{
+	struct elf_layout *layout;
+
+	for (;;) {
+		layout = list_first_entry(&elf_layout_lru, struct elf_layout,
+					  lru);
+		if (!layout->referenced)
+			break;
+		layout->referenced = false;
+		list_move_tail(&layout->lru, &elf_layout_lru);
+	}
+	elf_layout_del(layout);
+}
+
+static void elf_layout_add(struct file *file, const struct elfhdr *elf_ex,
+			   const struct elf_phdr *elf_phdata, unsigned int size)
+{
+	struct inode *inode = file_inode(file);
+	const struct elf_phdr *interp = NULL;
+	struct elf_layout *layout, *old;
+	unsigned int i, len = 0;
+
+	if (!elf_layout_cacheable(inode) ||
+	    atomic_read(&inode->i_writecount) >= 0)
+		return;
+
+	for (i = 0; i < elf_ex->e_phnum; i++) {
+		if (elf_phdata[i].p_type == PT_INTERP) {
+			interp = &elf_phdata[i];
+			len = interp->p_filesz;
+			if (len > PATH_MAX || len < 2)
+				return;
+			break;
+		}
+	}
+
+	layout = kmalloc(sizeof(*layout) + size + len, GFP_KERNEL);
+	if (!layout)
+		return;
+	layout->sb = inode->i_sb;
+	layout->ino = inode->i_ino;
+	layout->generation = inode->i_generation;
+	layout->iversion = inode_query_iversion(inode);
+	layout->mtime = inode->i_mtime;
+	layout->ctime = inode->i_ctime;
+	layout->size = i_size_read(inode);
+	layout->referenced = false;
+	layout->ehdr = *elf_ex;
+	layout->phsize = size;
+	memcpy(layout->phdata, elf_phdata, size);
+	layout->interp = NULL;
+	if (interp) {
+		layout->interp = (char *)layout->phdata + size;
+		layout->interp_off = interp->p_offset;
+		layout->interp_len = len;
+		if (elf_read(file, layout->interp, len, interp->p_offset) < 0 ||
+		    layout->interp[len - 1] != '\0') {
+			kfree(layout);
+			return;
+		}
+	}
+
+	spin_lock(&elf_layout_lock);
+	hash_for_each_possible(elf_layout_hash, old, node,
+			       elf_layout_key(inode)) {
+		if (!elf_layout_same_file(old, inode))
+			continue;
+		if (elf_layout_match(old, inode)) {
+			/* Someone beat us to it */
+			spin_unlock(&elf_layout_lock);
+			kfree(layout);
+			return;
+		}
+		elf_layout_del(old);
+		break;
+	}
+	if (elf_layout_count >= ELF_LAYOUT_CACHE_MAX)
+		elf_layout_evict();
+	hash_add_rcu(elf_layout_hash, &layout->node, elf_layout_key(inode));
+	list_add_tail(&layout->lru, &elf_layout_lru);
+	elf_layout_count++;
+	spin_unlock(&elf_layout_lock);
+}
+
 /**
  * load_elf_phdrs() - load ELF program headers
  * @elf_ex:   ELF header of the binary whose program headers should be loaded
@@ -448,12 +687,18 @@ static struct elf_phdr *load_elf_phdrs(const struct elfhdr *elf_ex,
 	if (!elf_phdata)
 		goto out;
 
+	if (elf_layout_phdrs(elf_file, elf_ex, elf_phdata, size)) {
+		err = 0;
+		goto out;
+	}
+
 	/* Read in the program headers */
 	retval = elf_read(elf_file, elf_phdata, size, elf_ex->e_phoff);
 	if (retval < 0) {
 		err = retval;
 		goto out;
 	}
+	elf_layout_add(elf_file, elf_ex, elf_phdata, size);
 
 	/* Success! */
 	err = 0;
@@ -747,10 +992,12 @@ static int load_elf_binary(struct linux_binprm *bprm)
 		if (!elf_interpreter)
 			goto out_free_ph;
 
-		retval = elf_read(bprm->file, elf_interpreter, elf_ppnt->p_filesz,
-				  elf_ppnt->p_offset);
-		if (retval < 0)
-			goto out_free_interp;
+		if (!elf_layout_interp(bprm->file, elf_ppnt, elf_interpreter)) {
+			retval = elf_read(bprm->file, elf_interpreter,
+					  elf_ppnt->p_filesz, elf_ppnt->p_offset);
+			if (retval < 0)
+				goto out_free_interp;
+		}
 		/* make sure path is NULL terminated */
 		retval = -ENOEXEC;
 		if (elf_interpreter[elf_ppnt->p_filesz - 1] != '\0')
@@ -769,8 +1016,10 @@ static int load_elf_binary(struct linux_binprm *bprm)
 		would_dump(bprm, interpreter);
 
 		/* Get the exec headers */
-		retval = elf_read(interpreter, &loc->interp_elf_ex,
-				  sizeof(loc->interp_elf_ex), 0);
+		retval = 0;
+		if (!elf_layout_ehdr(interpreter, &loc->interp_elf_ex))
+			retval = elf_read(interpreter, &loc->interp_elf_ex,
+					  sizeof(loc->interp_elf_ex), 0);
 		if (retval < 0)
 			goto out_free_dentry;
 
@@ -2331,26 +2580,8 @@ static int elf_core_dump(struct coredump_params *cprm)
 
 	for (i = 0, vma = first_vma(current, gate_vma); vma != NULL;
 			vma = next_vma(vma, gate_vma)) {
-		unsigned long addr;
-		unsigned long end;
-
-		end = vma->vm_start + vma_filesz[i++];
-
-		for (addr = vma->vm_start; addr < end; addr += PAGE_SIZE) {
-			struct page *page;
-			int stop;
-
-			page = get_dump_page(addr);
-			if (page) {
-				void *kaddr = kmap(page);
-				stop = !dump_emit(cprm, kaddr, PAGE_SIZE);
-				kunmap(page);
-				put_page(page);
-			} else
-				stop = !dump_skip(cprm, PAGE_SIZE);
-			if (stop)
-				goto end_coredump;
-		}
+		if (!dump_user_range(cprm, vma->vm_start, vma_filesz[i++]))
+			goto end_coredump;
 	}
 	dump_truncate(cprm);
 
@@ -41,8 +41,13 @@
 #include <linux/fs.h>
 #include <linux/path.h>
 #include <linux/timekeeping.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+#include <linux/zlib.h>
+#include <linux/crc32.h>
 
 #include <linux/uaccess.h>
+#include <asm/unaligned.h>
 #include <asm/mmu_context.h>
 #include <asm/tlb.h>
 #include <asm/exec.h>
@@ -54,6 +59,9 @@
 
 int core_uses_pid;
 unsigned int core_pipe_limit;
+#ifdef CONFIG_COREDUMP_COMPRESS
+int core_compress;
+#endif
 char core_pattern[CORENAME_MAX_SIZE] = "core";
 static int core_name_size = CORENAME_MAX_SIZE;
 
@@ -562,6 +570,230 @@ static int umh_pipe_setup(struct subprocess_info *info, struct cred *new)
 	return err;
 }
 
+static int dump_write(struct file *file, const void *addr, size_t nr)
+{
+	loff_t pos = file->f_pos;
+	ssize_t n;
+
+	while (nr) {
+		if (dump_interrupted())
+			return 0;
+		n = __kernel_write(file, addr, nr, &pos);
+		if (n <= 0)
+			return 0;
+		file->f_pos = pos;
+		addr += n;
+		nr -= n;
+	}
+	return 1;
+}
+
+/*
+ * The dump goes out through a chunk buffer, so that the file sees large
+ * writes rather than one per page.  With kernel.core_compress set, each
+ * full chunk is deflated on system_unbound_wq while the dumping task goes
+ * on filling the next one, and becomes a gzip member of its own; chunks
+ * are written in order, so the file is a valid (multi-member) gzip stream.
+ */
+#define CORE_CHUNK_SIZE		(1UL << 20)
+#define CORE_CHUNK_OUT_SIZE	(CORE_CHUNK_SIZE + CORE_CHUNK_SIZE / 8 + 64)
+#define CORE_COMPRESS_THREADS	4
+/* Holes up to this size are buffered as zeroes rather than flushed and seeked */
+#define CORE_SKIP_BUFFERED	(64UL << 10)
+
+struct core_chunk {
+	void *in;
+	size_t in_len;
+#ifdef CONFIG_COREDUMP_COMPRESS
+	struct work_struct work;
+	struct completion done;
+	void *out;
+	size_t out_len;
+	void *workspace;
+	int level;
+	bool busy;
+#endif
+};
+
+struct core_stream {
+	int level;		/* 0: buffered, 1-9: gzip level */
+	unsigned int nr_chunks;
+	unsigned int head;	/* chunk being filled */
+	struct core_chunk chunks[];
+};
+
+#ifdef CONFIG_COREDUMP_COMPRESS
+static void core_chunk_compress(struct work_struct *work)
+{
+	static const u8 gzip_header[] = {
+		0x1f, 0x8b, Z_DEFLATED, 0, 0, 0, 0, 0, 0, 3,
+	};
+	struct core_chunk *chunk = container_of(work, struct core_chunk, work);
+	struct z_stream_s strm = { .workspace = chunk->workspace };
+	u8 *out = chunk->out;
+	size_t len;
+
+	chunk->out_len = 0;
+	if (zlib_deflateInit2(&strm, chunk->level, Z_DEFLATED, -MAX_WBITS,
+			      MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK)
+		goto out;
+
+	memcpy(out, gzip_header, sizeof(gzip_header));
+	strm.next_in = chunk->in;
+	strm.avail_in = chunk->in_len;
+	strm.next_out = out + sizeof(gzip_header);
+	strm.avail_out = CORE_CHUNK_OUT_SIZE - sizeof(gzip_header) - 8;
+	if (zlib_deflate(&strm, Z_FINISH) == Z_STREAM_END) {
+		len = sizeof(gzip_header) + strm.total_out;
+		put_unaligned_le32(~crc32_le(~0, chunk->in, chunk->in_len),
+				   out + len);
+		put_unaligned_le32(chunk->in_len, out + len + 4);
+		chunk->out_len = len + 8;
+	}
+	zlib_deflateEnd(&strm);
+out:
+	complete(&chunk->done);
+}
+
+/* Wait for a chunk handed to the workqueue and write out its member */
+static int core_chunk_write(struct core_chunk *chunk, struct file *file)
+{
+	if (!chunk->busy)
+		return 1;
+	wait_for_completion(&chunk->done);
+	chunk->busy = false;
+	chunk->in_len = 0;
+	return chunk->out_len && dump_write(file, chunk->out, chunk->out_len);
+}
+#endif
+
+static void core_stream_free(struct core_stream *stream)
+{
+	unsigned int i;
+
+	for (i = 0; i < stream->nr_chunks; i++) {
+		struct core_chunk *chunk = &stream->chunks[i];
+
+#ifdef CONFIG_COREDUMP_COMPRESS
+		/* The worker may still be using the buffers */
+		if (chunk->busy)
+			wait_for_completion(&chunk->done);
+		vfree(chunk->out);
+		vfree(chunk->workspace);
+#endif
+		vfree(chunk->in);
+	}
+	kfree(stream);
+}
+
+/*
+ * Returns NULL if the buffers cannot be had, in which case the dump is
+ * written directly, and uncompressed.
+ */
+static struct core_stream *core_stream_alloc(void)
+{
+	struct core_stream *stream;
+	unsigned int i, nr = 1;
+	int level = 0;
+
+#ifdef CONFIG_COREDUMP_COMPRESS
+	level = READ_ONCE(core_compress);
+	if (level)
+		nr = min_t(unsigned int, num_online_cpus(),
+			   CORE_COMPRESS_THREADS) + 1;
+#endif
+	stream = kzalloc(struct_size(stream, chunks, nr), GFP_KERNEL);
+	if (!stream)
+		return NULL;
+	stream->level = level;
+	stream->nr_chunks = nr;
+
+	for (i = 0; i < nr; i++) {
+		struct core_chunk *chunk = &stream->chunks[i];
+
+		chunk->in = vmalloc(CORE_CHUNK_SIZE);
+		if (!chunk->in)
+			goto fail;
+#ifdef CONFIG_COREDUMP_COMPRESS
+		if (!level)
+			continue;
+		chunk->out = vmalloc(CORE_CHUNK_OUT_SIZE);
+		chunk->workspace = vmalloc(zlib_deflate_workspacesize(-MAX_WBITS,
+							MAX_MEM_LEVEL));
+		if (!chunk->out || !chunk->workspace)
+			goto fail;
+		chunk->level = level;
+		INIT_WORK(&chunk->work, core_chunk_compress);
+		init_completion(&chunk->done);
+#endif
+	}
+	return stream;
+fail:
+	core_stream_free(stream);
+	return NULL;
+}
+
+/* Pass on the chunk being filled: write it out, or queue it for deflate */
+static int core_stream_push(struct core_stream *stream, struct file *file)
+{
+	struct core_chunk *chunk = &stream->chunks[stream->head];
+	size_t len = chunk->in_len;
+
+	if (!len)
+		return 1;
+#ifdef CONFIG_COREDUMP_COMPRESS
+	if (stream->level) {
+		chunk->busy = true;
+		reinit_completion(&chunk->done);
+		queue_work(system_unbound_wq, &chunk->work);
+
+		/* The next chunk in the ring is the oldest one in flight */
+		stream->head = (stream->head + 1) % stream->nr_chunks;
+		return core_chunk_write(&stream->chunks[stream->head], file);
+	}
+#endif
+	chunk->in_len = 0;
+	return dump_write(file, chunk->in, len);
+}
+
+static int core_stream_emit(struct core_stream *stream, struct file *file,
+			    const void *addr, size_t nr)
+{
+	while (nr) {
+		struct core_chunk *chunk = &stream->chunks[stream->head];
+		size_t n = min(nr, CORE_CHUNK_SIZE - chunk->in_len);
+
+		memcpy(chunk->in + chunk->in_len, addr, n);
+		chunk->in_len += n;
+		addr += n;
+		nr -= n;
+		if (chunk->in_len == CORE_CHUNK_SIZE &&
+		    !core_stream_push(stream, file))
+			return 0;
+	}
+	return 1;
+}
+
+/* Get everything emitted so far into the file */
+static int core_stream_flush(struct core_stream *stream, struct file *file)
+{
+	if (!core_stream_push(stream, file))
+		return 0;
+#ifdef CONFIG_COREDUMP_COMPRESS
+	if (stream->level) {
+		unsigned int i;
+
+		for (i = 0; i < stream->nr_chunks; i++) {
+			if (!core_chunk_write(&stream->chunks[stream->head],
+					      file))
+				return 0;
+			stream->head = (stream->head + 1) % stream->nr_chunks;
+		}
+	}
+#endif
+	return 1;
+}
+
 void do_coredump(const kernel_siginfo_t *siginfo)
 {
 	struct core_state core_state;
@@ -786,8 +1018,16 @@ void do_coredump(const kernel_siginfo_t *siginfo)
 	if (displaced)
 		put_files_struct(displaced);
 	if (!dump_interrupted()) {
+		cprm.stream = core_stream_alloc();
 		file_start_write(cprm.file);
 		core_dumped = binfmt->core_dump(&cprm);
+		if (cprm.stream) {
+			if (core_dumped &&
+			    !core_stream_flush(cprm.stream, cprm.file))
+				core_dumped = false;
+			core_stream_free(cprm.stream);
+			cprm.stream = NULL;
+		}
 		file_end_write(cprm.file);
 	}
 	if (ispipe && core_pipe_limit)
@@ -816,32 +1056,59 @@ void do_coredump(const kernel_siginfo_t *siginfo)
  */
 int dump_emit(struct coredump_params *cprm, const void *addr, int nr)
 {
-	struct file *file = cprm->file;
-	loff_t pos = file->f_pos;
-	ssize_t n;
+	/* RLIMIT_CORE applies to the dump as emitted, not as compressed */
 	if (cprm->written + nr > cprm->limit)
 		return 0;
-	while (nr) {
-		if (dump_interrupted())
+	if (cprm->stream) {
+		if (!core_stream_emit(cprm->stream, cprm->file, addr, nr))
 			return 0;
-		n = __kernel_write(file, addr, nr, &pos);
-		if (n <= 0)
-			return 0;
-		file->f_pos = pos;
-		cprm->written += n;
-		cprm->pos += n;
-		nr -= n;
+	} else if (!dump_write(cprm->file, addr, nr)) {
+		return 0;
 	}
+	cprm->written += nr;
+	cprm->pos += nr;
 	return 1;
 }
 EXPORT_SYMBOL(dump_emit);
 
+/* A compressed dump has to be emitted byte for byte, holes included */
+static bool dump_can_seek(struct coredump_params *cprm)
+{
+	struct file *file = cprm->file;
+
+	if (cprm->stream && cprm->stream->level)
+		return false;
+	return file->f_op->llseek && file->f_op->llseek != no_llseek;
+}
+
 int dump_skip(struct coredump_params *cprm, size_t nr)
 {
 	static char zeroes[PAGE_SIZE];
 	struct file *file = cprm->file;
-	if (file->f_op->llseek && file->f_op->llseek != no_llseek) {
+	if (dump_can_seek(cprm)) {
+		/*
+		 * Seeking means flushing the chunk buffer first: a short
+		 * hole is cheaper as zeroes in the buffer.  Like a seek, it
+		 * does not count against RLIMIT_CORE.
+		 */
+		if (cprm->stream && nr <= CORE_SKIP_BUFFERED) {
+			size_t pos = 0;
+
+			if (dump_interrupted())
+				return 0;
+			while (pos < nr) {
+				size_t n = min_t(size_t, nr - pos, PAGE_SIZE);
+
+				if (!core_stream_emit(cprm->stream, file,
+						      zeroes, n))
+					return 0;
+				pos += n;
+			}
+			cprm->pos += nr;
+			return 1;
+		}
 		if (dump_interrupted() ||
+		    (cprm->stream && !core_stream_flush(cprm->stream, file)) ||
 		    file->f_op->llseek(file, nr, SEEK_CUR) < 0)
 			return 0;
 		cprm->pos += nr;
@@ -876,10 +1143,56 @@ void dump_truncate(struct coredump_params *cprm)
 	struct file *file = cprm->file;
 	loff_t offset;
 
-	if (file->f_op->llseek && file->f_op->llseek != no_llseek) {
+	if (dump_can_seek(cprm)) {
+		if (cprm->stream && !core_stream_flush(cprm->stream, file))
+			return;
 		offset = file->f_op->llseek(file, 0, SEEK_CUR);
 		if (i_size_read(file->f_mapping->host) < offset)
 			do_truncate(file->f_path.dentry, offset, 0, file);
 	}
 }
 EXPORT_SYMBOL(dump_truncate);
+
+#ifdef CONFIG_MMU
+/*
+ * Dump the pages of a user range.  Pages that are not there, or hold only
+ * zeroes, are skipped: they become holes in the file, or compress to next
+ * to nothing.  Consecutive skipped pages are skipped in one go, so that a
+ * sparse range costs one flush and seek per hole rather than per page.
+ */
+int dump_user_range(struct coredump_params *cprm, unsigned long start,
+		    unsigned long len)
+{
+	unsigned long addr;
+	size_t skip = 0;
+
+	for (addr = start; addr < start + len; addr += PAGE_SIZE) {
+		struct page *page;
+		void *kaddr;
+		int stop;
+
+		page = get_dump_page(addr);
+		if (!page) {
+			skip += PAGE_SIZE;
+			continue;
+		}
+
+		kaddr = kmap(page);
+		if (!memchr_inv(kaddr, 0, PAGE_SIZE)) {
+			skip += PAGE_SIZE;
+			stop = 0;
+		} else {
+			stop = skip && !dump_skip(cprm, skip);
+			skip = 0;
+			if (!stop)
+				stop = !dump_emit(cprm, kaddr, PAGE_SIZE);
+		}
+		kunmap(page);
+		put_page(page);
+		if (stop)
+			return 0;
+	}
+	return skip ? dump_skip(cprm, skip) : 1;
+}
+EXPORT_SYMBOL(dump_user_range);
+#endif
@@ -8,6 +8,7 @@
 #include <uapi/linux/binfmts.h>
 
 struct filename;
+struct core_stream;
 
 #define CORENAME_MAX_SIZE 128
 
@@ -87,6 +88,7 @@ struct coredump_params {
 	unsigned long mm_flags;
 	loff_t written;
 	loff_t pos;
+	struct core_stream *stream;	/* buffered / compressed output */
 };
 
 /*
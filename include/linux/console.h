@@ -23,6 +23,7 @@ struct console_font;
 struct module;
 struct tty_struct;
 struct notifier_block;
+struct task_struct;
 
 /*
  * this is what the terminal answers to a ESC-Z or csi0c query.
@@ -155,6 +156,9 @@ struct console {
 	int	cflag;
 	void	*data;
 	struct	 console *next;
+	u64	seq;		/* next printk record, under console_sem */
+	u32	idx;
+	struct	 task_struct *thread;
 };
 
 /*
@@ -23,6 +23,10 @@ int ksm_madvise(struct vm_area_struct *vma, unsigned long start,
 		unsigned long end, int advice, unsigned long *vm_flags);
 int __ksm_enter(struct mm_struct *mm);
 void __ksm_exit(struct mm_struct *mm);
+int ksm_enable_merge_any(struct mm_struct *mm);
+int ksm_disable_merge_any(struct mm_struct *mm);
+unsigned long ksm_vma_flags(struct mm_struct *mm, struct file *file,
+			    unsigned long vm_flags);
 
 static inline int ksm_fork(struct mm_struct *mm, struct mm_struct *oldmm)
 {
@@ -67,6 +71,22 @@ static inline void ksm_exit(struct mm_struct *mm)
 {
 }
 
+static inline int ksm_enable_merge_any(struct mm_struct *mm)
+{
+	return -EINVAL;
+}
+
+static inline int ksm_disable_merge_any(struct mm_struct *mm)
+{
+	return 0;
+}
+
+static inline unsigned long ksm_vma_flags(struct mm_struct *mm,
+		struct file *file, unsigned long vm_flags)
+{
+	return vm_flags;
+}
+
 #ifdef CONFIG_MMU
 static inline int ksm_madvise(struct vm_area_struct *vma, unsigned long start,
 		unsigned long end, int advice, unsigned long *vm_flags)
@@ -36,6 +36,8 @@ enum memcg_stat_item {
 	MEMCG_SOCK,
 	/* XXX: why are these zone and not node counters? */
 	MEMCG_KERNEL_STACK_KB,
+	MEMCG_ZSWAP_B,
+	MEMCG_ZSWAPPED,
 	MEMCG_NR_STAT,
 };
 
@@ -218,6 +220,11 @@ struct mem_cgroup {
 	/* Upper bound of normal memory consumption range */
 	unsigned long high;
 
+#ifdef CONFIG_ZSWAP
+	/* Upper bound of compressed swap cache usage, in pages */
+	unsigned long zswap_max;
+#endif
+
 	/* Range enforcement for interrupt charges */
 	struct work_struct high_work;
 
@@ -1470,4 +1477,25 @@ static inline void memcg_put_cache_ids(void)
 
 #endif /* CONFIG_MEMCG_KMEM */
 
+#if defined(CONFIG_MEMCG) && defined(CONFIG_ZSWAP)
+bool mem_cgroup_may_zswap(struct mem_cgroup *memcg);
+void mem_cgroup_charge_zswap(struct mem_cgroup *memcg, size_t size);
+void mem_cgroup_uncharge_zswap(struct mem_cgroup *memcg, size_t size);
+#else
+static inline bool mem_cgroup_may_zswap(struct mem_cgroup *memcg)
+{
+	return true;
+}
+
+static inline void mem_cgroup_charge_zswap(struct mem_cgroup *memcg,
+					   size_t size)
+{
+}
+
+static inline void mem_cgroup_uncharge_zswap(struct mem_cgroup *memcg,
+					     size_t size)
+{
+}
+#endif
+
 #endif /* _LINUX_MEMCONTROL_H */
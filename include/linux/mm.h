@@ -97,6 +97,7 @@ extern int mmap_rnd_compat_bits __read_mostly;
 
 #include <asm/page.h>
 #include <asm/pgtable.h>
+#include <asm-generic/pgtable_uffd.h>
 #include <asm/processor.h>
 
 /*
@@ -344,6 +345,13 @@ extern unsigned int kobjsize(const void *objp);
 # define VM_GROWSUP	VM_NONE
 #endif
 
+#ifdef CONFIG_HAVE_ARCH_USERFAULTFD_MINOR
+# define VM_UFFD_MINOR_BIT	37
+# define VM_UFFD_MINOR		BIT(VM_UFFD_MINOR_BIT)	/* UFFD minor faults */
+#else
+# define VM_UFFD_MINOR		VM_NONE
+#endif
+
 /* Bits set in the VMA until the stack is in its final location */
 #define VM_STACK_INCOMPLETE_SETUP	(VM_RAND_READ | VM_SEQ_READ)
 
@@ -1438,7 +1446,7 @@ struct mmu_notifier_range;
 void free_pgd_range(struct mmu_gather *tlb, unsigned long addr,
 		unsigned long end, unsigned long floor, unsigned long ceiling);
 int copy_page_range(struct mm_struct *dst, struct mm_struct *src,
-			struct vm_area_struct *vma);
+		    struct vm_area_struct *dst_vma, struct vm_area_struct *vma);
 int follow_pte_pmd(struct mm_struct *mm, unsigned long address,
 		   struct mmu_notifier_range *range,
 		   pte_t **ptepp, pmd_t **pmdpp, spinlock_t **ptlp);
@@ -1598,9 +1606,24 @@ extern unsigned long move_page_tables(struct vm_area_struct *vma,
 		unsigned long old_addr, struct vm_area_struct *new_vma,
 		unsigned long new_addr, unsigned long len,
 		bool need_rmap_locks);
+
+/*
+ * Flags used by change_protection(), they can be combined except for
+ * the two userfaultfd ones.
+ */
+/* Whether we should allow dirty bit accounting */
+#define MM_CP_DIRTY_ACCT		(1UL << 0)
+/* Whether this protection change is for NUMA hints */
+#define MM_CP_PROT_NUMA			(1UL << 1)
+/* Whether this change write protects the range for userfaultfd */
+#define MM_CP_UFFD_WP			(1UL << 2)
+/* Whether this change resolves userfaultfd write protection */
+#define MM_CP_UFFD_WP_RESOLVE		(1UL << 3)
+#define MM_CP_UFFD_WP_ALL		(MM_CP_UFFD_WP | MM_CP_UFFD_WP_RESOLVE)
+
 extern unsigned long change_protection(struct vm_area_struct *vma, unsigned long start,
 			      unsigned long end, pgprot_t newprot,
-			      int dirty_accountable, int prot_numa);
+			      unsigned long cp_flags);
 extern int mprotect_fixup(struct vm_area_struct *vma,
 			  struct vm_area_struct **pprev, unsigned long start,
 			  unsigned long end, unsigned long newflags);
@@ -1941,6 +1964,10 @@ static inline bool pgtable_pte_page_ctor(struct page *page)
 {
 	if (!ptlock_init(page))
 		return false;
+#ifdef CONFIG_LAZY_FORK
+	page->pt_mm = NULL;
+	page->pt_sharer = NULL;
+#endif
 	__SetPageTable(page);
 	inc_zone_page_state(page, NR_PAGETABLE);
 	return true;
@@ -1948,11 +1975,51 @@ static inline bool pgtable_pte_page_ctor(struct page *page)
 
 static inline void pgtable_pte_page_dtor(struct page *page)
 {
+#ifdef CONFIG_LAZY_FORK
+	VM_BUG_ON_PAGE(page->pt_sharer, page);
+	page->pt_mm = NULL;
+#endif
 	ptlock_free(page);
 	__ClearPageTable(page);
 	dec_zone_page_state(page, NR_PAGETABLE);
 }
 
+#ifdef CONFIG_LAZY_FORK
+/*
+ * Lazy fork write protects the PMD entries pointing to the PTE tables it
+ * shares between a parent and its child; no other PMD entry pointing to a
+ * PTE table is ever write protected.  The entry may stay write protected
+ * after the other mm dropped the table: pte_table_unshare() sorts it out.
+ */
+static inline bool pmd_lazy_shared(pmd_t pmd)
+{
+	return pmd_present(pmd) && !pmd_trans_huge(pmd) &&
+		!pmd_devmap(pmd) && !pmd_write(pmd);
+}
+
+extern int pte_table_unshare(struct vm_area_struct *vma, pmd_t *pmd,
+			     unsigned long addr);
+extern bool pte_table_foreign(struct mm_struct *mm, pmd_t *pmd,
+			      spinlock_t *ptl);
+#else
+static inline bool pmd_lazy_shared(pmd_t pmd)
+{
+	return false;
+}
+
+static inline int pte_table_unshare(struct vm_area_struct *vma, pmd_t *pmd,
+				    unsigned long addr)
+{
+	return 0;
+}
+
+static inline bool pte_table_foreign(struct mm_struct *mm, pmd_t *pmd,
+				     spinlock_t *ptl)
+{
+	return false;
+}
+#endif
+
 #define pte_offset_map_lock(mm, pmd, address, ptlp)	\
 ({							\
 	spinlock_t *__ptl = pte_lockptr(mm, pmd);	\
@@ -336,6 +336,10 @@ struct mod_kallsyms {
 	unsigned int num_symtab;
 	char *strtab;
 	char *typetab;
+	/* Name hash of the defined symbols, core kallsyms only */
+	unsigned int *buckets;
+	unsigned int *chain;
+	unsigned int num_buckets;
 };
 
 #ifdef CONFIG_LIVEPATCH
@@ -404,6 +408,9 @@ struct module {
 	const s32 *gpl_future_crcs;
 	unsigned int num_gpl_future_syms;
 
+	/* All of the above, hashed by name: protected like the module list. */
+	struct module_exports *exports;
+
 	/* Exception table */
 	unsigned int num_exentries;
 	struct exception_table_entry *extable;
@@ -443,6 +450,10 @@ struct module {
 	   keeping pointers to this stuff */
 	char *args;
 
+	/* Time spent in load_module() and in the init function, in ns. */
+	u64 load_ns;
+	u64 init_ns;
+
 #ifdef CONFIG_SMP
 	/* Per-cpu data. */
 	void __percpu *percpu;
@@ -36,6 +36,10 @@ enum stat_item {
 	CPU_PARTIAL_FREE,	/* Refill cpu partial on free */
 	CPU_PARTIAL_NODE,	/* Refill cpu partial from node partial */
 	CPU_PARTIAL_DRAIN,	/* Drain cpu partial to node partial */
+	ALLOC_CPU_ARRAY,	/* Allocation from cpu array */
+	FREE_CPU_ARRAY,		/* Free to cpu array */
+	CPU_ARRAY_REFILL,	/* Refill cpu array from the slabs */
+	CPU_ARRAY_FLUSH,	/* Flush cpu array to the slabs */
 	NR_SLUB_STAT_ITEMS };
 
 struct kmem_cache_cpu {
@@ -50,6 +54,16 @@ struct kmem_cache_cpu {
 #endif
 };
 
+/*
+ * Optional per cpu array of free objects in front of the cpu slab, which
+ * is refilled from and flushed to the slabs in batches.
+ */
+struct kmem_cache_cpu_array {
+	unsigned int count;	/* Number of objects in the array */
+	unsigned int size;	/* Capacity of the array */
+	void *objects[];
+};
+
 #ifdef CONFIG_SLUB_CPU_PARTIAL
 #define slub_percpu_partial(c)		((c)->partial)
 
@@ -91,6 +105,8 @@ struct kmem_cache {
 	/* Number of per cpu partial objects to keep around */
 	unsigned int cpu_partial;
 #endif
+	struct kmem_cache_cpu_array __percpu *cpu_array;
+	unsigned int cpu_array_size;	/* Objects per cpu array, 0 if none */
 	struct kmem_cache_order_objects oo;
 
 	/* Allocation and freeing of slabs */
@@ -618,11 +618,18 @@ static inline swp_entry_t get_swap_page(struct page *page)
 
 #ifdef CONFIG_THP_SWAP
 extern int split_swap_cluster(swp_entry_t entry);
+extern int swapcache_prepare_cluster(swp_entry_t entry);
+extern struct page *swapin_thp(swp_entry_t entry, struct vm_fault *vmf);
 #else
 static inline int split_swap_cluster(swp_entry_t entry)
 {
 	return 0;
 }
+
+static inline struct page *swapin_thp(swp_entry_t entry, struct vm_fault *vmf)
+{
+	return NULL;
+}
 #endif
 
 #ifdef CONFIG_MEMCG
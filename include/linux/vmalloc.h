@@ -70,10 +70,12 @@ struct vmap_area {
 
 	/*
 	 * The following three variables can be packed, because
-	 * a vmap_area object is always one of the three states:
-	 *    1) in "free" tree (root is vmap_area_root)
-	 *    2) in "busy" tree (root is free_vmap_area_root)
-	 *    3) in purge list  (head is vmap_purge_list)
+	 * a vmap_area object is always one of the four states:
+	 *    1) in "free" tree (root is free_vmap_area_root)
+	 *    2) in "busy" tree (root is vmap_area_root)
+	 *    3) in purge list  (per-cpu heads are vmap_purge_list)
+	 *    4) in a per-cpu vmap_area_cache, carved out of the free
+	 *       tree and not handed out yet: none of them is used
 	 */
 	union {
 		unsigned long subtree_max_size; /* in "free" tree */
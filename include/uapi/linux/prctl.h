@@ -234,4 +234,12 @@ struct prctl_mm_map {
 #define PR_GET_TAGGED_ADDR_CTRL		56
 # define PR_TAGGED_ADDR_ENABLE		(1UL << 0)
 
+/* Share anonymous page tables copy-on-write with children on fork */
+#define PR_SET_LAZY_FORK		57
+#define PR_GET_LAZY_FORK		58
+
+/* Let KSM merge all anonymous memory of the process, without madvise */
+#define PR_SET_MEMORY_MERGE		59
+#define PR_GET_MEMORY_MERGE		60
+
 #endif /* _LINUX_PRCTL_H */
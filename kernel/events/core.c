@@ -782,18 +782,23 @@ perf_cgroup_set_timestamp(struct task_struct *task,
 
 static DEFINE_PER_CPU(struct list_head, cgrp_cpuctx_list);
 
-#define PERF_CGROUP_SWOUT	0x1 /* cgroup switch out every event */
-#define PERF_CGROUP_SWIN	0x2 /* cgroup switch in events based on task */
+static void ctx_cgroup_sched_out(struct perf_cpu_context *cpuctx,
+				 struct perf_cgroup *cgrp);
+static void ctx_cgroup_sched_in(struct perf_cpu_context *cpuctx,
+				struct task_struct *task);
 
 /*
- * reschedule events based on the cgroup constraint of task.
+ * Reschedule the cgroup events of this CPU for the cgroup of @task.
  *
- * mode SWOUT : schedule out everything
- * mode SWIN : schedule in based on cgroup for next
+ * Only the cgroup events that start or stop matching are scheduled out and
+ * in; the other CPU events are left on the PMU. Switching between tasks of
+ * the same cgroup costs a pointer compare per CPU context.
  */
-static void perf_cgroup_switch(struct task_struct *task, int mode)
+static void perf_cgroup_switch(struct task_struct *task)
 {
 	struct perf_cpu_context *cpuctx;
+	struct perf_event_context *ctx;
+	struct perf_cgroup *cgrp;
 	struct list_head *list;
 	unsigned long flags;
 
@@ -803,91 +808,59 @@ static void perf_cgroup_switch(struct task_struct *task, int mode)
 	 */
 	local_irq_save(flags);
 
+	/*
+	 * We are holding the rcu lock, see perf_cgroup_sched_in() and
+	 * __perf_cgroup_move().
+	 */
+	cgrp = perf_cgroup_from_task(task, NULL);
+
 	list = this_cpu_ptr(&cgrp_cpuctx_list);
 	list_for_each_entry(cpuctx, list, cgrp_cpuctx_entry) {
-		WARN_ON_ONCE(cpuctx->ctx.nr_cgroups == 0);
+		ctx = &cpuctx->ctx;
+		WARN_ON_ONCE(ctx->nr_cgroups == 0);
+
+		if (READ_ONCE(cpuctx->cgrp) == cgrp)
+			continue;
 
 		perf_ctx_lock(cpuctx, cpuctx->task_ctx);
-		perf_pmu_disable(cpuctx->ctx.pmu);
+		perf_pmu_disable(ctx->pmu);
 
-		if (mode & PERF_CGROUP_SWOUT) {
-			cpu_ctx_sched_out(cpuctx, EVENT_ALL);
-			/*
-			 * must not be done before ctxswout due
-			 * to event_filter_match() in event_sched_out()
-			 */
-			cpuctx->cgrp = NULL;
+		if (ctx->is_active & EVENT_TIME) {
+			update_context_time(ctx);
+			update_cgrp_time_from_cpuctx(cpuctx);
 		}
 
-		if (mode & PERF_CGROUP_SWIN) {
-			WARN_ON_ONCE(cpuctx->cgrp);
-			/*
-			 * set cgrp before ctxsw in to allow
-			 * event_filter_match() to not have to pass
-			 * task around
-			 * we pass the cpuctx->ctx to perf_cgroup_from_task()
-			 * because cgorup events are only per-cpu
-			 */
-			cpuctx->cgrp = perf_cgroup_from_task(task,
-							     &cpuctx->ctx);
-			cpu_ctx_sched_in(cpuctx, EVENT_ALL, task);
-		}
-		perf_pmu_enable(cpuctx->ctx.pmu);
-		perf_ctx_unlock(cpuctx, cpuctx->task_ctx);
-	}
+		ctx_cgroup_sched_out(cpuctx, cgrp);
 
-	local_irq_restore(flags);
-}
+		/*
+		 * set cgrp before ctxsw in to allow
+		 * event_filter_match() to not have to pass
+		 * task around
+		 */
+		cpuctx->cgrp = cgrp;
 
-static inline void perf_cgroup_sched_out(struct task_struct *task,
-					 struct task_struct *next)
-{
-	struct perf_cgroup *cgrp1;
-	struct perf_cgroup *cgrp2 = NULL;
+		if (ctx->is_active & EVENT_TIME)
+			perf_cgroup_set_timestamp(task, ctx);
 
-	rcu_read_lock();
-	/*
-	 * we come here when we know perf_cgroup_events > 0
-	 * we do not need to pass the ctx here because we know
-	 * we are holding the rcu lock
-	 */
-	cgrp1 = perf_cgroup_from_task(task, NULL);
-	cgrp2 = perf_cgroup_from_task(next, NULL);
+		ctx_cgroup_sched_in(cpuctx, task);
 
-	/*
-	 * only schedule out current cgroup events if we know
-	 * that we are switching to a different cgroup. Otherwise,
-	 * do no touch the cgroup events.
-	 */
-	if (cgrp1 != cgrp2)
-		perf_cgroup_switch(task, PERF_CGROUP_SWOUT);
+		perf_pmu_enable(ctx->pmu);
+		perf_ctx_unlock(cpuctx, cpuctx->task_ctx);
+	}
 
-	rcu_read_unlock();
+	local_irq_restore(flags);
 }
 
 static inline void perf_cgroup_sched_in(struct task_struct *prev,
 					struct task_struct *task)
 {
-	struct perf_cgroup *cgrp1;
-	struct perf_cgroup *cgrp2 = NULL;
-
 	rcu_read_lock();
 	/*
-	 * we come here when we know perf_cgroup_events > 0
-	 * we do not need to pass the ctx here because we know
-	 * we are holding the rcu lock
-	 */
-	cgrp1 = perf_cgroup_from_task(task, NULL);
-	cgrp2 = perf_cgroup_from_task(prev, NULL);
-
-	/*
-	 * only need to schedule in cgroup events if we are changing
-	 * cgroup during ctxsw. Cgroup events were not scheduled
-	 * out of ctxsw out if that was not the case.
+	 * The cgroup events of @prev are left running until here; they are
+	 * only rescheduled if @task is in a different cgroup, see
+	 * perf_cgroup_switch().
 	 */
-	if (cgrp1 != cgrp2)
-		perf_cgroup_switch(task, PERF_CGROUP_SWIN);
-
+	perf_cgroup_switch(task);
 	rcu_read_unlock();
 }
 
@@ -1008,11 +981,6 @@ static inline void update_cgrp_time_from_cpuctx(struct perf_cpu_context *cpuctx)
 {
 }
 
-static inline void perf_cgroup_sched_out(struct task_struct *task,
-					 struct task_struct *next)
-{
-}
-
 static inline void perf_cgroup_sched_in(struct task_struct *prev,
 					struct task_struct *task)
 {
@@ -1032,7 +1000,7 @@ perf_cgroup_set_timestamp(struct task_struct *task,
 }
 
 static inline void
-perf_cgroup_switch(struct task_struct *task, struct task_struct *next)
+perf_cgroup_switch(struct task_struct *task)
 {
 }
 
@@ -3095,6 +3063,33 @@ static void ctx_sched_out(struct perf_event_context *ctx,
 	perf_pmu_enable(ctx->pmu);
 }
 
+#ifdef CONFIG_CGROUP_PERF
+/*
+ * Schedule out the active cgroup events of @cpuctx that do not cover @cgrp.
+ */
+static void ctx_cgroup_sched_out(struct perf_cpu_context *cpuctx,
+				 struct perf_cgroup *cgrp)
+{
+	struct perf_event_context *ctx = &cpuctx->ctx;
+	struct perf_event *event, *tmp;
+	struct list_head *lists[] = { &ctx->pinned_active, &ctx->flexible_active };
+	int i;
+
+	lockdep_assert_held(&ctx->lock);
+
+	for (i = 0; i < ARRAY_SIZE(lists); i++) {
+		list_for_each_entry_safe(event, tmp, lists[i], active_list) {
+			if (!is_cgroup_event(event) ||
+			    cgroup_is_descendant(cgrp->css.cgroup,
+						 event->cgrp->css.cgroup))
+				continue;
+
+			group_sched_out(event, cpuctx, ctx);
+		}
+	}
+}
+#endif
+
 /*
  * Test whether two contexts are equivalent, i.e. whether they have both been
  * cloned from the same version of the same context.
@@ -3368,14 +3363,6 @@ void __perf_event_task_sched_out(struct task_struct *task,
 
 	for_each_task_context_nr(ctxn)
 		perf_event_context_sched_out(task, ctxn, next);
-
-	/*
-	 * if cgroup events exist on this CPU, then we need
-	 * to check if we have to switch out PMU state.
-	 * cgroup event are system-wide mode only
-	 */
-	if (atomic_read(this_cpu_ptr(&perf_cgroup_events)))
-		perf_cgroup_sched_out(task, next);
 }
 
 /*
@@ -3422,13 +3409,29 @@ struct sched_in_data {
 	struct perf_event_context *ctx;
 	struct perf_cpu_context *cpuctx;
 	int can_add_hw;
+	int cgroup_only;
 };
 
+/*
+ * A cgroup switch only schedules in the cgroup events that are not
+ * running yet; see ctx_cgroup_sched_in().
+ */
+static inline bool sched_in_skip(struct perf_event *event,
+				 struct sched_in_data *sid)
+{
+	if (event->state <= PERF_EVENT_STATE_OFF)
+		return true;
+
+	return sid->cgroup_only &&
+	       (!is_cgroup_event(event) ||
+		event->state == PERF_EVENT_STATE_ACTIVE);
+}
+
 static int pinned_sched_in(struct perf_event *event, void *data)
 {
 	struct sched_in_data *sid = data;
 
-	if (event->state <= PERF_EVENT_STATE_OFF)
+	if (sched_in_skip(event, sid))
 		return 0;
 
 	if (!event_filter_match(event))
@@ -3453,7 +3456,7 @@ static int flexible_sched_in(struct perf_event *event, void *data)
 {
 	struct sched_in_data *sid = data;
 
-	if (event->state <= PERF_EVENT_STATE_OFF)
+	if (sched_in_skip(event, sid))
 		return 0;
 
 	if (!event_filter_match(event))
@@ -3502,6 +3505,47 @@ ctx_flexible_sched_in(struct perf_event_context *ctx,
 			   flexible_sched_in, &sid);
 }
 
+#ifdef CONFIG_CGROUP_PERF
+static void ctx_cgroup_sched_in(struct perf_cpu_context *cpuctx,
+				struct task_struct *task)
+{
+	struct perf_event_context *ctx = &cpuctx->ctx;
+	struct sched_in_data sid = {
+		.ctx = ctx,
+		.cpuctx = cpuctx,
+		.can_add_hw = 1,
+		.cgroup_only = 1,
+	};
+	bool flip = false;
+
+	/*
+	 * Pinned cgroup events must not lose against the flexible CPU events
+	 * we left on the PMU; if there can be any, flip the flexible ones
+	 * around like perf_event_context_sched_in() does.
+	 */
+	if ((ctx->is_active & EVENT_FLEXIBLE) &&
+	    !RB_EMPTY_ROOT(&ctx->pinned_groups.tree) &&
+	    !list_empty(&ctx->flexible_active)) {
+		cpu_ctx_sched_out(cpuctx, EVENT_FLEXIBLE);
+		flip = true;
+	}
+
+	if (ctx->is_active & EVENT_PINNED)
+		visit_groups_merge(&ctx->pinned_groups, smp_processor_id(),
+				   pinned_sched_in, &sid);
+
+	if (flip) {
+		cpu_ctx_sched_in(cpuctx, EVENT_FLEXIBLE, task);
+		return;
+	}
+
+	sid.can_add_hw = 1;
+	if (ctx->is_active & EVENT_FLEXIBLE)
+		visit_groups_merge(&ctx->flexible_groups, smp_processor_id(),
+				   flexible_sched_in, &sid);
+}
+#endif
+
 static void
 ctx_sched_in(struct perf_event_context *ctx,
 	     struct perf_cpu_context *cpuctx,
@@ -3578,9 +3622,11 @@ static void perf_event_context_sched_in(struct perf_event_context *ctx,
 	 * cpu flexible, task flexible.
 	 *
 	 * However, if task's ctx is not carrying any pinned
-	 * events, no need to flip the cpuctx's events around.
+	 * events, no need to flip the cpuctx's events around;
+	 * nor when none of the cpuctx's flexible events are on.
 	 */
-	if (!RB_EMPTY_ROOT(&ctx->pinned_groups.tree))
+	if (!RB_EMPTY_ROOT(&ctx->pinned_groups.tree) &&
+	    !list_empty(&cpuctx->ctx.flexible_active))
 		cpu_ctx_sched_out(cpuctx, EVENT_FLEXIBLE);
 	perf_event_sched_in(cpuctx, ctx, task);
 	perf_pmu_enable(ctx->pmu);
@@ -12587,7 +12633,7 @@ static int __perf_cgroup_move(void *info)
 {
 	struct task_struct *task = info;
 	rcu_read_lock();
-	perf_cgroup_switch(task, PERF_CGROUP_SWOUT | PERF_CGROUP_SWIN);
+	perf_cgroup_switch(task);
 	rcu_read_unlock();
 	return 0;
 }
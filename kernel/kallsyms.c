@@ -48,6 +48,7 @@ extern const u8 kallsyms_token_table[] __weak;
 extern const u16 kallsyms_token_index[] __weak;
 
 extern const unsigned int kallsyms_markers[] __weak;
+extern const u8 kallsyms_seqs_of_names[] __weak;
 
 /*
  * Expand a compressed symbol data into the resulting uncompressed string,
@@ -159,19 +160,56 @@ static unsigned long kallsyms_sym_address(int idx)
 	return kallsyms_relative_base - 1 - kallsyms_offsets[idx];
 }
 
+/*
+ * kallsyms_seqs_of_names[] holds the symbol indexes sorted by name, three
+ * bytes per entry, most significant byte first.
+ */
+static unsigned int get_symbol_seq(int index)
+{
+	const u8 *seq = &kallsyms_seqs_of_names[index * 3];
+
+	return (seq[0] << 16) | (seq[1] << 8) | seq[2];
+}
+
+static int kallsyms_lookup_names(const char *name)
+{
+	char namebuf[KSYM_NAME_LEN];
+	int low = 0, high = kallsyms_num_syms - 1;
+	int mid, ret, found = -1;
+	unsigned int seq;
+
+	/*
+	 * Binary search the name index for the leftmost match; symbols sharing
+	 * a name are sorted by address, so this returns the same symbol the
+	 * old linear scan did.
+	 */
+	while (low <= high) {
+		mid = low + (high - low) / 2;
+		seq = get_symbol_seq(mid);
+		kallsyms_expand_symbol(get_symbol_offset(seq),
+				       namebuf, ARRAY_SIZE(namebuf));
+		ret = strcmp(name, namebuf);
+		if (ret > 0) {
+			low = mid + 1;
+		} else {
+			if (!ret)
+				found = seq;
+			high = mid - 1;
+		}
+	}
+
+	return found;
+}
+
 /* Lookup the address for this symbol. Returns 0 if not found. */
 unsigned long kallsyms_lookup_name(const char *name)
 {
-	char namebuf[KSYM_NAME_LEN];
-	unsigned long i;
-	unsigned int off;
+	int seq;
 
-	for (i = 0, off = 0; i < kallsyms_num_syms; i++) {
-		off = kallsyms_expand_symbol(off, namebuf, ARRAY_SIZE(namebuf));
+	seq = kallsyms_lookup_names(name);
+	if (seq >= 0)
+		return kallsyms_sym_address(seq);
 
-		if (strcmp(namebuf, name) == 0)
-			return kallsyms_sym_address(i);
-	}
 	return module_kallsyms_lookup_name(name);
 }
 EXPORT_SYMBOL_GPL(kallsyms_lookup_name);
@@ -1015,10 +1015,126 @@ static int __arm_kprobe_ftrace(struct kprobe *p, struct ftrace_ops *ops,
 	return ret;
 }
 
+/*
+ * While register_kprobes() holds kprobe_mutex, ftrace-based kprobes are
+ * not armed one at a time, since every ftrace filter change patches all
+ * the affected call sites. They are collected here instead, and the
+ * filters are updated once for the whole batch.
+ */
+struct kprobe_ftrace_batch {
+	struct kprobe		**kps;
+	unsigned long		*ips;
+	unsigned int		nr;
+};
+
+static struct kprobe_ftrace_batch *kprobe_ftrace_batch;
+
+/* Caller must lock kprobe_mutex */
+static int kprobe_ftrace_batch_start(unsigned int num)
+{
+	struct kprobe_ftrace_batch *batch;
+
+	batch = kzalloc(sizeof(*batch), GFP_KERNEL);
+	if (!batch)
+		return -ENOMEM;
+
+	batch->kps = kcalloc(num, sizeof(*batch->kps), GFP_KERNEL);
+	batch->ips = kcalloc(num, sizeof(*batch->ips), GFP_KERNEL);
+	if (!batch->kps || !batch->ips) {
+		kfree(batch->kps);
+		kfree(batch->ips);
+		kfree(batch);
+		return -ENOMEM;
+	}
+
+	kprobe_ftrace_batch = batch;
+	return 0;
+}
+
+/* Caller must lock kprobe_mutex */
+static int __kprobe_ftrace_batch_flush(struct kprobe_ftrace_batch *batch,
+				       bool ipmodify, struct ftrace_ops *ops,
+				       int *cnt)
+{
+	struct kprobe *p, *kp;
+	unsigned int i, n = 0;
+	int ret;
+
+	for (i = 0; i < batch->nr; i++)
+		if ((batch->kps[i]->post_handler != NULL) == ipmodify)
+			batch->ips[n++] = (unsigned long)batch->kps[i]->addr;
+	if (!n)
+		return 0;
+
+	ret = ftrace_set_filter_ips(ops, batch->ips, n, 0, 0);
+	if (ret) {
+		pr_debug("Failed to arm %u kprobe-ftraces (%d)\n", n, ret);
+		goto disable;
+	}
+
+	if (*cnt == 0) {
+		ret = register_ftrace_function(ops);
+		if (ret) {
+			pr_debug("Failed to init kprobe-ftrace (%d)\n", ret);
+			ftrace_set_filter_ips(ops, batch->ips, n, 1, 0);
+			goto disable;
+		}
+	}
+
+	*cnt += n;
+	return 0;
+
+disable:
+	/*
+	 * These were never armed: mark them disabled so that unregistering
+	 * them doesn't try to disarm them.
+	 */
+	for (i = 0; i < batch->nr; i++) {
+		if ((batch->kps[i]->post_handler != NULL) != ipmodify)
+			continue;
+		/* A later probe at the same address may have aggregated it */
+		p = get_kprobe(batch->kps[i]->addr);
+		if (!p)
+			continue;
+		p->flags |= KPROBE_FLAG_DISABLED;
+		if (kprobe_aggrprobe(p))
+			list_for_each_entry(kp, &p->list, list)
+				kp->flags |= KPROBE_FLAG_DISABLED;
+	}
+	return ret;
+}
+
+/* Caller must lock kprobe_mutex */
+static int kprobe_ftrace_batch_finish(void)
+{
+	struct kprobe_ftrace_batch *batch = kprobe_ftrace_batch;
+	int ret, err;
+
+	kprobe_ftrace_batch = NULL;
+
+	ret = __kprobe_ftrace_batch_flush(batch, false, &kprobe_ftrace_ops,
+					  &kprobe_ftrace_enabled);
+	err = __kprobe_ftrace_batch_flush(batch, true, &kprobe_ipmodify_ops,
+					  &kprobe_ipmodify_enabled);
+	if (!ret)
+		ret = err;
+
+	kfree(batch->kps);
+	kfree(batch->ips);
+	kfree(batch);
+
+	return ret;
+}
+
 static int arm_kprobe_ftrace(struct kprobe *p)
 {
 	bool ipmodify = (p->post_handler != NULL);
 
+	if (kprobe_ftrace_batch) {
+		kprobe_ftrace_batch->kps[kprobe_ftrace_batch->nr++] = p;
+		return 0;
+	}
+
 	return __arm_kprobe_ftrace(p,
 		ipmodify ? &kprobe_ipmodify_ops : &kprobe_ftrace_ops,
 		ipmodify ? &kprobe_ipmodify_enabled : &kprobe_ftrace_enabled);
@@ -1056,6 +1172,8 @@ static int disarm_kprobe_ftrace(struct kprobe *p)
 #define prepare_kprobe(p)	arch_prepare_kprobe(p)
 #define arm_kprobe_ftrace(p)	(-ENODEV)
 #define disarm_kprobe_ftrace(p)	(-ENODEV)
+#define kprobe_ftrace_batch_start(num)	0
+#define kprobe_ftrace_batch_finish()	0
 #endif
 
 /* Arm a kprobe with text_mutex */
@@ -1574,12 +1692,15 @@ static int check_kprobe_address_safe(struct kprobe *p,
 	return ret;
 }
 
-int register_kprobe(struct kprobe *p)
+/*
+ * Resolve and check the address of a kprobe about to be registered. On
+ * success, the probed module (if any) is pinned until module_put().
+ */
+static int prepare_register_kprobe(struct kprobe *p,
+				   struct module **probed_mod)
 {
-	int ret;
-	struct kprobe *old_p;
-	struct module *probed_mod;
 	kprobe_opcode_t *addr;
+	int ret;
 
 	/* Adjust probe address from symbol */
 	addr = kprobe_addr(p);
@@ -1596,18 +1717,23 @@ int register_kprobe(struct kprobe *p)
 	p->nmissed = 0;
 	INIT_LIST_HEAD(&p->list);
 
-	ret = check_kprobe_address_safe(p, &probed_mod);
-	if (ret)
-		return ret;
+	return check_kprobe_address_safe(p, probed_mod);
+}
 
-	mutex_lock(&kprobe_mutex);
+/* Caller must lock kprobe_mutex */
+static int __register_kprobe(struct kprobe *p)
+{
+	int ret;
+	struct kprobe *old_p;
+
+	/* The same kprobe may show up twice in a register_kprobes() batch */
+	if (__get_valid_kprobe(p))
+		return -EINVAL;
 
 	old_p = get_kprobe(p->addr);
-	if (old_p) {
+	if (old_p)
 		/* Since this may unoptimize old_p, locking text_mutex. */
-		ret = register_aggr_kprobe(old_p, p);
-		goto out;
-	}
+		return register_aggr_kprobe(old_p, p);
 
 	cpus_read_lock();
 	/* Prevent text modification */
@@ -1616,7 +1742,7 @@ int register_kprobe(struct kprobe *p)
 	mutex_unlock(&text_mutex);
 	cpus_read_unlock();
 	if (ret)
-		goto out;
+		return ret;
 
 	INIT_HLIST_NODE(&p->hlist);
 	hlist_add_head_rcu(&p->hlist,
@@ -1627,13 +1753,27 @@ int register_kprobe(struct kprobe *p)
 		if (ret) {
 			hlist_del_rcu(&p->hlist);
 			synchronize_rcu();
-			goto out;
+			return ret;
 		}
 	}
 
 	/* Try to optimize kprobe */
 	try_to_optimize_kprobe(p);
-out:
+
+	return 0;
+}
+
+int register_kprobe(struct kprobe *p)
+{
+	int ret;
+	struct module *probed_mod;
+
+	ret = prepare_register_kprobe(p, &probed_mod);
+	if (ret)
+		return ret;
+
+	mutex_lock(&kprobe_mutex);
+	ret = __register_kprobe(p);
 	mutex_unlock(&kprobe_mutex);
 
 	if (probed_mod)
@@ -1769,20 +1909,56 @@ static void __unregister_kprobe_bottom(struct kprobe *p)
 	/* Otherwise, do nothing. */
 }
 
+/*
+ * Register kprobes as one batch: kprobe_mutex is only taken once, so the
+ * optimizer handles all of them in a single pass after one RCU-tasks
+ * grace period, and ftrace-based probes update the ftrace filters once.
+ */
 int register_kprobes(struct kprobe **kps, int num)
 {
-	int i, ret = 0;
+	struct module **probed_mods;
+	int i, nr_prepared, nr_registered = 0, ret, err;
 
 	if (num <= 0)
 		return -EINVAL;
-	for (i = 0; i < num; i++) {
-		ret = register_kprobe(kps[i]);
-		if (ret < 0) {
-			if (i > 0)
-				unregister_kprobes(kps, i);
-			break;
+	if (num == 1)
+		return register_kprobe(kps[0]);
+
+	probed_mods = kcalloc(num, sizeof(*probed_mods), GFP_KERNEL);
+	if (!probed_mods)
+		return -ENOMEM;
+
+	for (nr_prepared = 0; nr_prepared < num; nr_prepared++) {
+		ret = prepare_register_kprobe(kps[nr_prepared],
+					      &probed_mods[nr_prepared]);
+		if (ret)
+			goto out;
+	}
+
+	mutex_lock(&kprobe_mutex);
+	ret = kprobe_ftrace_batch_start(num);
+	if (!ret) {
+		for (; nr_registered < num; nr_registered++) {
+			ret = __register_kprobe(kps[nr_registered]);
+			if (ret)
+				break;
 		}
+
+		err = kprobe_ftrace_batch_finish();
+		if (!ret)
+			ret = err;
 	}
+	mutex_unlock(&kprobe_mutex);
+
+out:
+	for (i = 0; i < nr_prepared; i++)
+		if (probed_mods[i])
+			module_put(probed_mods[i]);
+	kfree(probed_mods);
+
+	if (ret && nr_registered > 0)
+		unregister_kprobes(kps, nr_registered);
+
 	return ret;
 }
 EXPORT_SYMBOL_GPL(register_kprobes);
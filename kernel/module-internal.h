@@ -17,6 +17,7 @@ struct load_info {
 	Elf_Shdr *sechdrs;
 	char *secstrings, *strtab;
 	unsigned long symoffs, stroffs, init_typeoffs, core_typeoffs;
+	unsigned long core_hashoffs;
 	struct _ddebug *debug;
 	unsigned int num_debug;
 	bool sig_ok;
@@ -51,6 +51,8 @@
 #include <linux/jump_label.h>
 #include <linux/pfn.h>
 #include <linux/bsearch.h>
+#include <linux/hashtable.h>
+#include <linux/stringhash.h>
 #include <linux/dynamic_debug.h>
 #include <linux/audit.h>
 #include <uapi/linux/module.h>
@@ -417,63 +419,79 @@ static bool each_symbol_in_section(const struct symsearch *arr,
 	return false;
 }
 
-/* Returns true as soon as fn returns true, otherwise false. */
-bool each_symbol_section(bool (*fn)(const struct symsearch *arr,
-				    struct module *owner,
-				    void *data),
-			 void *data)
+/* The symbols exported by vmlinux: these never go away. */
+static const struct symsearch kernel_symsearch[] = {
+	{ __start___ksymtab, __stop___ksymtab, __start___kcrctab,
+	  NOT_GPL_ONLY, false },
+	{ __start___ksymtab_gpl, __stop___ksymtab_gpl,
+	  __start___kcrctab_gpl,
+	  GPL_ONLY, false },
+	{ __start___ksymtab_gpl_future, __stop___ksymtab_gpl_future,
+	  __start___kcrctab_gpl_future,
+	  WILL_BE_GPL_ONLY, false },
+#ifdef CONFIG_UNUSED_SYMBOLS
+	{ __start___ksymtab_unused, __stop___ksymtab_unused,
+	  __start___kcrctab_unused,
+	  NOT_GPL_ONLY, true },
+	{ __start___ksymtab_unused_gpl, __stop___ksymtab_unused_gpl,
+	  __start___kcrctab_unused_gpl,
+	  GPL_ONLY, true },
+#endif
+};
+
+#define MODULE_SYMSEARCH_MAX	ARRAY_SIZE(kernel_symsearch)
+
+static void module_symsearch(struct module *mod,
+			     struct symsearch arr[MODULE_SYMSEARCH_MAX])
 {
-	struct module *mod;
-	static const struct symsearch arr[] = {
-		{ __start___ksymtab, __stop___ksymtab, __start___kcrctab,
+	const struct symsearch tmp[] = {
+		{ mod->syms, mod->syms + mod->num_syms, mod->crcs,
 		  NOT_GPL_ONLY, false },
-		{ __start___ksymtab_gpl, __stop___ksymtab_gpl,
-		  __start___kcrctab_gpl,
+		{ mod->gpl_syms, mod->gpl_syms + mod->num_gpl_syms,
+		  mod->gpl_crcs,
 		  GPL_ONLY, false },
-		{ __start___ksymtab_gpl_future, __stop___ksymtab_gpl_future,
-		  __start___kcrctab_gpl_future,
+		{ mod->gpl_future_syms,
+		  mod->gpl_future_syms + mod->num_gpl_future_syms,
+		  mod->gpl_future_crcs,
 		  WILL_BE_GPL_ONLY, false },
 #ifdef CONFIG_UNUSED_SYMBOLS
-		{ __start___ksymtab_unused, __stop___ksymtab_unused,
-		  __start___kcrctab_unused,
+		{ mod->unused_syms,
+		  mod->unused_syms + mod->num_unused_syms,
+		  mod->unused_crcs,
 		  NOT_GPL_ONLY, true },
-		{ __start___ksymtab_unused_gpl, __stop___ksymtab_unused_gpl,
-		  __start___kcrctab_unused_gpl,
+		{ mod->unused_gpl_syms,
+		  mod->unused_gpl_syms + mod->num_unused_gpl_syms,
+		  mod->unused_gpl_crcs,
 		  GPL_ONLY, true },
 #endif
 	};
 
+	BUILD_BUG_ON(ARRAY_SIZE(tmp) != MODULE_SYMSEARCH_MAX);
+	memcpy(arr, tmp, sizeof(tmp));
+}
+
+/* Returns true as soon as fn returns true, otherwise false. */
+bool each_symbol_section(bool (*fn)(const struct symsearch *arr,
+				    struct module *owner,
+				    void *data),
+			 void *data)
+{
+	struct module *mod;
+
 	module_assert_mutex_or_preempt();
 
-	if (each_symbol_in_section(arr, ARRAY_SIZE(arr), NULL, fn, data))
+	if (each_symbol_in_section(kernel_symsearch,
+				   ARRAY_SIZE(kernel_symsearch),
+				   NULL, fn, data))
 		return true;
 
 	list_for_each_entry_rcu(mod, &modules, list) {
-		struct symsearch arr[] = {
-			{ mod->syms, mod->syms + mod->num_syms, mod->crcs,
-			  NOT_GPL_ONLY, false },
-			{ mod->gpl_syms, mod->gpl_syms + mod->num_gpl_syms,
-			  mod->gpl_crcs,
-			  GPL_ONLY, false },
-			{ mod->gpl_future_syms,
-			  mod->gpl_future_syms + mod->num_gpl_future_syms,
-			  mod->gpl_future_crcs,
-			  WILL_BE_GPL_ONLY, false },
-#ifdef CONFIG_UNUSED_SYMBOLS
-			{ mod->unused_syms,
-			  mod->unused_syms + mod->num_unused_syms,
-			  mod->unused_crcs,
-			  NOT_GPL_ONLY, true },
-			{ mod->unused_gpl_syms,
-			  mod->unused_gpl_syms + mod->num_unused_gpl_syms,
-			  mod->unused_gpl_crcs,
-			  GPL_ONLY, true },
-#endif
-		};
+		struct symsearch arr[MODULE_SYMSEARCH_MAX];
 
 		if (mod->state == MODULE_STATE_UNFORMED)
 			continue;
 
+		module_symsearch(mod, arr);
 		if (each_symbol_in_section(arr, ARRAY_SIZE(arr), mod, fn, data))
 			return true;
 	}
@@ -578,6 +596,135 @@ static bool find_exported_symbol_in_section(const struct symsearch *syms,
 	return false;
 }
 
+/*
+ * The exports of loaded modules are hashed by name, so that resolving a
+ * symbol does not search the export tables of every module in turn. A
+ * module's exports are hashed once it is known not to duplicate any
+ * existing export, and unhashed before it is torn down; like the module
+ * list, this is protected by module_mutex for updates and by RCU-sched
+ * for lookups.
+ */
+#define MODULE_EXPORT_HASH_BITS	12
+static DEFINE_HASHTABLE(module_export_hash, MODULE_EXPORT_HASH_BITS);
+
+struct module_export {
+	struct hlist_node node;
+	const struct symsearch *syms;
+	struct module *owner;
+	unsigned int symnum;
+};
+
+struct module_exports {
+	struct symsearch syms[MODULE_SYMSEARCH_MAX];
+	unsigned int num;
+	struct module_export ent[];
+};
+
+static u32 export_name_hash(const char *name)
+{
+	return full_name_hash(NULL, name, strlen(name));
+}
+
+static struct module_exports *module_exports_alloc(struct module *mod)
+{
+	struct symsearch arr[MODULE_SYMSEARCH_MAX];
+	struct module_exports *exports;
+	struct module_export *e;
+	unsigned int i, j, num = 0;
+
+	module_symsearch(mod, arr);
+	for (i = 0; i < ARRAY_SIZE(arr); i++)
+		num += arr[i].stop - arr[i].start;
+
+	exports = kmalloc(struct_size(exports, ent, num), GFP_KERNEL);
+	if (!exports)
+		return NULL;
+
+	memcpy(exports->syms, arr, sizeof(arr));
+	exports->num = num;
+
+	e = exports->ent;
+	for (i = 0; i < ARRAY_SIZE(arr); i++) {
+		for (j = 0; j < arr[i].stop - arr[i].start; j++, e++) {
+			INIT_HLIST_NODE(&e->node);
+			e->syms = &exports->syms[i];
+			e->owner = mod;
+			e->symnum = j;
+		}
+	}
+
+	return exports;
+}
+
+static void module_exports_hash(struct module *mod)
+{
+	struct module_export *e;
+	unsigned int i;
+
+	lockdep_assert_held(&module_mutex);
+
+	for (i = 0; i < mod->exports->num; i++) {
+		e = &mod->exports->ent[i];
+		hash_add_rcu(module_export_hash, &e->node,
+			     export_name_hash(kernel_symbol_name(
+					&e->syms->start[e->symnum])));
+	}
+}
+
+static void module_exports_unhash(struct module *mod)
+{
+	unsigned int i;
+
+	lockdep_assert_held(&module_mutex);
+
+	if (!mod->exports)
+		return;
+
+	for (i = 0; i < mod->exports->num; i++)
+		hash_del_rcu(&mod->exports->ent[i].node);
+}
+
+static bool find_exported_symbol_in_modules(struct find_symbol_arg *fsa)
+{
+	struct module_export *e;
+
+	hash_for_each_possible_rcu(module_export_hash, e, node,
+				   export_name_hash(fsa->name)) {
+		if (strcmp(fsa->name,
+			   kernel_symbol_name(&e->syms->start[e->symnum])))
+			continue;
+
+		if (check_exported_symbol(e->syms, e->owner, e->symnum, fsa))
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Like find_symbol(), but only for the symbols exported by vmlinux. Those
+ * never go away, so this needs no locking at all.
+ */
+static const struct kernel_symbol *find_kernel_symbol(const char *name,
+						      const s32 **crc,
+						      bool gplok,
+						      bool warn)
+{
+	struct find_symbol_arg fsa;
+
+	fsa.name = name;
+	fsa.gplok = gplok;
+	fsa.warn = warn;
+
+	if (!each_symbol_in_section(kernel_symsearch,
+				    ARRAY_SIZE(kernel_symsearch), NULL,
+				    find_exported_symbol_in_section, &fsa))
+		return NULL;
+
+	*crc = fsa.crc;
+	return fsa.sym;
+}
+
 /* Find an exported symbol and return it, along with, (optional) crc and
  * (optional) module which owns it.  Needs preempt disabled or module_mutex. */
 const struct kernel_symbol *find_symbol(const char *name,
@@ -592,7 +739,12 @@ const struct kernel_symbol *find_symbol(const char *name,
 	fsa.gplok = gplok;
 	fsa.warn = warn;
 
-	if (each_symbol_section(find_exported_symbol_in_section, &fsa)) {
+	module_assert_mutex_or_preempt();
+
+	if (each_symbol_in_section(kernel_symsearch,
+				   ARRAY_SIZE(kernel_symsearch), NULL,
+				   find_exported_symbol_in_section, &fsa) ||
+	    find_exported_symbol_in_modules(&fsa)) {
 		if (owner)
 			*owner = fsa.owner;
 		if (crc)
@@ -1243,6 +1395,26 @@ static ssize_t show_initsize(struct module_attribute *mattr,
 static struct module_attribute modinfo_initsize =
 	__ATTR(initsize, 0444, show_initsize, NULL);
 
+static ssize_t show_loadtime(struct module_attribute *mattr,
+			     struct module_kobject *mk, char *buffer)
+{
+	return sprintf(buffer, "%llu\n", div_u64(mk->mod->load_ns,
+						  NSEC_PER_USEC));
+}
+
+static struct module_attribute modinfo_loadtime =
+	__ATTR(loadtime, 0444, show_loadtime, NULL);
+
+static ssize_t show_inittime(struct module_attribute *mattr,
+			     struct module_kobject *mk, char *buffer)
+{
+	return sprintf(buffer, "%llu\n", div_u64(mk->mod->init_ns,
+						  NSEC_PER_USEC));
+}
+
+static struct module_attribute modinfo_inittime =
+	__ATTR(inittime, 0444, show_inittime, NULL);
+
 static ssize_t show_taint(struct module_attribute *mattr,
 			  struct module_kobject *mk, char *buffer)
 {
@@ -1263,6 +1435,8 @@ static struct module_attribute *modinfo_attrs[] = {
 	&modinfo_initstate,
 	&modinfo_coresize,
 	&modinfo_initsize,
+	&modinfo_loadtime,
+	&modinfo_inittime,
 	&modinfo_taint,
 #ifdef CONFIG_MODULE_UNLOAD
 	&modinfo_refcnt,
@@ -1431,11 +1605,28 @@ static const struct kernel_symbol *resolve_symbol(struct module *mod,
 						  const char *name,
 						  char ownername[])
 {
+	bool gplok = !(mod->taints & (1 << TAINT_PROPRIETARY_MODULE));
 	struct module *owner;
 	const struct kernel_symbol *sym;
 	const s32 *crc;
 	int err;
 
+	/*
+	 * Most symbols come from vmlinux, which needs neither module_mutex
+	 * nor a reference: resolve those without serializing against other
+	 * modules being loaded.
+	 */
+	sym = find_kernel_symbol(name, &crc, gplok, true);
+	if (sym) {
+		strncpy(ownername, module_name(NULL), MODULE_NAME_LEN);
+		if (!check_version(info, name, mod, crc))
+			return ERR_PTR(-EINVAL);
+		err = verify_namespace_is_imported(info, sym, mod);
+		if (err)
+			return ERR_PTR(err);
+		return sym;
+	}
+
 	/*
 	 * The module_mutex should not be a heavily contended lock;
 	 * if we get the occasional sleep here, we'll go an extra iteration
@@ -1443,8 +1634,7 @@ static const struct kernel_symbol *resolve_symbol(struct module *mod,
 	 */
 	sched_annotate_sleep();
 	mutex_lock(&module_mutex);
-	sym = find_symbol(name, &owner, &crc,
-			  !(mod->taints & (1 << TAINT_PROPRIETARY_MODULE)), true);
+	sym = find_symbol(name, &owner, &crc, gplok, true);
 	if (!sym)
 		goto unlock;
 
@@ -2192,6 +2382,7 @@ static void free_module(struct module *mod)
 	 * that noone uses it while it's being deconstructed. */
 	mutex_lock(&module_mutex);
 	mod->state = MODULE_STATE_UNFORMED;
+	module_exports_unhash(mod);
 	mutex_unlock(&module_mutex);
 
 	/* Remove dynamic debug info */
@@ -2224,6 +2415,7 @@ static void free_module(struct module *mod)
 	module_arch_freeing_init(mod);
 	module_memfree(mod->init_layout.base);
 	kfree(mod->args);
+	kfree(mod->exports);
 	percpu_modfree(mod);
 
 	/* Free lock-classes; relies on the preceding sync_rcu(). */
@@ -2715,6 +2907,10 @@ static void layout_symtab(struct module *mod, struct load_info *info)
 	mod->core_layout.size += strtab_size;
 	info->core_typeoffs = mod->core_layout.size;
 	mod->core_layout.size += ndst * sizeof(char);
+	info->core_hashoffs = ALIGN(mod->core_layout.size,
+				    __alignof__(unsigned int));
+	mod->core_layout.size = info->core_hashoffs +
+		(roundup_pow_of_two(ndst) + ndst) * sizeof(unsigned int);
 	mod->core_layout.size = debug_align(mod->core_layout.size);
 
 	/* Put string table section at end of init part of module. */
@@ -2777,6 +2973,28 @@ static void add_kallsyms(struct module *mod, const struct load_info *info)
 		}
 	}
 	mod->core_kallsyms.num_symtab = ndst;
+
+	/*
+	 * Chain the defined core symbols by name hash.  Symbol 0 is the
+	 * empty null symbol, so 0 ends a chain.  Adding them backwards
+	 * keeps each chain in symtab order, so that lookups find the
+	 * same symbol as a linear walk would.
+	 */
+	mod->core_kallsyms.num_buckets = roundup_pow_of_two(ndst);
+	mod->core_kallsyms.buckets = mod->core_layout.base + info->core_hashoffs;
+	mod->core_kallsyms.chain = mod->core_kallsyms.buckets +
+				   mod->core_kallsyms.num_buckets;
+	while (--ndst > 0) {
+		unsigned int b;
+
+		if (dst[ndst].st_shndx == SHN_UNDEF)
+			continue;
+		b = export_name_hash(mod->core_kallsyms.strtab +
+				     dst[ndst].st_name) &
+		    (mod->core_kallsyms.num_buckets - 1);
+		mod->core_kallsyms.chain[ndst] = mod->core_kallsyms.buckets[b];
+		mod->core_kallsyms.buckets[b] = ndst;
+	}
 }
 #else
 static inline void layout_symtab(struct module *mod, struct load_info *info)
@@ -3558,6 +3776,7 @@ static noinline int do_init_module(struct module *mod)
 {
 	int ret = 0;
 	struct mod_initfree *freeinit;
+	u64 start;
 
 	freeinit = kmalloc(sizeof(*freeinit), GFP_KERNEL);
 	if (!freeinit) {
@@ -3572,10 +3791,12 @@ static noinline int do_init_module(struct module *mod)
 	 */
 	current->flags &= ~PF_USED_ASYNC;
 
+	start = ktime_get_ns();
 	do_mod_ctors(mod);
 	/* Start the module */
 	if (mod->init != NULL)
 		ret = do_one_initcall(mod->init);
+	mod->init_ns = ktime_get_ns() - start;
 	if (ret < 0) {
 		goto fail_free_freeinit;
 	}
@@ -3718,6 +3939,10 @@ static int complete_formation(struct module *mod, struct load_info *info)
 {
 	int err;
 
+	mod->exports = module_exports_alloc(mod);
+	if (!mod->exports)
+		return -ENOMEM;
+
 	mutex_lock(&module_mutex);
 
 	/* Find duplicate symbols (must be called under lock). */
@@ -3725,6 +3950,9 @@ static int complete_formation(struct module *mod, struct load_info *info)
 	if (err < 0)
 		goto out;
 
+	/* No duplicates: our exports can now be found by name. */
+	module_exports_hash(mod);
+
 	/* This relies on module_mutex for list integrity. */
 	module_bug_finalize(info->hdr, info->sechdrs, mod);
 
@@ -3784,6 +4012,7 @@ static int load_module(struct load_info *info, const char __user *uargs,
 	struct module *mod;
 	long err = 0;
 	char *after_dashes;
+	u64 start = ktime_get_ns();
 
 	err = elf_header_check(info);
 	if (err)
@@ -3926,6 +4155,8 @@ static int load_module(struct load_info *info, const char __user *uargs,
 	/* Done! */
 	trace_module_load(mod);
 
+	mod->load_ns = ktime_get_ns() - start;
+
 	return do_init_module(mod);
 
  sysfs_cleanup:
@@ -3939,6 +4170,7 @@ static int load_module(struct load_info *info, const char __user *uargs,
  bug_cleanup:
 	/* module_bug_cleanup needs module_mutex protection */
 	mutex_lock(&module_mutex);
+	module_exports_unhash(mod);
 	module_bug_cleanup(mod);
 	mutex_unlock(&module_mutex);
 
@@ -3946,6 +4178,7 @@ static int load_module(struct load_info *info, const char __user *uargs,
 	ftrace_release_mod(mod);
 	dynamic_debug_remove(mod, info->debug);
 	synchronize_rcu();
+	kfree(mod->exports);
 	kfree(mod->args);
  free_arch_cleanup:
 	module_arch_cleanup(mod);
@@ -4220,6 +4453,16 @@ static unsigned long find_kallsyms_symbol_value(struct module *mod, const char *
 	unsigned int i;
 	struct mod_kallsyms *kallsyms = rcu_dereference_sched(mod->kallsyms);
 
+	/* Only the core symbols are hashed, the init ones are walked */
+	if (kallsyms->num_buckets) {
+		i = export_name_hash(name) & (kallsyms->num_buckets - 1);
+		for (i = kallsyms->buckets[i]; i; i = kallsyms->chain[i]) {
+			if (strcmp(name, kallsyms_symbol_name(kallsyms, i)) == 0)
+				return kallsyms_symbol_value(&kallsyms->symtab[i]);
+		}
+		return 0;
+	}
+
 	for (i = 0; i < kallsyms->num_symtab; i++) {
 		const Elf_Sym *sym = &kallsyms->symtab[i];
 
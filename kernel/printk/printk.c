@@ -43,6 +43,7 @@
 #include <linux/rculist.h>
 #include <linux/poll.h>
 #include <linux/irq_work.h>
+#include <linux/kthread.h>
 #include <linux/ctype.h>
 #include <linux/uio.h>
 #include <linux/sched/clock.h>
@@ -211,9 +212,6 @@ int devkmsg_sysctl_set_loglvl(struct ctl_table *table, int write,
 	return 0;
 }
 
-/* Number of registered extended console drivers. */
-static int nr_ext_console_drivers;
-
 /*
  * Helper macros to handle lockdep when locking/unlocking console_sem. We use
  * macros instead of functions so that _RET_IP_ contains useful information.
@@ -267,9 +265,52 @@ static void __up_console_sem(unsigned long ip)
 static int console_locked, console_suspended;
 
 /*
- * If exclusive_console is non-NULL then only this console is to be printed to.
+ * Set once the printer kthreads are started: from then on printk() only
+ * stores messages, and each console's kthread prints them, unless
+ * printk_direct() says they must go out right away.
  */
-static struct console *exclusive_console;
+static bool printk_kthreads_available;
+
+/*
+ * Number of sections, on any CPU, reporting a problem that may keep the
+ * printer kthreads from running (WARN, lockups, stalls, hung tasks,
+ * sysrq).  Their messages are printed directly, like during an oops.
+ */
+static atomic_t printk_prefer_direct = ATOMIC_INIT(0);
+
+/**
+ * printk_prefer_direct_enter - start a section printing directly
+ *
+ * Until the matching printk_prefer_direct_exit(), printk() prints to
+ * the consoles from the caller, on every CPU, instead of leaving it to
+ * the printer kthreads.  Sections nest.  Safe from any context.
+ */
+void printk_prefer_direct_enter(void)
+{
+	atomic_inc(&printk_prefer_direct);
+}
+
+/**
+ * printk_prefer_direct_exit - end a section started by
+ *                             printk_prefer_direct_enter()
+ */
+void printk_prefer_direct_exit(void)
+{
+	int direct = atomic_dec_if_positive(&printk_prefer_direct);
+
+	WARN_ON(direct < 0);
+	/* The kthreads pick up whatever could not be printed directly */
+	if (!direct)
+		wake_up_klogd();
+}
+
+static bool printk_direct(void)
+{
+	return !READ_ONCE(printk_kthreads_available) || oops_in_progress ||
+	       atomic_read(&printk_prefer_direct) ||
+	       atomic_read(&panic_cpu) != PANIC_CPU_INVALID ||
+	       system_state > SYSTEM_RUNNING;
+}
 
 /*
  *	Array of consoles built from command line options (console=)
@@ -433,11 +474,6 @@ static u32 log_first_idx;
 static u64 log_next_seq;
 static u32 log_next_idx;
 
-/* the next printk record to write to the console */
-static u64 console_seq;
-static u32 console_idx;
-static u64 exclusive_console_stop_seq;
-
 /* the next printk record to read after the last 'clear' command */
 static u64 clear_seq;
 static u32 clear_idx;
@@ -1760,38 +1796,6 @@ static int console_trylock_spinning(void)
 	return 1;
 }
 
-/*
- * Call the console drivers, asking them to write out
- * log_buf[start] to log_buf[end - 1].
- * The console_lock must be held.
- */
-static void call_console_drivers(const char *ext_text, size_t ext_len,
-				 const char *text, size_t len)
-{
-	struct console *con;
-
-	trace_console_rcuidle(text, len);
-
-	if (!console_drivers)
-		return;
-
-	for_each_console(con) {
-		if (exclusive_console && con != exclusive_console)
-			continue;
-		if (!(con->flags & CON_ENABLED))
-			continue;
-		if (!con->write)
-			continue;
-		if (!cpu_online(smp_processor_id()) &&
-		    !(con->flags & CON_ANYTIME))
-			continue;
-		if (con->flags & CON_EXTENDED)
-			con->write(con, ext_text, ext_len);
-		else
-			con->write(con, text, len);
-	}
-}
-
 int printk_delay_msec __read_mostly;
 
 static inline void printk_delay(void)
@@ -1900,22 +1904,33 @@ static size_t log_output(int facility, int level, enum log_flags lflags, const c
 			 dict, dictlen, text, text_len);
 }
 
+/*
+ * Messages are formatted into a per-CPU buffer before logbuf_lock is
+ * taken, so that CPUs printing at the same time only serialize on
+ * storing the text.  NMIs, which may interrupt the formatting, have
+ * buffers of their own.
+ */
+struct printk_textbuf {
+	char buf[LOG_LINE_MAX];
+};
+static DEFINE_PER_CPU(struct printk_textbuf, printk_textbuf);
+static DEFINE_PER_CPU(struct printk_textbuf, printk_nmi_textbuf);
+
+/* Must be called with interrupts disabled. */
+static char *printk_textbuf_get(void)
+{
+	if (in_nmi())
+		return this_cpu_ptr(&printk_nmi_textbuf)->buf;
+	return this_cpu_ptr(&printk_textbuf)->buf;
+}
+
 /* Must be called under logbuf_lock. */
-int vprintk_store(int facility, int level,
-		  const char *dict, size_t dictlen,
-		  const char *fmt, va_list args)
+static int printk_store(int facility, int level,
+			const char *dict, size_t dictlen,
+			char *text, size_t text_len)
 {
-	static char textbuf[LOG_LINE_MAX];
-	char *text = textbuf;
-	size_t text_len;
 	enum log_flags lflags = 0;
 
-	/*
-	 * The printf needs to come first; we need the syslog
-	 * prefix which might be passed-in as a parameter.
-	 */
-	text_len = vscnprintf(text, sizeof(textbuf), fmt, args);
-
 	/* mark and strip a trailing newline */
 	if (text_len && text[text_len-1] == '\n') {
 		text_len--;
@@ -1951,6 +1966,23 @@ int vprintk_store(int facility, int level,
 			  dict, dictlen, text, text_len);
 }
 
+/* Must be called under logbuf_lock. */
+int vprintk_store(int facility, int level,
+		  const char *dict, size_t dictlen,
+		  const char *fmt, va_list args)
+{
+	char *text = printk_textbuf_get();
+	size_t text_len;
+
+	/*
+	 * The printf needs to come first; we need the syslog
+	 * prefix which might be passed-in as a parameter.
+	 */
+	text_len = vscnprintf(text, LOG_LINE_MAX, fmt, args);
+
+	return printk_store(facility, level, dict, dictlen, text, text_len);
+}
+
 asmlinkage int vprintk_emit(int facility, int level,
 			    const char *dict, size_t dictlen,
 			    const char *fmt, va_list args)
@@ -1959,6 +1991,8 @@ asmlinkage int vprintk_emit(int facility, int level,
 	bool in_sched = false, pending_output;
 	unsigned long flags;
 	u64 curr_log_seq;
+	size_t text_len;
+	char *text;
 
 	/* Suppress unimportant messages after panic happens */
 	if (unlikely(suppress_printk))
@@ -1972,15 +2006,24 @@ asmlinkage int vprintk_emit(int facility, int level,
 	boot_delay_msec(level);
 	printk_delay();
 
+	printk_safe_enter_irqsave(flags);
+	text = printk_textbuf_get();
+	text_len = vscnprintf(text, LOG_LINE_MAX, fmt, args);
+
 	/* This stops the holder of console_sem just where we want him */
-	logbuf_lock_irqsave(flags);
+	raw_spin_lock(&logbuf_lock);
 	curr_log_seq = log_next_seq;
-	printed_len = vprintk_store(facility, level, dict, dictlen, fmt, args);
+	printed_len = printk_store(facility, level, dict, dictlen,
+				   text, text_len);
 	pending_output = (curr_log_seq != log_next_seq);
 	logbuf_unlock_irqrestore(flags);
 
-	/* If called from the scheduler, we can not call up(). */
-	if (!in_sched && pending_output) {
+	/*
+	 * If called from the scheduler, we can not call up().  Otherwise,
+	 * the printer kthreads are woken up along with klogd below, and
+	 * only print directly when they cannot be relied upon.
+	 */
+	if (!in_sched && pending_output && printk_direct()) {
 		/*
 		 * Disable preemption to avoid being preempted while holding
 		 * console_sem which would prevent anyone from printing to
@@ -2038,6 +2081,10 @@ EXPORT_SYMBOL_GPL(vprintk_default);
  * the console_sem will notice the new output in console_unlock(); and will
  * send it to the consoles before releasing the lock.
  *
+ * Once the per-console printer kthreads are running, printk() does not
+ * try for the console_lock at all, but leaves the printing to them; only
+ * oopses, panics and shutdown still print from the caller.
+ *
  * One effect of this deferred printing is that code which calls printk() and
  * then changes console_loglevel may break. This is because console_loglevel
  * is inspected when the actual printing occurs.
@@ -2068,12 +2115,10 @@ EXPORT_SYMBOL(printk);
 
 static u64 syslog_seq;
 static u32 syslog_idx;
-static u64 console_seq;
-static u32 console_idx;
-static u64 exclusive_console_stop_seq;
 static u64 log_first_seq;
 static u32 log_first_idx;
 static u64 log_next_seq;
+static u32 log_next_idx;
 static char *log_text(const struct printk_log *msg) { return NULL; }
 static char *log_dict(const struct printk_log *msg) { return NULL; }
 static struct printk_log *log_from_idx(u32 idx) { return NULL; }
@@ -2086,8 +2131,6 @@ static ssize_t msg_print_ext_body(char *buf, size_t size,
 				  char *text, size_t text_len) { return 0; }
 static void console_lock_spinning_enable(void) { }
 static int console_lock_spinning_disable_and_check(void) { return 0; }
-static void call_console_drivers(const char *ext_text, size_t ext_len,
-				 const char *text, size_t len) {}
 static size_t msg_print_text(const struct printk_log *msg, bool syslog,
 			     bool time, char *buf, size_t size) { return 0; }
 static bool suppress_message_printing(int level) { return false; }
@@ -2350,6 +2393,118 @@ static inline int can_use_console(void)
 	return cpu_online(raw_smp_processor_id()) || have_callable_console();
 }
 
+/*
+ * Print the next printk record to @con, or skip it if @con does not want
+ * it.  Must be called with console_sem held; returns false once @con is
+ * caught up.
+ *
+ * With @handover, a printk() caller may busy wait for console_sem while
+ * the record is written and be handed the lock; *@handover then tells the
+ * caller that it no longer holds console_sem.
+ */
+static bool console_emit_next_record(struct console *con, bool *handover)
+{
+	/* Shared by all printers, under console_sem */
+	static char ext_text[CONSOLE_EXT_LOG_MAX];
+	static char text[LOG_LINE_MAX + PREFIX_MAX];
+	struct printk_log *msg;
+	unsigned long flags;
+	size_t ext_len = 0;
+	size_t len = 0;
+	bool write;
+
+	if (handover)
+		*handover = false;
+
+	printk_safe_enter_irqsave(flags);
+	raw_spin_lock(&logbuf_lock);
+	if (con->seq < log_first_seq) {
+		len = sprintf(text, "** %llu printk messages dropped **\n",
+			      log_first_seq - con->seq);
+
+		/* messages are gone, move to first one */
+		con->seq = log_first_seq;
+		con->idx = log_first_idx;
+	}
+	if (con->seq == log_next_seq) {
+		raw_spin_unlock(&logbuf_lock);
+		printk_safe_exit_irqrestore(flags);
+		return false;
+	}
+
+	/*
+	 * Skip record we have buffered and already printed directly to the
+	 * console when we received it, and record that has level above the
+	 * console loglevel.
+	 */
+	msg = log_from_idx(con->idx);
+	write = (con->flags & CON_ENABLED) && con->write &&
+		(cpu_online(smp_processor_id()) ||
+		 (con->flags & CON_ANYTIME)) &&
+		!suppress_message_printing(msg->level);
+	if (write && (con->flags & CON_EXTENDED)) {
+		ext_len = msg_print_ext_header(ext_text, sizeof(ext_text),
+					       msg, con->seq);
+		ext_len += msg_print_ext_body(ext_text + ext_len,
+					      sizeof(ext_text) - ext_len,
+					      log_dict(msg), msg->dict_len,
+					      log_text(msg), msg->text_len);
+	} else if (write) {
+		len += msg_print_text(msg,
+				console_msg_format & MSG_FORMAT_SYSLOG,
+				printk_time, text + len, sizeof(text) - len);
+	}
+	con->idx = log_next(con->idx);
+	con->seq++;
+	raw_spin_unlock(&logbuf_lock);
+
+	if (!write) {
+		printk_safe_exit_irqrestore(flags);
+		return true;
+	}
+
+	/*
+	 * While actively printing out messages, if another printk()
+	 * were to occur on another CPU, it may wait for this one to
+	 * finish. This task can not be preempted if there is a
+	 * waiter waiting to take over.
+	 */
+	if (handover)
+		console_lock_spinning_enable();
+
+	stop_critical_timings();	/* don't trace print latency */
+	if (con->flags & CON_EXTENDED) {
+		con->write(con, ext_text, ext_len);
+	} else {
+		trace_console_rcuidle(text, len);
+		con->write(con, text, len);
+	}
+	start_critical_timings();
+
+	if (handover)
+		*handover = console_lock_spinning_disable_and_check();
+
+	printk_safe_exit_irqrestore(flags);
+	return true;
+}
+
+/* Does any console have records left to print? */
+static bool console_pending(void)
+{
+	struct console *con;
+	bool pending = false;
+
+	raw_spin_lock(&logbuf_lock);
+	for_each_console(con) {
+		if (con->seq != log_next_seq) {
+			pending = true;
+			break;
+		}
+	}
+	raw_spin_unlock(&logbuf_lock);
+	return pending;
+}
+
 /**
  * console_unlock - unlock the console system
  *
@@ -2357,8 +2512,9 @@ static inline int can_use_console(void)
  * and the console driver list.
  *
  * While the console_lock was held, console output may have been buffered
- * by printk().  If this is the case, console_unlock(); emits
- * the output prior to releasing the lock.
+ * by printk().  If this is the case, and the printer kthreads cannot be
+ * relied upon (see printk_direct()), console_unlock(); emits the output
+ * prior to releasing the lock.  Otherwise the kthreads print it.
  *
  * If there is output waiting, we wake /dev/kmsg and syslog() users.
  *
@@ -2366,16 +2522,22 @@ static inline int can_use_console(void)
  */
 void console_unlock(void)
 {
-	static char ext_text[CONSOLE_EXT_LOG_MAX];
-	static char text[LOG_LINE_MAX + PREFIX_MAX];
 	unsigned long flags;
-	bool do_cond_resched, retry;
+	bool do_cond_resched, progress, retry;
 
 	if (console_suspended) {
 		up_console_sem();
 		return;
 	}
 
+	if (!printk_direct()) {
+		console_locked = 0;
+		up_console_sem();
+		/* The kthreads may have waited for console_suspended */
+		wake_up_klogd();
+		return;
+	}
+
 	/*
 	 * Console drivers are called with interrupts disabled, so
 	 * @console_may_schedule should be cleared before; however, we may
@@ -2405,89 +2567,26 @@ void console_unlock(void)
 		return;
 	}
 
-	for (;;) {
-		struct printk_log *msg;
-		size_t ext_len = 0;
-		size_t len;
-
-		printk_safe_enter_irqsave(flags);
-		raw_spin_lock(&logbuf_lock);
-		if (console_seq < log_first_seq) {
-			len = sprintf(text,
-				      "** %llu printk messages dropped **\n",
-				      log_first_seq - console_seq);
-
-			/* messages are gone, move to first one */
-			console_seq = log_first_seq;
-			console_idx = log_first_idx;
-		} else {
-			len = 0;
-		}
-skip:
-		if (console_seq == log_next_seq)
-			break;
-
-		msg = log_from_idx(console_idx);
-		if (suppress_message_printing(msg->level)) {
-			/*
-			 * Skip record we have buffered and already printed
-			 * directly to the console when we received it, and
-			 * record that has level above the console loglevel.
-			 */
-			console_idx = log_next(console_idx);
-			console_seq++;
-			goto skip;
-		}
-
-		/* Output to all consoles once old messages replayed. */
-		if (unlikely(exclusive_console &&
-			     console_seq >= exclusive_console_stop_seq)) {
-			exclusive_console = NULL;
-		}
-
-		len += msg_print_text(msg,
-				console_msg_format & MSG_FORMAT_SYSLOG,
-				printk_time, text + len, sizeof(text) - len);
-		if (nr_ext_console_drivers) {
-			ext_len = msg_print_ext_header(ext_text,
-						sizeof(ext_text),
-						msg, console_seq);
-			ext_len += msg_print_ext_body(ext_text + ext_len,
-						sizeof(ext_text) - ext_len,
-						log_dict(msg), msg->dict_len,
-						log_text(msg), msg->text_len);
-		}
-		console_idx = log_next(console_idx);
-		console_seq++;
-		raw_spin_unlock(&logbuf_lock);
-
-		/*
-		 * While actively printing out messages, if another printk()
-		 * were to occur on another CPU, it may wait for this one to
-		 * finish. This task can not be preempted if there is a
-		 * waiter waiting to take over.
-		 */
-		console_lock_spinning_enable();
+	/* Each console is printed to from its own position in the log */
+	do {
+		struct console *con;
+		bool handover;
 
-		stop_critical_timings();	/* don't trace print latency */
-		call_console_drivers(ext_text, ext_len, text, len);
-		start_critical_timings();
+		progress = false;
+		for_each_console(con) {
+			if (!console_emit_next_record(con, &handover))
+				continue;
+			if (handover)
+				return;
+			progress = true;
 
-		if (console_lock_spinning_disable_and_check()) {
-			printk_safe_exit_irqrestore(flags);
-			return;
+			if (do_cond_resched)
+				cond_resched();
 		}
-
-		printk_safe_exit_irqrestore(flags);
-
-		if (do_cond_resched)
-			cond_resched();
-	}
+	} while (progress);
 
 	console_locked = 0;
 
-	raw_spin_unlock(&logbuf_lock);
-
 	up_console_sem();
 
 	/*
@@ -2496,9 +2595,8 @@ void console_unlock(void)
 	 * there's a new owner and the console_unlock() from them will do the
 	 * flush, no worries.
 	 */
-	raw_spin_lock(&logbuf_lock);
-	retry = console_seq != log_next_seq;
-	raw_spin_unlock(&logbuf_lock);
+	printk_safe_enter_irqsave(flags);
+	retry = console_pending();
 	printk_safe_exit_irqrestore(flags);
 
 	if (retry && console_trylock())
@@ -2506,6 +2604,82 @@ void console_unlock(void)
 }
 EXPORT_SYMBOL(console_unlock);
 
+#ifdef CONFIG_PRINTK
+static bool printk_kthread_should_wake(struct console *con)
+{
+	unsigned long flags;
+	bool pending;
+
+	if (kthread_should_stop())
+		return true;
+	if (READ_ONCE(console_suspended))
+		return false;
+	/* Stay out of the way of the direct printers */
+	if (atomic_read(&printk_prefer_direct))
+		return false;
+
+	logbuf_lock_irqsave(flags);
+	pending = con->seq != log_next_seq;
+	logbuf_unlock_irqrestore(flags);
+	return pending;
+}
+
+/*
+ * The printer kthread of @con: prints one record at a time, so that
+ * printk() callers never wait on the console and console_lock() users
+ * wait for at most one record to be written.
+ */
+static int printk_kthread_func(void *data)
+{
+	struct console *con = data;
+	bool handover;
+
+	for (;;) {
+		wait_event_interruptible(log_wait,
+					 printk_kthread_should_wake(con));
+		if (kthread_should_stop())
+			break;
+
+		console_lock();
+		if (console_suspended) {
+			up_console_sem();
+			continue;
+		}
+		/* An oops may take console_sem over to print directly */
+		console_emit_next_record(con, &handover);
+		if (!handover) {
+			console_locked = 0;
+			up_console_sem();
+		}
+
+		cond_resched();
+	}
+	return 0;
+}
+
+/* Must be called under console_lock(). */
+static void printk_start_kthread(struct console *con)
+{
+	struct task_struct *tsk;
+
+	if (!printk_kthreads_available)
+		return;
+
+	tsk = kthread_run(printk_kthread_func, con, "pr/%s%d",
+			  con->name, con->index);
+	if (IS_ERR(tsk)) {
+		/* Print directly from now on, rather than not at all */
+		pr_err("%s%d: failed to start printing thread\n",
+		       con->name, con->index);
+		WRITE_ONCE(printk_kthreads_available, false);
+		return;
+	}
+	con->thread = tsk;
+}
+#else
+static void printk_start_kthread(struct console *con) { }
+#endif
+
 /**
  * console_conditional_schedule - yield the CPU if required
  *
@@ -2563,11 +2737,14 @@ void console_flush_on_panic(enum con_flush_mode mode)
 	console_may_schedule = 0;
 
 	if (mode == CONSOLE_REPLAY_ALL) {
+		struct console *con;
 		unsigned long flags;
 
 		logbuf_lock_irqsave(flags);
-		console_seq = log_first_seq;
-		console_idx = log_first_idx;
+		for_each_console(con) {
+			con->seq = log_first_seq;
+			con->idx = log_first_idx;
+		}
 		logbuf_unlock_irqrestore(flags);
 	}
 	console_unlock();
@@ -2761,30 +2938,23 @@ void register_console(struct console *newcon)
 		console_drivers->next = newcon;
 	}
 
-	if (newcon->flags & CON_EXTENDED)
-		nr_ext_console_drivers++;
-
+	/*
+	 * The new console starts at its own position in the log, so
+	 * replaying the log buffer to it does not spam the already
+	 * registered consoles.  console_unlock(); or the console's
+	 * kthread will print out the buffered messages for us.
+	 */
+	logbuf_lock_irqsave(flags);
 	if (newcon->flags & CON_PRINTBUFFER) {
-		/*
-		 * console_unlock(); will print out the buffered messages
-		 * for us.
-		 */
-		logbuf_lock_irqsave(flags);
-		console_seq = syslog_seq;
-		console_idx = syslog_idx;
-		/*
-		 * We're about to replay the log buffer.  Only do this to the
-		 * just-registered console to avoid excessive message spam to
-		 * the already-registered consoles.
-		 *
-		 * Set exclusive_console with disabled interrupts to reduce
-		 * race window with eventual console_flush_on_panic() that
-		 * ignores console_lock.
-		 */
-		exclusive_console = newcon;
-		exclusive_console_stop_seq = console_seq;
-		logbuf_unlock_irqrestore(flags);
+		newcon->seq = syslog_seq;
+		newcon->idx = syslog_idx;
+	} else {
+		newcon->seq = log_next_seq;
+		newcon->idx = log_next_idx;
 	}
+	logbuf_unlock_irqrestore(flags);
+	newcon->thread = NULL;
+	printk_start_kthread(newcon);
 	console_unlock();
 	console_sysfs_notify();
 
@@ -2814,6 +2984,7 @@ EXPORT_SYMBOL(register_console);
 int unregister_console(struct console *console)
 {
         struct console *a, *b;
+	struct task_struct *thread;
 	int res;
 
 	pr_info("%sconsole [%s%d] disabled\n",
@@ -2840,9 +3011,6 @@ int unregister_console(struct console *console)
 		}
 	}
 
-	if (!res && (console->flags & CON_EXTENDED))
-		nr_ext_console_drivers--;
-
 	/*
 	 * If this isn't the last console and it has CON_CONSDEV set, we
 	 * need to set it on the next preferred console.
@@ -2851,7 +3019,11 @@ int unregister_console(struct console *console)
 		console_drivers->flags |= CON_CONSDEV;
 
 	console->flags &= ~CON_ENABLED;
+	thread = console->thread;
+	console->thread = NULL;
 	console_unlock();
+	if (thread)
+		kthread_stop(thread);
 	console_sysfs_notify();
 	return res;
 }
@@ -2936,6 +3108,25 @@ static int __init printk_late_init(void)
 }
 late_initcall(printk_late_init);
 
+#if defined CONFIG_PRINTK
+/*
+ * Hand console output over to per-console kthreads once they can be
+ * created; until then, and in emergencies, printk() prints directly.
+ */
+static int __init printk_start_kthreads(void)
+{
+	struct console *con;
+
+	console_lock();
+	printk_kthreads_available = true;
+	for_each_console(con)
+		printk_start_kthread(con);
+	console_unlock();
+	return 0;
+}
+late_initcall(printk_start_kthreads);
+#endif
+
 #if defined CONFIG_PRINTK
 /*
  * Delayed printk version, for scheduler-internal messages:
@@ -9,6 +9,7 @@
 #include <linux/mm.h>
 #include <linux/utsname.h>
 #include <linux/mman.h>
+#include <linux/ksm.h>
 #include <linux/reboot.h>
 #include <linux/prctl.h>
 #include <linux/highuid.h>
@@ -2447,6 +2448,45 @@ SYSCALL_DEFINE5(prctl, int, option, unsigned long, arg2, unsigned long, arg3,
 			clear_bit(MMF_DISABLE_THP, &me->mm->flags);
 		up_write(&me->mm->mmap_sem);
 		break;
+	case PR_GET_LAZY_FORK:
+		if (arg2 || arg3 || arg4 || arg5)
+			return -EINVAL;
+		error = !!test_bit(MMF_LAZY_FORK, &me->mm->flags);
+		break;
+	case PR_SET_LAZY_FORK:
+		if (!IS_ENABLED(CONFIG_LAZY_FORK) || arg3 || arg4 || arg5)
+			return -EINVAL;
+		/*
+		 * Pages mapped by shared tables can't be migrated or
+		 * unmapped, which gets in the way of compaction, CMA,
+		 * memory offlining and hwpoison handling.
+		 */
+		if (arg2 && !capable(CAP_IPC_LOCK))
+			return -EPERM;
+		if (down_write_killable(&me->mm->mmap_sem))
+			return -EINTR;
+		if (arg2)
+			set_bit(MMF_LAZY_FORK, &me->mm->flags);
+		else
+			clear_bit(MMF_LAZY_FORK, &me->mm->flags);
+		up_write(&me->mm->mmap_sem);
+		break;
+	case PR_GET_MEMORY_MERGE:
+		if (arg2 || arg3 || arg4 || arg5)
+			return -EINVAL;
+		error = !!test_bit(MMF_VM_MERGE_ANY, &me->mm->flags);
+		break;
+	case PR_SET_MEMORY_MERGE:
+		if (!IS_ENABLED(CONFIG_KSM) || arg3 || arg4 || arg5)
+			return -EINVAL;
+		if (down_write_killable(&me->mm->mmap_sem))
+			return -EINTR;
+		if (arg2)
+			error = ksm_enable_merge_any(me->mm);
+		else
+			error = ksm_disable_merge_any(me->mm);
+		up_write(&me->mm->mmap_sem);
+		break;
 	case PR_MPX_ENABLE_MANAGEMENT:
 	case PR_MPX_DISABLE_MANAGEMENT:
 		/* No longer implemented: */
@@ -108,6 +108,7 @@ static bool ftrace_pids_enabled(struct ftrace_ops *ops)
 }
 
 static void ftrace_update_trampoline(struct ftrace_ops *ops);
+static void ftrace_callsites_update(void);
 
 /*
  * ftrace_disabled is set when an anomaly is discovered.
@@ -152,6 +153,34 @@ static void ftrace_pid_func(unsigned long ip, unsigned long parent_ip,
 	op->saved_func(ip, parent_ip, op, regs);
 }
 
+/*
+ * Check the following for the ops before calling its func:
+ *  if RCU flag is set, then rcu_is_watching() must be true
+ *  Otherwise test if the ip matches the ops filter
+ *
+ * If any of the above fails then the op->func() is not executed.
+ * Returns false if the ops is broken and the caller should stop.
+ */
+static nokprobe_inline bool
+ftrace_ops_call(struct ftrace_ops *op, unsigned long ip,
+		unsigned long parent_ip, struct pt_regs *regs)
+{
+	/* Stub functions don't need to be called nor tested */
+	if (op->flags & FTRACE_OPS_FL_STUB)
+		return true;
+
+	if ((!(op->flags & FTRACE_OPS_FL_RCU) || rcu_is_watching()) &&
+	    ftrace_ops_test(op, ip, regs)) {
+		if (FTRACE_WARN_ON(!op->func)) {
+			pr_warn("op=%p %pS\n", op, op);
+			return false;
+		}
+		op->func(ip, parent_ip, op, regs);
+	}
+
+	return true;
+}
+
 static void ftrace_sync(struct work_struct *work)
 {
 	/*
@@ -333,6 +362,7 @@ int __register_ftrace_function(struct ftrace_ops *ops)
 		ops->flags |= FTRACE_OPS_FL_DYNAMIC;
 
 	add_ftrace_ops(&ftrace_ops_list, ops);
+	ftrace_callsites_update();
 
 	/* Always save the function, and reset at unregistering */
 	ops->saved_func = ops->func;
@@ -360,6 +390,8 @@ int __unregister_ftrace_function(struct ftrace_ops *ops)
 	if (ret < 0)
 		return ret;
 
+	ftrace_callsites_update();
+
 	if (ftrace_enabled)
 		update_ftrace_function();
 
@@ -1509,6 +1541,176 @@ ftrace_ops_test(struct ftrace_ops *ops, unsigned long ip, void *regs)
 	return ret;
 }
 
+/*
+ * When more than one ops is registered, the list function is called for
+ * every traced function and would have to test the filter of each ops.
+ * The callsite table maps each ip to the ops that filter on it, so that
+ * only those, plus the ops that trace everything, are looked at.
+ */
+struct ftrace_callsite {
+	struct hlist_node	hlist;
+	unsigned long		ip;
+	struct ftrace_ops	*ops;
+};
+
+struct ftrace_callsites {
+	struct rcu_head		rcu;
+	int			size_bits;
+	struct hlist_head	*buckets;
+	struct ftrace_callsite	*sites;
+	int			nr_global;
+	struct ftrace_ops	*global[];
+};
+
+/* Ops filtering on more functions than this are tested on every call */
+#define FTRACE_CALLSITES_MAX_FILTER	(1 << FTRACE_HASH_MAX_BITS)
+#define FTRACE_CALLSITES_MAX_BITS	16
+
+/* Protected by preempt_disable() for reading, and ftrace_lock for writing */
+static struct ftrace_callsites __rcu *ftrace_callsites;
+
+static __always_inline unsigned long
+ftrace_callsites_key(struct ftrace_callsites *sites, unsigned long ip)
+{
+	if (sites->size_bits > 0)
+		return hash_long(ip, sites->size_bits);
+
+	return 0;
+}
+
+static bool ftrace_callsites_global(struct ftrace_ops *op)
+{
+	struct ftrace_hash *hash = op->func_hash->filter_hash;
+
+	return ftrace_hash_empty(hash) ||
+		hash->count > FTRACE_CALLSITES_MAX_FILTER;
+}
+
+static void ftrace_callsites_free_rcu(struct rcu_head *rcu)
+{
+	struct ftrace_callsites *sites =
+		container_of(rcu, struct ftrace_callsites, rcu);
+
+	kvfree(sites->sites);
+	kvfree(sites->buckets);
+	kfree(sites);
+}
+
+static struct ftrace_callsites *ftrace_callsites_build(void)
+{
+	struct ftrace_callsites *sites;
+	struct ftrace_callsite *site;
+	struct ftrace_func_entry *entry;
+	struct ftrace_hash *hash;
+	struct ftrace_ops *op;
+	int nr_ops = 0, nr_global = 0, nr_sites = 0;
+	int bits, size, i;
+
+	do_for_each_ftrace_op(op, ftrace_ops_list) {
+		if (op->flags & FTRACE_OPS_FL_STUB)
+			continue;
+		nr_ops++;
+		if (ftrace_callsites_global(op))
+			nr_global++;
+		else
+			nr_sites += op->func_hash->filter_hash->count;
+	} while_for_each_ftrace_op(op);
+
+	/* A single ops does not go through the list function */
+	if (nr_ops < 2)
+		return NULL;
+
+	sites = kzalloc(struct_size(sites, global, nr_global), GFP_KERNEL);
+	if (!sites)
+		return NULL;
+
+	bits = min(fls(nr_sites), FTRACE_CALLSITES_MAX_BITS);
+	sites->size_bits = bits;
+	sites->buckets = kvcalloc(1 << bits, sizeof(*sites->buckets), GFP_KERNEL);
+	if (nr_sites)
+		sites->sites = kvmalloc_array(nr_sites, sizeof(*sites->sites),
+					      GFP_KERNEL);
+	if (!sites->buckets || (nr_sites && !sites->sites)) {
+		ftrace_callsites_free_rcu(&sites->rcu);
+		return NULL;
+	}
+
+	site = sites->sites;
+	do_for_each_ftrace_op(op, ftrace_ops_list) {
+		if (op->flags & FTRACE_OPS_FL_STUB)
+			continue;
+
+		if (ftrace_callsites_global(op)) {
+			sites->global[sites->nr_global++] = op;
+			continue;
+		}
+
+		hash = op->func_hash->filter_hash;
+		size = 1 << hash->size_bits;
+		for (i = 0; i < size; i++) {
+			hlist_for_each_entry(entry, &hash->buckets[i], hlist) {
+				site->ip = entry->ip;
+				site->ops = op;
+				hlist_add_head(&site->hlist,
+					       &sites->buckets[ftrace_callsites_key(sites, entry->ip)]);
+				site++;
+			}
+		}
+	} while_for_each_ftrace_op(op);
+
+	return sites;
+}
+
+/*
+ * Must be called with ftrace_lock held whenever the ops list, or the filter
+ * of a registered ops, changes. If the table can not be allocated, the list
+ * function falls back to testing every ops.
+ */
+static void ftrace_callsites_update(void)
+{
+	struct ftrace_callsites *old;
+
+	lockdep_assert_held(&ftrace_lock);
+
+	old = rcu_dereference_protected(ftrace_callsites,
+					lockdep_is_held(&ftrace_lock));
+	rcu_assign_pointer(ftrace_callsites, ftrace_callsites_build());
+	if (old)
+		call_rcu(&old->rcu, ftrace_callsites_free_rcu);
+}
+
+/*
+ * Call the ops tracing @ip from the callsite table. Returns false if
+ * there is no table, and the caller must walk all the ops instead.
+ */
+static nokprobe_inline bool
+ftrace_callsites_call(unsigned long ip, unsigned long parent_ip,
+		      struct pt_regs *regs)
+{
+	struct ftrace_callsites *sites;
+	struct ftrace_callsite *site;
+	struct hlist_head *hhd;
+	int i;
+
+	sites = rcu_dereference_raw_check(ftrace_callsites);
+	if (!sites)
+		return false;
+
+	for (i = 0; i < sites->nr_global; i++) {
+		if (!ftrace_ops_call(sites->global[i], ip, parent_ip, regs))
+			return true;
+	}
+
+	hhd = &sites->buckets[ftrace_callsites_key(sites, ip)];
+	hlist_for_each_entry(site, hhd, hlist) {
+		if (site->ip == ip &&
+		    !ftrace_ops_call(site->ops, ip, parent_ip, regs))
+			return true;
+	}
+
+	return true;
+}
+
 /*
  * This is a double for. Do not use 'break' to break out of the loop,
  * you must use a goto.
@@ -3994,6 +4196,9 @@ static void ftrace_ops_update_code(struct ftrace_ops *ops,
 {
 	struct ftrace_ops *op;
 
+	/* The filter may be shared with other registered ops */
+	ftrace_callsites_update();
+
 	if (!ftrace_enabled)
 		return;
 
@@ -4860,7 +5065,7 @@ ftrace_notrace_write(struct file *file, const char __user *ubuf,
 }
 
 static int
-ftrace_match_addr(struct ftrace_hash *hash, unsigned long ip, int remove)
+__ftrace_match_addr(struct ftrace_hash *hash, unsigned long ip, int remove)
 {
 	struct ftrace_func_entry *entry;
 
@@ -4878,9 +5083,26 @@ ftrace_match_addr(struct ftrace_hash *hash, unsigned long ip, int remove)
 	return add_hash_entry(hash, ip);
 }
 
+static int
+ftrace_match_addr(struct ftrace_hash *hash, unsigned long *ips,
+		  unsigned int cnt, int remove)
+{
+	unsigned int i;
+	int err;
+
+	for (i = 0; i < cnt; i++) {
+		/* On failure the caller throws away the whole temporary @hash */
+		err = __ftrace_match_addr(hash, ips[i], remove);
+		if (err)
+			return err;
+	}
+	return 0;
+}
+
 static int
 ftrace_set_hash(struct ftrace_ops *ops, unsigned char *buf, int len,
-		unsigned long ip, int remove, int reset, int enable)
+		unsigned long *ips, unsigned int cnt,
+		int remove, int reset, int enable)
 {
 	struct ftrace_hash **orig_hash;
 	struct ftrace_hash *hash;
@@ -4910,8 +5132,8 @@ ftrace_set_hash(struct ftrace_ops *ops, unsigned char *buf, int len,
 		ret = -EINVAL;
 		goto out_regex_unlock;
 	}
-	if (ip) {
-		ret = ftrace_match_addr(hash, ip, remove);
+	if (ips) {
+		ret = ftrace_match_addr(hash, ips, cnt, remove);
 		if (ret < 0)
 			goto out_regex_unlock;
 	}
@@ -4928,10 +5150,10 @@ ftrace_set_hash(struct ftrace_ops *ops, unsigned char *buf, int len,
 }
 
 static int
-ftrace_set_addr(struct ftrace_ops *ops, unsigned long ip, int remove,
-		int reset, int enable)
+ftrace_set_addr(struct ftrace_ops *ops, unsigned long *ips, unsigned int cnt,
+		int remove, int reset, int enable)
 {
-	return ftrace_set_hash(ops, NULL, 0, ip, remove, reset, enable);
+	return ftrace_set_hash(ops, NULL, 0, ips, cnt, remove, reset, enable);
 }
 
 #ifdef CONFIG_DYNAMIC_FTRACE_WITH_DIRECT_CALLS
@@ -5308,10 +5530,29 @@ int ftrace_set_filter_ip(struct ftrace_ops *ops, unsigned long ip,
 			 int remove, int reset)
 {
 	ftrace_ops_init(ops);
-	return ftrace_set_addr(ops, ip, remove, reset, 1);
+	return ftrace_set_addr(ops, &ip, 1, remove, reset, 1);
 }
 EXPORT_SYMBOL_GPL(ftrace_set_filter_ip);
 
+/**
+ * ftrace_set_filter_ips - set functions to filter on in ftrace by addresses
+ * @ops - the ops to set the filter with
+ * @ips - the array of addresses to add to or remove from the filter.
+ * @cnt - the number of addresses in @ips
+ * @remove - non zero to remove ips from the filter
+ * @reset - non zero to reset all filters before applying this filter.
+ *
+ * Like ftrace_set_filter_ip(), but the code is only updated once for all
+ * of @ips. Either all of them are applied or, on error, none.
+ */
+int ftrace_set_filter_ips(struct ftrace_ops *ops, unsigned long *ips,
+			  unsigned int cnt, int remove, int reset)
+{
+	ftrace_ops_init(ops);
+	return ftrace_set_addr(ops, ips, cnt, remove, reset, 1);
+}
+EXPORT_SYMBOL_GPL(ftrace_set_filter_ips);
+
 /**
  * ftrace_ops_set_global_filter - setup ops to use global filters
  * @ops - the ops which will use the global filters
@@ -5333,7 +5574,7 @@ static int
 ftrace_set_regex(struct ftrace_ops *ops, unsigned char *buf, int len,
 		 int reset, int enable)
 {
-	return ftrace_set_hash(ops, buf, len, 0, 0, reset, enable);
+	return ftrace_set_hash(ops, buf, len, NULL, 0, 0, reset, enable);
 }
 
 /**
@@ -6765,6 +7006,17 @@ static void ftrace_update_trampoline(struct ftrace_ops *ops)
 {
 }
 
+static void ftrace_callsites_update(void)
+{
+}
+
+static inline bool
+ftrace_callsites_call(unsigned long ip, unsigned long parent_ip,
+		      struct pt_regs *regs)
+{
+	return false;
+}
+
 #endif /* CONFIG_DYNAMIC_FTRACE */
 
 __init void ftrace_init_global_array_ops(struct trace_array *tr)
@@ -6808,27 +7060,13 @@ __ftrace_ops_list_func(unsigned long ip, unsigned long parent_ip,
 	 */
 	preempt_disable_notrace();
 
+	/* Only look at the ops that trace @ip, if we know them */
+	if (ftrace_callsites_call(ip, parent_ip, regs))
+		goto out;
+
 	do_for_each_ftrace_op(op, ftrace_ops_list) {
-		/* Stub functions don't need to be called nor tested */
-		if (op->flags & FTRACE_OPS_FL_STUB)
-			continue;
-		/*
-		 * Check the following for each ops before calling their func:
-		 *  if RCU flag is set, then rcu_is_watching() must be true
-		 *  if PER_CPU is set, then ftrace_function_local_disable()
-		 *                          must be false
-		 *  Otherwise test if the ip matches the ops filter
-		 *
-		 * If any of the above fails then the op->func() is not executed.
-		 */
-		if ((!(op->flags & FTRACE_OPS_FL_RCU) || rcu_is_watching()) &&
-		    ftrace_ops_test(op, ip, regs)) {
-			if (FTRACE_WARN_ON(!op->func)) {
-				pr_warn("op=%p %pS\n", op, op);
-				goto out;
-			}
-			op->func(ip, parent_ip, op, regs);
-		}
+		if (!ftrace_ops_call(op, ip, parent_ip, regs))
+			goto out;
 	} while_for_each_ftrace_op(op);
 out:
 	preempt_enable_notrace();
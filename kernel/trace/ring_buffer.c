@@ -6,6 +6,7 @@
  */
 #include <linux/trace_events.h>
 #include <linux/ring_buffer.h>
+#include <linux/trace_mmap.h>
 #include <linux/trace_clock.h>
 #include <linux/sched/clock.h>
 #include <linux/trace_seq.h>
@@ -322,6 +323,7 @@ struct buffer_page {
 	unsigned	 read;		/* index for next read */
 	local_t		 entries;	/* entries on this page */
 	unsigned long	 real_end;	/* real end of data */
+	unsigned	 id;		/* ID for external mapping */
 	struct buffer_data_page *page;	/* Actual data page */
 };
 
@@ -480,6 +482,11 @@ struct ring_buffer_per_cpu {
 	struct completion		update_done;
 
 	struct rb_irq_work		irq_work;
+
+	/* user space mapping, protected by buffer->mutex and reader_lock */
+	unsigned int			mapped;
+	struct trace_buffer_meta	*meta_page;
+	unsigned long			*subbuf_ids;	/* ID to addr */
 };
 
 struct ring_buffer {
@@ -1749,6 +1756,16 @@ int ring_buffer_resize(struct ring_buffer *buffer, unsigned long size,
 	/* prevent another thread from changing buffer sizes */
 	mutex_lock(&buffer->mutex);
 
+	/* The pages of a mapped buffer are in use by user space */
+	for_each_buffer_cpu(buffer, cpu) {
+		if (cpu_id != RING_BUFFER_ALL_CPUS && cpu_id != cpu)
+			continue;
+		if (buffer->buffers[cpu]->mapped) {
+			mutex_unlock(&buffer->mutex);
+			return -EBUSY;
+		}
+	}
+
 	if (cpu_id == RING_BUFFER_ALL_CPUS) {
 		/* calculate the pages to update */
 		for_each_buffer_cpu(buffer, cpu) {
@@ -4542,6 +4559,11 @@ int ring_buffer_swap_cpu(struct ring_buffer *buffer_a,
 	if (atomic_read(&cpu_buffer_b->record_disabled))
 		goto out;
 
+	/* The pages of a mapped buffer can not change owner */
+	ret = -EBUSY;
+	if (READ_ONCE(cpu_buffer_a->mapped) || READ_ONCE(cpu_buffer_b->mapped))
+		goto out;
+
 	/*
 	 * We can't do a synchronize_rcu here because this
 	 * function can be called in atomic context.
@@ -4750,9 +4772,11 @@ int ring_buffer_read_page(struct ring_buffer *buffer,
 	 * a writer is still on the page, then
 	 * we must copy the data from the page to the buffer.
 	 * Otherwise, we can simply swap the page with the one passed in.
+	 * The pages of a buffer mapped to user space can never be swapped.
 	 */
 	if (read || (len < (commit - read)) ||
-	    cpu_buffer->reader_page == cpu_buffer->commit_page) {
+	    cpu_buffer->reader_page == cpu_buffer->commit_page ||
+	    cpu_buffer->mapped) {
 		struct buffer_data_page *rpage = cpu_buffer->reader_page->page;
 		unsigned int rpos = read;
 		unsigned int pos = 0;
@@ -4861,6 +4885,357 @@ int ring_buffer_read_page(struct ring_buffer *buffer,
 }
 EXPORT_SYMBOL_GPL(ring_buffer_read_page);
 
+static void rb_update_meta_page(struct ring_buffer_per_cpu *cpu_buffer)
+{
+	struct trace_buffer_meta *meta = cpu_buffer->meta_page;
+
+	meta->reader.read = cpu_buffer->reader_page->read;
+	meta->reader.id = cpu_buffer->reader_page->id;
+	meta->reader.lost_events = cpu_buffer->lost_events;
+
+	meta->entries = local_read(&cpu_buffer->entries);
+	meta->overrun = local_read(&cpu_buffer->overrun);
+	meta->read = cpu_buffer->read;
+
+	/* Some archs do not have data cache coherency between kernel and user */
+	flush_dcache_page(virt_to_page(cpu_buffer->meta_page));
+}
+
+static void rb_setup_ids_meta_page(struct ring_buffer_per_cpu *cpu_buffer,
+				   unsigned long *subbuf_ids)
+{
+	struct trace_buffer_meta *meta = cpu_buffer->meta_page;
+	unsigned int nr_subbufs = cpu_buffer->nr_pages + 1;
+	struct buffer_page *first_subbuf, *subbuf;
+	int id = 0;
+
+	subbuf_ids[id] = (unsigned long)cpu_buffer->reader_page->page;
+	cpu_buffer->reader_page->id = id++;
+
+	first_subbuf = subbuf = rb_set_head_page(cpu_buffer);
+	do {
+		if (RB_WARN_ON(cpu_buffer, id >= nr_subbufs))
+			break;
+
+		subbuf_ids[id] = (unsigned long)subbuf->page;
+		subbuf->id = id;
+
+		rb_inc_page(cpu_buffer, &subbuf);
+		id++;
+	} while (subbuf != first_subbuf);
+
+	/* install subbuf ID to kern VA translation */
+	cpu_buffer->subbuf_ids = subbuf_ids;
+
+	meta->meta_page_size = PAGE_SIZE;
+	meta->meta_struct_len = sizeof(*meta);
+	meta->nr_subbufs = nr_subbufs;
+	meta->subbuf_size = PAGE_SIZE;
+
+	rb_update_meta_page(cpu_buffer);
+}
+
+static int __rb_map_vma(struct ring_buffer_per_cpu *cpu_buffer,
+			struct vm_area_struct *vma)
+{
+	unsigned long nr_pages, pgoff = vma->vm_pgoff;
+	unsigned long addr;
+	struct page *page;
+	int err;
+
+	if (vma->vm_flags & VM_WRITE || vma->vm_flags & VM_EXEC ||
+	    !(vma->vm_flags & VM_MAYSHARE))
+		return -EPERM;
+
+	/*
+	 * Make sure the mapping cannot become writable later. Also tell the VM
+	 * to not touch these pages (VM_DONTCOPY | VM_DONTEXPAND).
+	 */
+	vma->vm_flags |= VM_DONTCOPY | VM_DONTEXPAND | VM_DONTDUMP;
+	vma->vm_flags &= ~VM_MAYWRITE;
+
+	/* meta-page + reader page + ring pages */
+	nr_pages = cpu_buffer->nr_pages + 2;
+	if (pgoff >= nr_pages)
+		return -EINVAL;
+
+	if (!vma_pages(vma) || vma_pages(vma) > nr_pages - pgoff)
+		return -EINVAL;
+
+	for (addr = vma->vm_start; addr < vma->vm_end; addr += PAGE_SIZE) {
+		if (!pgoff)
+			page = virt_to_page(cpu_buffer->meta_page);
+		else
+			page = virt_to_page(cpu_buffer->subbuf_ids[pgoff - 1]);
+
+		/* On failure, the caller unmaps the whole VMA */
+		err = vm_insert_page(vma, addr, page);
+		if (err)
+			return err;
+		pgoff++;
+	}
+
+	return 0;
+}
+
+/**
+ * ring_buffer_map - map a per CPU buffer into user space
+ * @buffer: The ring buffer the per CPU buffer belongs to
+ * @cpu: The CPU buffer to map
+ * @vma: The user space mapping to populate
+ *
+ * Maps the meta-page followed by the reader page and all the ring pages,
+ * in the order of their IDs. While a CPU buffer is mapped, it can not be
+ * resized or swapped and ring_buffer_read_page() always copies the data.
+ * Mapping the same CPU buffer several times is allowed.
+ *
+ * Returns 0 on success or a negative error code.
+ */
+int ring_buffer_map(struct ring_buffer *buffer, int cpu,
+		    struct vm_area_struct *vma)
+{
+	struct ring_buffer_per_cpu *cpu_buffer;
+	unsigned long flags, *subbuf_ids;
+	struct page *page;
+	int err = 0;
+
+	if (!cpumask_test_cpu(cpu, buffer->cpumask))
+		return -EINVAL;
+
+	cpu_buffer = buffer->buffers[cpu];
+
+	/* prevent another thread from changing buffer sizes */
+	mutex_lock(&buffer->mutex);
+
+	if (cpu_buffer->mapped) {
+		err = __rb_map_vma(cpu_buffer, vma);
+		if (!err)
+			cpu_buffer->mapped++;
+		goto out;
+	}
+
+	page = alloc_pages_node(cpu_to_node(cpu), GFP_KERNEL | __GFP_ZERO, 0);
+	if (!page) {
+		err = -ENOMEM;
+		goto out;
+	}
+	cpu_buffer->meta_page = page_address(page);
+
+	/* subbuf_ids include the reader while nr_pages does not */
+	subbuf_ids = kcalloc(cpu_buffer->nr_pages + 1, sizeof(*subbuf_ids),
+			     GFP_KERNEL);
+	if (!subbuf_ids) {
+		err = -ENOMEM;
+		goto out_free_meta;
+	}
+
+	/*
+	 * Lock all readers to block any page swap until the page IDs are
+	 * assigned.
+	 */
+	raw_spin_lock_irqsave(&cpu_buffer->reader_lock, flags);
+	rb_setup_ids_meta_page(cpu_buffer, subbuf_ids);
+	raw_spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
+
+	err = __rb_map_vma(cpu_buffer, vma);
+	if (err)
+		goto out_free_ids;
+
+	raw_spin_lock_irqsave(&cpu_buffer->reader_lock, flags);
+	cpu_buffer->mapped = 1;
+	raw_spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
+
+	mutex_unlock(&buffer->mutex);
+
+	return 0;
+
+ out_free_ids:
+	kfree(subbuf_ids);
+	cpu_buffer->subbuf_ids = NULL;
+ out_free_meta:
+	free_page((unsigned long)cpu_buffer->meta_page);
+	cpu_buffer->meta_page = NULL;
+ out:
+	mutex_unlock(&buffer->mutex);
+
+	return err;
+}
+EXPORT_SYMBOL_GPL(ring_buffer_map);
+
+/**
+ * ring_buffer_map_dup - account for a copy of an existing mapping
+ * @buffer: The ring buffer the per CPU buffer belongs to
+ * @cpu: The mapped CPU buffer
+ *
+ * Called when the VM duplicates a mapping of the CPU buffer, for instance
+ * when a VMA is split or moved. Every successful call must be paired with
+ * ring_buffer_unmap().
+ */
+int ring_buffer_map_dup(struct ring_buffer *buffer, int cpu)
+{
+	struct ring_buffer_per_cpu *cpu_buffer;
+	int err = 0;
+
+	if (!cpumask_test_cpu(cpu, buffer->cpumask))
+		return -EINVAL;
+
+	cpu_buffer = buffer->buffers[cpu];
+
+	mutex_lock(&buffer->mutex);
+	if (RB_WARN_ON(cpu_buffer, !cpu_buffer->mapped))
+		err = -ENODEV;
+	else
+		cpu_buffer->mapped++;
+	mutex_unlock(&buffer->mutex);
+
+	return err;
+}
+EXPORT_SYMBOL_GPL(ring_buffer_map_dup);
+
+/**
+ * ring_buffer_unmap - drop a user space mapping of a per CPU buffer
+ * @buffer: The ring buffer the per CPU buffer belongs to
+ * @cpu: The mapped CPU buffer
+ *
+ * The meta-page is freed and the CPU buffer becomes resizable again when
+ * the last mapping goes away.
+ */
+int ring_buffer_unmap(struct ring_buffer *buffer, int cpu)
+{
+	struct ring_buffer_per_cpu *cpu_buffer;
+	unsigned long flags;
+	int err = 0;
+
+	if (!cpumask_test_cpu(cpu, buffer->cpumask))
+		return -EINVAL;
+
+	cpu_buffer = buffer->buffers[cpu];
+
+	mutex_lock(&buffer->mutex);
+
+	if (!cpu_buffer->mapped) {
+		err = -ENODEV;
+		goto out;
+	} else if (cpu_buffer->mapped > 1) {
+		cpu_buffer->mapped--;
+		goto out;
+	}
+
+	raw_spin_lock_irqsave(&cpu_buffer->reader_lock, flags);
+	cpu_buffer->mapped = 0;
+	raw_spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
+
+	free_page((unsigned long)cpu_buffer->meta_page);
+	cpu_buffer->meta_page = NULL;
+	kfree(cpu_buffer->subbuf_ids);
+	cpu_buffer->subbuf_ids = NULL;
+
+ out:
+	mutex_unlock(&buffer->mutex);
+
+	return err;
+}
+EXPORT_SYMBOL_GPL(ring_buffer_unmap);
+
+/**
+ * ring_buffer_map_get_reader - swap in the next page for a mapped buffer
+ * @buffer: The ring buffer the per CPU buffer belongs to
+ * @cpu: The mapped CPU buffer
+ *
+ * If the current reader page still has unread data, it is left in place.
+ * Otherwise the next page of the ring is swapped in. In both cases the
+ * data on the reader page is consumed on behalf of user space, which
+ * reads it directly from the mapping, and the meta-page is updated.
+ *
+ * Returns 0 on success or a negative error code.
+ */
+int ring_buffer_map_get_reader(struct ring_buffer *buffer, int cpu)
+{
+	struct ring_buffer_per_cpu *cpu_buffer;
+	unsigned long missed_events;
+	struct buffer_page *reader;
+	unsigned long reader_size;
+	unsigned long flags;
+	int err = 0;
+
+	if (!cpumask_test_cpu(cpu, buffer->cpumask))
+		return -EINVAL;
+
+	cpu_buffer = buffer->buffers[cpu];
+
+	raw_spin_lock_irqsave(&cpu_buffer->reader_lock, flags);
+
+	if (!cpu_buffer->mapped) {
+		err = -ENODEV;
+		goto out_unlock;
+	}
+
+ consume:
+	if (rb_per_cpu_empty(cpu_buffer))
+		goto out;
+
+	reader_size = rb_page_size(cpu_buffer->reader_page);
+
+	/*
+	 * There is data to be read on the current reader page, we can
+	 * return to the caller. But before that, we assume the latter will
+	 * read everything. Let's update the kernel reader accordingly.
+	 */
+	if (cpu_buffer->reader_page->read < reader_size) {
+		while (cpu_buffer->reader_page->read < reader_size)
+			rb_advance_reader(cpu_buffer);
+		goto out;
+	}
+
+	reader = rb_get_reader_page(cpu_buffer);
+	if (RB_WARN_ON(cpu_buffer, !reader))
+		goto out;
+
+	/* Check if any events were dropped */
+	missed_events = cpu_buffer->lost_events;
+
+	if (missed_events && cpu_buffer->reader_page != cpu_buffer->commit_page) {
+		struct buffer_data_page *bpage = reader->page;
+		unsigned int commit;
+
+		/*
+		 * Use the real_end for the data size,
+		 * This gives us a chance to store the lost events
+		 * on the page.
+		 */
+		if (reader->real_end)
+			local_set(&bpage->commit, reader->real_end);
+
+		/*
+		 * If there is room at the end of the page to save the
+		 * missed events, then record it there.
+		 */
+		commit = rb_page_size(reader);
+		if (BUF_PAGE_SIZE - commit >= sizeof(missed_events)) {
+			memcpy(&bpage->data[commit], &missed_events,
+			       sizeof(missed_events));
+			local_add(RB_MISSED_STORED, &bpage->commit);
+		}
+		local_add(RB_MISSED_EVENTS, &bpage->commit);
+	}
+
+	cpu_buffer->lost_events = 0;
+
+	goto consume;
+
+ out:
+	/* Some archs do not have data cache coherency between kernel and user */
+	flush_dcache_page(virt_to_page(cpu_buffer->reader_page->page));
+
+	rb_update_meta_page(cpu_buffer);
+
+ out_unlock:
+	raw_spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
+
+	return err;
+}
+EXPORT_SYMBOL_GPL(ring_buffer_map_get_reader);
+
 /*
  * We only allocate new buffers, never free them if the CPU goes down.
  * If we were to free the buffer, then the user would lose any trace that was in
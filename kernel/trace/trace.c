@@ -43,6 +43,7 @@
 #include <linux/nmi.h>
 #include <linux/fs.h>
 #include <linux/trace.h>
+#include <linux/trace_mmap.h>
 #include <linux/sched/clock.h>
 #include <linux/sched/rt.h>
 #include <linux/fsnotify.h>
@@ -1046,6 +1047,10 @@ int tracing_alloc_snapshot_instance(struct trace_array *tr)
 
 	if (!tr->allocated_snapshot) {
 
+		/* Taking a snapshot would swap out the buffer mapped to user space */
+		if (READ_ONCE(tr->mapped))
+			return -EBUSY;
+
 		/* allocate spare buffer */
 		ret = resize_buffer_duplicate_size(&tr->max_buffer,
 				   &tr->trace_buffer, RING_BUFFER_ALL_CPUS);
@@ -1647,6 +1652,10 @@ update_max_tr(struct trace_array *tr, struct task_struct *tsk, int cpu,
 		return;
 	}
 
+	/* The buffer mapped to user space must stay the trace_buffer */
+	if (READ_ONCE(tr->mapped))
+		return;
+
 	arch_spin_lock(&tr->max_lock);
 
 	/* Inherit the recordable setting from trace_buffer */
@@ -1690,6 +1699,10 @@ update_max_tr_single(struct trace_array *tr, struct task_struct *tsk, int cpu)
 		return;
 	}
 
+	/* The buffer mapped to user space must stay the trace_buffer */
+	if (READ_ONCE(tr->mapped))
+		return;
+
 	arch_spin_lock(&tr->max_lock);
 
 	ret = ring_buffer_swap_cpu(tr->max_buffer.buffer, tr->trace_buffer.buffer, cpu);
@@ -5037,7 +5050,7 @@ static const char readme_msg[] =
 	"\t    Format: hist:keys=<field1[,field2,...]>\n"
 	"\t            [:values=<field1[,field2,...]>]\n"
 	"\t            [:sort=<field1[,field2,...]>]\n"
-	"\t            [:size=#entries]\n"
+	"\t            [:size=#entries][:maxsize=#entries]\n"
 	"\t            [:pause][:continue][:clear]\n"
 	"\t            [:name=histname1]\n"
 	"\t            [:<handler>.<action>]\n"
@@ -5054,6 +5067,8 @@ static const char readme_msg[] =
 	"\t    be modified by appending '.descending' or '.ascending' to a\n"
 	"\t    sort field.  The 'size' parameter can be used to specify more\n"
 	"\t    or fewer than the default 2048 entries for the hashtable size.\n"
+	"\t    If 'maxsize' is larger than 'size', the hashtable grows as it\n"
+	"\t    fills up, until it holds 'maxsize' entries.\n"
 	"\t    If a hist trigger is given a name using the 'name' parameter,\n"
 	"\t    its histogram data will be shared with other triggers of the\n"
 	"\t    same name, and trigger hits will update this common data.\n\n"
@@ -5071,7 +5086,8 @@ static const char readme_msg[] =
 	"\t            .execname   display a common_pid as a program name\n"
 	"\t            .syscall    display a syscall id as a syscall name\n"
 	"\t            .log2       display log2 value rather than raw number\n"
-	"\t            .usecs      display a common_timestamp in microseconds\n\n"
+	"\t            .usecs      display a common_timestamp in microseconds\n"
+	"\t            .percentiles display a value's p50/p90/p99 (log2 buckets)\n\n"
 	"\t    The 'pause' parameter can be used to pause an existing hist\n"
 	"\t    trigger or to start a hist trigger but not log any events\n"
 	"\t    until told to do so.  'continue' can be used to start or\n"
@@ -7598,12 +7614,114 @@ tracing_buffers_splice_read(struct file *file, loff_t *ppos,
 	return ret;
 }
 
+static long tracing_buffers_ioctl(struct file *file, unsigned int cmd,
+				  unsigned long arg)
+{
+	struct ftrace_buffer_info *info = file->private_data;
+	struct trace_iterator *iter = &info->iter;
+	int err;
+
+	if (cmd != TRACE_MMAP_IOCTL_GET_READER)
+		return -ENOTTY;
+
+	if (!(file->f_flags & O_NONBLOCK)) {
+		err = wait_on_pipe(iter, iter->tr->buffer_percent);
+		if (err)
+			return err;
+	}
+
+	return ring_buffer_map_get_reader(iter->trace_buffer->buffer,
+					  iter->cpu_file);
+}
+
+#ifdef CONFIG_TRACER_MAX_TRACE
+static int get_snapshot_map(struct trace_array *tr)
+{
+	int err = 0;
+
+	/*
+	 * Called with mmap_sem held: use snapshot_map_lock rather than
+	 * trace_types_lock. update_max_tr() checks tr->mapped again, so
+	 * racing with a snapshot allocation is harmless.
+	 */
+	spin_lock(&tr->snapshot_map_lock);
+
+	if (tr->allocated_snapshot || tr->mapped == UINT_MAX)
+		err = -EBUSY;
+	else
+		tr->mapped++;
+
+	spin_unlock(&tr->snapshot_map_lock);
+
+	return err;
+}
+
+static void put_snapshot_map(struct trace_array *tr)
+{
+	spin_lock(&tr->snapshot_map_lock);
+	if (!WARN_ON(!tr->mapped))
+		tr->mapped--;
+	spin_unlock(&tr->snapshot_map_lock);
+}
+#else
+static inline int get_snapshot_map(struct trace_array *tr) { return 0; }
+static inline void put_snapshot_map(struct trace_array *tr) { }
+#endif
+
+static void tracing_buffers_mmap_open(struct vm_area_struct *vma)
+{
+	struct ftrace_buffer_info *info = vma->vm_file->private_data;
+	struct trace_iterator *iter = &info->iter;
+
+	/* The mapping is being split or moved, account for the copy */
+	WARN_ON(get_snapshot_map(iter->tr));
+	WARN_ON(ring_buffer_map_dup(iter->trace_buffer->buffer,
+				    iter->cpu_file));
+}
+
+static void tracing_buffers_mmap_close(struct vm_area_struct *vma)
+{
+	struct ftrace_buffer_info *info = vma->vm_file->private_data;
+	struct trace_iterator *iter = &info->iter;
+
+	WARN_ON(ring_buffer_unmap(iter->trace_buffer->buffer, iter->cpu_file));
+	put_snapshot_map(iter->tr);
+}
+
+static const struct vm_operations_struct tracing_buffers_vmops = {
+	.open		= tracing_buffers_mmap_open,
+	.close		= tracing_buffers_mmap_close,
+};
+
+static int tracing_buffers_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct ftrace_buffer_info *info = filp->private_data;
+	struct trace_iterator *iter = &info->iter;
+	int ret;
+
+	ret = get_snapshot_map(iter->tr);
+	if (ret)
+		return ret;
+
+	ret = ring_buffer_map(iter->trace_buffer->buffer, iter->cpu_file, vma);
+	if (ret) {
+		put_snapshot_map(iter->tr);
+		return ret;
+	}
+
+	vma->vm_ops = &tracing_buffers_vmops;
+
+	return 0;
+}
+
 static const struct file_operations tracing_buffers_fops = {
 	.open		= tracing_buffers_open,
 	.read		= tracing_buffers_read,
 	.poll		= tracing_buffers_poll,
 	.release	= tracing_buffers_release,
 	.splice_read	= tracing_buffers_splice_read,
+	.unlocked_ioctl	= tracing_buffers_ioctl,
+	.mmap		= tracing_buffers_mmap,
 	.llseek		= no_llseek,
 };
 
@@ -8487,6 +8605,9 @@ static struct trace_array *trace_array_create(const char *name)
 	raw_spin_lock_init(&tr->start_lock);
 
 	tr->max_lock = (arch_spinlock_t)__ARCH_SPIN_LOCK_UNLOCKED;
+#ifdef CONFIG_TRACER_MAX_TRACE
+	spin_lock_init(&tr->snapshot_map_lock);
+#endif
 
 	tr->current_trace = &nop_trace;
 
@@ -9329,6 +9450,9 @@ __init static int tracer_alloc_buffers(void)
 	global_trace.current_trace = &nop_trace;
 
 	global_trace.max_lock = (arch_spinlock_t)__ARCH_SPIN_LOCK_UNLOCKED;
+#ifdef CONFIG_TRACER_MAX_TRACE
+	spin_lock_init(&global_trace.snapshot_map_lock);
+#endif
 
 	ftrace_init_global_array_ops(&global_trace);
 
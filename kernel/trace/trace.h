@@ -264,6 +264,12 @@ struct trace_array {
 	 */
 	struct trace_buffer	max_buffer;
 	bool			allocated_snapshot;
+	/*
+	 * Number of user space mappings of trace_buffer. A mapped buffer
+	 * can not be swapped with the max_buffer.
+	 */
+	unsigned int		mapped;
+	spinlock_t		snapshot_map_lock;
 #endif
 #if defined(CONFIG_TRACER_MAX_TRACE) || defined(CONFIG_HWLAT_TRACER)
 	unsigned long		max_latency;
@@ -287,6 +287,9 @@ DEFINE_HIST_FIELD_FN(u8);
 #define HITCOUNT_IDX		0
 #define HIST_KEY_SIZE_MAX	(MAX_FILTER_STR_VAL + HIST_STACKTRACE_SIZE)
 
+/* One bucket per power of two a u64 can be rounded up to, plus zero */
+#define HIST_LOG2_BUCKETS	65
+
 enum hist_field_flags {
 	HIST_FIELD_FL_HITCOUNT		= 1 << 0,
 	HIST_FIELD_FL_KEY		= 1 << 1,
@@ -305,6 +308,7 @@ enum hist_field_flags {
 	HIST_FIELD_FL_VAR_REF		= 1 << 14,
 	HIST_FIELD_FL_CPU		= 1 << 15,
 	HIST_FIELD_FL_ALIAS		= 1 << 16,
+	HIST_FIELD_FL_PERCENTILES	= 1 << 17,
 };
 
 struct var_defs {
@@ -324,6 +328,7 @@ struct hist_trigger_attrs {
 	bool		clear;
 	bool		ts_in_usecs;
 	unsigned int	map_bits;
+	unsigned int	max_bits;
 
 	char		*assignment_str[TRACING_MAP_VARS_MAX];
 	unsigned int	n_assignments;
@@ -531,6 +536,7 @@ struct hist_elt_data {
 	char *comm;
 	u64 *var_ref_vals;
 	char *field_var_str[SYNTH_FIELDS_MAX];
+	atomic64_t *log2_buckets[TRACING_MAP_VALS_MAX];
 };
 
 struct snapshot_context {
@@ -2030,7 +2036,7 @@ static hist_field_fn_t select_value_fn(int field_size, int field_is_signed)
 	return fn;
 }
 
-static int parse_map_size(char *str)
+static int parse_map_size(char *str, unsigned int max_bits)
 {
 	unsigned long size, map_bits;
 	int ret;
@@ -2047,7 +2053,7 @@ static int parse_map_size(char *str)
 
 	map_bits = ilog2(roundup_pow_of_two(size));
 	if (map_bits < TRACING_MAP_BITS_MIN ||
-	    map_bits > TRACING_MAP_BITS_MAX)
+	    map_bits > max_bits)
 		ret = -EINVAL;
 	else
 		ret = map_bits;
@@ -2143,13 +2149,21 @@ static int parse_assignment(struct trace_array *tr,
 			goto out;
 		}
 	} else if (str_has_prefix(str, "size=")) {
-		int map_bits = parse_map_size(str);
+		int map_bits = parse_map_size(str, TRACING_MAP_BITS_MAX);
 
 		if (map_bits < 0) {
 			ret = map_bits;
 			goto out;
 		}
 		attrs->map_bits = map_bits;
+	} else if (str_has_prefix(str, "maxsize=")) {
+		int max_bits = parse_map_size(str, TRACING_MAP_BITS_GROW_MAX);
+
+		if (max_bits < 0) {
+			ret = max_bits;
+			goto out;
+		}
+		attrs->max_bits = max_bits;
 	} else {
 		char *assignment;
 
@@ -2244,6 +2258,9 @@ static void hist_elt_data_free(struct hist_elt_data *elt_data)
 	for (i = 0; i < SYNTH_FIELDS_MAX; i++)
 		kfree(elt_data->field_var_str[i]);
 
+	for (i = 0; i < TRACING_MAP_VALS_MAX; i++)
+		kfree(elt_data->log2_buckets[i]);
+
 	kfree(elt_data->comm);
 	kfree(elt_data);
 }
@@ -2260,7 +2277,7 @@ static int hist_trigger_elt_data_alloc(struct tracing_map_elt *elt)
 	struct hist_trigger_data *hist_data = elt->map->private_data;
 	unsigned int size = TASK_COMM_LEN;
 	struct hist_elt_data *elt_data;
-	struct hist_field *key_field;
+	struct hist_field *key_field, *val_field;
 	unsigned int i, n_str;
 
 	elt_data = kzalloc(sizeof(*elt_data), GFP_KERNEL);
@@ -2292,6 +2309,21 @@ static int hist_trigger_elt_data_alloc(struct tracing_map_elt *elt)
 		}
 	}
 
+	for_each_hist_val_field(i, hist_data) {
+		val_field = hist_data->fields[i];
+
+		if (!(val_field->flags & HIST_FIELD_FL_PERCENTILES))
+			continue;
+
+		elt_data->log2_buckets[i] = kcalloc(HIST_LOG2_BUCKETS,
+						    sizeof(atomic64_t),
+						    GFP_KERNEL);
+		if (!elt_data->log2_buckets[i]) {
+			hist_elt_data_free(elt_data);
+			return -ENOMEM;
+		}
+	}
+
 	elt->private_data = elt_data;
 
 	return 0;
@@ -2305,9 +2337,27 @@ static void hist_trigger_elt_data_init(struct tracing_map_elt *elt)
 		save_comm(elt_data->comm, current);
 }
 
+static void hist_trigger_elt_data_clear(struct tracing_map_elt *elt)
+{
+	struct hist_elt_data *elt_data = elt->private_data;
+	unsigned int i, j;
+
+	/* Also called while the element is set up, before elt_alloc() */
+	if (!elt_data)
+		return;
+
+	for (i = 0; i < TRACING_MAP_VALS_MAX; i++) {
+		if (!elt_data->log2_buckets[i])
+			continue;
+		for (j = 0; j < HIST_LOG2_BUCKETS; j++)
+			atomic64_set(&elt_data->log2_buckets[i][j], 0);
+	}
+}
+
 static const struct tracing_map_ops hist_trigger_elt_data_ops = {
 	.elt_alloc	= hist_trigger_elt_data_alloc,
 	.elt_free	= hist_trigger_elt_data_free,
+	.elt_clear	= hist_trigger_elt_data_clear,
 	.elt_init	= hist_trigger_elt_data_init,
 };
 
@@ -2329,6 +2379,8 @@ static const char *get_hist_field_flags(struct hist_field *hist_field)
 		flags_str = "log2";
 	else if (hist_field->flags & HIST_FIELD_FL_TIMESTAMP_USECS)
 		flags_str = "usecs";
+	else if (hist_field->flags & HIST_FIELD_FL_PERCENTILES)
+		flags_str = "percentiles";
 
 	return flags_str;
 }
@@ -2809,6 +2861,9 @@ parse_field(struct hist_trigger_data *hist_data, struct trace_event_file *file,
 			*flags |= HIST_FIELD_FL_LOG2;
 		else if (strcmp(modifier, "usecs") == 0)
 			*flags |= HIST_FIELD_FL_TIMESTAMP_USECS;
+		else if ((strcmp(modifier, "percentiles") == 0) &&
+			 !(*flags & (HIST_FIELD_FL_KEY | HIST_FIELD_FL_VAR)))
+			*flags |= HIST_FIELD_FL_PERCENTILES;
 		else {
 			hist_err(tr, HIST_ERR_BAD_FIELD_MODIFIER, errpos(modifier));
 			field = ERR_PTR(-EINVAL);
@@ -5210,7 +5265,9 @@ create_hist_data(unsigned int map_bits,
 
 	map_ops = &hist_trigger_elt_data_ops;
 
-	hist_data->map = tracing_map_create(map_bits, hist_data->key_size,
+	hist_data->map = tracing_map_create(map_bits,
+					    max(attrs->max_bits, map_bits),
+					    hist_data->key_size,
 					    map_ops, hist_data);
 	if (IS_ERR(hist_data->map)) {
 		ret = PTR_ERR(hist_data->map);
@@ -5233,6 +5290,13 @@ create_hist_data(unsigned int map_bits,
 	goto out;
 }
 
+static inline void hist_elt_update_log2_buckets(struct hist_elt_data *elt_data,
+						unsigned int i, u64 val)
+{
+	/* Bucket b holds the values in (2 ** (b - 1), 2 ** b] */
+	atomic64_inc(&elt_data->log2_buckets[i][val ? fls64(val - 1) : 0]);
+}
+
 static void hist_trigger_elt_update(struct hist_trigger_data *hist_data,
 				    struct tracing_map_elt *elt, void *rec,
 				    struct ring_buffer_event *rbe,
@@ -5255,6 +5319,8 @@ static void hist_trigger_elt_update(struct hist_trigger_data *hist_data,
 			continue;
 		}
 		tracing_map_update_sum(elt, i, hist_val);
+		if (hist_field->flags & HIST_FIELD_FL_PERCENTILES)
+			hist_elt_update_log2_buckets(elt_data, i, hist_val);
 	}
 
 	for_each_hist_key_field(i, hist_data) {
@@ -5462,11 +5528,41 @@ static void hist_trigger_print_key(struct seq_file *m,
 	seq_puts(m, "}");
 }
 
+static const unsigned int hist_percentiles[] = { 50, 90, 99 };
+
+static void hist_trigger_print_percentiles(struct seq_file *m,
+					   const char *field_name,
+					   atomic64_t *buckets)
+{
+	u64 total = 0, seen;
+	unsigned int b, p;
+
+	for (b = 0; b < HIST_LOG2_BUCKETS; b++)
+		total += atomic64_read(&buckets[b]);
+
+	/*
+	 * Each percentile is shown as the upper bound of the first
+	 * bucket at which that share of the values has been seen.
+	 */
+	b = 0;
+	seen = atomic64_read(&buckets[0]);
+	for (p = 0; p < ARRAY_SIZE(hist_percentiles); p++) {
+		while (b < HIST_LOG2_BUCKETS - 1 &&
+		       seen * 100 < total * hist_percentiles[p])
+			seen += atomic64_read(&buckets[++b]);
+
+		seq_printf(m, "  %s.p%u: %10llu", field_name,
+			   hist_percentiles[p],
+			   b < 64 ? 1ULL << b : U64_MAX);
+	}
+}
+
 static void hist_trigger_entry_print(struct seq_file *m,
 				     struct hist_trigger_data *hist_data,
 				     void *key,
 				     struct tracing_map_elt *elt)
 {
+	struct hist_elt_data *elt_data = elt->private_data;
 	const char *field_name;
 	unsigned int i;
 
@@ -5489,6 +5585,10 @@ static void hist_trigger_entry_print(struct seq_file *m,
 			seq_printf(m, "  %s: %10llu", field_name,
 				   tracing_map_read_sum(elt, i));
 		}
+
+		if (hist_data->fields[i]->flags & HIST_FIELD_FL_PERCENTILES)
+			hist_trigger_print_percentiles(m, field_name,
+						       elt_data->log2_buckets[i]);
 	}
 
 	print_actions(m, hist_data, elt);
@@ -5706,6 +5806,8 @@ static int event_hist_trigger_print(struct seq_file *m,
 			seq_puts(m, ".descending");
 	}
 	seq_printf(m, ":size=%u", (1 << hist_data->map->map_bits));
+	if (hist_data->map->max_bits > hist_data->map->map_bits)
+		seq_printf(m, ":maxsize=%u", (1 << hist_data->map->max_bits));
 	if (hist_data->enable_timestamps)
 		seq_printf(m, ":clock=%s", hist_data->attrs->clock);
 
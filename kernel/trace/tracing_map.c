@@ -19,6 +19,9 @@
 #include "tracing_map.h"
 #include "trace.h"
 
+/* Each table added to a growable map is this many bits larger */
+#define TRACING_MAP_GROW_BITS	2
+
 /*
  * NOTE: For a detailed description of the data structures used by
  * these functions (such as tracing_map_elt) please see the overview
@@ -328,7 +331,7 @@ struct tracing_map_array *tracing_map_array_alloc(unsigned int n_elts,
 
 	a->entry_size_shift = fls(roundup_pow_of_two(entry_size) - 1);
 	a->entries_per_page = PAGE_SIZE / (1 << a->entry_size_shift);
-	a->n_pages = n_elts / a->entries_per_page;
+	a->n_pages = DIV_ROUND_UP(n_elts, a->entries_per_page);
 	if (!a->n_pages)
 		a->n_pages = 1;
 	a->entry_shift = fls(a->entries_per_page) - 1;
@@ -446,51 +449,70 @@ static struct tracing_map_elt *tracing_map_elt_alloc(struct tracing_map *map)
 	return ERR_PTR(err);
 }
 
-static struct tracing_map_elt *get_free_elt(struct tracing_map *map)
+static inline bool tracing_map_table_full(struct tracing_map_table *table)
+{
+	return atomic_read(&table->next_elt) >= (int)table->max_elts - 1;
+}
+
+static struct tracing_map_elt *get_free_elt(struct tracing_map *map,
+					    struct tracing_map_table *table)
 {
 	struct tracing_map_elt *elt = NULL;
 	int idx;
 
-	idx = atomic_inc_return(&map->next_elt);
-	if (idx < map->max_elts) {
-		elt = *(TRACING_MAP_ELT(map->elts, idx));
+	idx = atomic_inc_return(&table->next_elt);
+	if (idx < table->max_elts) {
+		elt = *(TRACING_MAP_ELT(table->elts, idx));
 		if (map->ops && map->ops->elt_init)
 			map->ops->elt_init(elt);
 	}
 
+	/*
+	 * Ask for the next table when this one is three quarters
+	 * full, so that it's usually ready before this one runs out,
+	 * and once more when it does run out in case that failed.
+	 * This can be called from any context, including NMI, so
+	 * the allocation is left to a work item.
+	 */
+	if (map->max_bits > map->map_bits && !READ_ONCE(table->next) &&
+	    (idx == table->max_elts - (table->max_elts >> 2) ||
+	     idx == table->max_elts))
+		irq_work_queue(&map->grow_irq_work);
+
 	return elt;
 }
 
-static void tracing_map_free_elts(struct tracing_map *map)
+static void tracing_map_free_elts(struct tracing_map_table *table)
 {
 	unsigned int i;
 
-	if (!map->elts)
+	if (!table->elts)
 		return;
 
-	for (i = 0; i < map->max_elts; i++) {
-		tracing_map_elt_free(*(TRACING_MAP_ELT(map->elts, i)));
-		*(TRACING_MAP_ELT(map->elts, i)) = NULL;
+	for (i = 0; i < table->max_elts; i++) {
+		tracing_map_elt_free(*(TRACING_MAP_ELT(table->elts, i)));
+		*(TRACING_MAP_ELT(table->elts, i)) = NULL;
 	}
 
-	tracing_map_array_free(map->elts);
-	map->elts = NULL;
+	tracing_map_array_free(table->elts);
+	table->elts = NULL;
 }
 
-static int tracing_map_alloc_elts(struct tracing_map *map)
+static int tracing_map_alloc_elts(struct tracing_map *map,
+				  struct tracing_map_table *table)
 {
 	unsigned int i;
 
-	map->elts = tracing_map_array_alloc(map->max_elts,
-					    sizeof(struct tracing_map_elt *));
-	if (!map->elts)
+	table->elts = tracing_map_array_alloc(table->max_elts,
+					      sizeof(struct tracing_map_elt *));
+	if (!table->elts)
 		return -ENOMEM;
 
-	for (i = 0; i < map->max_elts; i++) {
-		*(TRACING_MAP_ELT(map->elts, i)) = tracing_map_elt_alloc(map);
-		if (IS_ERR(*(TRACING_MAP_ELT(map->elts, i)))) {
-			*(TRACING_MAP_ELT(map->elts, i)) = NULL;
-			tracing_map_free_elts(map);
+	for (i = 0; i < table->max_elts; i++) {
+		*(TRACING_MAP_ELT(table->elts, i)) = tracing_map_elt_alloc(map);
+		if (IS_ERR(*(TRACING_MAP_ELT(table->elts, i)))) {
+			*(TRACING_MAP_ELT(table->elts, i)) = NULL;
+			tracing_map_free_elts(table);
 
 			return -ENOMEM;
 		}
@@ -499,6 +521,103 @@ static int tracing_map_alloc_elts(struct tracing_map *map)
 	return 0;
 }
 
+static void tracing_map_table_init(struct tracing_map_table *table,
+				   unsigned int map_bits)
+{
+	table->map_bits = map_bits;
+	table->max_elts = (1 << map_bits);
+	atomic_set(&table->next_elt, -1);
+
+	table->map_size = (1 << (map_bits + 1));
+}
+
+static void tracing_map_table_clear(struct tracing_map_table *table)
+{
+	unsigned int i;
+
+	atomic_set(&table->next_elt, -1);
+
+	tracing_map_array_clear(table->map);
+
+	for (i = 0; i < table->max_elts; i++)
+		tracing_map_elt_clear(*(TRACING_MAP_ELT(table->elts, i)));
+}
+
+static void tracing_map_table_free(struct tracing_map_table *table)
+{
+	tracing_map_free_elts(table);
+	tracing_map_array_free(table->map);
+	kfree(table);
+}
+
+/*
+ * The hash table is sized by @map_bits, but holds no more than @max_elts
+ * elements, so that the last table of a map does not take it past its
+ * maximum size.
+ */
+static struct tracing_map_table *
+tracing_map_table_alloc(struct tracing_map *map, unsigned int map_bits,
+			unsigned int max_elts)
+{
+	struct tracing_map_table *table;
+
+	table = kzalloc(sizeof(*table), GFP_KERNEL);
+	if (!table)
+		return NULL;
+
+	tracing_map_table_init(table, map_bits);
+	table->max_elts = min(table->max_elts, max_elts);
+
+	table->map = tracing_map_array_alloc(table->map_size,
+					     sizeof(struct tracing_map_entry));
+	if (!table->map)
+		goto free;
+
+	if (tracing_map_alloc_elts(map, table))
+		goto free;
+
+	return table;
+ free:
+	tracing_map_table_free(table);
+
+	return NULL;
+}
+
+static void tracing_map_grow_work(struct work_struct *work)
+{
+	struct tracing_map *map = container_of(work, struct tracing_map,
+					       grow_work);
+	struct tracing_map_table *last, *table;
+	unsigned int map_bits, n_elts = 0;
+
+	for (last = &map->table; ; last = last->next) {
+		n_elts += last->max_elts;
+		if (!last->next)
+			break;
+	}
+
+	if (n_elts >= (1U << map->max_bits))
+		return;
+
+	map_bits = min(last->map_bits + TRACING_MAP_GROW_BITS, map->max_bits);
+
+	table = tracing_map_table_alloc(map, map_bits,
+					(1U << map->max_bits) - n_elts);
+	if (!table)
+		return;
+
+	/* Pairs with the smp_load_acquire()s walking the tables */
+	smp_store_release(&last->next, table);
+}
+
+static void tracing_map_grow_irq_work(struct irq_work *work)
+{
+	struct tracing_map *map = container_of(work, struct tracing_map,
+					       grow_irq_work);
+
+	schedule_work(&map->grow_work);
+}
+
 static inline bool keys_match(void *key, void *test_key, unsigned key_size)
 {
 	bool match = true;
@@ -510,31 +629,29 @@ static inline bool keys_match(void *key, void *test_key, unsigned key_size)
 }
 
 static inline struct tracing_map_elt *
-__tracing_map_insert(struct tracing_map *map, void *key, bool lookup_only)
+tracing_map_table_insert(struct tracing_map *map,
+			 struct tracing_map_table *table,
+			 void *key, u32 key_hash, bool lookup_only,
+			 bool *full)
 {
-	u32 idx, key_hash, test_key;
+	u32 idx, test_key;
 	int dup_try = 0;
 	struct tracing_map_entry *entry;
 	struct tracing_map_elt *val;
 
-	key_hash = jhash(key, map->key_size, 0);
-	if (key_hash == 0)
-		key_hash = 1;
-	idx = key_hash >> (32 - (map->map_bits + 1));
+	idx = key_hash >> (32 - (table->map_bits + 1));
 
 	while (1) {
-		idx &= (map->map_size - 1);
-		entry = TRACING_MAP_ENTRY(map->map, idx);
+		idx &= (table->map_size - 1);
+		entry = TRACING_MAP_ENTRY(table->map, idx);
 		test_key = entry->key;
 
 		if (test_key && test_key == key_hash) {
 			val = READ_ONCE(entry->val);
 			if (val &&
-			    keys_match(key, val->key, map->key_size)) {
-				if (!lookup_only)
-					atomic64_inc(&map->hits);
+			    keys_match(key, val->key, map->key_size))
 				return val;
-			} else if (unlikely(!val)) {
+			else if (unlikely(!val)) {
 				/*
 				 * The key is present. But, val (pointer to elt
 				 * struct) is still NULL. which means some other
@@ -548,10 +665,8 @@ __tracing_map_insert(struct tracing_map *map, void *key, bool lookup_only)
 				 */
 
 				dup_try++;
-				if (dup_try > map->map_size) {
-					atomic64_inc(&map->drops);
+				if (dup_try > table->map_size)
 					break;
-				}
 				continue;
 			}
 		}
@@ -563,16 +678,15 @@ __tracing_map_insert(struct tracing_map *map, void *key, bool lookup_only)
 			if (!cmpxchg(&entry->key, 0, key_hash)) {
 				struct tracing_map_elt *elt;
 
-				elt = get_free_elt(map);
+				elt = get_free_elt(map, table);
 				if (!elt) {
-					atomic64_inc(&map->drops);
 					entry->key = 0;
+					*full = true;
 					break;
 				}
 
 				memcpy(elt->key, key, map->key_size);
 				entry->val = elt;
-				atomic64_inc(&map->hits);
 
 				return entry->val;
 			} else {
@@ -591,6 +705,48 @@ __tracing_map_insert(struct tracing_map *map, void *key, bool lookup_only)
 	return NULL;
 }
 
+static inline struct tracing_map_elt *
+__tracing_map_insert(struct tracing_map *map, void *key, bool lookup_only)
+{
+	struct tracing_map_table *table = &map->table;
+	struct tracing_map_elt *elt;
+	u32 key_hash;
+	bool full;
+
+	key_hash = jhash(key, map->key_size, 0);
+	if (key_hash == 0)
+		key_hash = 1;
+
+	do {
+		full = false;
+		elt = tracing_map_table_insert(map, table, key, key_hash,
+					       lookup_only, &full);
+		if (elt) {
+			if (!lookup_only)
+				atomic64_inc(&map->hits);
+			return elt;
+		}
+
+		/*
+		 * A key only ever goes into a table once every table
+		 * before it has run out of elements, so there's no
+		 * need to look any further than the first table that
+		 * still has some.
+		 */
+		if (lookup_only)
+			full = tracing_map_table_full(table);
+		if (!full)
+			break;
+
+		table = smp_load_acquire(&table->next);
+	} while (table);
+
+	if (!lookup_only)
+		atomic64_inc(&map->drops);
+
+	return NULL;
+}
+
 /**
  * tracing_map_insert - Insert key and/or retrieve val from a tracing_map
  * @map: The tracing_map to insert into
@@ -605,7 +761,8 @@ __tracing_map_insert(struct tracing_map *map, void *key, bool lookup_only)
  * tracing_map_elts was created by tracing_map_init().  This is the
  * pre-allocated pool of tracing_map_elts that tracing_map_insert()
  * will allocate from when adding new keys.  Once that pool is
- * exhausted, tracing_map_insert() is useless and will return NULL to
+ * exhausted, new keys go into the next table of a growable map, if
+ * there is one yet; otherwise tracing_map_insert() returns NULL to
  * signal that state.  There are two user-visible tracing_map
  * variables, 'hits' and 'drops', which are updated by this function.
  * Every time an element is either successfully inserted or retrieved,
@@ -618,15 +775,16 @@ __tracing_map_insert(struct tracing_map *map, void *key, bool lookup_only)
  * possibility of an infinite loop we always make the internal table
  * size double the size of the requested table size (max_elts * 2).
  * Likewise, we never reuse a slot or resize or delete elements - when
- * we've reached max_elts entries, we simply return NULL once we've
- * run out of entries.  Readers can at any point in time traverse the
- * tracing map and safely access the key/val pairs.
+ * we've reached max_elts entries, we move on to the next table, or
+ * simply return NULL if there isn't one.  Readers can at any point in
+ * time traverse the tracing map and safely access the key/val pairs.
  *
  * Return: the tracing_map_elt pointer val associated with the key.
  * If this was a newly inserted key, the val will be a newly allocated
  * and associated tracing_map_elt pointer val.  If the key wasn't
- * found and the pool of tracing_map_elts has been exhausted, NULL is
- * returned and no further insertions will succeed.
+ * found and the pools of tracing_map_elts of all the tables have been
+ * exhausted, NULL is returned and no further insertions will succeed
+ * until the map has grown.
  */
 struct tracing_map_elt *tracing_map_insert(struct tracing_map *map, void *key)
 {
@@ -660,19 +818,29 @@ struct tracing_map_elt *tracing_map_lookup(struct tracing_map *map, void *key)
  * @map: The tracing_map to destroy
  *
  * Frees a tracing_map along with its associated array of
- * tracing_map_elts.
+ * tracing_map_elts, and any tables it has grown.
  *
  * Callers should make sure there are no readers or writers actively
  * reading or inserting into the map before calling this.
  */
 void tracing_map_destroy(struct tracing_map *map)
 {
+	struct tracing_map_table *table, *next;
+
 	if (!map)
 		return;
 
-	tracing_map_free_elts(map);
+	irq_work_sync(&map->grow_irq_work);
+	cancel_work_sync(&map->grow_work);
+
+	for (table = map->table.next; table; table = next) {
+		next = table->next;
+		tracing_map_table_free(table);
+	}
+
+	tracing_map_free_elts(&map->table);
 
-	tracing_map_array_free(map->map);
+	tracing_map_array_free(map->table.map);
 	kfree(map);
 }
 
@@ -682,23 +850,21 @@ void tracing_map_destroy(struct tracing_map *map)
  *
  * Resets the tracing map to a cleared or initial state.  The
  * tracing_map_elts are all cleared, and the array of struct
- * tracing_map_entry is reset to an initialized state.
+ * tracing_map_entry is reset to an initialized state.  Tables the map
+ * has grown are kept, and cleared the same way.
  *
  * Callers should make sure there are no writers actively inserting
  * into the map before calling this.
  */
 void tracing_map_clear(struct tracing_map *map)
 {
-	unsigned int i;
+	struct tracing_map_table *table;
 
-	atomic_set(&map->next_elt, -1);
 	atomic64_set(&map->hits, 0);
 	atomic64_set(&map->drops, 0);
 
-	tracing_map_array_clear(map->map);
-
-	for (i = 0; i < map->max_elts; i++)
-		tracing_map_elt_clear(*(TRACING_MAP_ELT(map->elts, i)));
+	for (table = &map->table; table; table = smp_load_acquire(&table->next))
+		tracing_map_table_clear(table);
 }
 
 static void set_sort_key(struct tracing_map *map,
@@ -710,6 +876,7 @@ static void set_sort_key(struct tracing_map *map,
 /**
  * tracing_map_create - Create a lock-free map and element pool
  * @map_bits: The size of the map (2 ** map_bits)
+ * @max_bits: The size the map may grow to (2 ** max_bits)
  * @key_size: The size of the key for the map in bytes
  * @ops: Optional client-defined tracing_map_ops instance
  * @private_data: Client data associated with the map
@@ -723,7 +890,9 @@ static void set_sort_key(struct tracing_map *map,
  * insertion path.  The user-specified map size reflects the maximum
  * number of elements that can be contained in the table requested by
  * the user - internally we double that in order to keep the table
- * sparse and keep collisions manageable.
+ * sparse and keep collisions manageable.  If max_bits is larger than
+ * map_bits, the map adds tables as it fills up, until they can hold
+ * 2 ** max_bits elements altogether; otherwise it never grows.
  *
  * A tracing_map is a special-purpose map designed to aggregate or
  * 'sum' one or more values associated with a specific object of type
@@ -758,6 +927,7 @@ static void set_sort_key(struct tracing_map *map,
  * Return: the tracing_map pointer if successful, ERR_PTR if not.
  */
 struct tracing_map *tracing_map_create(unsigned int map_bits,
+				       unsigned int max_bits,
 				       unsigned int key_size,
 				       const struct tracing_map_ops *ops,
 				       void *private_data)
@@ -769,22 +939,27 @@ struct tracing_map *tracing_map_create(unsigned int map_bits,
 	    map_bits > TRACING_MAP_BITS_MAX)
 		return ERR_PTR(-EINVAL);
 
+	if (max_bits < map_bits || max_bits > TRACING_MAP_BITS_GROW_MAX)
+		return ERR_PTR(-EINVAL);
+
 	map = kzalloc(sizeof(*map), GFP_KERNEL);
 	if (!map)
 		return ERR_PTR(-ENOMEM);
 
 	map->map_bits = map_bits;
-	map->max_elts = (1 << map_bits);
-	atomic_set(&map->next_elt, -1);
+	map->max_bits = max_bits;
+	tracing_map_table_init(&map->table, map_bits);
+
+	init_irq_work(&map->grow_irq_work, tracing_map_grow_irq_work);
+	INIT_WORK(&map->grow_work, tracing_map_grow_work);
 
-	map->map_size = (1 << (map_bits + 1));
 	map->ops = ops;
 
 	map->private_data = private_data;
 
-	map->map = tracing_map_array_alloc(map->map_size,
-					   sizeof(struct tracing_map_entry));
-	if (!map->map)
+	map->table.map = tracing_map_array_alloc(map->table.map_size,
+						 sizeof(struct tracing_map_entry));
+	if (!map->table.map)
 		goto free;
 
 	map->key_size = key_size;
@@ -825,7 +1000,7 @@ int tracing_map_init(struct tracing_map *map)
 	if (map->n_fields < 2)
 		return -EINVAL; /* need at least 1 key and 1 val */
 
-	err = tracing_map_alloc_elts(map);
+	err = tracing_map_alloc_elts(map, &map->table);
 	if (err)
 		return err;
 
@@ -1050,6 +1225,9 @@ static void sort_secondary(struct tracing_map *map,
  * 'descending' is a flag that if set reverses the sort order, which
  * by default is ascending.
  *
+ * The entries of all the map's tables are gathered into the one
+ * array, so a map that has grown sorts the same as one that hasn't.
+ *
  * The client should not hold on to the returned array but should use
  * it and call tracing_map_destroy_sort_entries() when done.
  *
@@ -1064,26 +1242,42 @@ int tracing_map_sort_entries(struct tracing_map *map,
 	int (*cmp_entries_fn)(const struct tracing_map_sort_entry **,
 			      const struct tracing_map_sort_entry **);
 	struct tracing_map_sort_entry *sort_entry, **entries;
-	int i, n_entries, ret;
+	struct tracing_map_table *table, *last = NULL;
+	unsigned int max_elts = 0;
+	int i, n_entries = 0, ret;
+
+	/*
+	 * A table added from here on has no room in entries[], so only
+	 * the tables that are there now are gathered.
+	 */
+	for (table = &map->table; table; table = smp_load_acquire(&table->next)) {
+		max_elts += table->max_elts;
+		last = table;
+	}
 
-	entries = vmalloc(array_size(sizeof(sort_entry), map->max_elts));
+	entries = vmalloc(array_size(sizeof(sort_entry), max_elts));
 	if (!entries)
 		return -ENOMEM;
 
-	for (i = 0, n_entries = 0; i < map->map_size; i++) {
-		struct tracing_map_entry *entry;
+	for (table = &map->table; ; table = table->next) {
+		for (i = 0; i < table->map_size; i++) {
+			struct tracing_map_entry *entry;
 
-		entry = TRACING_MAP_ENTRY(map->map, i);
+			entry = TRACING_MAP_ENTRY(table->map, i);
 
-		if (!entry->key || !entry->val)
-			continue;
+			if (!entry->key || !entry->val)
+				continue;
 
-		entries[n_entries] = create_sort_entry(entry->val->key,
-						       entry->val);
-		if (!entries[n_entries++]) {
-			ret = -ENOMEM;
-			goto free;
+			entries[n_entries] = create_sort_entry(entry->val->key,
+							       entry->val);
+			if (!entries[n_entries++]) {
+				ret = -ENOMEM;
+				goto free;
+			}
 		}
+
+		if (table == last)
+			break;
 	}
 
 	if (n_entries == 0) {
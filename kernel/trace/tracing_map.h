@@ -2,9 +2,13 @@
 #ifndef __TRACING_MAP_H
 #define __TRACING_MAP_H
 
+#include <linux/irq_work.h>
+#include <linux/workqueue.h>
+
 #define TRACING_MAP_BITS_DEFAULT	11
 #define TRACING_MAP_BITS_MAX		17
 #define TRACING_MAP_BITS_MIN		7
+#define TRACING_MAP_BITS_GROW_MAX	20
 
 #define TRACING_MAP_KEYS_MAX		3
 #define TRACING_MAP_VALS_MAX		3
@@ -58,8 +62,8 @@ typedef int (*tracing_map_cmp_fn_t) (void *val_a, void *val_b);
  * When tracing_map_create() is called to create the tracing map, the
  * user specifies (indirectly via the map_bits param, the details are
  * unimportant for this discussion) the maximum number of elements
- * that the map can hold (stored in the max_elts field of struct
- * tracing_map).  This is the maximum possible number of
+ * that the map can hold (stored in the max_elts field of the map's
+ * base struct tracing_map_table).  This is the maximum possible number of
  * tracing_map_entries in the tracing_map_entry array which can be
  * 'claimed' as described in the above discussion, and therefore is
  * also the maximum number of tracing_map_elts that can be associated
@@ -67,7 +71,7 @@ typedef int (*tracing_map_cmp_fn_t) (void *val_a, void *val_b);
  * the way the insertion algorithm works, the size of the allocated
  * tracing_map_entry array is always twice the maximum number of
  * elements (2 * max_elts).  This value is stored in the map_size
- * field of struct tracing_map.
+ * field of struct tracing_map_table.
  *
  * Because tracing_map_insert() needs to work from any context,
  * including from within the memory allocation functions themselves,
@@ -78,6 +82,19 @@ typedef int (*tracing_map_cmp_fn_t) (void *val_a, void *val_b);
  * The tracing_map_entry array is allocated as a single block by
  * tracing_map_create().
  *
+ * If the map was created with max_bits larger than map_bits, it can
+ * grow past its initial size.  When the last table's pool of
+ * tracing_map_elts is three quarters used, tracing_map_insert()
+ * queues an irq_work, which in turn queues a work item that allocates
+ * another, four times larger, struct tracing_map_table with its own
+ * entry array and element pool, and links it behind the current last
+ * one.  Tables are never rehashed or resized: once a table's pool is
+ * exhausted, keys that aren't already in it are looked up in and
+ * inserted into the next table, so elements never move and readers
+ * can keep traversing the map locklessly.  Growth stops once the
+ * tables together hold 2 ** max_bits elements; only after that, or
+ * if the next table isn't ready yet, are insertions dropped.
+ *
  * Because the tracing_map_elts are much larger objects and can't
  * generally be allocated together as a single large array without
  * failure, they're allocated individually, by tracing_map_init().
@@ -180,14 +197,23 @@ struct tracing_map_array {
 #define TRACING_MAP_ELT(array, idx)					\
 	((struct tracing_map_elt **)TRACING_MAP_ARRAY_ELT(array, idx))
 
-struct tracing_map {
-	unsigned int			key_size;
+struct tracing_map_table {
 	unsigned int			map_bits;
 	unsigned int			map_size;
 	unsigned int			max_elts;
 	atomic_t			next_elt;
 	struct tracing_map_array	*elts;
 	struct tracing_map_array	*map;
+	struct tracing_map_table	*next;
+};
+
+struct tracing_map {
+	unsigned int			key_size;
+	unsigned int			map_bits;
+	unsigned int			max_bits;
+	struct tracing_map_table	table;
+	struct irq_work			grow_irq_work;
+	struct work_struct		grow_work;
 	const struct tracing_map_ops	*ops;
 	void				*private_data;
 	struct tracing_map_field	fields[TRACING_MAP_FIELDS_MAX];
@@ -217,7 +243,8 @@ struct tracing_map {
  *	allocate additional data and attach it to the element
  *	(tracing_map_elt->private_data is meant for that purpose).
  *	Element allocation occurs before tracing begins, when the
- *	tracing_map_init() call is made by client code.
+ *	tracing_map_init() call is made by client code, and from a
+ *	work item whenever a growable map adds a table.
  *
  * @elt_free: When a tracing_map_elt is freed, this function is called
  *	and allows client-allocated per-element data to be freed.
@@ -239,6 +266,7 @@ struct tracing_map_ops {
 
 extern struct tracing_map *
 tracing_map_create(unsigned int map_bits,
+		   unsigned int max_bits,
 		   unsigned int key_size,
 		   const struct tracing_map_ops *ops,
 		   void *private_data);
@@ -28,6 +28,7 @@
 #include <linux/uaccess.h>
 #include <linux/shmem_fs.h>
 #include <linux/pipe_fs_i.h>
+#include <linux/initrd.h>
 
 #include <trace/events/module.h>
 
@@ -102,6 +103,9 @@ static int call_usermodehelper_exec_async(void *data)
 
 	commit_creds(new);
 
+	/* The helper most likely lives in the initramfs. */
+	wait_for_initramfs();
+
 	sub_info->pid = task_pid_nr(current);
 	if (sub_info->file) {
 		retval = do_execve_file(sub_info->file,
@@ -182,6 +182,9 @@ static struct page *follow_page_pte(struct vm_area_struct *vma,
 retry:
 	if (unlikely(pmd_bad(*pmd)))
 		return no_page_table(vma, flags);
+	/* Writing through a lazily shared PTE table must fault to unshare it */
+	if ((flags & FOLL_WRITE) && pmd_lazy_shared(*pmd))
+		return NULL;
 
 	ptep = pte_offset_map_lock(mm, pmd, address, &ptl);
 	pte = *ptep;
@@ -2219,6 +2222,9 @@ static int gup_pmd_range(pud_t pud, unsigned long addr, unsigned long end,
 			if (!gup_huge_pd(__hugepd(pmd_val(pmd)), addr,
 					 PMD_SHIFT, next, flags, pages, nr))
 				return 0;
+		} else if ((flags & FOLL_WRITE) && pmd_lazy_shared(pmd)) {
+			/* Writes must fault to unshare the PTE table */
+			return 0;
 		} else if (!gup_pte_range(pmd, addr, next, flags, pages, nr))
 			return 0;
 	} while (pmdp++, addr = next, addr != end);
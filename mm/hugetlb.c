@@ -39,6 +39,7 @@
 #include <linux/node.h>
 #include <linux/userfaultfd_k.h>
 #include <linux/page_owner.h>
+#include <linux/padata.h>
 #include "internal.h"
 
 int hugetlb_max_hstate __read_mostly;
@@ -2165,6 +2166,57 @@ static void __init gather_bootmem_prealloc(void)
 	}
 }
 
+struct hugetlb_boot_alloc {
+	struct hstate *h;
+	nodemask_t *node_alloc_noretry;
+	atomic_long_t allocated;
+};
+
+static void __init hugetlb_alloc_pool_pages_chunk(unsigned long start,
+						  unsigned long end, void *arg)
+{
+	struct hugetlb_boot_alloc *ba = arg;
+	unsigned long i;
+
+	for (i = start; i < end; i++) {
+		if (!alloc_pool_huge_page(ba->h, &node_states[N_MEMORY],
+					  ba->node_alloc_noretry))
+			break;
+		atomic_long_inc(&ba->allocated);
+		cond_resched();
+	}
+}
+
+/*
+ * Non-gigantic pages are allocated from the buddy allocator, once the
+ * workqueues are up: preparing each one touches all of its struct pages,
+ * so split the work over a couple of threads per node.  Nodes are still
+ * picked round robin by alloc_pool_huge_page().
+ */
+static unsigned long __init hugetlb_alloc_pool_pages_boot(struct hstate *h,
+						nodemask_t *node_alloc_noretry)
+{
+	int max_threads = 2 * num_node_state(N_MEMORY);
+	struct hugetlb_boot_alloc ba = {
+		.h			= h,
+		.node_alloc_noretry	= node_alloc_noretry,
+		.allocated		= ATOMIC_LONG_INIT(0),
+	};
+	struct padata_mt_job job = {
+		.thread_fn	= hugetlb_alloc_pool_pages_chunk,
+		.fn_arg		= &ba,
+		.start		= 0,
+		.size		= h->max_huge_pages,
+		.align		= 1,
+		.min_chunk	= max(h->max_huge_pages / max_threads, 1UL),
+		.max_threads	= max_threads,
+	};
+
+	padata_do_multithreaded(&job);
+
+	return atomic_long_read(&ba.allocated);
+}
+
 static void __init hugetlb_hstate_alloc_pages(struct hstate *h)
 {
 	unsigned long i;
@@ -2188,15 +2240,14 @@ static void __init hugetlb_hstate_alloc_pages(struct hstate *h)
 	if (node_alloc_noretry)
 		nodes_clear(*node_alloc_noretry);
 
-	for (i = 0; i < h->max_huge_pages; ++i) {
-		if (hstate_is_gigantic(h)) {
+	if (hstate_is_gigantic(h)) {
+		for (i = 0; i < h->max_huge_pages; ++i) {
 			if (!alloc_bootmem_huge_page(h))
 				break;
-		} else if (!alloc_pool_huge_page(h,
-					 &node_states[N_MEMORY],
-					 node_alloc_noretry))
-			break;
-		cond_resched();
+			cond_resched();
+		}
+	} else {
+		i = hugetlb_alloc_pool_pages_boot(h, node_alloc_noretry);
 	}
 	if (i < h->max_huge_pages) {
 		char buf[32];
@@ -3785,6 +3836,41 @@ int huge_add_to_page_cache(struct page *page, struct address_space *mapping,
 	return 0;
 }
 
+static inline vm_fault_t hugetlb_handle_userfault(struct vm_area_struct *vma,
+						  struct address_space *mapping,
+						  pgoff_t idx,
+						  unsigned int flags,
+						  unsigned long haddr,
+						  unsigned long reason)
+{
+	vm_fault_t ret;
+	u32 hash;
+	struct vm_fault vmf = {
+		.vma = vma,
+		.address = haddr,
+		.flags = flags,
+		/*
+		 * Hard to debug if it ends up being
+		 * used by a callee that assumes
+		 * something about the other
+		 * uninitialized fields... same as in
+		 * memory.c
+		 */
+	};
+
+	/*
+	 * hugetlb_fault_mutex must be dropped before
+	 * handling userfault.  Reacquire after handling
+	 * fault to make calling code simpler.
+	 */
+	hash = hugetlb_fault_mutex_hash(mapping, idx);
+	mutex_unlock(&hugetlb_fault_mutex_table[hash]);
+	ret = handle_userfault(&vmf, reason);
+	mutex_lock(&hugetlb_fault_mutex_table[hash]);
+
+	return ret;
+}
+
 static vm_fault_t hugetlb_no_page(struct mm_struct *mm,
 			struct vm_area_struct *vma,
 			struct address_space *mapping, pgoff_t idx,
@@ -3826,29 +3912,9 @@ static vm_fault_t hugetlb_no_page(struct mm_struct *mm,
 		 * Check for page in userfault range
 		 */
 		if (userfaultfd_missing(vma)) {
-			u32 hash;
-			struct vm_fault vmf = {
-				.vma = vma,
-				.address = haddr,
-				.flags = flags,
-				/*
-				 * Hard to debug if it ends up being
-				 * used by a callee that assumes
-				 * something about the other
-				 * uninitialized fields... same as in
-				 * memory.c
-				 */
-			};
-
-			/*
-			 * hugetlb_fault_mutex must be dropped before
-			 * handling userfault.  Reacquire after handling
-			 * fault to make calling code simpler.
-			 */
-			hash = hugetlb_fault_mutex_hash(mapping, idx);
-			mutex_unlock(&hugetlb_fault_mutex_table[hash]);
-			ret = handle_userfault(&vmf, VM_UFFD_MISSING);
-			mutex_lock(&hugetlb_fault_mutex_table[hash]);
+			ret = hugetlb_handle_userfault(vma, mapping, idx,
+						       flags, haddr,
+						       VM_UFFD_MISSING);
 			goto out;
 		}
 
@@ -3897,6 +3963,19 @@ static vm_fault_t hugetlb_no_page(struct mm_struct *mm,
 			anon_rmap = 1;
 		}
 	} else {
+		/*
+		 * The page is in the page cache but not mapped here: let
+		 * userland decide what to do about the minor fault.
+		 */
+		if (userfaultfd_minor(vma)) {
+			unlock_page(page);
+			put_page(page);
+			ret = hugetlb_handle_userfault(vma, mapping, idx,
+						       flags, haddr,
+						       VM_UFFD_MINOR);
+			goto out;
+		}
+
 		/*
 		 * If memory error occurs between mmap() and fault, some process
 		 * don't have hwpoisoned swap entry for errored virtual address.
@@ -4263,6 +4342,77 @@ int hugetlb_mcopy_atomic_pte(struct mm_struct *dst_mm,
 	goto out;
 }
 
+/*
+ * Used by userfaultfd UFFDIO_CONTINUE.  Maps the huge page that is
+ * already present in the page cache at dst_addr; like
+ * hugetlb_mcopy_atomic_pte the caller must hold the
+ * hugetlb_fault_mutex_table entry.
+ */
+int hugetlb_mcontinue_atomic_pte(struct mm_struct *dst_mm,
+				 pte_t *dst_pte,
+				 struct vm_area_struct *dst_vma,
+				 unsigned long dst_addr)
+{
+	struct address_space *mapping = dst_vma->vm_file->f_mapping;
+	struct hstate *h = hstate_vma(dst_vma);
+	/* private mappings are mapped readonly and COWed on write */
+	bool writable = (dst_vma->vm_flags & VM_SHARED) &&
+			(dst_vma->vm_flags & VM_WRITE);
+	unsigned long size;
+	pgoff_t idx;
+	pte_t _dst_pte;
+	spinlock_t *ptl;
+	struct page *page;
+	int ret;
+
+	idx = vma_hugecache_offset(h, dst_vma, dst_addr);
+	ret = -EFAULT;
+	page = find_lock_page(mapping, idx);
+	if (!page)
+		goto out;
+
+	ptl = huge_pte_lockptr(h, dst_mm, dst_pte);
+	spin_lock(ptl);
+
+	/* see hugetlb_mcopy_atomic_pte */
+	size = i_size_read(mapping->host) >> huge_page_shift(h);
+	ret = -EFAULT;
+	if (idx >= size)
+		goto out_release_unlock;
+
+	ret = -EEXIST;
+	if (!huge_pte_none(huge_ptep_get(dst_pte)))
+		goto out_release_unlock;
+
+	page_dup_rmap(page, true);
+
+	_dst_pte = make_huge_pte(dst_vma, page, writable);
+	if (writable)
+		_dst_pte = huge_pte_mkdirty(_dst_pte);
+	_dst_pte = pte_mkyoung(_dst_pte);
+
+	set_huge_pte_at(dst_mm, dst_addr, dst_pte, _dst_pte);
+
+	(void)huge_ptep_set_access_flags(dst_vma, dst_addr, dst_pte, _dst_pte,
+					writable);
+	hugetlb_count_add(pages_per_huge_page(h), dst_mm);
+
+	/* No need to invalidate - it was non-present before */
+	update_mmu_cache(dst_vma, dst_addr, dst_pte);
+
+	spin_unlock(ptl);
+	/* the page cache lookup reference now belongs to the mapping */
+	unlock_page(page);
+	ret = 0;
+out:
+	return ret;
+out_release_unlock:
+	spin_unlock(ptl);
+	unlock_page(page);
+	put_page(page);
+	goto out;
+}
+
 long follow_hugetlb_page(struct mm_struct *mm, struct vm_area_struct *vma,
 			 struct page **pages, struct vm_area_struct **vmas,
 			 unsigned long *position, unsigned long *nr_pages,
@@ -4724,6 +4874,13 @@ static bool vma_shareable(struct vm_area_struct *vma, unsigned long addr)
 	unsigned long base = addr & PUD_MASK;
 	unsigned long end = base + PUD_SIZE;
 
+	/*
+	 * A shared PMD would map pages faulted in by another process
+	 * without reporting minor faults on them.
+	 */
+	if (userfaultfd_minor(vma))
+		return false;
+
 	/*
 	 * check on proper vm_flags and page table alignment
 	 */
@@ -188,6 +188,8 @@ struct stable_node {
  * @mm: the memory structure this rmap_item is pointing into
  * @address: the virtual address this rmap_item tracks (+ flags in low bits)
  * @oldchecksum: previous checksum of the page at that virtual address
+ * @age: number of scans the page went through without being merged
+ * @remaining_skips: how many more scans will skip the page
  * @node: rb node of this rmap_item in the unstable tree
  * @head: pointer to stable_node heading this list in the stable tree
  * @hlist: link into hlist of rmap_items hanging off that stable_node
@@ -203,6 +205,8 @@ struct rmap_item {
 	struct mm_struct *mm;
 	unsigned long address;		/* + low bits used for flags below */
 	unsigned int oldchecksum;	/* when unstable */
+	u8 age;				/* for smart scan */
+	u8 remaining_skips;		/* for smart scan */
 	union {
 		struct rb_node node;	/* when node of unstable tree */
 		struct {		/* when listed from stable tree */
@@ -254,6 +258,9 @@ static unsigned long ksm_pages_unshared;
 /* The number of rmap_items in use: to calculate pages_volatile */
 static unsigned long ksm_rmap_items;
 
+/* The number of page visits skipped by smart scan */
+static unsigned long ksm_pages_skipped;
+
 /* The number of stable_node chains */
 static unsigned long ksm_stable_node_chains;
 
@@ -278,6 +285,9 @@ static unsigned int zero_checksum __read_mostly;
 /* Whether to merge empty (zeroed) pages with actual zero pages */
 static bool ksm_use_zero_pages __read_mostly;
 
+/* Whether to back off from pages that have not been merged for a while */
+static bool ksm_smart_scan __read_mostly = true;
+
 #ifdef CONFIG_NUMA
 /* Zeroed when merging across nodes is not allowed */
 static unsigned int ksm_merge_across_nodes = 1;
@@ -1918,6 +1928,11 @@ static struct stable_node *stable_tree_insert(struct page *kpage)
  *
  * This function does both searching and inserting, because they share
  * the same walking algorithm in an rbtree.
+ *
+ * The tree is ordered by checksum first and by content second, so the
+ * walk only has to look up and compare the pages whose checksum is the
+ * same as that of the scanned page.  The checksum of an rmap_item does
+ * not change while it is linked in the unstable tree.
  */
 static
 struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
@@ -1940,6 +1955,16 @@ struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
 
 		cond_resched();
 		tree_rmap_item = rb_entry(*new, struct rmap_item, node);
+
+		parent = *new;
+		if (rmap_item->oldchecksum < tree_rmap_item->oldchecksum) {
+			new = &parent->rb_left;
+			continue;
+		} else if (rmap_item->oldchecksum > tree_rmap_item->oldchecksum) {
+			new = &parent->rb_right;
+			continue;
+		}
+
 		tree_page = get_mergeable_page(tree_rmap_item);
 		if (!tree_page)
 			return NULL;
@@ -1954,7 +1979,6 @@ struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
 
 		ret = memcmp_pages(page, tree_page);
 
-		parent = *new;
 		if (ret < 0) {
 			put_page(tree_page);
 			new = &parent->rb_left;
@@ -2015,6 +2039,8 @@ static void stable_tree_append(struct rmap_item *rmap_item,
 
 	rmap_item->head = stable_node;
 	rmap_item->address |= STABLE_FLAG;
+	rmap_item->age = 0;
+	rmap_item->remaining_skips = 0;
 	hlist_add_head(&rmap_item->hlist, &stable_node->hlist);
 
 	if (rmap_item->hlist.next)
@@ -2213,6 +2239,60 @@ static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
 	return rmap_item;
 }
 
+/*
+ * Smart scan: a page that went through several scans without being
+ * merged is unlikely to be merged in the next one either, so skip it
+ * for a number of scans that grows with its age.  A page that gets
+ * merged starts over from age 0.
+ */
+static unsigned int skip_age(u8 age)
+{
+	if (age <= 3)
+		return 1;
+	if (age <= 5)
+		return 2;
+	if (age <= 8)
+		return 4;
+
+	return 8;
+}
+
+static bool should_skip_rmap_item(struct page *page,
+				  struct rmap_item *rmap_item)
+{
+	u8 age;
+
+	if (!ksm_smart_scan)
+		return false;
+
+	/* Never skip ksm pages, nor pages already merged */
+	if (PageKsm(page) || (rmap_item->address & STABLE_FLAG))
+		return false;
+
+	age = rmap_item->age;
+	if (age != U8_MAX)
+		rmap_item->age++;
+
+	if (age < 3)
+		return false;
+
+	if (rmap_item->remaining_skips) {
+		rmap_item->remaining_skips--;
+	} else {
+		/* Visit it this time, and decide how long to skip it for */
+		rmap_item->remaining_skips = skip_age(age);
+		return false;
+	}
+
+	/*
+	 * The rmap_item may still be linked from the previous scan's
+	 * unstable tree: unlink it now, while its seqnr is recent enough.
+	 */
+	remove_rmap_item_from_tree(rmap_item);
+	ksm_pages_skipped++;
+	return true;
+}
+
 static struct rmap_item *scan_get_next_rmap_item(struct page **page)
 {
 	struct mm_struct *mm;
@@ -2308,12 +2388,16 @@ static struct rmap_item *scan_get_next_rmap_item(struct page **page)
 				if (rmap_item) {
 					ksm_scan.rmap_list =
 							&rmap_item->rmap_list;
+					if (should_skip_rmap_item(*page,
+								  rmap_item))
+						goto next_page;
 					ksm_scan.address += PAGE_SIZE;
 				} else
 					put_page(*page);
 				up_read(&mm->mmap_sem);
 				return rmap_item;
 			}
+next_page:
 			put_page(*page);
 			ksm_scan.address += PAGE_SIZE;
 			cond_resched();
@@ -2425,6 +2509,27 @@ static int ksm_scan_thread(void *nothing)
 	return 0;
 }
 
+static bool ksm_compatible(unsigned long vm_flags)
+{
+	/*
+	 * Be somewhat over-protective for now!
+	 */
+	if (vm_flags & (VM_SHARED  | VM_MAYSHARE   | VM_PFNMAP  | VM_IO |
+			VM_DONTEXPAND | VM_HUGETLB | VM_MIXEDMAP))
+		return false;
+
+#ifdef VM_SAO
+	if (vm_flags & VM_SAO)
+		return false;
+#endif
+#ifdef VM_SPARC_ADI
+	if (vm_flags & VM_SPARC_ADI)
+		return false;
+#endif
+
+	return true;
+}
+
 int ksm_madvise(struct vm_area_struct *vma, unsigned long start,
 		unsigned long end, int advice, unsigned long *vm_flags)
 {
@@ -2433,26 +2538,12 @@ int ksm_madvise(struct vm_area_struct *vma, unsigned long start,
 
 	switch (advice) {
 	case MADV_MERGEABLE:
-		/*
-		 * Be somewhat over-protective for now!
-		 */
-		if (*vm_flags & (VM_MERGEABLE | VM_SHARED  | VM_MAYSHARE   |
-				 VM_PFNMAP    | VM_IO      | VM_DONTEXPAND |
-				 VM_HUGETLB | VM_MIXEDMAP))
+		if ((*vm_flags & VM_MERGEABLE) || !ksm_compatible(*vm_flags))
 			return 0;		/* just ignore the advice */
 
 		if (vma_is_dax(vma))
 			return 0;
 
-#ifdef VM_SAO
-		if (*vm_flags & VM_SAO)
-			return 0;
-#endif
-#ifdef VM_SPARC_ADI
-		if (*vm_flags & VM_SPARC_ADI)
-			return 0;
-#endif
-
 		if (!test_bit(MMF_VM_MERGEABLE, &mm->flags)) {
 			err = __ksm_enter(mm);
 			if (err)
@@ -2480,6 +2571,92 @@ int ksm_madvise(struct vm_area_struct *vma, unsigned long start,
 }
 EXPORT_SYMBOL_GPL(ksm_madvise);
 
+/*
+ * PR_SET_MEMORY_MERGE only covers private anonymous mappings, present ones
+ * and those created later alike (see ksm_vma_flags()).  Private file
+ * mappings are left to MADV_MERGEABLE.
+ */
+static bool ksm_merge_any_vma(struct vm_area_struct *vma)
+{
+	return !vma->vm_file;
+}
+
+/**
+ * ksm_enable_merge_any - make all present and future anonymous mappings
+ * of @mm mergeable, as if MADV_MERGEABLE had been applied to each of them
+ * @mm: the mm, with mmap_sem held for write
+ */
+int ksm_enable_merge_any(struct mm_struct *mm)
+{
+	struct vm_area_struct *vma;
+	int err;
+
+	if (test_bit(MMF_VM_MERGE_ANY, &mm->flags))
+		return 0;
+
+	for (vma = mm->mmap; vma; vma = vma->vm_next) {
+		if (!ksm_merge_any_vma(vma))
+			continue;
+		err = ksm_madvise(vma, vma->vm_start, vma->vm_end,
+				  MADV_MERGEABLE, &vma->vm_flags);
+		if (err)
+			return err;
+	}
+
+	set_bit(MMF_VM_MERGE_ANY, &mm->flags);
+	return 0;
+}
+
+/**
+ * ksm_disable_merge_any - undo ksm_enable_merge_any(), unmerging the
+ * pages of all mergeable anonymous mappings of @mm
+ * @mm: the mm, with mmap_sem held for write
+ */
+int ksm_disable_merge_any(struct mm_struct *mm)
+{
+	struct vm_area_struct *vma;
+	int err;
+
+	if (!test_bit(MMF_VM_MERGE_ANY, &mm->flags))
+		return 0;
+
+	clear_bit(MMF_VM_MERGE_ANY, &mm->flags);
+
+	for (vma = mm->mmap; vma; vma = vma->vm_next) {
+		if (!ksm_merge_any_vma(vma))
+			continue;
+		err = ksm_madvise(vma, vma->vm_start, vma->vm_end,
+				  MADV_UNMERGEABLE, &vma->vm_flags);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+/**
+ * ksm_vma_flags - flags for a new anonymous mapping of @mm
+ * @mm: the mm, with mmap_sem held for write
+ * @file: the file being mapped, or NULL
+ * @vm_flags: the flags the mapping is about to be created with
+ *
+ * When the process opted in to merging with PR_SET_MEMORY_MERGE, new
+ * private anonymous mappings are made mergeable right away, so that
+ * they can still be merged with their mergeable neighbours.
+ */
+unsigned long ksm_vma_flags(struct mm_struct *mm, struct file *file,
+			    unsigned long vm_flags)
+{
+	if (!test_bit(MMF_VM_MERGE_ANY, &mm->flags) || file ||
+	    (vm_flags & VM_MERGEABLE) || !ksm_compatible(vm_flags))
+		return vm_flags;
+
+	if (!test_bit(MMF_VM_MERGEABLE, &mm->flags) && __ksm_enter(mm))
+		return vm_flags;
+
+	return vm_flags | VM_MERGEABLE;
+}
+
 int __ksm_enter(struct mm_struct *mm)
 {
 	struct mm_slot *mm_slot;
@@ -2570,7 +2747,7 @@ struct page *ksm_might_need_to_copy(struct page *page,
 	} else if (!anon_vma) {
 		return page;		/* no need to copy it */
 	} else if (anon_vma->root == vma->anon_vma->root &&
-		 page->index == linear_page_index(vma, address)) {
+		 page_to_pgoff(page) == linear_page_index(vma, address)) {
 		return page;		/* still no need to copy it */
 	}
 	if (!PageUptodate(page))
@@ -3018,6 +3195,29 @@ static ssize_t use_zero_pages_store(struct kobject *kobj,
 }
 KSM_ATTR(use_zero_pages);
 
+static ssize_t smart_scan_show(struct kobject *kobj,
+			       struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_smart_scan);
+}
+
+static ssize_t smart_scan_store(struct kobject *kobj,
+				struct kobj_attribute *attr,
+				const char *buf, size_t count)
+{
+	int err;
+	bool value;
+
+	err = kstrtobool(buf, &value);
+	if (err)
+		return -EINVAL;
+
+	ksm_smart_scan = value;
+
+	return count;
+}
+KSM_ATTR(smart_scan);
+
 static ssize_t max_page_sharing_show(struct kobject *kobj,
 				     struct kobj_attribute *attr, char *buf)
 {
@@ -3097,6 +3297,13 @@ static ssize_t pages_volatile_show(struct kobject *kobj,
 }
 KSM_ATTR_RO(pages_volatile);
 
+static ssize_t pages_skipped_show(struct kobject *kobj,
+				  struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_pages_skipped);
+}
+KSM_ATTR_RO(pages_skipped);
+
 static ssize_t stable_node_dups_show(struct kobject *kobj,
 				     struct kobj_attribute *attr, char *buf)
 {
@@ -3152,6 +3359,7 @@ static struct attribute *ksm_attrs[] = {
 	&pages_sharing_attr.attr,
 	&pages_unshared_attr.attr,
 	&pages_volatile_attr.attr,
+	&pages_skipped_attr.attr,
 	&full_scans_attr.attr,
 #ifdef CONFIG_NUMA
 	&merge_across_nodes_attr.attr,
@@ -3161,6 +3369,7 @@ static struct attribute *ksm_attrs[] = {
 	&stable_node_dups_attr.attr,
 	&stable_node_chains_prune_millisecs_attr.attr,
 	&use_zero_pages_attr.attr,
+	&smart_scan_attr.attr,
 	NULL,
 };
 
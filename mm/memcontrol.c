@@ -1388,6 +1388,13 @@ static char *memory_stat_format(struct mem_cgroup *memcg)
 	seq_buf_printf(&s, "sock %llu\n",
 		       (u64)memcg_page_state(memcg, MEMCG_SOCK) *
 		       PAGE_SIZE);
+#ifdef CONFIG_ZSWAP
+	seq_buf_printf(&s, "zswap %llu\n",
+		       (u64)memcg_page_state(memcg, MEMCG_ZSWAP_B));
+	seq_buf_printf(&s, "zswapped %llu\n",
+		       (u64)memcg_page_state(memcg, MEMCG_ZSWAPPED) *
+		       PAGE_SIZE);
+#endif
 
 	seq_buf_printf(&s, "shmem %llu\n",
 		       (u64)memcg_page_state(memcg, NR_SHMEM) *
@@ -2029,9 +2036,13 @@ void unlock_page_memcg(struct page *page)
 }
 EXPORT_SYMBOL(unlock_page_memcg);
 
+/* Number of memcgs whose charges are cached on each cpu */
+#define MEMCG_STOCK_SLOTS	4
+
 struct memcg_stock_pcp {
-	struct mem_cgroup *cached; /* this never be root cgroup */
-	unsigned int nr_pages;
+	struct mem_cgroup *cached[MEMCG_STOCK_SLOTS]; /* never the root cgroup */
+	unsigned int nr_pages[MEMCG_STOCK_SLOTS];
+	unsigned int next_evict;
 	struct work_struct work;
 	unsigned long flags;
 #define FLUSHING_CACHED_CHARGE	0
@@ -2044,9 +2055,9 @@ static DEFINE_MUTEX(percpu_charge_mutex);
  * @memcg: memcg to consume from.
  * @nr_pages: how many pages to charge.
  *
- * The charges will only happen if @memcg matches the current cpu's memcg
- * stock, and at least @nr_pages are available in that stock.  Failure to
- * service an allocation will refill the stock.
+ * The charges will only happen if @memcg is one of the current cpu's
+ * stocked memcgs, and at least @nr_pages are available in its stock.
+ * Failure to service an allocation will refill the stock.
  *
  * returns true if successful, false otherwise.
  */
@@ -2055,6 +2066,7 @@ static bool consume_stock(struct mem_cgroup *memcg, unsigned int nr_pages)
 	struct memcg_stock_pcp *stock;
 	unsigned long flags;
 	bool ret = false;
+	int i;
 
 	if (nr_pages > MEMCG_CHARGE_BATCH)
 		return ret;
@@ -2062,10 +2074,15 @@ static bool consume_stock(struct mem_cgroup *memcg, unsigned int nr_pages)
 	local_irq_save(flags);
 
 	stock = this_cpu_ptr(&memcg_stock);
-	if (memcg == stock->cached && stock->nr_pages >= nr_pages) {
-		stock->nr_pages -= nr_pages;
-		ret = true;
+	for (i = 0; i < MEMCG_STOCK_SLOTS; i++) {
+		if (memcg == stock->cached[i] &&
+		    stock->nr_pages[i] >= nr_pages) {
+			stock->nr_pages[i] -= nr_pages;
+			ret = true;
+			break;
+		}
 	}
+	__count_vm_event(ret ? MEMCG_STOCK_HIT : MEMCG_STOCK_MISS);
 
 	local_irq_restore(flags);
 
@@ -2073,20 +2090,31 @@ static bool consume_stock(struct mem_cgroup *memcg, unsigned int nr_pages)
 }
 
 /*
- * Returns stocks cached in percpu and reset cached information.
+ * Returns the charges stocked for one memcg and resets the slot.
  */
-static void drain_stock(struct memcg_stock_pcp *stock)
+static void drain_stock_slot(struct memcg_stock_pcp *stock, int i)
 {
-	struct mem_cgroup *old = stock->cached;
+	struct mem_cgroup *old = stock->cached[i];
 
-	if (stock->nr_pages) {
-		page_counter_uncharge(&old->memory, stock->nr_pages);
+	if (stock->nr_pages[i]) {
+		page_counter_uncharge(&old->memory, stock->nr_pages[i]);
 		if (do_memsw_account())
-			page_counter_uncharge(&old->memsw, stock->nr_pages);
-		css_put_many(&old->css, stock->nr_pages);
-		stock->nr_pages = 0;
+			page_counter_uncharge(&old->memsw, stock->nr_pages[i]);
+		css_put_many(&old->css, stock->nr_pages[i]);
+		stock->nr_pages[i] = 0;
 	}
-	stock->cached = NULL;
+	stock->cached[i] = NULL;
+}
+
+/*
+ * Returns stocks cached in percpu and reset cached information.
+ */
+static void drain_stock(struct memcg_stock_pcp *stock)
+{
+	int i;
+
+	for (i = 0; i < MEMCG_STOCK_SLOTS; i++)
+		drain_stock_slot(stock, i);
 }
 
 static void drain_local_stock(struct work_struct *dummy)
@@ -2115,18 +2143,35 @@ static void refill_stock(struct mem_cgroup *memcg, unsigned int nr_pages)
 {
 	struct memcg_stock_pcp *stock;
 	unsigned long flags;
+	int i, slot = -1;
 
 	local_irq_save(flags);
 
 	stock = this_cpu_ptr(&memcg_stock);
-	if (stock->cached != memcg) { /* reset if necessary */
-		drain_stock(stock);
-		stock->cached = memcg;
+	for (i = 0; i < MEMCG_STOCK_SLOTS; i++) {
+		if (stock->cached[i] == memcg) {
+			slot = i;
+			break;
+		}
+		/* An empty slot can be reused without draining anything */
+		if (slot < 0 && !stock->nr_pages[i])
+			slot = i;
 	}
-	stock->nr_pages += nr_pages;
+	if (slot < 0) {
+		/* All slots are in use: take them over in turn */
+		slot = stock->next_evict;
+		stock->next_evict = (slot + 1) % MEMCG_STOCK_SLOTS;
+		drain_stock_slot(stock, slot);
+		__count_vm_event(MEMCG_STOCK_DRAIN);
+	}
+	if (stock->cached[slot] != memcg) { /* reset if necessary */
+		drain_stock_slot(stock, slot);
+		stock->cached[slot] = memcg;
+	}
+	stock->nr_pages[slot] += nr_pages;
 
-	if (stock->nr_pages > MEMCG_CHARGE_BATCH)
-		drain_stock(stock);
+	if (stock->nr_pages[slot] > MEMCG_CHARGE_BATCH)
+		drain_stock_slot(stock, slot);
 
 	local_irq_restore(flags);
 }
@@ -2153,12 +2198,15 @@ static void drain_all_stock(struct mem_cgroup *root_memcg)
 		struct memcg_stock_pcp *stock = &per_cpu(memcg_stock, cpu);
 		struct mem_cgroup *memcg;
 		bool flush = false;
+		int i;
 
 		rcu_read_lock();
-		memcg = stock->cached;
-		if (memcg && stock->nr_pages &&
-		    mem_cgroup_is_descendant(memcg, root_memcg))
-			flush = true;
+		for (i = 0; i < MEMCG_STOCK_SLOTS && !flush; i++) {
+			memcg = READ_ONCE(stock->cached[i]);
+			if (memcg && READ_ONCE(stock->nr_pages[i]) &&
+			    mem_cgroup_is_descendant(memcg, root_memcg))
+				flush = true;
+		}
 		rcu_read_unlock();
 
 		if (flush &&
@@ -4977,6 +5025,9 @@ mem_cgroup_css_alloc(struct cgroup_subsys_state *parent_css)
 
 	memcg->high = PAGE_COUNTER_MAX;
 	memcg->soft_limit = PAGE_COUNTER_MAX;
+#ifdef CONFIG_ZSWAP
+	memcg->zswap_max = PAGE_COUNTER_MAX;
+#endif
 	if (parent) {
 		memcg->swappiness = mem_cgroup_swappiness(parent);
 		memcg->oom_kill_disable = parent->oom_kill_disable;
@@ -5130,6 +5181,9 @@ static void mem_cgroup_css_reset(struct cgroup_subsys_state *css)
 	page_counter_set_low(&memcg->memory, 0);
 	memcg->high = PAGE_COUNTER_MAX;
 	memcg->soft_limit = PAGE_COUNTER_MAX;
+#ifdef CONFIG_ZSWAP
+	memcg->zswap_max = PAGE_COUNTER_MAX;
+#endif
 	memcg_wb_domain_size_changed(memcg);
 }
 
@@ -6503,14 +6557,9 @@ static void uncharge_batch(const struct uncharge_gather *ug)
 	unsigned long nr_pages = ug->nr_anon + ug->nr_file + ug->nr_kmem;
 	unsigned long flags;
 
-	if (!mem_cgroup_is_root(ug->memcg)) {
-		page_counter_uncharge(&ug->memcg->memory, nr_pages);
-		if (do_memsw_account())
-			page_counter_uncharge(&ug->memcg->memsw, nr_pages);
-		if (!cgroup_subsys_on_dfl(memory_cgrp_subsys) && ug->nr_kmem)
-			page_counter_uncharge(&ug->memcg->kmem, ug->nr_kmem);
-		memcg_oom_recover(ug->memcg);
-	}
+	if (!mem_cgroup_is_root(ug->memcg) &&
+	    !cgroup_subsys_on_dfl(memory_cgrp_subsys) && ug->nr_kmem)
+		page_counter_uncharge(&ug->memcg->kmem, ug->nr_kmem);
 
 	local_irq_save(flags);
 	__mod_memcg_state(ug->memcg, MEMCG_RSS, -ug->nr_anon);
@@ -6522,8 +6571,28 @@ static void uncharge_batch(const struct uncharge_gather *ug)
 	memcg_check_events(ug->memcg, ug->dummy_page);
 	local_irq_restore(flags);
 
-	if (!mem_cgroup_is_root(ug->memcg))
-		css_put_many(&ug->memcg->css, nr_pages);
+	if (mem_cgroup_is_root(ug->memcg))
+		return;
+
+	/*
+	 * Pages freed in batches, like on unmap or truncate, are usually
+	 * charged again soon by the same memcg on this cpu: keep the charge
+	 * and its css references in the stock, and spare the page counter
+	 * atomics both ways.  Not when someone waits for the memcg to get
+	 * below its limit, though, nor for an offline memcg: it won't charge
+	 * again, and the stock would pin it until the cpu drains.
+	 */
+	if (nr_pages <= MEMCG_CHARGE_BATCH && mem_cgroup_online(ug->memcg) &&
+	    !READ_ONCE(ug->memcg->under_oom)) {
+		refill_stock(ug->memcg, nr_pages);
+		return;
+	}
+
+	page_counter_uncharge(&ug->memcg->memory, nr_pages);
+	if (do_memsw_account())
+		page_counter_uncharge(&ug->memcg->memsw, nr_pages);
+	memcg_oom_recover(ug->memcg);
+	css_put_many(&ug->memcg->css, nr_pages);
 }
 
 static void uncharge_page(struct page *page, struct uncharge_gather *ug)
@@ -7168,3 +7237,112 @@ static int __init mem_cgroup_swap_init(void)
 subsys_initcall(mem_cgroup_swap_init);
 
 #endif /* CONFIG_MEMCG_SWAP */
+
+#ifdef CONFIG_ZSWAP
+/**
+ * mem_cgroup_may_zswap - check if a cgroup can store more in zswap
+ * @memcg: the cgroup the page being swapped out belongs to
+ *
+ * Returns false if @memcg or any of its ancestors is at or above its
+ * memory.zswap.max, in which case the page should go straight to the
+ * swap device instead of being compressed.
+ */
+bool mem_cgroup_may_zswap(struct mem_cgroup *memcg)
+{
+	if (mem_cgroup_disabled() || !cgroup_subsys_on_dfl(memory_cgrp_subsys))
+		return true;
+
+	for (; memcg != root_mem_cgroup; memcg = parent_mem_cgroup(memcg)) {
+		unsigned long max = READ_ONCE(memcg->zswap_max);
+
+		if (max == PAGE_COUNTER_MAX)
+			continue;
+		if (memcg_page_state(memcg, MEMCG_ZSWAP_B) >= max * PAGE_SIZE)
+			return false;
+	}
+	return true;
+}
+
+/**
+ * mem_cgroup_charge_zswap - account a compressed page stored in zswap
+ * @memcg: the cgroup the compressed page belongs to
+ * @size: size of the compressed data in bytes
+ */
+void mem_cgroup_charge_zswap(struct mem_cgroup *memcg, size_t size)
+{
+	if (mem_cgroup_disabled())
+		return;
+
+	mod_memcg_state(memcg, MEMCG_ZSWAP_B, size);
+	mod_memcg_state(memcg, MEMCG_ZSWAPPED, 1);
+}
+
+/**
+ * mem_cgroup_uncharge_zswap - unaccount a compressed page freed from zswap
+ * @memcg: the cgroup the compressed page belongs to
+ * @size: size of the compressed data in bytes
+ */
+void mem_cgroup_uncharge_zswap(struct mem_cgroup *memcg, size_t size)
+{
+	if (mem_cgroup_disabled())
+		return;
+
+	mod_memcg_state(memcg, MEMCG_ZSWAP_B, -(long)size);
+	mod_memcg_state(memcg, MEMCG_ZSWAPPED, -1);
+}
+
+static u64 zswap_current_read(struct cgroup_subsys_state *css,
+			      struct cftype *cft)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_css(css);
+
+	return (u64)memcg_page_state(memcg, MEMCG_ZSWAP_B);
+}
+
+static int zswap_max_show(struct seq_file *m, void *v)
+{
+	return seq_puts_memcg_tunable(m,
+		READ_ONCE(mem_cgroup_from_seq(m)->zswap_max));
+}
+
+static ssize_t zswap_max_write(struct kernfs_open_file *of,
+			       char *buf, size_t nbytes, loff_t off)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_css(of_css(of));
+	unsigned long max;
+	int err;
+
+	buf = strstrip(buf);
+	err = page_counter_memparse(buf, "max", &max);
+	if (err)
+		return err;
+
+	xchg(&memcg->zswap_max, max);
+
+	return nbytes;
+}
+
+static struct cftype zswap_files[] = {
+	{
+		.name = "zswap.current",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.read_u64 = zswap_current_read,
+	},
+	{
+		.name = "zswap.max",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.seq_show = zswap_max_show,
+		.write = zswap_max_write,
+	},
+	{ }	/* terminate */
+};
+
+static int __init mem_cgroup_zswap_init(void)
+{
+	if (!mem_cgroup_disabled())
+		WARN_ON(cgroup_add_dfl_cftypes(&memory_cgrp_subsys,
+					       zswap_files));
+	return 0;
+}
+subsys_initcall(mem_cgroup_zswap_init);
+#endif /* CONFIG_ZSWAP */
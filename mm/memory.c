@@ -694,8 +694,8 @@ struct page *vm_normal_page_pmd(struct vm_area_struct *vma, unsigned long addr,
 
 static inline unsigned long
 copy_one_pte(struct mm_struct *dst_mm, struct mm_struct *src_mm,
-		pte_t *dst_pte, pte_t *src_pte, struct vm_area_struct *vma,
-		unsigned long addr, int *rss)
+		pte_t *dst_pte, pte_t *src_pte, struct vm_area_struct *dst_vma,
+		struct vm_area_struct *vma, unsigned long addr, int *rss)
 {
 	unsigned long vm_flags = vma->vm_flags;
 	pte_t pte = *src_pte;
@@ -733,6 +733,8 @@ copy_one_pte(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 				pte = swp_entry_to_pte(entry);
 				if (pte_swp_soft_dirty(*src_pte))
 					pte = pte_swp_mksoft_dirty(pte);
+				if (pte_swp_uffd_wp(*src_pte))
+					pte = pte_swp_mkuffd_wp(pte);
 				set_pte_at(src_mm, addr, src_pte, pte);
 			}
 		} else if (is_device_private_entry(entry)) {
@@ -765,6 +767,9 @@ copy_one_pte(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 				set_pte_at(src_mm, addr, src_pte, pte);
 			}
 		}
+		/* see below */
+		if (!userfaultfd_wp(dst_vma))
+			pte = pte_swp_clear_uffd_wp(pte);
 		goto out_set_pte;
 	}
 
@@ -785,6 +790,14 @@ copy_one_pte(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 		pte = pte_mkclean(pte);
 	pte = pte_mkold(pte);
 
+	/*
+	 * The child only keeps userfaultfd write protection if its vma is
+	 * still registered for it: dup_userfaultfd() drops the registration
+	 * unless the context asked for fork events.
+	 */
+	if (!userfaultfd_wp(dst_vma))
+		pte = pte_clear_uffd_wp(pte);
+
 	page = vm_normal_page(vma, addr, pte);
 	if (page) {
 		get_page(page);
@@ -800,8 +813,9 @@ copy_one_pte(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 }
 
 static int copy_pte_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
-		   pmd_t *dst_pmd, pmd_t *src_pmd, struct vm_area_struct *vma,
-		   unsigned long addr, unsigned long end)
+		   pmd_t *dst_pmd, pmd_t *src_pmd, struct vm_area_struct *dst_vma,
+		   struct vm_area_struct *vma, unsigned long addr,
+		   unsigned long end)
 {
 	pte_t *orig_src_pte, *orig_dst_pte;
 	pte_t *src_pte, *dst_pte;
@@ -839,7 +853,7 @@ static int copy_pte_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 			continue;
 		}
 		entry.val = copy_one_pte(dst_mm, src_mm, dst_pte, src_pte,
-							vma, addr, rss);
+					 dst_vma, vma, addr, rss);
 		if (entry.val)
 			break;
 		progress += 8;
@@ -862,9 +876,338 @@ static int copy_pte_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 	return 0;
 }
 
-static inline int copy_pmd_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
-		pud_t *dst_pud, pud_t *src_pud, struct vm_area_struct *vma,
+#ifdef CONFIG_LAZY_FORK
+/*
+ * Lazy fork.  Instead of copying the PTE tables of its private anonymous
+ * memory, the child of a process that set PR_SET_LAZY_FORK shares them with
+ * its parent.  Only tables mapping nothing but a single vma are shared, and
+ * by two mms at most: the owner, whose rss accounts for what the table maps,
+ * and the sharer.  Both PMD entries are write protected, so the hardware
+ * catches writes through either mm.
+ *
+ * Before the first fault through a shared table, and before anything else
+ * changes its entries on behalf of one of the mms, that mm gets a copy of the
+ * table made like fork would have made it.  Reverse map walks skip shared
+ * tables: until the tables are unshared, the pages they map are neither
+ * reclaimed nor migrated, so compaction, CMA, memory offlining and hwpoison
+ * handling fail on them.  The sharing state lives in the table's struct
+ * page, under the table's split ptlock which both mms use.
+ */
+
+static void lazy_fork_mmlist(struct mm_struct *mm, struct mm_struct *from)
+{
+	/* make sure mm is on swapoff's mmlist if from is. */
+	if (unlikely(list_empty(&mm->mmlist)) && !list_empty(&from->mmlist)) {
+		spin_lock(&mmlist_lock);
+		if (list_empty(&mm->mmlist))
+			list_add(&mm->mmlist, &from->mmlist);
+		spin_unlock(&mmlist_lock);
+	}
+}
+
+static void lazy_fork_move_rss(struct mm_struct *to, struct mm_struct *from,
+			       int *rss)
+{
+	int i;
+
+	for (i = 0; i < NR_MM_COUNTERS; i++) {
+		if (rss[i]) {
+			add_mm_counter(to, i, rss[i]);
+			add_mm_counter(from, i, -rss[i]);
+		}
+	}
+}
+
+/* Count what a PTE table maps the way zap_pte_range() would */
+static void lazy_fork_table_rss(struct vm_area_struct *vma, pmd_t *pmd,
+				unsigned long addr, int *rss)
+{
+	unsigned long end = addr + PMD_SIZE;
+	pte_t *start_pte, *pte;
+	struct page *page;
+	swp_entry_t entry;
+
+	start_pte = pte = pte_offset_map(pmd, addr);
+	for (; addr != end; pte++, addr += PAGE_SIZE) {
+		if (pte_none(*pte))
+			continue;
+		if (pte_present(*pte)) {
+			page = vm_normal_page(vma, addr, *pte);
+			if (page)
+				rss[mm_counter(page)]++;
+			continue;
+		}
+		entry = pte_to_swp_entry(*pte);
+		if (!non_swap_entry(entry))
+			rss[MM_SWAPENTS]++;
+		else if (is_migration_entry(entry))
+			rss[mm_counter(migration_entry_to_page(entry))]++;
+		else if (is_device_private_entry(entry))
+			rss[mm_counter(device_private_entry_to_page(entry))]++;
+	}
+	pte_unmap(start_pte);
+}
+
+/* Drop the references copy_one_pte() took for the first nr entries */
+static void lazy_fork_copy_undo(struct vm_area_struct *vma, pte_t *pte,
+				unsigned long addr, int nr)
+{
+	struct page *page;
+	swp_entry_t entry;
+
+	for (; nr--; pte++, addr += PAGE_SIZE) {
+		if (pte_none(*pte))
+			continue;
+		if (pte_present(*pte)) {
+			page = vm_normal_page(vma, addr, *pte);
+		} else {
+			entry = pte_to_swp_entry(*pte);
+			if (!non_swap_entry(entry)) {
+				swap_free(entry);
+				continue;
+			}
+			if (!is_device_private_entry(entry))
+				continue;
+			page = device_private_entry_to_page(entry);
+		}
+		if (page) {
+			page_remove_rmap(page, false);
+			put_page(page);
+		}
+	}
+}
+
+/*
+ * Share the PTE table src_pmd points to with dst_mm instead of copying it,
+ * if src_mm asked for that and the table maps nothing outside of vma.
+ */
+static bool lazy_fork_share(struct mm_struct *dst_mm, struct mm_struct *src_mm,
+		pmd_t *dst_pmd, pmd_t *src_pmd, struct vm_area_struct *vma,
+		unsigned long addr, unsigned long end)
+{
+	struct page *table;
+	spinlock_t *ptl;
+
+	/* Both mms must serialize on the same lock */
+	if (!USE_SPLIT_PTE_PTLOCKS || !test_bit(MMF_LAZY_FORK, &src_mm->flags))
+		return false;
+	if (!vma_is_anonymous(vma) || !is_cow_mapping(vma->vm_flags))
+		return false;
+	/* userfaultfd write protection is tracked per mm in the ptes */
+	if (userfaultfd_wp(vma))
+		return false;
+	if ((addr & ~PMD_MASK) || end - addr != PMD_SIZE)
+		return false;
+
+	table = pmd_page(*src_pmd);
+	ptl = pte_lockptr(src_mm, src_pmd);
+	spin_lock(ptl);
+	if (table->pt_sharer) {
+		/* Already shared with an earlier child */
+		spin_unlock(ptl);
+		return false;
+	}
+	table->pt_mm = src_mm;
+	table->pt_sharer = dst_mm;
+	set_pmd(src_pmd, pmd_wrprotect(*src_pmd));
+	pmd_populate(dst_mm, dst_pmd, table);
+	set_pmd(dst_pmd, pmd_wrprotect(*dst_pmd));
+	mm_inc_nr_ptes(dst_mm);
+	spin_unlock(ptl);
+
+	/* dup_mmap() flushes the TLB of src_mm once it is done */
+	return true;
+}
+
+/**
+ * pte_table_unshare - give an mm its own copy of a lazily shared PTE table
+ * @vma: vma the caller is about to change the page tables of
+ * @pmd: PMD entry pointing to the table
+ * @addr: address inside the PMD range
+ *
+ * Must be called with mmap_sem held before anything changes the entries of,
+ * or replaces, the PTE table @pmd points to if pmd_lazy_shared() says it may
+ * be shared.  If the other mm is done with the table, @pmd is just made
+ * writable again.
+ *
+ * Return: 0 on success, -ENOMEM if the copy could not be allocated.
+ */
+int pte_table_unshare(struct vm_area_struct *vma, pmd_t *pmd,
+		      unsigned long addr)
+{
+	struct mm_struct *mm = vma->vm_mm, *rss_mm;
+	unsigned long start = addr & PMD_MASK;
+	int rss[NR_MM_COUNTERS];
+	pte_t *src_pte, *dst_pte;
+	struct page *table;
+	swp_entry_t entry;
+	spinlock_t *ptl;
+	pgtable_t new;
+	pmd_t pmdval;
+	int i;
+
+	new = pte_alloc_one(mm);
+	if (!new)
+		return -ENOMEM;
+again:
+	pmdval = READ_ONCE(*pmd);
+	if (!pmd_lazy_shared(pmdval)) {
+		pte_free(mm, new);
+		return 0;
+	}
+	table = pmd_page(pmdval);
+	ptl = pte_lockptr(mm, &pmdval);
+	spin_lock(ptl);
+	if (unlikely(!pmd_same(*pmd, pmdval))) {
+		spin_unlock(ptl);
+		goto again;
+	}
+
+	if (!table->pt_sharer) {
+		/* The other mm is done with the table: it is ours again */
+		set_pmd(pmd, pmd_mkwrite(pmdval));
+		spin_unlock(ptl);
+		pte_free(mm, new);
+		return 0;
+	}
+
+	/*
+	 * The copy's rss goes to us, unless we own the table: then the
+	 * sharer keeps it and takes over its rss.
+	 */
+	rss_mm = table->pt_mm == mm ? table->pt_sharer : mm;
+	init_rss_vec(rss);
+	src_pte = pte_offset_map(&pmdval, start);
+	dst_pte = (pte_t *)page_address(new);
+	for (i = 0; i < PTRS_PER_PTE; i++) {
+		if (pte_none(src_pte[i]))
+			continue;
+		entry.val = copy_one_pte(mm, mm, &dst_pte[i], &src_pte[i],
+					 vma, vma, start + i * PAGE_SIZE, rss);
+		if (unlikely(entry.val)) {
+			/* We hold the ptl: no sleeping allocation here */
+			if (add_swap_count_continuation(entry, GFP_ATOMIC) < 0)
+				goto nomem;
+			i--;
+		}
+	}
+	pte_unmap(src_pte);
+
+	add_mm_rss_vec(rss_mm, rss);
+	if (rss_mm != mm) {
+		lazy_fork_mmlist(rss_mm, mm);
+		table->pt_mm = rss_mm;
+	}
+	table->pt_sharer = NULL;
+
+	smp_wmb(); /* See comment in __pte_alloc() */
+	pmd_populate(mm, pmd, new);
+	flush_tlb_range(vma, start, start + PMD_SIZE);
+	spin_unlock(ptl);
+	return 0;
+
+nomem:
+	lazy_fork_copy_undo(vma, dst_pte, start, i);
+	pte_unmap(src_pte);
+	spin_unlock(ptl);
+	pte_free(mm, new);
+	return -ENOMEM;
+}
+
+/*
+ * Called with the PTE lock @ptl of a table @pmd pointed to: whether that
+ * table is shared with another mm whose rss accounts for it, or has been
+ * unshared since.  Either way, the caller must leave it alone.
+ */
+bool pte_table_foreign(struct mm_struct *mm, pmd_t *pmd, spinlock_t *ptl)
+{
+	pmd_t pmdval = READ_ONCE(*pmd);
+	struct page *table = pmd_page(pmdval);
+
+	if (!pmd_present(pmdval) || pte_lockptr(mm, &pmdval) != ptl)
+		return true;
+	return table->pt_sharer && table->pt_mm != mm;
+}
+
+/*
+ * Unmapping a whole PMD range, or the whole mm, drops a shared PTE table
+ * from the mm's page tables instead of zapping it.  Returns false if the
+ * table must be zapped like any other.
+ */
+static bool zap_lazy_pte_table(struct mmu_gather *tlb,
+		struct vm_area_struct *vma, pmd_t *pmd,
 		unsigned long addr, unsigned long end)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long start = addr & PMD_MASK;
+	int rss[NR_MM_COUNTERS];
+	struct page *table;
+	spinlock_t *ptl;
+	pmd_t pmdval;
+
+	/*
+	 * A partial unmap zaps a private copy instead.  Only oom victims
+	 * fail to allocate one, and the oom reaper must not even try: they
+	 * can do with losing the rest of the PMD range.
+	 */
+	if (!tlb->fullmm && end - addr != PMD_SIZE &&
+	    !test_bit(MMF_UNSTABLE, &mm->flags) &&
+	    !pte_table_unshare(vma, pmd, addr))
+		return false;
+again:
+	pmdval = READ_ONCE(*pmd);
+	if (!pmd_lazy_shared(pmdval))
+		return false;
+	table = pmd_page(pmdval);
+	ptl = pte_lockptr(mm, &pmdval);
+	spin_lock(ptl);
+	if (unlikely(!pmd_same(*pmd, pmdval))) {
+		spin_unlock(ptl);
+		goto again;
+	}
+
+	if (!table->pt_sharer) {
+		set_pmd(pmd, pmd_mkwrite(pmdval));
+		spin_unlock(ptl);
+		return false;
+	}
+
+	if (table->pt_mm == mm) {
+		/* Leave the table, and the rss for it, to the sharer */
+		init_rss_vec(rss);
+		lazy_fork_table_rss(vma, &pmdval, start, rss);
+		lazy_fork_move_rss(table->pt_sharer, mm, rss);
+		lazy_fork_mmlist(table->pt_sharer, mm);
+		table->pt_mm = table->pt_sharer;
+	}
+	table->pt_sharer = NULL;
+
+	pmd_clear(pmd);
+	mm_dec_nr_ptes(mm);
+	flush_tlb_range(vma, start, start + PMD_SIZE);
+	spin_unlock(ptl);
+	return true;
+}
+#else
+static inline bool lazy_fork_share(struct mm_struct *dst_mm,
+		struct mm_struct *src_mm, pmd_t *dst_pmd, pmd_t *src_pmd,
+		struct vm_area_struct *vma, unsigned long addr,
+		unsigned long end)
+{
+	return false;
+}
+
+static inline bool zap_lazy_pte_table(struct mmu_gather *tlb,
+		struct vm_area_struct *vma, pmd_t *pmd,
+		unsigned long addr, unsigned long end)
+{
+	return false;
+}
+#endif /* CONFIG_LAZY_FORK */
+
+static inline int copy_pmd_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
+		pud_t *dst_pud, pud_t *src_pud, struct vm_area_struct *dst_vma,
+		struct vm_area_struct *vma, unsigned long addr, unsigned long end)
 {
 	pmd_t *src_pmd, *dst_pmd;
 	unsigned long next;
@@ -889,16 +1232,19 @@ static inline int copy_pmd_range(struct mm_struct *dst_mm, struct mm_struct *src
 		}
 		if (pmd_none_or_clear_bad(src_pmd))
 			continue;
+		if (lazy_fork_share(dst_mm, src_mm, dst_pmd, src_pmd,
+				    vma, addr, next))
+			continue;
 		if (copy_pte_range(dst_mm, src_mm, dst_pmd, src_pmd,
-						vma, addr, next))
+						dst_vma, vma, addr, next))
 			return -ENOMEM;
 	} while (dst_pmd++, src_pmd++, addr = next, addr != end);
 	return 0;
 }
 
 static inline int copy_pud_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
-		p4d_t *dst_p4d, p4d_t *src_p4d, struct vm_area_struct *vma,
-		unsigned long addr, unsigned long end)
+		p4d_t *dst_p4d, p4d_t *src_p4d, struct vm_area_struct *dst_vma,
+		struct vm_area_struct *vma, unsigned long addr, unsigned long end)
 {
 	pud_t *src_pud, *dst_pud;
 	unsigned long next;
@@ -924,15 +1270,15 @@ static inline int copy_pud_range(struct mm_struct *dst_mm, struct mm_struct *src
 		if (pud_none_or_clear_bad(src_pud))
 			continue;
 		if (copy_pmd_range(dst_mm, src_mm, dst_pud, src_pud,
-						vma, addr, next))
+						dst_vma, vma, addr, next))
 			return -ENOMEM;
 	} while (dst_pud++, src_pud++, addr = next, addr != end);
 	return 0;
 }
 
 static inline int copy_p4d_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
-		pgd_t *dst_pgd, pgd_t *src_pgd, struct vm_area_struct *vma,
-		unsigned long addr, unsigned long end)
+		pgd_t *dst_pgd, pgd_t *src_pgd, struct vm_area_struct *dst_vma,
+		struct vm_area_struct *vma, unsigned long addr, unsigned long end)
 {
 	p4d_t *src_p4d, *dst_p4d;
 	unsigned long next;
@@ -946,14 +1292,14 @@ static inline int copy_p4d_range(struct mm_struct *dst_mm, struct mm_struct *src
 		if (p4d_none_or_clear_bad(src_p4d))
 			continue;
 		if (copy_pud_range(dst_mm, src_mm, dst_p4d, src_p4d,
-						vma, addr, next))
+						dst_vma, vma, addr, next))
 			return -ENOMEM;
 	} while (dst_p4d++, src_p4d++, addr = next, addr != end);
 	return 0;
 }
 
 int copy_page_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
-		struct vm_area_struct *vma)
+		struct vm_area_struct *dst_vma, struct vm_area_struct *vma)
 {
 	pgd_t *src_pgd, *dst_pgd;
 	unsigned long next;
@@ -1008,7 +1354,7 @@ int copy_page_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 		if (pgd_none_or_clear_bad(src_pgd))
 			continue;
 		if (unlikely(copy_p4d_range(dst_mm, src_mm, dst_pgd, src_pgd,
-					    vma, addr, next))) {
+					    dst_vma, vma, addr, next))) {
 			ret = -ENOMEM;
 			break;
 		}
@@ -1181,6 +1527,9 @@ static inline unsigned long zap_pmd_range(struct mmu_gather *tlb,
 		 */
 		if (pmd_none_or_trans_huge_or_clear_bad(pmd))
 			goto next;
+		if (unlikely(pmd_lazy_shared(*pmd)) &&
+		    zap_lazy_pte_table(tlb, vma, pmd, addr, next))
+			goto next;
 		next = zap_pte_range(tlb, vma, pmd, addr, next, details);
 next:
 		cond_resched();
@@ -2697,6 +3046,11 @@ static vm_fault_t do_wp_page(struct vm_fault *vmf)
 {
 	struct vm_area_struct *vma = vmf->vma;
 
+	if (userfaultfd_pte_wp(vma, *vmf->pte)) {
+		pte_unmap_unlock(vmf->pte, vmf->ptl);
+		return handle_userfault(vmf, VM_UFFD_WP);
+	}
+
 	vmf->page = vm_normal_page(vma, vmf->address, vmf->orig_pte);
 	if (!vmf->page) {
 		/*
@@ -2919,7 +3273,11 @@ vm_fault_t do_swap_page(struct vm_fault *vmf)
 	if (!page) {
 		struct swap_info_struct *si = swp_swap_info(entry);
 
-		if (si->flags & SWP_SYNCHRONOUS_IO &&
+		/* A THP swapped out in one piece comes back in one piece */
+		page = swapin_thp(entry, vmf);
+		if (page) {
+			swapcache = page;
+		} else if (si->flags & SWP_SYNCHRONOUS_IO &&
 				__swap_count(entry) == 1) {
 			/* skip swapcache */
 			page = alloc_page_vma(GFP_HIGHUSER_MOVABLE, vma,
@@ -3030,6 +3388,10 @@ vm_fault_t do_swap_page(struct vm_fault *vmf)
 	flush_icache_page(vma, page);
 	if (pte_swp_soft_dirty(vmf->orig_pte))
 		pte = pte_mksoft_dirty(pte);
+	if (pte_swp_uffd_wp(vmf->orig_pte)) {
+		pte = pte_mkuffd_wp(pte);
+		pte = pte_wrprotect(pte);
+	}
 	set_pte_at(vma->vm_mm, vmf->address, vmf->pte, pte);
 	arch_do_swap_page(vma->vm_mm, vma, vmf->address, pte, vmf->orig_pte);
 	vmf->orig_pte = pte;
@@ -3627,8 +3989,12 @@ static vm_fault_t do_read_fault(struct vm_fault *vmf)
 	 * Let's call ->map_pages() first and use ->fault() as fallback
 	 * if page by the offset is not ready to be mapped (cold cache or
 	 * something).
+	 *
+	 * Fault-around would map cached pages without ->fault() ever seeing
+	 * them, so skip it when minor faults must go to userfaultfd.
 	 */
-	if (vma->vm_ops->map_pages && fault_around_bytes >> PAGE_SHIFT > 1) {
+	if (vma->vm_ops->map_pages && fault_around_bytes >> PAGE_SHIFT > 1 &&
+	    !userfaultfd_minor(vma)) {
 		ret = do_fault_around(vmf);
 		if (ret)
 			return ret;
@@ -4124,6 +4490,10 @@ static vm_fault_t __handle_mm_fault(struct vm_area_struct *vma,
 		}
 	}
 
+	if (unlikely(pmd_lazy_shared(*vmf.pmd)) &&
+	    pte_table_unshare(vma, vmf.pmd, address))
+		return VM_FAULT_OOM;
+
 	return handle_pte_fault(&vmf);
 }
 
@@ -266,6 +266,9 @@ unsigned long move_page_tables(struct vm_area_struct *vma,
 		new_pmd = alloc_new_pmd(vma->vm_mm, vma, new_addr);
 		if (!new_pmd)
 			break;
+		if (unlikely(pmd_lazy_shared(*old_pmd)) &&
+		    pte_table_unshare(vma, old_pmd, old_addr))
+			break;
 		if (is_swap_pmd(*old_pmd) || pmd_trans_huge(*old_pmd)) {
 			if (extent == HPAGE_PMD_SIZE) {
 				bool moved;
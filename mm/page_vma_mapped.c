@@ -60,6 +60,31 @@ static inline bool pfn_in_hpage(struct page *hpage, unsigned long pfn)
 	return pfn >= hpage_pfn && pfn - hpage_pfn < hpage_nr_pages(hpage);
 }
 
+#ifdef CONFIG_LAZY_FORK
+/*
+ * Reverse map walks leave PTE tables shared by lazy fork alone, except to
+ * remove migration entries, which the table maps for both mms alike.  With
+ * the PTE lock held, also catch the table having been unshared or dropped
+ * from the mm while we were getting there.
+ */
+static bool pte_table_skip(struct page_vma_mapped_walk *pvmw)
+{
+	pmd_t pmde = READ_ONCE(*pvmw->pmd);
+	struct page *table = pmd_page(pmde);
+
+	if (!pmd_present(pmde) || pmd_trans_huge(pmde) ||
+	    virt_to_page(pvmw->pte) != table ||
+	    pte_lockptr(pvmw->vma->vm_mm, &pmde) != pvmw->ptl)
+		return true;
+	return table->pt_sharer && !(pvmw->flags & PVMW_MIGRATION);
+}
+#else
+static inline bool pte_table_skip(struct page_vma_mapped_walk *pvmw)
+{
+	return false;
+}
+#endif
+
 /**
  * check_pte - check if @pvmw->page is mapped at the @pvmw->pte
  *
@@ -82,6 +107,9 @@ static bool check_pte(struct page_vma_mapped_walk *pvmw)
 {
 	unsigned long pfn;
 
+	if (pvmw->pmd && pte_table_skip(pvmw))
+		return false;
+
 	if (pvmw->flags & PVMW_MIGRATION) {
 		swp_entry_t entry;
 		if (!is_swap_pte(*pvmw->pte))
@@ -186,6 +186,10 @@ pgtable_t pgtable_trans_huge_withdraw(struct mm_struct *mm, pmd_t *pmdp)
 							  struct page, lru);
 	if (pmd_huge_pte(mm, pmdp))
 		list_del(&pgtable->lru);
+#ifdef CONFIG_LAZY_FORK
+	/* lru.prev overlays pt_sharer; a withdrawn table is never shared */
+	pgtable->pt_sharer = NULL;
+#endif
 	return pgtable;
 }
 #endif
@@ -753,10 +753,12 @@ pmd_t *mm_find_pmd(struct mm_struct *mm, unsigned long address)
 	 * Some THP functions use the sequence pmdp_huge_clear_flush(), set_pmd_at()
 	 * without holding anon_vma lock for write.  So when looking for a
 	 * genuine pmde (in which to find pte), test present and !THP together.
+	 * Callers change the ptes they find: skip tables lazy fork may share.
 	 */
 	pmde = *pmd;
 	barrier();
-	if (!pmd_present(pmde) || pmd_trans_huge(pmde))
+	if (!pmd_present(pmde) || pmd_trans_huge(pmde) ||
+	    pmd_lazy_shared(pmde))
 		pmd = NULL;
 out:
 	return pmd;
@@ -1092,6 +1094,30 @@ static void __page_check_anon_rmap(struct page *page,
 		       page);
 }
 
+#ifdef CONFIG_THP_SWAP
+/**
+ * page_set_anon_rmap_swapin - set up the anon rmap of a THP read from swap
+ * @page:	the locked, not yet mapped THP in the swap cache
+ * @vma:	the vm area the THP is going to be mapped in
+ * @address:	the user virtual address of the head page
+ *
+ * do_swap_page() maps the subpages of a THP found in the swap cache one
+ * pte at a time, which relies on the anon rmap of the THP being set up
+ * already, as it is for a THP still in the swap cache after swapout.
+ * Do the same for a THP swapped in as a whole by swapin_thp().
+ */
+void page_set_anon_rmap_swapin(struct page *page,
+	struct vm_area_struct *vma, unsigned long address)
+{
+	VM_BUG_ON_PAGE(!PageLocked(page), page);
+	VM_BUG_ON_PAGE(!PageTransHuge(page), page);
+	VM_BUG_ON_PAGE(page_mapped(page), page);
+
+	/* the swap entries may still be shared with other processes */
+	__page_set_anon_rmap(page, vma, address, 0);
+}
+#endif
+
 /**
  * page_add_anon_rmap - add pte mapping to an anonymous page
  * @page:	the page to add the mapping to
@@ -1497,6 +1523,8 @@ static bool try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
 			swp_pte = swp_entry_to_pte(entry);
 			if (pte_soft_dirty(pteval))
 				swp_pte = pte_swp_mksoft_dirty(swp_pte);
+			if (pte_uffd_wp(pteval))
+				swp_pte = pte_swp_mkuffd_wp(swp_pte);
 			set_pte_at(mm, pvmw.address, pvmw.pte, swp_pte);
 			/*
 			 * No need to invalidate here it will synchronize on
@@ -1596,6 +1624,8 @@ static bool try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
 			swp_pte = swp_entry_to_pte(entry);
 			if (pte_soft_dirty(pteval))
 				swp_pte = pte_swp_mksoft_dirty(swp_pte);
+			if (pte_uffd_wp(pteval))
+				swp_pte = pte_swp_mkuffd_wp(swp_pte);
 			set_pte_at(mm, address, pvmw.pte, swp_pte);
 			/*
 			 * No need to invalidate here it will synchronize on
@@ -1662,6 +1692,8 @@ static bool try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
 			swp_pte = swp_entry_to_pte(entry);
 			if (pte_soft_dirty(pteval))
 				swp_pte = pte_swp_mksoft_dirty(swp_pte);
+			if (pte_uffd_wp(pteval))
+				swp_pte = pte_swp_mkuffd_wp(swp_pte);
 			set_pte_at(mm, address, pvmw.pte, swp_pte);
 			/* Invalidate as we cleared the pte */
 			mmu_notifier_invalidate_range(mm, address,
@@ -1769,6 +1769,20 @@ static int shmem_getpage_gfp(struct inode *inode, pgoff_t index,
 	charge_mm = vma ? vma->vm_mm : current->mm;
 
 	page = find_lock_entry(mapping, index);
+
+	/*
+	 * The page exists (possibly swapped out) but is not mapped
+	 * here: a minor fault for userfaultfd to resolve.
+	 */
+	if (page && vma && userfaultfd_minor(vma)) {
+		if (!xa_is_value(page)) {
+			unlock_page(page);
+			put_page(page);
+		}
+		*fault_type = handle_userfault(vmf, VM_UFFD_MINOR);
+		return 0;
+	}
+
 	if (xa_is_value(page)) {
 		error = shmem_swapin_page(inode, index, &page,
 					  sgp, gfp, vma, fault_type);
@@ -2301,6 +2301,12 @@ static void put_cpu_partial(struct kmem_cache *s, struct page *page, int drain)
 #endif	/* CONFIG_SLUB_CPU_PARTIAL */
 }
 
+static void *cpu_array_alloc(struct kmem_cache *s, gfp_t gfpflags);
+static bool cpu_array_free(struct kmem_cache *s, struct page *page,
+			   void *object);
+static void cpu_array_flush(struct kmem_cache *s,
+			    struct kmem_cache_cpu_array *ca, unsigned int nr);
+
 static inline void flush_slab(struct kmem_cache *s, struct kmem_cache_cpu *c)
 {
 	stat(s, CPUSLAB_FLUSH);
@@ -2318,6 +2324,12 @@ static inline void __flush_cpu_slab(struct kmem_cache *s, int cpu)
 {
 	struct kmem_cache_cpu *c = per_cpu_ptr(s->cpu_slab, cpu);
 
+	if (s->cpu_array) {
+		struct kmem_cache_cpu_array *ca = per_cpu_ptr(s->cpu_array, cpu);
+
+		cpu_array_flush(s, ca, ca->count);
+	}
+
 	if (c->page)
 		flush_slab(s, c);
 
@@ -2331,10 +2343,18 @@ static void flush_cpu_slab(void *d)
 	__flush_cpu_slab(s, smp_processor_id());
 }
 
+/*
+ * Called with preemption disabled, but not from @cpu: cpu_array_resize()
+ * frees the arrays seen here only after an RCU grace period.
+ */
 static bool has_cpu_slab(int cpu, void *info)
 {
 	struct kmem_cache *s = info;
 	struct kmem_cache_cpu *c = per_cpu_ptr(s->cpu_slab, cpu);
+	struct kmem_cache_cpu_array __percpu *array = READ_ONCE(s->cpu_array);
+
+	if (array && per_cpu_ptr(array, cpu)->count)
+		return true;
 
 	return c->page || slub_percpu_partial(c);
 }
@@ -2683,6 +2703,12 @@ static __always_inline void *slab_alloc_node(struct kmem_cache *s,
 	s = slab_pre_alloc_hook(s, gfpflags);
 	if (!s)
 		return NULL;
+
+	if (unlikely(s->cpu_array) && node == NUMA_NO_NODE) {
+		object = cpu_array_alloc(s, gfpflags);
+		if (object)
+			goto out;
+	}
 redo:
 	/*
 	 * Must read kmem_cache cpu data via this cpu ptr. Preemption is
@@ -2750,7 +2776,7 @@ static __always_inline void *slab_alloc_node(struct kmem_cache *s,
 		prefetch_freepointer(s, next_object);
 		stat(s, ALLOC_FASTPATH);
 	}
-
+out:
 	maybe_wipe_obj_freeptr(s, object);
 
 	if (unlikely(slab_want_init_on_alloc(gfpflags, s)) && object)
@@ -3002,8 +3028,12 @@ static __always_inline void slab_free(struct kmem_cache *s, struct page *page,
 	 * With KASAN enabled slab_free_freelist_hook modifies the freelist
 	 * to remove objects, whose reuse must be delayed.
 	 */
-	if (slab_free_freelist_hook(s, &head, &tail))
-		do_slab_free(s, page, head, tail, cnt, addr);
+	if (!slab_free_freelist_hook(s, &head, &tail))
+		return;
+	if (unlikely(s->cpu_array) && cnt == 1 &&
+	    cpu_array_free(s, page, head))
+		return;
+	do_slab_free(s, page, head, tail, cnt, addr);
 }
 
 #ifdef CONFIG_KASAN_GENERIC
@@ -3132,23 +3162,24 @@ void kmem_cache_free_bulk(struct kmem_cache *s, size_t size, void **p)
 }
 EXPORT_SYMBOL(kmem_cache_free_bulk);
 
-/* Note that interrupts must be enabled when calling this function. */
-int kmem_cache_alloc_bulk(struct kmem_cache *s, gfp_t flags, size_t size,
-			  void **p)
+/*
+ * Take up to @size objects off the cpu slab, going to the slow path as
+ * needed, but without running any allocation hooks.  Returns the number of
+ * objects taken, which is less than @size only if the slow path failed.
+ */
+static int __slab_alloc_bulk(struct kmem_cache *s, gfp_t flags, size_t size,
+			     void **p)
 {
 	struct kmem_cache_cpu *c;
+	unsigned long irqflags;
 	int i;
 
-	/* memcg and kmem_cache debug support */
-	s = slab_pre_alloc_hook(s, flags);
-	if (unlikely(!s))
-		return false;
 	/*
 	 * Drain objects in the per cpu slab, while disabling local
 	 * IRQs, which protects against PREEMPT and interrupts
 	 * handlers invoking normal fastpath.
 	 */
-	local_irq_disable();
+	local_irq_save(irqflags);
 	c = this_cpu_ptr(s->cpu_slab);
 
 	for (i = 0; i < size; i++) {
@@ -3161,8 +3192,10 @@ int kmem_cache_alloc_bulk(struct kmem_cache *s, gfp_t flags, size_t size,
 			 */
 			p[i] = ___slab_alloc(s, flags, NUMA_NO_NODE,
 					    _RET_IP_, c);
-			if (unlikely(!p[i]))
-				goto error;
+			if (unlikely(!p[i])) {
+				c = this_cpu_ptr(s->cpu_slab);
+				break;
+			}
 
 			c = this_cpu_ptr(s->cpu_slab);
 			maybe_wipe_obj_freeptr(s, p[i]);
@@ -3174,7 +3207,25 @@ int kmem_cache_alloc_bulk(struct kmem_cache *s, gfp_t flags, size_t size,
 		maybe_wipe_obj_freeptr(s, p[i]);
 	}
 	c->tid = next_tid(c->tid);
-	local_irq_enable();
+	local_irq_restore(irqflags);
+
+	return i;
+}
+
+/* Note that interrupts must be enabled when calling this function. */
+int kmem_cache_alloc_bulk(struct kmem_cache *s, gfp_t flags, size_t size,
+			  void **p)
+{
+	int i;
+
+	/* memcg and kmem_cache debug support */
+	s = slab_pre_alloc_hook(s, flags);
+	if (unlikely(!s))
+		return false;
+
+	i = __slab_alloc_bulk(s, flags, size, p);
+	if (unlikely(i < size))
+		goto error;
 
 	/* Clear memory outside IRQ disabled fastpath loop */
 	if (unlikely(slab_want_init_on_alloc(flags, s))) {
@@ -3188,13 +3239,218 @@ int kmem_cache_alloc_bulk(struct kmem_cache *s, gfp_t flags, size_t size,
 	slab_post_alloc_hook(s, flags, size, p);
 	return i;
 error:
-	local_irq_enable();
 	slab_post_alloc_hook(s, flags, i, p);
 	__kmem_cache_free_bulk(s, i, p);
 	return 0;
 }
 EXPORT_SYMBOL(kmem_cache_alloc_bulk);
 
+/*
+ * Per cpu object arrays.
+ *
+ * For caches where it is enabled (sysfs "cpu_array"), freed objects are
+ * kept in a per cpu array and handed out again by the next allocations on
+ * that cpu, while the slabs (and n->list_lock) are only touched to refill
+ * or flush the array in batches.  The array is only looked at with
+ * interrupts disabled.
+ */
+#define SLUB_CPU_ARRAY_MAX	512
+#define SLUB_CPU_ARRAY_BATCH	32
+
+static DEFINE_MUTEX(cpu_array_mutex);
+
+static inline unsigned int cpu_array_batch(struct kmem_cache_cpu_array *ca)
+{
+	return clamp(ca->size / 2, 1U, (unsigned int)SLUB_CPU_ARRAY_BATCH);
+}
+
+/* Return objects to their slabs, without running the free hooks again */
+static void __slab_free_array(struct kmem_cache *s, size_t size, void **p)
+{
+	do {
+		struct detached_freelist df;
+
+		size = build_detached_freelist(s, size, p, &df);
+		if (!df.page)
+			continue;
+
+		do_slab_free(df.s, df.page, df.freelist, df.tail, df.cnt,
+			     _RET_IP_);
+	} while (likely(size));
+}
+
+/* Flush the @nr oldest objects in @ca */
+static void cpu_array_flush(struct kmem_cache *s,
+			    struct kmem_cache_cpu_array *ca, unsigned int nr)
+{
+	if (!nr)
+		return;
+
+	__slab_free_array(s, nr, ca->objects);
+	ca->count -= nr;
+	memmove(ca->objects, ca->objects + nr, ca->count * sizeof(void *));
+	stat(s, CPU_ARRAY_FLUSH);
+}
+
+static void *cpu_array_alloc(struct kmem_cache *s, gfp_t gfpflags)
+{
+	struct kmem_cache_cpu_array __percpu *array;
+	void *objects[SLUB_CPU_ARRAY_BATCH];
+	struct kmem_cache_cpu_array *ca;
+	unsigned int batch = 0;
+	unsigned long flags;
+	void *object = NULL;
+	int nr;
+
+	if (kmem_cache_debug(s))
+		return NULL;
+
+	local_irq_save(flags);
+	array = READ_ONCE(s->cpu_array);
+	if (array) {
+		ca = this_cpu_ptr(array);
+		if (ca->count) {
+			object = ca->objects[--ca->count];
+			stat(s, ALLOC_CPU_ARRAY);
+		} else {
+			batch = cpu_array_batch(ca);
+		}
+	}
+	local_irq_restore(flags);
+	if (!batch)
+		return object;
+
+	/*
+	 * Objects of pfmemalloc slabs must not end up in the array, where
+	 * they could be handed out to anybody.
+	 */
+	if (gfp_pfmemalloc_allowed(gfpflags))
+		return NULL;
+
+	nr = __slab_alloc_bulk(s, gfpflags, batch, objects);
+	if (!nr)
+		return NULL;
+	stat(s, CPU_ARRAY_REFILL);
+
+	/* Keep the first object, and stash the others */
+	local_irq_save(flags);
+	array = READ_ONCE(s->cpu_array);
+	if (array) {
+		ca = this_cpu_ptr(array);
+		while (nr > 1 && ca->count < ca->size)
+			ca->objects[ca->count++] = objects[--nr];
+	}
+	local_irq_restore(flags);
+	if (nr > 1)
+		__slab_free_array(s, nr - 1, objects + 1);
+
+	return objects[0];
+}
+
+static bool cpu_array_free(struct kmem_cache *s, struct page *page,
+			   void *object)
+{
+	struct kmem_cache_cpu_array __percpu *array;
+	struct kmem_cache_cpu_array *ca;
+	unsigned long flags;
+	bool ret = false;
+
+	if (kmem_cache_debug(s) || PageSlabPfmemalloc(page))
+		return false;
+
+	local_irq_save(flags);
+	array = READ_ONCE(s->cpu_array);
+	if (array) {
+		ca = this_cpu_ptr(array);
+		if (ca->count == ca->size)
+			cpu_array_flush(s, ca, cpu_array_batch(ca));
+		ca->objects[ca->count++] = object;
+		stat(s, FREE_CPU_ARRAY);
+		ret = true;
+	}
+	local_irq_restore(flags);
+
+	return ret;
+}
+
+struct cpu_array_flush_info {
+	struct kmem_cache *s;
+	struct kmem_cache_cpu_array __percpu *array;
+};
+
+static void cpu_array_flush_ipi(void *d)
+{
+	struct cpu_array_flush_info *info = d;
+	struct kmem_cache_cpu_array *ca = this_cpu_ptr(info->array);
+
+	cpu_array_flush(info->s, ca, ca->count);
+}
+
+struct cpu_array_rcu {
+	struct rcu_head rcu;
+	struct kmem_cache_cpu_array __percpu *array;
+};
+
+static void cpu_array_free_rcu(struct rcu_head *head)
+{
+	struct cpu_array_rcu *old = container_of(head, struct cpu_array_rcu, rcu);
+
+	free_percpu(old->array);
+	kfree(old);
+}
+
+/*
+ * Replace the per cpu arrays of @s by arrays of @size objects, or remove
+ * them if @size is 0.  Users get at the array of their own cpu with
+ * interrupts disabled, so once every cpu has flushed its old array from
+ * an IPI, nobody can be using the old arrays any more.  has_cpu_slab()
+ * peeks at the arrays of other cpus with only preemption disabled, so
+ * the old arrays are only freed after an RCU grace period.
+ *
+ * The caller holds the cpu hotplug lock, and may hold slab_mutex.
+ */
+static int cpu_array_resize_locked(struct kmem_cache *s, unsigned int size)
+{
+	struct kmem_cache_cpu_array __percpu *new = NULL;
+	struct cpu_array_flush_info info = { .s = s };
+	struct cpu_array_rcu *old;
+	int cpu;
+
+	lockdep_assert_cpus_held();
+
+	old = kmalloc(sizeof(*old), GFP_KERNEL);
+	if (!old)
+		return -ENOMEM;
+
+	if (size) {
+		new = __alloc_percpu(sizeof(struct kmem_cache_cpu_array) +
+				     size * sizeof(void *), sizeof(void *));
+		if (!new) {
+			kfree(old);
+			return -ENOMEM;
+		}
+		for_each_possible_cpu(cpu)
+			per_cpu_ptr(new, cpu)->size = size;
+	}
+
+	mutex_lock(&cpu_array_mutex);
+	info.array = s->cpu_array;
+	WRITE_ONCE(s->cpu_array, new);
+	s->cpu_array_size = size;
+	/* Arrays of offline cpus were flushed by slub_cpu_dead() */
+	if (info.array)
+		on_each_cpu(cpu_array_flush_ipi, &info, 1);
+	mutex_unlock(&cpu_array_mutex);
+
+	if (info.array) {
+		old->array = info.array;
+		call_rcu(&old->rcu, cpu_array_free_rcu);
+	} else {
+		kfree(old);
+	}
+	return 0;
+}
+
 
 /*
  * Object placement in a slab is made very easy because we always start at
@@ -3415,6 +3671,7 @@ static void free_kmem_cache_nodes(struct kmem_cache *s)
 void __kmem_cache_release(struct kmem_cache *s)
 {
 	cache_random_seq_destroy(s);
+	free_percpu(s->cpu_array);
 	free_percpu(s->cpu_slab);
 	free_kmem_cache_nodes(s);
 }
@@ -4058,6 +4315,7 @@ void __kmemcg_cache_deactivate(struct kmem_cache *s)
 	 */
 	slub_set_cpu_partial(s, 0);
 	s->min_partial = 0;
+	cpu_array_resize_locked(s, 0);
 }
 #endif	/* CONFIG_MEMCG */
 
@@ -5007,6 +5265,41 @@ static ssize_t cpu_partial_store(struct kmem_cache *s, const char *buf,
 }
 SLAB_ATTR(cpu_partial);
 
+static ssize_t cpu_array_show(struct kmem_cache *s, char *buf)
+{
+	return sprintf(buf, "%u\n", s->cpu_array_size);
+}
+
+static int cpu_array_resize(struct kmem_cache *s, unsigned int size)
+{
+	int ret;
+
+	get_online_cpus();
+	ret = cpu_array_resize_locked(s, size);
+	put_online_cpus();
+
+	return ret;
+}
+
+static ssize_t cpu_array_store(struct kmem_cache *s, const char *buf,
+			       size_t length)
+{
+	unsigned int objects;
+	int err;
+
+	err = kstrtouint(buf, 10, &objects);
+	if (err)
+		return err;
+	if (objects > SLUB_CPU_ARRAY_MAX || (objects && kmem_cache_debug(s)))
+		return -EINVAL;
+
+	err = cpu_array_resize(s, objects);
+	if (err)
+		return err;
+	return length;
+}
+SLAB_ATTR(cpu_array);
+
 static ssize_t ctor_show(struct kmem_cache *s, char *buf)
 {
 	if (!s->ctor)
@@ -5413,6 +5706,10 @@ STAT_ATTR(CPU_PARTIAL_ALLOC, cpu_partial_alloc);
 STAT_ATTR(CPU_PARTIAL_FREE, cpu_partial_free);
 STAT_ATTR(CPU_PARTIAL_NODE, cpu_partial_node);
 STAT_ATTR(CPU_PARTIAL_DRAIN, cpu_partial_drain);
+STAT_ATTR(ALLOC_CPU_ARRAY, alloc_cpu_array);
+STAT_ATTR(FREE_CPU_ARRAY, free_cpu_array);
+STAT_ATTR(CPU_ARRAY_REFILL, cpu_array_refill);
+STAT_ATTR(CPU_ARRAY_FLUSH, cpu_array_flush);
 #endif	/* CONFIG_SLUB_STATS */
 
 static struct attribute *slab_attrs[] = {
@@ -5422,6 +5719,7 @@ static struct attribute *slab_attrs[] = {
 	&order_attr.attr,
 	&min_partial_attr.attr,
 	&cpu_partial_attr.attr,
+	&cpu_array_attr.attr,
 	&objects_attr.attr,
 	&objects_partial_attr.attr,
 	&partial_attr.attr,
@@ -5479,6 +5777,10 @@ static struct attribute *slab_attrs[] = {
 	&cpu_partial_free_attr.attr,
 	&cpu_partial_node_attr.attr,
 	&cpu_partial_drain_attr.attr,
+	&alloc_cpu_array_attr.attr,
+	&free_cpu_array_attr.attr,
+	&cpu_array_refill_attr.attr,
+	&cpu_array_flush_attr.attr,
 #endif
 #ifdef CONFIG_FAILSLAB
 	&failslab_attr.attr,
@@ -5587,6 +5889,10 @@ static void memcg_propagate_slab_attrs(struct kmem_cache *s)
 		if (!attr || !attr->store || !attr->show)
 			continue;
 
+		/* cpu_array_store() would take the cpu hotplug lock again */
+		if (attr == &cpu_array_attr)
+			continue;
+
 		/*
 		 * It is really bad that we have to allocate here, so we will
 		 * do it only as a fallback. If we actually allocate, though,
@@ -5612,6 +5918,9 @@ static void memcg_propagate_slab_attrs(struct kmem_cache *s)
 			attr->store(s, buf, len);
 	}
 
+	if (root_cache->cpu_array_size && !kmem_cache_debug(s))
+		cpu_array_resize_locked(s, root_cache->cpu_array_size);
+
 	if (buffer)
 		free_page((unsigned long)buffer);
 #endif	/* CONFIG_MEMCG */
@@ -21,6 +21,8 @@
 #include <linux/vmalloc.h>
 #include <linux/swap_slots.h>
 #include <linux/huge_mm.h>
+#include <linux/rmap.h>
+#include <linux/frontswap.h>
 
 #include <asm/pgtable.h>
 
@@ -653,7 +655,8 @@ static void swap_ra_info(struct vm_fault *vmf,
 
 	max_win = 1 << min_t(unsigned int, READ_ONCE(page_cluster),
 			     SWAP_RA_ORDER_CEILING);
-	if (max_win == 1) {
+	/* MADV_RANDOM: readahead would only waste I/O */
+	if (max_win == 1 || (vma->vm_flags & VM_RAND_READ)) {
 		ra_info->win = 1;
 		return;
 	}
@@ -671,8 +674,12 @@ static void swap_ra_info(struct vm_fault *vmf,
 	pfn = PFN_DOWN(SWAP_RA_ADDR(ra_val));
 	prev_win = SWAP_RA_WIN(ra_val);
 	hits = SWAP_RA_HITS(ra_val);
-	ra_info->win = win = __swapin_nr_pages(pfn, fpfn, hits,
-					       max_win, prev_win);
+	/* MADV_SEQUENTIAL: don't wait for hits to open up the window */
+	if (vma->vm_flags & VM_SEQ_READ)
+		win = max_win;
+	else
+		win = __swapin_nr_pages(pfn, fpfn, hits, max_win, prev_win);
+	ra_info->win = win;
 	atomic_long_set(&vma->swap_readahead_info,
 			SWAP_RA_VAL(faddr, win, 0));
 
@@ -682,7 +689,7 @@ static void swap_ra_info(struct vm_fault *vmf,
 	}
 
 	/* Copy the PTEs because the page table may be unmapped */
-	if (fpfn == pfn + 1)
+	if (fpfn == pfn + 1 || (vma->vm_flags & VM_SEQ_READ))
 		swap_ra_clamp_pfn(vma, faddr, fpfn, fpfn + win, &start, &end);
 	else if (pfn == fpfn + 1)
 		swap_ra_clamp_pfn(vma, faddr, fpfn - win + 1, fpfn + 1,
@@ -766,6 +773,126 @@ static struct page *swap_vma_readahead(swp_entry_t fentry, gfp_t gfp_mask,
 				     ra_info.win == 1);
 }
 
+#ifdef CONFIG_THP_SWAP
+/*
+ * Does the PMD range around the fault still map, in order, the swap
+ * cluster starting at @entry?
+ */
+static bool swap_thp_mapped(struct vm_fault *vmf, swp_entry_t entry)
+{
+	unsigned long haddr = vmf->address & HPAGE_PMD_MASK;
+	pte_t *pte, *orig_pte;
+	int i;
+
+	orig_pte = pte = pte_offset_map(vmf->pmd, haddr);
+	for (i = 0; i < HPAGE_PMD_NR; i++, pte++) {
+		pte_t pteval = *pte;
+
+		if (!is_swap_pte(pteval) ||
+		    pte_to_swp_entry(pteval).val != entry.val + i)
+			break;
+	}
+	pte_unmap(orig_pte);
+
+	return i == HPAGE_PMD_NR;
+}
+
+/**
+ * swapin_thp - swap in a THP that was swapped out in one piece
+ * @fentry: swap entry of the faulting pte
+ * @vmf: fault information
+ *
+ * THPs are written to swap without being split, but reclaim splits
+ * their PMD into swap ptes, so they would come back one small page per
+ * fault.  If the PMD range around the fault still maps the whole swap
+ * cluster the THP was written to, read it back with a single I/O into a
+ * THP in the swap cache instead: do_swap_page() maps its subpages as
+ * they fault, and khugepaged can collapse them into a PMD again.
+ *
+ * Returns the subpage for @fentry, or NULL to fall back to small pages.
+ *
+ * Caller must hold read mmap_sem.
+ */
+struct page *swapin_thp(swp_entry_t fentry, struct vm_fault *vmf)
+{
+	struct vm_area_struct *vma = vmf->vma;
+	unsigned long haddr = vmf->address & HPAGE_PMD_MASK;
+	unsigned long nr = swp_offset(fentry) & (HPAGE_PMD_NR - 1);
+	gfp_t gfp = GFP_TRANSHUGE_LIGHT;
+	struct swap_info_struct *si;
+	struct mem_cgroup *memcg;
+	swp_entry_t entry;
+	struct page *page;
+	int i;
+
+	if (nr != (vmf->address - haddr) >> PAGE_SHIFT)
+		return NULL;
+	if (!vma_is_anonymous(vma) || !transhuge_vma_suitable(vma, haddr) ||
+	    !__transparent_hugepage_enabled(vma))
+		return NULL;
+	entry = swp_entry(swp_type(fentry), swp_offset(fentry) - nr);
+
+	/*
+	 * Reject what swapcache_prepare_cluster() would refuse anyway
+	 * before paying for a huge page allocation: only clustered block
+	 * device swap stores THPs in one piece, and frontswap holds the
+	 * data of any page it took, not the swap device.
+	 */
+	si = swp_swap_info(entry);
+	if (!si->cluster_info || (si->flags & SWP_FS))
+		return NULL;
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		if (frontswap_test(si, swp_offset(entry) + i))
+			return NULL;
+
+	if (!swap_thp_mapped(vmf, entry))
+		return NULL;
+
+	page = alloc_hugepage_vma(gfp, vma, haddr, HPAGE_PMD_ORDER);
+	if (!page)
+		goto fallback;
+	prep_transhuge_page(page);
+
+	/* Somebody else may have started to swap in part of the cluster */
+	if (swapcache_prepare_cluster(entry))
+		goto out_put;
+
+	__SetPageLocked(page);
+	__SetPageSwapBacked(page);
+	if (add_to_swap_cache(page, entry, GFP_KERNEL)) {
+		__ClearPageLocked(page);
+		put_swap_page(page, entry);
+		goto out_put;
+	}
+
+	/*
+	 * Charge the THP as a whole now: do_swap_page() only charges
+	 * swap cache pages that are not charged yet, one small page at
+	 * a time.
+	 */
+	if (mem_cgroup_try_charge_delay(page, vma->vm_mm, gfp, &memcg, true)) {
+		delete_from_swap_cache(page);
+		unlock_page(page);
+		goto out_put;
+	}
+	mem_cgroup_commit_charge(page, memcg, false, true);
+	page_set_anon_rmap_swapin(page, vma, haddr);
+
+	SetPageWorkingset(page);
+	lru_cache_add_anon(page);
+	count_vm_event(THP_SWPIN);
+	swap_readpage(page, false);
+
+	return page + nr;
+
+out_put:
+	put_page(page);
+fallback:
+	count_vm_event(THP_SWPIN_FALLBACK);
+	return NULL;
+}
+#endif /* CONFIG_THP_SWAP */
+
 /**
  * swapin_readahead - swap in pages in hope we need them soon
  * @entry: swap entry of this memory
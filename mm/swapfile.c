@@ -1384,6 +1384,59 @@ int split_swap_cluster(swp_entry_t entry)
 	unlock_cluster(ci);
 	return 0;
 }
+
+/*
+ * Like swapcache_prepare(), but for the whole cluster starting at
+ * @entry, so that a THP can be added to the swap cache for it.  Every
+ * entry must be in use and uncached, and none may have been stored
+ * in frontswap, which only deals in single pages.  The cluster is
+ * marked huge again, as it was while the THP was being swapped out.
+ */
+int swapcache_prepare_cluster(swp_entry_t entry)
+{
+	struct swap_info_struct *si;
+	struct swap_cluster_info *ci;
+	unsigned long offset = swp_offset(entry);
+	unsigned char *map;
+	int i, err = 0;
+
+	VM_BUG_ON(offset % SWAPFILE_CLUSTER);
+
+	si = get_swap_device(entry);
+	if (!si)
+		return -ENOENT;
+	ci = lock_cluster(si, offset);
+	if (!ci || (si->flags & SWP_FS) ||
+	    offset + SWAPFILE_CLUSTER > si->max) {
+		err = -EINVAL;
+		goto unlock;
+	}
+
+	map = si->swap_map + offset;
+	for (i = 0; i < SWAPFILE_CLUSTER; i++) {
+		if (map[i] == SWAP_MAP_BAD || !swap_count(map[i])) {
+			err = -ENOENT;
+			goto unlock;
+		}
+		if (map[i] & SWAP_HAS_CACHE) {
+			err = -EEXIST;
+			goto unlock;
+		}
+		if (frontswap_test(si, offset + i)) {
+			err = -EINVAL;
+			goto unlock;
+		}
+	}
+
+	VM_BUG_ON(cluster_count(ci) != SWAPFILE_CLUSTER);
+	for (i = 0; i < SWAPFILE_CLUSTER; i++)
+		map[i] |= SWAP_HAS_CACHE;
+	cluster_set_flag(ci, CLUSTER_FLAG_HUGE);
+unlock:
+	unlock_cluster(ci);
+	put_swap_device(si);
+	return err;
+}
 #endif
 
 static int swp_entry_cmp(const void *ent1, const void *ent2)
@@ -1871,7 +1924,9 @@ static int unuse_pte(struct vm_area_struct *vma, pmd_t *pmd,
 	}
 
 	pte = pte_offset_map_lock(vma->vm_mm, pmd, addr, &ptl);
-	if (unlikely(!pte_same_as_swp(*pte, swp_entry_to_pte(entry)))) {
+	/* A lazily shared PTE table is left to the mm accounting for it */
+	if (unlikely(!pte_same_as_swp(*pte, swp_entry_to_pte(entry)) ||
+		     pte_table_foreign(vma->vm_mm, pmd, ptl))) {
 		mem_cgroup_cancel_charge(page, memcg, false);
 		ret = 0;
 		goto out;
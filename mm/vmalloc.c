@@ -334,7 +334,7 @@ static DEFINE_SPINLOCK(vmap_area_lock);
 static DEFINE_SPINLOCK(free_vmap_area_lock);
 /* Export for kexec only */
 LIST_HEAD(vmap_area_list);
-static LLIST_HEAD(vmap_purge_list);
+static DEFINE_PER_CPU(struct llist_head, vmap_purge_list);
 static struct rb_root vmap_area_root = RB_ROOT;
 static bool vmap_initialized __read_mostly;
 
@@ -371,6 +371,31 @@ static struct rb_root free_vmap_area_root = RB_ROOT;
  */
 static DEFINE_PER_CPU(struct vmap_area *, ne_fit_preload_node);
 
+/*
+ * Per-CPU caches of pre-carved vmap areas for small sizes, which
+ * covers vmalloc'ed thread stacks and most ioremaps. A miss carves a
+ * batch of areas of the requested size under a single
+ * free_vmap_area_lock hold and parks the extra ones here, so that
+ * following allocations of that size skip the free tree. Cached
+ * areas have never been mapped, thus they can be handed out without
+ * any TLB flush. They are given back to the free tree by
+ * purge_vmap_area_lazy(), before an allocation gives up.
+ *
+ * Only allocations from the whole VMALLOC_START..VMALLOC_END range are
+ * cached: areas carved for a narrower range would sit in the cache of
+ * their size without serving anybody else.
+ */
+#define VMAP_CACHE_MAX_PAGES	16
+#define VMAP_CACHE_BATCH	4
+
+struct vmap_area_cache {
+	spinlock_t lock;
+	unsigned int nr[VMAP_CACHE_MAX_PAGES];
+	struct vmap_area *areas[VMAP_CACHE_MAX_PAGES][VMAP_CACHE_BATCH];
+};
+
+static DEFINE_PER_CPU(struct vmap_area_cache, vmap_area_cache);
+
 static __always_inline unsigned long
 va_size(struct vmap_area *va)
 {
@@ -1081,6 +1106,134 @@ static void free_vmap_area(struct vmap_area *va)
 	spin_unlock(&free_vmap_area_lock);
 }
 
+static __always_inline bool
+vmap_cache_usable(unsigned long size, unsigned long vstart, unsigned long vend)
+{
+	return size <= VMAP_CACHE_MAX_PAGES << PAGE_SHIFT &&
+		vstart == VMALLOC_START && vend == VMALLOC_END;
+}
+
+/*
+ * Take an area of exactly "size" bytes from this CPU's cache, if its
+ * most recently cached one fits the alignment.
+ */
+static struct vmap_area *
+vmap_cache_get(unsigned long size, unsigned long align,
+	unsigned long vstart, unsigned long vend)
+{
+	unsigned long nr = size >> PAGE_SHIFT;
+	struct vmap_area_cache *vc;
+	struct vmap_area *va = NULL;
+
+	if (!vmap_cache_usable(size, vstart, vend))
+		return NULL;
+
+	vc = raw_cpu_ptr(&vmap_area_cache);
+	spin_lock(&vc->lock);
+	if (vc->nr[nr - 1]) {
+		va = vc->areas[nr - 1][vc->nr[nr - 1] - 1];
+		if (IS_ALIGNED(va->va_start, align))
+			vc->nr[nr - 1]--;
+		else
+			va = NULL;
+	}
+	spin_unlock(&vc->lock);
+
+	return va;
+}
+
+/*
+ * If this CPU has no cached areas of "size", allocate vmap_area
+ * objects for a batch of them. Returns the number of objects.
+ */
+static unsigned int
+vmap_cache_prealloc(unsigned long size, unsigned long vstart,
+	unsigned long vend, struct vmap_area **extra, int node, gfp_t gfp_mask)
+{
+	unsigned long nr = size >> PAGE_SHIFT;
+	unsigned int i;
+
+	if (!vmap_cache_usable(size, vstart, vend) ||
+			READ_ONCE(raw_cpu_ptr(&vmap_area_cache)->nr[nr - 1]))
+		return 0;
+
+	for (i = 0; i < VMAP_CACHE_BATCH; i++) {
+		extra[i] = kmem_cache_alloc_node(vmap_area_cachep,
+				gfp_mask | __GFP_NOWARN, node);
+		if (!extra[i])
+			break;
+
+		kmemleak_scan_area(&extra[i]->rb_node, SIZE_MAX, gfp_mask);
+	}
+
+	return i;
+}
+
+/*
+ * Park "nr_carved" freshly carved areas in this CPU's cache. Whatever
+ * does not fit goes back to the free tree, and the remaining unused
+ * objects up to "nr_extra" are released.
+ */
+static void
+vmap_cache_refill(unsigned long size, struct vmap_area **extra,
+	unsigned int nr_carved, unsigned int nr_extra)
+{
+	unsigned long nr = size >> PAGE_SHIFT;
+	struct vmap_area_cache *vc;
+	unsigned int i = 0;
+
+	if (nr_carved) {
+		vc = raw_cpu_ptr(&vmap_area_cache);
+		spin_lock(&vc->lock);
+		while (i < nr_carved && vc->nr[nr - 1] < VMAP_CACHE_BATCH)
+			vc->areas[nr - 1][vc->nr[nr - 1]++] = extra[i++];
+		spin_unlock(&vc->lock);
+	}
+
+	if (i < nr_carved) {
+		spin_lock(&free_vmap_area_lock);
+		for (; i < nr_carved; i++)
+			merge_or_add_vmap_area(extra[i],
+				&free_vmap_area_root, &free_vmap_area_list);
+		spin_unlock(&free_vmap_area_lock);
+	}
+
+	for (; i < nr_extra; i++)
+		kmem_cache_free(vmap_area_cachep, extra[i]);
+}
+
+/*
+ * Give all cached areas of all CPUs back to the free tree.
+ */
+static void vmap_cache_drain_all(void)
+{
+	struct vmap_area_cache *vc;
+	struct vmap_area *va;
+	unsigned long orig_start, orig_end;
+	int cpu, i;
+
+	for_each_possible_cpu(cpu) {
+		vc = per_cpu_ptr(&vmap_area_cache, cpu);
+
+		spin_lock(&vc->lock);
+		spin_lock(&free_vmap_area_lock);
+		for (i = 0; i < VMAP_CACHE_MAX_PAGES; i++) {
+			while (vc->nr[i]) {
+				va = vc->areas[i][--vc->nr[i]];
+				orig_start = va->va_start;
+				orig_end = va->va_end;
+				va = merge_or_add_vmap_area(va,
+					&free_vmap_area_root, &free_vmap_area_list);
+				/* the merged range may free whole shadow pages */
+				kasan_release_vmalloc(orig_start, orig_end,
+						      va->va_start, va->va_end);
+			}
+		}
+		spin_unlock(&free_vmap_area_lock);
+		spin_unlock(&vc->lock);
+	}
+}
+
 /*
  * Allocate a region of KVA of the specified size and alignment, within the
  * vstart and vend.
@@ -1090,6 +1243,8 @@ static struct vmap_area *alloc_vmap_area(unsigned long size,
 				unsigned long vstart, unsigned long vend,
 				int node, gfp_t gfp_mask)
 {
+	struct vmap_area *extra[VMAP_CACHE_BATCH];
+	unsigned int nr_extra, nr_carved;
 	struct vmap_area *va, *pva;
 	unsigned long addr;
 	int purged = 0;
@@ -1105,6 +1260,12 @@ static struct vmap_area *alloc_vmap_area(unsigned long size,
 	might_sleep();
 	gfp_mask = gfp_mask & GFP_RECLAIM_MASK;
 
+	va = vmap_cache_get(size, align, vstart, vend);
+	if (va) {
+		addr = va->va_start;
+		goto insert;
+	}
+
 	va = kmem_cache_alloc_node(vmap_area_cachep, gfp_mask, node);
 	if (unlikely(!va))
 		return ERR_PTR(-ENOMEM);
@@ -1115,6 +1276,13 @@ static struct vmap_area *alloc_vmap_area(unsigned long size,
 	 */
 	kmemleak_scan_area(&va->rb_node, SIZE_MAX, gfp_mask);
 
+	/*
+	 * Objects for the areas carved on behalf of the per-CPU cache,
+	 * while the free tree is locked anyway.
+	 */
+	nr_extra = vmap_cache_prealloc(size, vstart, vend, extra,
+				       node, gfp_mask);
+
 retry:
 	/*
 	 * Preload this CPU with one extra vmap_area object. It is used
@@ -1151,6 +1319,17 @@ static struct vmap_area *alloc_vmap_area(unsigned long size,
 	 * returned. Therefore trigger the overflow path.
 	 */
 	addr = __alloc_vmap_area(size, align, vstart, vend);
+
+	for (nr_carved = 0; addr != vend && nr_carved < nr_extra; nr_carved++) {
+		unsigned long extra_addr;
+
+		extra_addr = __alloc_vmap_area(size, align, vstart, vend);
+		if (extra_addr == vend)
+			break;
+
+		extra[nr_carved]->va_start = extra_addr;
+		extra[nr_carved]->va_end = extra_addr + size;
+	}
 	spin_unlock(&free_vmap_area_lock);
 
 	if (unlikely(addr == vend))
@@ -1158,8 +1337,12 @@ static struct vmap_area *alloc_vmap_area(unsigned long size,
 
 	va->va_start = addr;
 	va->va_end = addr + size;
-	va->vm = NULL;
 
+	if (nr_extra)
+		vmap_cache_refill(size, extra, nr_carved, nr_extra);
+
+insert:
+	va->vm = NULL;
 
 	spin_lock(&vmap_area_lock);
 	insert_vmap_area(va, &vmap_area_root, &vmap_area_list);
@@ -1197,6 +1380,7 @@ static struct vmap_area *alloc_vmap_area(unsigned long size,
 		pr_warn("vmap allocation for size %lu failed: use vmalloc=<size> to increase size\n",
 			size);
 
+	vmap_cache_refill(size, extra, 0, nr_extra);
 	kmem_cache_free(vmap_area_cachep, va);
 	return ERR_PTR(-EBUSY);
 }
@@ -1273,13 +1457,38 @@ void set_iounmap_nonlazy(void)
 static bool __purge_vmap_area_lazy(unsigned long start, unsigned long end)
 {
 	unsigned long resched_threshold;
-	struct llist_node *valist;
+	struct llist_node *valist = NULL;
+	struct llist_node *head, *tail;
 	struct vmap_area *va;
 	struct vmap_area *n_va;
+	int cpu;
 
 	lockdep_assert_held(&vmap_purge_lock);
 
-	valist = llist_del_all(&vmap_purge_list);
+	/*
+	 * Splice the lazily-freed areas of all CPUs into one list and
+	 * extend the range to cover them, so that a single TLB flush
+	 * serves every area, whichever CPU released it.
+	 */
+	for_each_possible_cpu(cpu) {
+		head = llist_del_all(per_cpu_ptr(&vmap_purge_list, cpu));
+		if (!head)
+			continue;
+
+		for (tail = head; ; tail = tail->next) {
+			va = llist_entry(tail, struct vmap_area, purge_list);
+			if (va->va_start < start)
+				start = va->va_start;
+			if (va->va_end > end)
+				end = va->va_end;
+			if (!tail->next)
+				break;
+		}
+
+		tail->next = valist;
+		valist = head;
+	}
+
 	if (unlikely(valist == NULL))
 		return false;
 
@@ -1289,17 +1498,6 @@ static bool __purge_vmap_area_lazy(unsigned long start, unsigned long end)
 	 */
 	vmalloc_sync_all();
 
-	/*
-	 * TODO: to calculate a flush range without looping.
-	 * The list can be up to lazy_max_pages() elements.
-	 */
-	llist_for_each_entry(va, valist, purge_list) {
-		if (va->va_start < start)
-			start = va->va_start;
-		if (va->va_end > end)
-			end = va->va_end;
-	}
-
 	flush_tlb_kernel_range(start, end);
 	resched_threshold = lazy_max_pages() << 1;
 
@@ -1348,6 +1546,7 @@ static void try_purge_vmap_area_lazy(void)
 static void purge_vmap_area_lazy(void)
 {
 	mutex_lock(&vmap_purge_lock);
+	vmap_cache_drain_all();
 	purge_fragmented_blocks_allcpus();
 	__purge_vmap_area_lazy(ULONG_MAX, 0);
 	mutex_unlock(&vmap_purge_lock);
@@ -1370,7 +1569,7 @@ static void free_vmap_area_noflush(struct vmap_area *va)
 				PAGE_SHIFT, &vmap_lazy_nr);
 
 	/* After this point, we may free va at any time */
-	llist_add(&va->purge_list, &vmap_purge_list);
+	llist_add(&va->purge_list, raw_cpu_ptr(&vmap_purge_list));
 
 	if (unlikely(nr_lazy > lazy_max_pages()))
 		try_purge_vmap_area_lazy();
@@ -1957,6 +2156,7 @@ void __init vmalloc_init(void)
 		p = &per_cpu(vfree_deferred, i);
 		init_llist_head(&p->list);
 		INIT_WORK(&p->wq, free_work);
+		spin_lock_init(&per_cpu(vmap_area_cache, i).lock);
 	}
 
 	/* Import existing vmlist entries. */
@@ -3581,15 +3781,15 @@ static void show_purge_info(struct seq_file *m)
 {
 	struct llist_node *head;
 	struct vmap_area *va;
+	int cpu;
 
-	head = READ_ONCE(vmap_purge_list.first);
-	if (head == NULL)
-		return;
-
-	llist_for_each_entry(va, head, purge_list) {
-		seq_printf(m, "0x%pK-0x%pK %7ld unpurged vm_area\n",
-			(void *)va->va_start, (void *)va->va_end,
-			va->va_end - va->va_start);
+	for_each_possible_cpu(cpu) {
+		head = READ_ONCE(per_cpu(vmap_purge_list, cpu).first);
+		llist_for_each_entry(va, head, purge_list) {
+			seq_printf(m, "0x%pK-0x%pK %7ld unpurged vm_area\n",
+				(void *)va->va_start, (void *)va->va_end,
+				va->va_end - va->va_start);
+		}
 	}
 }
 
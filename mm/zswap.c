@@ -26,6 +26,8 @@
 #include <linux/crypto.h>
 #include <linux/mempool.h>
 #include <linux/zpool.h>
+#include <linux/memcontrol.h>
+#include <linux/hash.h>
 
 #include <linux/mm_types.h>
 #include <linux/page-flags.h>
@@ -62,6 +64,8 @@ static u64 zswap_reject_compress_poor;
 static u64 zswap_reject_alloc_fail;
 /* Store failed because the entry metadata could not be allocated (rare) */
 static u64 zswap_reject_kmemcache_fail;
+/* Store failed because the cgroup was at its memory.zswap.max */
+static u64 zswap_reject_memcg_limit;
 /* Duplicate store was encountered (rare) */
 static u64 zswap_duplicate_entry;
 
@@ -114,12 +118,49 @@ static bool zswap_same_filled_pages_enabled = true;
 module_param_named(same_filled_pages_enabled, zswap_same_filled_pages_enabled,
 		   bool, 0644);
 
+/* Enable/disable writeback of cold entries under memory pressure */
+static bool zswap_shrinker_enabled = true;
+module_param_named(shrinker_enabled, zswap_shrinker_enabled, bool, 0644);
+
 /*********************************
 * data structures
 **********************************/
 
+/*
+ * Entries are spread over several zpools to reduce contention on the
+ * zpool internal locks when many CPUs are swapping out at once.
+ */
+#define ZSWAP_NR_ZPOOLS 8
+
+/*
+ * struct zswap_lru
+ *
+ * Each zpool has its own LRU, so that stores, loads and writeback spread
+ * over as many locks as the zpools do.
+ *
+ * list - compressed entries of the zpool, most recently stored or loaded
+ *        first; written back from the tail
+ * lock - protects list; nests inside the tree lock
+ */
+struct zswap_lru {
+	struct list_head list;
+	spinlock_t lock;
+} ____cacheline_aligned_in_smp;
+
+/*
+ * struct zswap_pool
+ *
+ * zpools - the zpools the compressed pages are stored in, see
+ *          zswap_find_zpool()
+ * lrus - the LRU of each zpool
+ * nr_lru - number of entries on the LRUs, i.e. that writeback can free
+ * next_lru - where writeback starts looking for an entry
+ */
 struct zswap_pool {
-	struct zpool *zpool;
+	struct zpool *zpools[ZSWAP_NR_ZPOOLS];
+	struct zswap_lru lrus[ZSWAP_NR_ZPOOLS];
+	atomic_long_t nr_lru;
+	atomic_t next_lru;
 	struct crypto_comp * __percpu *tfm;
 	struct kref kref;
 	struct list_head list;
@@ -135,7 +176,8 @@ struct zswap_pool {
  * page within zswap.
  *
  * rbnode - links the entry into red-black tree for the appropriate swap type
- * offset - the swap offset for the entry.  Index into the red-black tree.
+ * swpentry - the swap entry for the page.  Its offset is the index into the
+ *            red-black tree.
  * refcount - the number of outstanding reference to the entry. This is needed
  *            to protect against premature freeing of the entry by code
  *            concurrent calls to load, invalidate, and writeback.  The lock
@@ -145,25 +187,25 @@ struct zswap_pool {
  * length - the length in bytes of the compressed page data.  Needed during
  *          decompression. For a same value filled page length is 0.
  * pool - the zswap_pool the entry's data is in
+ * lru - links the entry into its zpool's LRU list, compressed entries only
+ * memcg - the cgroup the compressed page is charged to
  * handle - zpool allocation handle that stores the compressed page data
  * value - value of the same-value filled pages which have same content
  */
 struct zswap_entry {
 	struct rb_node rbnode;
-	pgoff_t offset;
+	swp_entry_t swpentry;
 	int refcount;
 	unsigned int length;
 	struct zswap_pool *pool;
+	struct list_head lru;
+	struct mem_cgroup *memcg;
 	union {
 		unsigned long handle;
 		unsigned long value;
 	};
 };
 
-struct zswap_header {
-	swp_entry_t swpentry;
-};
-
 /*
  * The tree lock in the zswap_tree struct protects a few things:
  * - the rbtree
@@ -174,6 +216,15 @@ struct zswap_tree {
 	spinlock_t lock;
 };
 
+/*
+ * Each swap type is split into ZSWAP_NR_TREES trees.  Offsets are
+ * interleaved between them in chunks of 1 << ZSWAP_TREE_SHIFT pages,
+ * the size of a swap cluster, so CPUs swapping out into their own
+ * per-cpu clusters mostly take different tree locks.
+ */
+#define ZSWAP_TREE_SHIFT	9
+#define ZSWAP_NR_TREES		16
+
 static struct zswap_tree *zswap_trees[MAX_SWAPFILES];
 
 /* RCU-protected iteration */
@@ -198,16 +249,11 @@ static bool zswap_has_pool;
 
 #define zswap_pool_debug(msg, p)				\
 	pr_debug("%s pool %s/%s\n", msg, (p)->tfm_name,		\
-		 zpool_get_type((p)->zpool))
+		 zpool_get_type((p)->zpools[0]))
 
-static int zswap_writeback_entry(struct zpool *pool, unsigned long handle);
 static int zswap_pool_get(struct zswap_pool *pool);
 static void zswap_pool_put(struct zswap_pool *pool);
 
-static const struct zpool_ops zswap_zpool_ops = {
-	.evict = zswap_writeback_entry
-};
-
 static bool zswap_is_full(void)
 {
 	return totalram_pages() * zswap_max_pool_percent / 100 <
@@ -218,17 +264,94 @@ static void zswap_update_total_size(void)
 {
 	struct zswap_pool *pool;
 	u64 total = 0;
+	int i;
 
 	rcu_read_lock();
 
 	list_for_each_entry_rcu(pool, &zswap_pools, list)
-		total += zpool_get_total_size(pool->zpool);
+		for (i = 0; i < ZSWAP_NR_ZPOOLS; i++)
+			total += zpool_get_total_size(pool->zpools[i]);
 
 	rcu_read_unlock();
 
 	zswap_pool_total_size = total;
 }
 
+static struct zswap_tree *swap_zswap_tree(unsigned type, pgoff_t offset)
+{
+	struct zswap_tree *trees = zswap_trees[type];
+
+	if (!trees)
+		return NULL;
+
+	return &trees[(offset >> ZSWAP_TREE_SHIFT) % ZSWAP_NR_TREES];
+}
+
+/*
+ * Entries come from per-cpu slab freelists, so hashing the entry spreads
+ * concurrent stores from different CPUs over different zpools.
+ */
+static int zswap_zpool_index(struct zswap_entry *entry)
+{
+	int i = 0;
+
+	if (ZSWAP_NR_ZPOOLS > 1)
+		i = hash_ptr(entry, ilog2(ZSWAP_NR_ZPOOLS));
+
+	return i;
+}
+
+static struct zpool *zswap_find_zpool(struct zswap_entry *entry)
+{
+	return entry->pool->zpools[zswap_zpool_index(entry)];
+}
+
+static struct zswap_lru *zswap_find_lru(struct zswap_entry *entry)
+{
+	return &entry->pool->lrus[zswap_zpool_index(entry)];
+}
+
+/*
+ * A failed writeback puts its entry back, but the entry it isolated may
+ * have been freed and reused for a new store that is on the LRU already.
+ */
+static void zswap_lru_add(struct zswap_entry *entry)
+{
+	struct zswap_lru *lru = zswap_find_lru(entry);
+	bool on_lru;
+
+	spin_lock(&lru->lock);
+	on_lru = !list_empty(&entry->lru);
+	list_move(&entry->lru, &lru->list);
+	spin_unlock(&lru->lock);
+	if (!on_lru)
+		atomic_long_inc(&entry->pool->nr_lru);
+}
+
+/* Entries isolated by writeback are off the LRU already */
+static void zswap_lru_del(struct zswap_entry *entry)
+{
+	struct zswap_lru *lru = zswap_find_lru(entry);
+	bool on_lru;
+
+	spin_lock(&lru->lock);
+	on_lru = !list_empty(&entry->lru);
+	list_del_init(&entry->lru);
+	spin_unlock(&lru->lock);
+	if (on_lru)
+		atomic_long_dec(&entry->pool->nr_lru);
+}
+
+static void zswap_lru_rotate(struct zswap_entry *entry)
+{
+	struct zswap_lru *lru = zswap_find_lru(entry);
+
+	spin_lock(&lru->lock);
+	if (!list_empty(&entry->lru))
+		list_move(&entry->lru, &lru->list);
+	spin_unlock(&lru->lock);
+}
+
 /*********************************
 * zswap entry functions
 **********************************/
@@ -253,6 +376,7 @@ static struct zswap_entry *zswap_entry_cache_alloc(gfp_t gfp)
 		return NULL;
 	entry->refcount = 1;
 	RB_CLEAR_NODE(&entry->rbnode);
+	INIT_LIST_HEAD(&entry->lru);
 	return entry;
 }
 
@@ -271,9 +395,9 @@ static struct zswap_entry *zswap_rb_search(struct rb_root *root, pgoff_t offset)
 
 	while (node) {
 		entry = rb_entry(node, struct zswap_entry, rbnode);
-		if (entry->offset > offset)
+		if (swp_offset(entry->swpentry) > offset)
 			node = node->rb_left;
-		else if (entry->offset < offset)
+		else if (swp_offset(entry->swpentry) < offset)
 			node = node->rb_right;
 		else
 			return entry;
@@ -290,13 +414,15 @@ static int zswap_rb_insert(struct rb_root *root, struct zswap_entry *entry,
 {
 	struct rb_node **link = &root->rb_node, *parent = NULL;
 	struct zswap_entry *myentry;
+	pgoff_t myoffset, offset = swp_offset(entry->swpentry);
 
 	while (*link) {
 		parent = *link;
 		myentry = rb_entry(parent, struct zswap_entry, rbnode);
-		if (myentry->offset > entry->offset)
+		myoffset = swp_offset(myentry->swpentry);
+		if (myoffset > offset)
 			link = &(*link)->rb_left;
-		else if (myentry->offset < entry->offset)
+		else if (myoffset < offset)
 			link = &(*link)->rb_right;
 		else {
 			*dupentry = myentry;
@@ -325,7 +451,10 @@ static void zswap_free_entry(struct zswap_entry *entry)
 	if (!entry->length)
 		atomic_dec(&zswap_same_filled_pages);
 	else {
-		zpool_free(entry->pool->zpool, entry->handle);
+		zswap_lru_del(entry);
+		zpool_free(zswap_find_zpool(entry), entry->handle);
+		mem_cgroup_uncharge_zswap(entry->memcg, entry->length);
+		mem_cgroup_put(entry->memcg);
 		zswap_pool_put(entry->pool);
 	}
 	zswap_entry_cache_free(entry);
@@ -490,7 +619,7 @@ static struct zswap_pool *zswap_pool_find_get(char *type, char *compressor)
 	list_for_each_entry_rcu(pool, &zswap_pools, list) {
 		if (strcmp(pool->tfm_name, compressor))
 			continue;
-		if (strcmp(zpool_get_type(pool->zpool), type))
+		if (strcmp(zpool_get_type(pool->zpools[0]), type))
 			continue;
 		/* if we can't get it, it's about to be destroyed */
 		if (!zswap_pool_get(pool))
@@ -506,7 +635,7 @@ static struct zswap_pool *zswap_pool_create(char *type, char *compressor)
 	struct zswap_pool *pool;
 	char name[38]; /* 'zswap' + 32 char (max) num + \0 */
 	gfp_t gfp = __GFP_NORETRY | __GFP_NOWARN | __GFP_KSWAPD_RECLAIM;
-	int ret;
+	int i, ret;
 
 	if (!zswap_has_pool) {
 		/* if either are unset, pool initialization failed, and we
@@ -523,15 +652,19 @@ static struct zswap_pool *zswap_pool_create(char *type, char *compressor)
 	if (!pool)
 		return NULL;
 
-	/* unique name for each pool specifically required by zsmalloc */
-	snprintf(name, 38, "zswap%x", atomic_inc_return(&zswap_pools_count));
+	for (i = 0; i < ZSWAP_NR_ZPOOLS; i++) {
+		/* unique name for each pool specifically required by zsmalloc */
+		snprintf(name, 38, "zswap%x",
+			 atomic_inc_return(&zswap_pools_count));
 
-	pool->zpool = zpool_create_pool(type, name, gfp, &zswap_zpool_ops);
-	if (!pool->zpool) {
-		pr_err("%s zpool not available\n", type);
-		goto error;
+		/* no zpool_ops: zswap does its own LRU and writeback */
+		pool->zpools[i] = zpool_create_pool(type, name, gfp, NULL);
+		if (!pool->zpools[i]) {
+			pr_err("%s zpool not available\n", type);
+			goto error;
+		}
 	}
-	pr_debug("using %s zpool\n", zpool_get_type(pool->zpool));
+	pr_debug("using %s zpool\n", zpool_get_type(pool->zpools[0]));
 
 	strlcpy(pool->tfm_name, compressor, sizeof(pool->tfm_name));
 	pool->tfm = alloc_percpu(struct crypto_comp *);
@@ -551,6 +684,10 @@ static struct zswap_pool *zswap_pool_create(char *type, char *compressor)
 	 */
 	kref_init(&pool->kref);
 	INIT_LIST_HEAD(&pool->list);
+	for (i = 0; i < ZSWAP_NR_ZPOOLS; i++) {
+		INIT_LIST_HEAD(&pool->lrus[i].list);
+		spin_lock_init(&pool->lrus[i].lock);
+	}
 
 	zswap_pool_debug("created", pool);
 
@@ -558,8 +695,8 @@ static struct zswap_pool *zswap_pool_create(char *type, char *compressor)
 
 error:
 	free_percpu(pool->tfm);
-	if (pool->zpool)
-		zpool_destroy_pool(pool->zpool);
+	while (i--)
+		zpool_destroy_pool(pool->zpools[i]);
 	kfree(pool);
 	return NULL;
 }
@@ -606,11 +743,14 @@ static __init struct zswap_pool *__zswap_pool_create_fallback(void)
 
 static void zswap_pool_destroy(struct zswap_pool *pool)
 {
+	int i;
+
 	zswap_pool_debug("destroying", pool);
 
 	cpuhp_state_remove_instance(CPUHP_MM_ZSWP_POOL_PREPARE, &pool->node);
 	free_percpu(pool->tfm);
-	zpool_destroy_pool(pool->zpool);
+	for (i = 0; i < ZSWAP_NR_ZPOOLS; i++)
+		zpool_destroy_pool(pool->zpools[i]);
 	kfree(pool);
 }
 
@@ -836,14 +976,14 @@ static int zswap_get_swap_cache_page(swp_entry_t entry,
  * in the first place.  After the page has been decompressed into
  * the swap cache, the compressed version stored by zswap can be
  * freed.
+ *
+ * The caller must hold a reference on the entry.
  */
-static int zswap_writeback_entry(struct zpool *pool, unsigned long handle)
+static int zswap_writeback_entry(struct zswap_entry *entry,
+				 struct zswap_tree *tree)
 {
-	struct zswap_header *zhdr;
-	swp_entry_t swpentry;
-	struct zswap_tree *tree;
-	pgoff_t offset;
-	struct zswap_entry *entry;
+	swp_entry_t swpentry = entry->swpentry;
+	struct zpool *zpool = zswap_find_zpool(entry);
 	struct page *page;
 	struct crypto_comp *tfm;
 	u8 *src, *dst;
@@ -853,46 +993,44 @@ static int zswap_writeback_entry(struct zpool *pool, unsigned long handle)
 		.sync_mode = WB_SYNC_NONE,
 	};
 
-	/* extract swpentry from data */
-	zhdr = zpool_map_handle(pool, handle, ZPOOL_MM_RO);
-	swpentry = zhdr->swpentry; /* here */
-	tree = zswap_trees[swp_type(swpentry)];
-	offset = swp_offset(swpentry);
-
-	/* find and ref zswap entry */
-	spin_lock(&tree->lock);
-	entry = zswap_entry_find_get(&tree->rbroot, offset);
-	if (!entry) {
-		/* entry was invalidated */
-		spin_unlock(&tree->lock);
-		zpool_unmap_handle(pool, handle);
-		return 0;
-	}
-	spin_unlock(&tree->lock);
-	BUG_ON(offset != entry->offset);
-
 	/* try to allocate swap cache page */
 	switch (zswap_get_swap_cache_page(swpentry, &page)) {
 	case ZSWAP_SWAPCACHE_FAIL: /* no memory or invalidate happened */
-		ret = -ENOMEM;
-		goto fail;
+		return -ENOMEM;
 
 	case ZSWAP_SWAPCACHE_EXIST:
 		/* page is already in the swap cache, ignore for now */
 		put_page(page);
-		ret = -EEXIST;
-		goto fail;
+		return -EEXIST;
 
 	case ZSWAP_SWAPCACHE_NEW: /* page is locked */
+		/*
+		 * Our reference on the entry doesn't stop the swap slot from
+		 * being invalidated and reused.  Now that the swap cache page
+		 * holds off swapping to and from the slot, make sure the entry
+		 * is still current before writing it.
+		 */
+		spin_lock(&tree->lock);
+		if (zswap_rb_search(&tree->rbroot,
+				    swp_offset(swpentry)) != entry) {
+			spin_unlock(&tree->lock);
+			delete_from_swap_cache(page);
+			unlock_page(page);
+			put_page(page);
+			return -ENOMEM;
+		}
+		spin_unlock(&tree->lock);
+
 		/* decompress */
 		dlen = PAGE_SIZE;
-		src = (u8 *)zhdr + sizeof(struct zswap_header);
+		src = zpool_map_handle(zpool, entry->handle, ZPOOL_MM_RO);
 		dst = kmap_atomic(page);
 		tfm = *get_cpu_ptr(entry->pool->tfm);
 		ret = crypto_comp_decompress(tfm, src, entry->length,
 					     dst, &dlen);
 		put_cpu_ptr(entry->pool->tfm);
 		kunmap_atomic(dst);
+		zpool_unmap_handle(zpool, entry->handle);
 		BUG_ON(ret);
 		BUG_ON(dlen != PAGE_SIZE);
 
@@ -908,38 +1046,70 @@ static int zswap_writeback_entry(struct zpool *pool, unsigned long handle)
 	put_page(page);
 	zswap_written_back_pages++;
 
-	spin_lock(&tree->lock);
-	/* drop local reference */
-	zswap_entry_put(tree, entry);
+	return 0;
+}
+
+/*
+ * Writes back the coldest entry of one of @pool's LRUs, taking them in
+ * turn.  Returns 0 if an entry was freed, -EAGAIN if it raced with a
+ * load or invalidate, and -ENOENT if the pool has nothing left to write
+ * back.
+ */
+static int zswap_reclaim_entry(struct zswap_pool *pool)
+{
+	struct zswap_entry *entry;
+	struct zswap_tree *tree;
+	struct zswap_lru *lru;
+	pgoff_t offset;
+	int i, start, ret;
+
+	start = atomic_inc_return(&pool->next_lru);
+	for (i = 0; i < ZSWAP_NR_ZPOOLS; i++) {
+		lru = &pool->lrus[(start + i) % ZSWAP_NR_ZPOOLS];
+		spin_lock(&lru->lock);
+		if (!list_empty(&lru->list))
+			break;
+		spin_unlock(&lru->lock);
+	}
+	if (i == ZSWAP_NR_ZPOOLS)
+		return -ENOENT;
 
+	entry = list_last_entry(&lru->list, struct zswap_entry, lru);
+	list_del_init(&entry->lru);
+	atomic_long_dec(&pool->nr_lru);
 	/*
-	* There are two possible situations for entry here:
-	* (1) refcount is 1(normal case),  entry is valid and on the tree
-	* (2) refcount is 0, entry is freed and not on the tree
-	*     because invalidate happened during writeback
-	*  search the tree and free the entry if find entry
-	*/
-	if (entry == zswap_rb_search(&tree->rbroot, offset))
-		zswap_entry_put(tree, entry);
+	 * The entry may be freed as soon as the lru lock is dropped, so
+	 * don't touch it again until it has been found in the tree.
+	 */
+	offset = swp_offset(entry->swpentry);
+	tree = swap_zswap_tree(swp_type(entry->swpentry), offset);
+	spin_unlock(&lru->lock);
+
+	/* check for invalidate() race */
+	spin_lock(&tree->lock);
+	if (entry != zswap_rb_search(&tree->rbroot, offset)) {
+		spin_unlock(&tree->lock);
+		return -EAGAIN;
+	}
+	/* hold a reference to prevent a free during writeback */
+	zswap_entry_get(entry);
 	spin_unlock(&tree->lock);
 
-	goto end;
+	ret = zswap_writeback_entry(entry, tree);
 
-	/*
-	* if we get here due to ZSWAP_SWAPCACHE_EXIST
-	* a load may happening concurrently
-	* it is safe and okay to not free the entry
-	* if we free the entry in the following put
-	* it it either okay to return !0
-	*/
-fail:
 	spin_lock(&tree->lock);
+	if (ret) {
+		/* writeback failed, put the entry back on the LRU */
+		zswap_lru_add(entry);
+	} else if (entry == zswap_rb_search(&tree->rbroot, offset)) {
+		/* drop the initial reference from entry creation */
+		zswap_entry_put(tree, entry);
+	}
+	/* drop local reference */
 	zswap_entry_put(tree, entry);
 	spin_unlock(&tree->lock);
 
-end:
-	zpool_unmap_handle(pool, handle);
-	return ret;
+	return ret ? -EAGAIN : 0;
 }
 
 static int zswap_shrink(void)
@@ -951,13 +1121,80 @@ static int zswap_shrink(void)
 	if (!pool)
 		return -ENOENT;
 
-	ret = zpool_shrink(pool->zpool, 1, NULL);
+	ret = zswap_reclaim_entry(pool);
 
 	zswap_pool_put(pool);
 
 	return ret;
 }
 
+/*
+ * Under memory pressure, write the coldest compressed pages back to the
+ * swap device so that zswap doesn't keep memory pinned for pages that
+ * are unlikely to be faulted in again soon.
+ */
+static unsigned long zswap_shrinker_count(struct shrinker *shrinker,
+					  struct shrink_control *sc)
+{
+	struct zswap_pool *pool;
+	long nr;
+
+	if (!zswap_shrinker_enabled)
+		return 0;
+
+	/*
+	 * Only what zswap_shrinker_scan() can free: the entries on the
+	 * LRUs of the pool it writes back from.  Same-value filled entries
+	 * and those of newer pools are not there.
+	 */
+	pool = zswap_pool_last_get();
+	if (!pool)
+		return 0;
+	nr = atomic_long_read(&pool->nr_lru);
+	zswap_pool_put(pool);
+
+	return nr > 0 ? nr : 0;
+}
+
+static unsigned long zswap_shrinker_scan(struct shrinker *shrinker,
+					 struct shrink_control *sc)
+{
+	struct zswap_pool *pool;
+	unsigned long freed = 0;
+	unsigned long nr;
+	int ret = 0;
+
+	/* writeback goes through the swap device */
+	if (!(sc->gfp_mask & __GFP_IO))
+		return SHRINK_STOP;
+
+	pool = zswap_pool_last_get();
+	if (!pool)
+		return SHRINK_STOP;
+
+	for (nr = 0; nr < sc->nr_to_scan; nr++) {
+		ret = zswap_reclaim_entry(pool);
+		if (ret == -ENOENT)
+			break;
+		if (!ret)
+			freed++;
+		cond_resched();
+	}
+
+	zswap_pool_put(pool);
+
+	if (!freed && ret == -ENOENT)
+		return SHRINK_STOP;
+
+	return freed;
+}
+
+static struct shrinker zswap_shrinker = {
+	.count_objects = zswap_shrinker_count,
+	.scan_objects = zswap_shrinker_scan,
+	.seeks = DEFAULT_SEEKS,
+};
+
 static int zswap_is_page_same_filled(void *ptr, unsigned long *value)
 {
 	unsigned int pos;
@@ -987,15 +1224,15 @@ static void zswap_fill_page(void *ptr, unsigned long value)
 static int zswap_frontswap_store(unsigned type, pgoff_t offset,
 				struct page *page)
 {
-	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_tree *tree = swap_zswap_tree(type, offset);
 	struct zswap_entry *entry, *dupentry;
 	struct crypto_comp *tfm;
+	struct zpool *zpool;
 	int ret;
-	unsigned int hlen, dlen = PAGE_SIZE;
+	unsigned int dlen = PAGE_SIZE;
 	unsigned long handle, value;
 	char *buf;
 	u8 *src, *dst;
-	struct zswap_header zhdr = { .swpentry = swp_entry(type, offset) };
 	gfp_t gfp;
 
 	/* THP isn't supported */
@@ -1040,7 +1277,7 @@ static int zswap_frontswap_store(unsigned type, pgoff_t offset,
 		src = kmap_atomic(page);
 		if (zswap_is_page_same_filled(src, &value)) {
 			kunmap_atomic(src);
-			entry->offset = offset;
+			entry->swpentry = swp_entry(type, offset);
 			entry->length = 0;
 			entry->value = value;
 			atomic_inc(&zswap_same_filled_pages);
@@ -1049,11 +1286,19 @@ static int zswap_frontswap_store(unsigned type, pgoff_t offset,
 		kunmap_atomic(src);
 	}
 
+	/* the compressed page is charged to the page's cgroup */
+	entry->memcg = get_mem_cgroup_from_page(page);
+	if (!mem_cgroup_may_zswap(entry->memcg)) {
+		zswap_reject_memcg_limit++;
+		ret = -ENOMEM;
+		goto put_memcg;
+	}
+
 	/* if entry is successfully added, it keeps the reference */
 	entry->pool = zswap_pool_current_get();
 	if (!entry->pool) {
 		ret = -EINVAL;
-		goto freepage;
+		goto put_memcg;
 	}
 
 	/* compress */
@@ -1069,11 +1314,11 @@ static int zswap_frontswap_store(unsigned type, pgoff_t offset,
 	}
 
 	/* store */
-	hlen = zpool_evictable(entry->pool->zpool) ? sizeof(zhdr) : 0;
+	zpool = zswap_find_zpool(entry);
 	gfp = __GFP_NORETRY | __GFP_NOWARN | __GFP_KSWAPD_RECLAIM;
-	if (zpool_malloc_support_movable(entry->pool->zpool))
+	if (zpool_malloc_support_movable(zpool))
 		gfp |= __GFP_HIGHMEM | __GFP_MOVABLE;
-	ret = zpool_malloc(entry->pool->zpool, hlen + dlen, gfp, &handle);
+	ret = zpool_malloc(zpool, dlen, gfp, &handle);
 	if (ret == -ENOSPC) {
 		zswap_reject_compress_poor++;
 		goto put_dstmem;
@@ -1082,16 +1327,16 @@ static int zswap_frontswap_store(unsigned type, pgoff_t offset,
 		zswap_reject_alloc_fail++;
 		goto put_dstmem;
 	}
-	buf = zpool_map_handle(entry->pool->zpool, handle, ZPOOL_MM_RW);
-	memcpy(buf, &zhdr, hlen);
-	memcpy(buf + hlen, dst, dlen);
-	zpool_unmap_handle(entry->pool->zpool, handle);
+	buf = zpool_map_handle(zpool, handle, ZPOOL_MM_RW);
+	memcpy(buf, dst, dlen);
+	zpool_unmap_handle(zpool, handle);
 	put_cpu_var(zswap_dstmem);
 
 	/* populate entry */
-	entry->offset = offset;
+	entry->swpentry = swp_entry(type, offset);
 	entry->handle = handle;
 	entry->length = dlen;
+	mem_cgroup_charge_zswap(entry->memcg, dlen);
 
 insert_entry:
 	/* map */
@@ -1105,6 +1350,8 @@ static int zswap_frontswap_store(unsigned type, pgoff_t offset,
 			zswap_entry_put(tree, dupentry);
 		}
 	} while (ret == -EEXIST);
+	if (entry->length)
+		zswap_lru_add(entry);
 	spin_unlock(&tree->lock);
 
 	/* update stats */
@@ -1116,6 +1363,8 @@ static int zswap_frontswap_store(unsigned type, pgoff_t offset,
 put_dstmem:
 	put_cpu_var(zswap_dstmem);
 	zswap_pool_put(entry->pool);
+put_memcg:
+	mem_cgroup_put(entry->memcg);
 freepage:
 	zswap_entry_cache_free(entry);
 reject:
@@ -1129,9 +1378,10 @@ static int zswap_frontswap_store(unsigned type, pgoff_t offset,
 static int zswap_frontswap_load(unsigned type, pgoff_t offset,
 				struct page *page)
 {
-	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_tree *tree = swap_zswap_tree(type, offset);
 	struct zswap_entry *entry;
 	struct crypto_comp *tfm;
+	struct zpool *zpool;
 	u8 *src, *dst;
 	unsigned int dlen;
 	int ret;
@@ -1155,17 +1405,19 @@ static int zswap_frontswap_load(unsigned type, pgoff_t offset,
 
 	/* decompress */
 	dlen = PAGE_SIZE;
-	src = zpool_map_handle(entry->pool->zpool, entry->handle, ZPOOL_MM_RO);
-	if (zpool_evictable(entry->pool->zpool))
-		src += sizeof(struct zswap_header);
+	zpool = zswap_find_zpool(entry);
+	src = zpool_map_handle(zpool, entry->handle, ZPOOL_MM_RO);
 	dst = kmap_atomic(page);
 	tfm = *get_cpu_ptr(entry->pool->tfm);
 	ret = crypto_comp_decompress(tfm, src, entry->length, dst, &dlen);
 	put_cpu_ptr(entry->pool->tfm);
 	kunmap_atomic(dst);
-	zpool_unmap_handle(entry->pool->zpool, entry->handle);
+	zpool_unmap_handle(zpool, entry->handle);
 	BUG_ON(ret);
 
+	/* the entry is hot again, keep it away from writeback */
+	zswap_lru_rotate(entry);
+
 freeentry:
 	spin_lock(&tree->lock);
 	zswap_entry_put(tree, entry);
@@ -1177,7 +1429,7 @@ static int zswap_frontswap_load(unsigned type, pgoff_t offset,
 /* frees an entry in zswap */
 static void zswap_frontswap_invalidate_page(unsigned type, pgoff_t offset)
 {
-	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_tree *tree = swap_zswap_tree(type, offset);
 	struct zswap_entry *entry;
 
 	/* find */
@@ -1201,35 +1453,43 @@ static void zswap_frontswap_invalidate_page(unsigned type, pgoff_t offset)
 /* frees all zswap entries for the given swap type */
 static void zswap_frontswap_invalidate_area(unsigned type)
 {
-	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_tree *trees = zswap_trees[type], *tree;
 	struct zswap_entry *entry, *n;
+	int i;
 
-	if (!tree)
+	if (!trees)
 		return;
 
-	/* walk the tree and free everything */
-	spin_lock(&tree->lock);
-	rbtree_postorder_for_each_entry_safe(entry, n, &tree->rbroot, rbnode)
-		zswap_free_entry(entry);
-	tree->rbroot = RB_ROOT;
-	spin_unlock(&tree->lock);
-	kfree(tree);
+	/* walk the trees and free everything */
+	for (i = 0; i < ZSWAP_NR_TREES; i++) {
+		tree = &trees[i];
+		spin_lock(&tree->lock);
+		rbtree_postorder_for_each_entry_safe(entry, n, &tree->rbroot,
+						     rbnode)
+			zswap_free_entry(entry);
+		tree->rbroot = RB_ROOT;
+		spin_unlock(&tree->lock);
+	}
+	kfree(trees);
 	zswap_trees[type] = NULL;
 }
 
 static void zswap_frontswap_init(unsigned type)
 {
-	struct zswap_tree *tree;
+	struct zswap_tree *trees;
+	int i;
 
-	tree = kzalloc(sizeof(*tree), GFP_KERNEL);
-	if (!tree) {
+	trees = kcalloc(ZSWAP_NR_TREES, sizeof(*trees), GFP_KERNEL);
+	if (!trees) {
 		pr_err("alloc failed, zswap disabled for swap type %d\n", type);
 		return;
 	}
 
-	tree->rbroot = RB_ROOT;
-	spin_lock_init(&tree->lock);
-	zswap_trees[type] = tree;
+	for (i = 0; i < ZSWAP_NR_TREES; i++) {
+		trees[i].rbroot = RB_ROOT;
+		spin_lock_init(&trees[i].lock);
+	}
+	zswap_trees[type] = trees;
 }
 
 static struct frontswap_ops zswap_frontswap_ops = {
@@ -1265,6 +1525,8 @@ static int __init zswap_debugfs_init(void)
 			   zswap_debugfs_root, &zswap_reject_kmemcache_fail);
 	debugfs_create_u64("reject_compress_poor", 0444,
 			   zswap_debugfs_root, &zswap_reject_compress_poor);
+	debugfs_create_u64("reject_memcg_limit", 0444,
+			   zswap_debugfs_root, &zswap_reject_memcg_limit);
 	debugfs_create_u64("written_back_pages", 0444,
 			   zswap_debugfs_root, &zswap_written_back_pages);
 	debugfs_create_u64("duplicate_entry", 0444,
@@ -1324,7 +1586,7 @@ static int __init init_zswap(void)
 	pool = __zswap_pool_create_fallback();
 	if (pool) {
 		pr_info("loaded using pool %s/%s\n", pool->tfm_name,
-			zpool_get_type(pool->zpool));
+			zpool_get_type(pool->zpools[0]));
 		list_add(&pool->list, &zswap_pools);
 		zswap_has_pool = true;
 	} else {
@@ -1333,6 +1595,8 @@ static int __init init_zswap(void)
 	}
 
 	frontswap_register_ops(&zswap_frontswap_ops);
+	if (register_shrinker(&zswap_shrinker))
+		pr_warn("shrinker registration failed\n");
 	if (zswap_debugfs_init())
 		pr_warn("debugfs initialization failed\n");
 	return 0;
@@ -57,6 +57,7 @@ static struct addr_range percpu_range = {
 
 static struct sym_entry *table;
 static unsigned int table_size, table_cnt;
+static unsigned int *seqs_of_names;
 static int all_symbols;
 static int absolute_percpu;
 static int base_relative;
@@ -98,6 +99,7 @@ static bool is_ignored_symbol(const char *name, char type)
 		"kallsyms_markers",
 		"kallsyms_token_table",
 		"kallsyms_token_index",
+		"kallsyms_seqs_of_names",
 		/* Exclude linker generated symbols which vary between passes */
 		"_SDA_BASE_",		/* ppc */
 		"_SDA2_BASE_",		/* ppc */
@@ -467,6 +469,15 @@ static void write_src(void)
 	for (i = 0; i < 256; i++)
 		printf("\t.short\t%d\n", best_idx[i]);
 	printf("\n");
+
+	/* symbol indexes sorted by name, three bytes each, most significant first */
+	output_label("kallsyms_seqs_of_names");
+	for (i = 0; i < table_cnt; i++)
+		printf("\t.byte 0x%02x, 0x%02x, 0x%02x\n",
+			(seqs_of_names[i] >> 16) & 0xff,
+			(seqs_of_names[i] >> 8) & 0xff,
+			seqs_of_names[i] & 0xff);
+	printf("\n");
 }
 
 
@@ -700,6 +711,48 @@ static void sort_symbols(void)
 	qsort(table, table_cnt, sizeof(struct sym_entry), compare_symbols);
 }
 
+static int compare_names(const void *a, const void *b)
+{
+	unsigned int ia = *(const unsigned int *)a;
+	unsigned int ib = *(const unsigned int *)b;
+	int ret;
+
+	ret = strcmp(sym_name(&table[ia]), sym_name(&table[ib]));
+	if (ret)
+		return ret;
+
+	/* same name: keep address order, the kernel returns the first one */
+	return ia < ib ? -1 : ia > ib;
+}
+
+/*
+ * Build the index the kernel binary searches in kallsyms_lookup_name().
+ * This must run on the final (address sorted) table, while the names are
+ * still uncompressed.
+ */
+static void sort_symbols_by_name(void)
+{
+	unsigned int i;
+
+	if (table_cnt >= (1 << 24)) {
+		fprintf(stderr, "kallsyms failure: "
+			"too many symbols (%u) for the name index\n", table_cnt);
+		exit(EXIT_FAILURE);
+	}
+
+	seqs_of_names = malloc(sizeof(*seqs_of_names) * table_cnt);
+	if (!seqs_of_names) {
+		fprintf(stderr, "kallsyms failure: "
+			"unable to allocate required memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < table_cnt; i++)
+		seqs_of_names[i] = i;
+
+	qsort(seqs_of_names, table_cnt, sizeof(*seqs_of_names), compare_names);
+}
+
 static void make_percpus_absolute(void)
 {
 	unsigned int i;
@@ -756,6 +809,7 @@ int main(int argc, char **argv)
 	sort_symbols();
 	if (base_relative)
 		record_relative_base();
+	sort_symbols_by_name();
 	optimize_token_table();
 	write_src();
 
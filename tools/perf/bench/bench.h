@@ -41,6 +41,17 @@ int bench_futex_lock_pi(int argc, const char **argv);
 int bench_epoll_wait(int argc, const char **argv);
 int bench_epoll_ctl(int argc, const char **argv);
 
+int bench_uring_nop(int argc, const char **argv);
+int bench_uring_rw(int argc, const char **argv);
+
+int bench_vm_page_fault(int argc, const char **argv);
+int bench_vm_mmap(int argc, const char **argv);
+int bench_vm_mprotect(int argc, const char **argv);
+
+int bench_net_tcp(int argc, const char **argv);
+int bench_net_udp(int argc, const char **argv);
+int bench_net_unix(int argc, const char **argv);
+
 #define BENCH_FORMAT_DEFAULT_STR	"default"
 #define BENCH_FORMAT_DEFAULT		0
 #define BENCH_FORMAT_SIMPLE_STR		"simple"
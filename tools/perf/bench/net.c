@@ -0,0 +1,450 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * net.c
+ *
+ * tcp:  TCP throughput or round trip latency over the loopback device.
+ * udp:  UDP throughput or round trip latency over the loopback device.
+ * unix: Throughput or round trip latency of a UNIX stream socket pair.
+ *
+ * Each pair of threads owns one connection: a client that sends messages
+ * and a server that receives them, replying in latency mode.
+ */
+#include <pthread.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <linux/compiler.h>
+#include <linux/kernel.h>
+#include <internal/cpumap.h>
+#include <perf/cpumap.h>
+
+#include "../util/stat.h"
+#include "../util/string2.h"
+#include <subcmd/parse-options.h>
+#include "bench.h"
+
+#include <err.h>
+
+/* Largest payload of a UDP datagram over IPv4 */
+#define UDP_MAX_MSG	65507
+
+static unsigned int nthreads;
+static unsigned int nsecs = 5;
+static const char *size_str;
+static bool latency, noaffinity, silent;
+
+static struct timeval start, end, runtime;
+static bool done;
+
+static pthread_mutex_t thread_lock;
+static unsigned int threads_starting;
+static pthread_cond_t thread_parent, thread_worker;
+
+static size_t msg_size;
+static bool stream;
+
+struct conn {
+	int		tid;
+	pthread_t	client;
+	pthread_t	server;
+	int		fd[2];	/* client, server */
+	unsigned long	ops;
+	unsigned long	bytes;
+};
+
+static const struct option options[] = {
+	OPT_UINTEGER('t', "threads", &nthreads, "Specify amount of client/server thread pairs"),
+	OPT_UINTEGER('r', "runtime", &nsecs,    "Specify runtime (in seconds)"),
+	OPT_STRING('s', "size", &size_str, "size",
+		   "Specify the message size (default: 64KB, 1 byte with --latency)"),
+	OPT_BOOLEAN('l', "latency", &latency, "Measure request/response round trips instead of throughput"),
+	OPT_BOOLEAN('n', "noaffinity", &noaffinity, "Disables CPU affinity"),
+	OPT_BOOLEAN('q', "silent", &silent, "Silent mode: do not display per-thread data"),
+	OPT_END()
+};
+
+static const char * const bench_net_tcp_usage[] = {
+	"perf bench net tcp <options>",
+	NULL
+};
+
+static const char * const bench_net_udp_usage[] = {
+	"perf bench net udp <options>",
+	NULL
+};
+
+static const char * const bench_net_unix_usage[] = {
+	"perf bench net unix <options>",
+	NULL
+};
+
+static void toggle_done(int sig __maybe_unused,
+			siginfo_t *info __maybe_unused,
+			void *uc __maybe_unused)
+{
+	/* inform all threads that we're done for the day */
+	done = true;
+	gettimeofday(&end, NULL);
+	timersub(&end, &start, &runtime);
+}
+
+/*
+ * Transfer a whole message. The sockets have send and receive timeouts so
+ * that blocked threads notice the end of the run; returns false then.
+ */
+static bool xfer_msg(int fd, void *buf, bool do_send)
+{
+	size_t off = 0;
+	ssize_t ret;
+
+	while (off < msg_size) {
+		if (do_send)
+			ret = send(fd, buf + off, msg_size - off, MSG_NOSIGNAL);
+		else
+			ret = recv(fd, buf + off, msg_size - off, 0);
+
+		if (ret < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+				/* Lost datagrams are sent again by the client */
+				if (done || !stream)
+					return false;
+				continue;
+			}
+			/* The peer is gone after the run, or the datagram was dropped */
+			if (done || errno == ECONNREFUSED)
+				return false;
+			err(EXIT_FAILURE, do_send ? "send" : "recv");
+		}
+		if (!ret)
+			return false;
+
+		/* Datagrams are never split */
+		if (!stream)
+			return true;
+		off += ret;
+	}
+
+	return true;
+}
+
+static void worker_wait_start(void)
+{
+	pthread_mutex_lock(&thread_lock);
+	threads_starting--;
+	if (!threads_starting)
+		pthread_cond_signal(&thread_parent);
+	pthread_cond_wait(&thread_worker, &thread_lock);
+	pthread_mutex_unlock(&thread_lock);
+}
+
+static void *client_workerfn(void *arg)
+{
+	struct conn *c = arg;
+	unsigned long ops = 0;
+	void *buf;
+
+	buf = calloc(1, msg_size);
+	if (!buf)
+		err(EXIT_FAILURE, "calloc");
+
+	worker_wait_start();
+
+	while (!done) {
+		if (!xfer_msg(c->fd[0], buf, true))
+			continue;
+		if (latency) {
+			if (!xfer_msg(c->fd[0], buf, false))
+				continue;
+			ops++;
+		}
+	}
+
+	if (latency)
+		c->ops = ops;
+	free(buf);
+	return NULL;
+}
+
+static void *server_workerfn(void *arg)
+{
+	struct conn *c = arg;
+	unsigned long ops = 0;
+	void *buf;
+
+	buf = calloc(1, msg_size);
+	if (!buf)
+		err(EXIT_FAILURE, "calloc");
+
+	worker_wait_start();
+
+	while (!done) {
+		if (!xfer_msg(c->fd[1], buf, false))
+			continue;
+		if (latency)
+			xfer_msg(c->fd[1], buf, true);
+		else
+			ops++;
+	}
+
+	if (!latency) {
+		c->ops = ops;
+		c->bytes = ops * msg_size;
+	}
+	free(buf);
+	return NULL;
+}
+
+static void set_timeouts(int fd)
+{
+	struct timeval tv = { .tv_sec = 0, .tv_usec = 100000 };
+
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) ||
+	    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)))
+		err(EXIT_FAILURE, "setsockopt");
+}
+
+static int bind_loopback(int type, struct sockaddr_in *addr)
+{
+	socklen_t len = sizeof(*addr);
+	int fd;
+
+	fd = socket(AF_INET, type, 0);
+	if (fd < 0)
+		err(EXIT_FAILURE, "socket");
+
+	memset(addr, 0, sizeof(*addr));
+	addr->sin_family = AF_INET;
+	addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(fd, (struct sockaddr *)addr, len))
+		err(EXIT_FAILURE, "bind");
+	if (getsockname(fd, (struct sockaddr *)addr, &len))
+		err(EXIT_FAILURE, "getsockname");
+
+	return fd;
+}
+
+static void conn_init_tcp(struct conn *c)
+{
+	struct sockaddr_in addr;
+	int one = 1;
+	int lfd;
+
+	lfd = bind_loopback(SOCK_STREAM, &addr);
+	if (listen(lfd, 1))
+		err(EXIT_FAILURE, "listen");
+
+	c->fd[0] = socket(AF_INET, SOCK_STREAM, 0);
+	if (c->fd[0] < 0)
+		err(EXIT_FAILURE, "socket");
+	if (connect(c->fd[0], (struct sockaddr *)&addr, sizeof(addr)))
+		err(EXIT_FAILURE, "connect");
+
+	c->fd[1] = accept(lfd, NULL, NULL);
+	if (c->fd[1] < 0)
+		err(EXIT_FAILURE, "accept");
+	close(lfd);
+
+	if (latency &&
+	    (setsockopt(c->fd[0], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) ||
+	     setsockopt(c->fd[1], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one))))
+		err(EXIT_FAILURE, "setsockopt(TCP_NODELAY)");
+}
+
+static void conn_init_udp(struct conn *c)
+{
+	struct sockaddr_in addr[2];
+
+	c->fd[0] = bind_loopback(SOCK_DGRAM, &addr[0]);
+	c->fd[1] = bind_loopback(SOCK_DGRAM, &addr[1]);
+
+	if (connect(c->fd[0], (struct sockaddr *)&addr[1], sizeof(addr[1])) ||
+	    connect(c->fd[1], (struct sockaddr *)&addr[0], sizeof(addr[0])))
+		err(EXIT_FAILURE, "connect");
+}
+
+static void conn_init_unix(struct conn *c)
+{
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, c->fd))
+		err(EXIT_FAILURE, "socketpair");
+}
+
+static int bench_net(int argc, const char **argv, const char * const *usage,
+		     const char *name, void (*conn_init)(struct conn *c))
+{
+	struct sigaction act;
+	struct conn *conns;
+	struct perf_cpu_map *cpu;
+	pthread_attr_t thread_attr;
+	struct stats throughput_stats;
+	cpu_set_t cpuset;
+	unsigned int i;
+	s64 size;
+	int ret;
+
+	argc = parse_options(argc, argv, options, usage, 0);
+	if (argc) {
+		usage_with_options(usage, options);
+		exit(EXIT_FAILURE);
+	}
+
+	size = perf_atoll((char *)(size_str ?: (latency ? "1" : "64KB")));
+	if (size <= 0)
+		errx(EXIT_FAILURE, "Invalid size: %s", size_str);
+	msg_size = size;
+	stream = conn_init != conn_init_udp;
+	if (!stream && msg_size > UDP_MAX_MSG)
+		errx(EXIT_FAILURE, "UDP messages are limited to %d bytes", UDP_MAX_MSG);
+
+	cpu = perf_cpu_map__new(NULL);
+	if (!cpu)
+		err(EXIT_FAILURE, "calloc");
+
+	sigfillset(&act.sa_mask);
+	act.sa_sigaction = toggle_done;
+	sigaction(SIGINT, &act, NULL);
+
+	if (!nthreads) /* default to one pair per two CPUs */
+		nthreads = max(cpu->nr / 2, 1);
+
+	if (!nsecs)
+		nsecs = 1;
+
+	conns = calloc(nthreads, sizeof(*conns));
+	if (!conns)
+		err(EXIT_FAILURE, "calloc");
+
+	for (i = 0; i < nthreads; i++) {
+		conns[i].tid = i;
+		conn_init(&conns[i]);
+		set_timeouts(conns[i].fd[0]);
+		set_timeouts(conns[i].fd[1]);
+	}
+
+	printf("Run summary [PID %d]: %d %s connections, %zu byte messages, measuring %s, for %d secs.\n\n",
+	       getpid(), nthreads, name, msg_size,
+	       latency ? "latency" : "throughput", nsecs);
+
+	init_stats(&throughput_stats);
+	pthread_mutex_init(&thread_lock, NULL);
+	pthread_cond_init(&thread_parent, NULL);
+	pthread_cond_init(&thread_worker, NULL);
+
+	/* 'perf bench all' runs every benchmark in the same process */
+	done = false;
+	threads_starting = nthreads * 2;
+	pthread_attr_init(&thread_attr);
+	for (i = 0; i < nthreads * 2; i++) {
+		struct conn *c = &conns[i / 2];
+
+		if (!noaffinity) {
+			CPU_ZERO(&cpuset);
+			CPU_SET(cpu->map[i % cpu->nr], &cpuset);
+
+			ret = pthread_attr_setaffinity_np(&thread_attr, sizeof(cpu_set_t), &cpuset);
+			if (ret)
+				err(EXIT_FAILURE, "pthread_attr_setaffinity_np");
+		}
+
+		if (i % 2)
+			ret = pthread_create(&c->server, &thread_attr, server_workerfn, c);
+		else
+			ret = pthread_create(&c->client, &thread_attr, client_workerfn, c);
+		if (ret)
+			err(EXIT_FAILURE, "pthread_create");
+	}
+	pthread_attr_destroy(&thread_attr);
+
+	pthread_mutex_lock(&thread_lock);
+	while (threads_starting)
+		pthread_cond_wait(&thread_parent, &thread_lock);
+	gettimeofday(&start, NULL);
+	pthread_cond_broadcast(&thread_worker);
+	pthread_mutex_unlock(&thread_lock);
+
+	sleep(nsecs);
+	toggle_done(0, NULL, NULL);
+
+	for (i = 0; i < nthreads; i++) {
+		ret = pthread_join(conns[i].client, NULL);
+		if (ret)
+			err(EXIT_FAILURE, "pthread_join");
+		ret = pthread_join(conns[i].server, NULL);
+		if (ret)
+			err(EXIT_FAILURE, "pthread_join");
+	}
+
+	pthread_cond_destroy(&thread_parent);
+	pthread_cond_destroy(&thread_worker);
+	pthread_mutex_destroy(&thread_lock);
+
+	for (i = 0; i < nthreads; i++) {
+		unsigned long t = conns[i].ops / runtime.tv_sec;
+
+		update_stats(&throughput_stats, t);
+		if (!silent) {
+			if (latency)
+				printf("[conn %3d] %ld round trips/sec, %.2f usecs/round trip\n",
+				       conns[i].tid, t, t ? 1000000.0 / t : 0);
+			else
+				printf("[conn %3d] %ld msgs/sec, %.2f MB/sec\n",
+				       conns[i].tid, t,
+				       (double)conns[i].bytes / runtime.tv_sec / (1024 * 1024));
+		}
+
+		close(conns[i].fd[0]);
+		close(conns[i].fd[1]);
+	}
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("%sAveraged %.0f %s/sec (+- %.2f%%) per connection",
+		       !silent ? "\n" : "", avg_stats(&throughput_stats),
+		       latency ? "round trips" : "msgs",
+		       rel_stddev_stats(stddev_stats(&throughput_stats),
+					avg_stats(&throughput_stats)));
+		if (latency)
+			printf(", %.2f usecs/round trip",
+			       avg_stats(&throughput_stats) ?
+			       1000000.0 / avg_stats(&throughput_stats) : 0);
+		else
+			printf(", %.2f MB/sec total",
+			       avg_stats(&throughput_stats) * nthreads *
+			       msg_size / (1024 * 1024));
+		printf(", secs = %d\n", (int)runtime.tv_sec);
+		break;
+	case BENCH_FORMAT_SIMPLE:
+		printf("%.0f\n", avg_stats(&throughput_stats) * nthreads);
+		break;
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+	}
+
+	free(conns);
+	perf_cpu_map__put(cpu);
+	return 0;
+}
+
+int bench_net_tcp(int argc, const char **argv)
+{
+	return bench_net(argc, argv, bench_net_tcp_usage, "TCP", conn_init_tcp);
+}
+
+int bench_net_udp(int argc, const char **argv)
+{
+	return bench_net(argc, argv, bench_net_udp_usage, "UDP", conn_init_udp);
+}
+
+int bench_net_unix(int argc, const char **argv)
+{
+	return bench_net(argc, argv, bench_net_unix_usage, "UNIX", conn_init_unix);
+}
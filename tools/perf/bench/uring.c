@@ -0,0 +1,607 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * uring.c
+ *
+ * nop: Measure the io_uring submission and completion overhead, by
+ *      having each thread push batches of IORING_OP_NOP through its own ring.
+ * rw:  Read or write a file (ideally a null_blk device) through io_uring,
+ *      optionally with registered files and buffers.
+ */
+#include <pthread.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <linux/compiler.h>
+#include <linux/kernel.h>
+#include <linux/zalloc.h>
+#include <linux/io_uring.h>
+#include <asm/barrier.h>
+#include <internal/cpumap.h>
+#include <perf/cpumap.h>
+
+#include "../util/stat.h"
+#include "../util/string2.h"
+#include <subcmd/parse-options.h>
+#include "bench.h"
+
+#include <err.h>
+
+#ifdef __alpha__
+# ifndef __NR_io_uring_setup
+#  define __NR_io_uring_setup		535
+# endif
+# ifndef __NR_io_uring_enter
+#  define __NR_io_uring_enter		536
+# endif
+# ifndef __NR_io_uring_register
+#  define __NR_io_uring_register	537
+# endif
+#else /* !__alpha__ */
+# ifndef __NR_io_uring_setup
+#  define __NR_io_uring_setup		425
+# endif
+# ifndef __NR_io_uring_enter
+#  define __NR_io_uring_enter		426
+# endif
+# ifndef __NR_io_uring_register
+#  define __NR_io_uring_register	427
+# endif
+#endif
+
+static unsigned int nthreads;
+static unsigned int nsecs = 5;
+static unsigned int depth = 32;
+static const char *bs_str;
+static const char *file_str = "/dev/nullb0";
+static bool do_write, fixed_files, fixed_bufs, direct = true;
+static bool noaffinity, silent;
+
+static struct timeval start, end, runtime;
+static bool done;
+
+static pthread_mutex_t thread_lock;
+static unsigned int threads_starting;
+static pthread_cond_t thread_parent, thread_worker;
+
+static size_t block_size;
+
+struct uring_sq {
+	unsigned int		*head;
+	unsigned int		*tail;
+	unsigned int		*ring_mask;
+	unsigned int		*array;
+	struct io_uring_sqe	*sqes;
+	void			*ring;
+	size_t			ring_sz;
+};
+
+struct uring_cq {
+	unsigned int		*head;
+	unsigned int		*tail;
+	unsigned int		*ring_mask;
+	struct io_uring_cqe	*cqes;
+	void			*ring;
+	size_t			ring_sz;
+};
+
+struct submitter {
+	int		tid;
+	pthread_t	thread;
+	int		ring_fd;
+	struct uring_sq	sq;
+	struct uring_cq	cq;
+	unsigned int	entries;
+	int		fd;
+	off_t		file_size;
+	off_t		offset;
+	struct iovec	*iovecs;
+	unsigned long	ops;
+	int		err;
+};
+
+static const struct option nop_options[] = {
+	OPT_UINTEGER('t', "threads", &nthreads, "Specify amount of threads"),
+	OPT_UINTEGER('r', "runtime", &nsecs,    "Specify runtime (in seconds)"),
+	OPT_UINTEGER('d', "depth", &depth,      "Specify the number of requests submitted at once"),
+	OPT_BOOLEAN('n', "noaffinity", &noaffinity, "Disables CPU affinity"),
+	OPT_BOOLEAN('q', "silent", &silent, "Silent mode: do not display per-thread data"),
+	OPT_END()
+};
+
+static const struct option rw_options[] = {
+	OPT_UINTEGER('t', "threads", &nthreads, "Specify amount of threads"),
+	OPT_UINTEGER('r', "runtime", &nsecs,    "Specify runtime (in seconds)"),
+	OPT_UINTEGER('d', "depth", &depth,      "Specify the number of requests submitted at once"),
+	OPT_STRING('f', "file", &file_str, "path",
+		   "File or block device to do I/O on (default: /dev/nullb0)"),
+	OPT_STRING('b', "block-size", &bs_str, "4KB", "Specify the size of each I/O"),
+	OPT_BOOLEAN('w', "write", &do_write, "Write instead of read"),
+	OPT_BOOLEAN('D', "direct", &direct, "Use O_DIRECT (default, disable with --no-direct)"),
+	OPT_BOOLEAN('F', "fixed-files", &fixed_files, "Use registered files"),
+	OPT_BOOLEAN('B', "fixed-bufs", &fixed_bufs, "Use registered buffers"),
+	OPT_BOOLEAN('n', "noaffinity", &noaffinity, "Disables CPU affinity"),
+	OPT_BOOLEAN('q', "silent", &silent, "Silent mode: do not display per-thread data"),
+	OPT_END()
+};
+
+static const char * const bench_uring_nop_usage[] = {
+	"perf bench uring nop <options>",
+	NULL
+};
+
+static const char * const bench_uring_rw_usage[] = {
+	"perf bench uring rw <options>",
+	NULL
+};
+
+static int io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned int to_submit,
+			  unsigned int min_complete, unsigned int flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+		       flags, NULL, 0);
+}
+
+static int io_uring_register(int fd, unsigned int opcode, void *arg,
+			     unsigned int nr_args)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void uring_exit(struct submitter *s)
+{
+	if (s->sq.sqes)
+		munmap(s->sq.sqes, s->entries * sizeof(struct io_uring_sqe));
+	if (s->sq.ring)
+		munmap(s->sq.ring, s->sq.ring_sz);
+	if (s->cq.ring)
+		munmap(s->cq.ring, s->cq.ring_sz);
+	if (s->ring_fd >= 0)
+		close(s->ring_fd);
+	s->sq.sqes = NULL;
+	s->sq.ring = s->cq.ring = NULL;
+	s->ring_fd = -1;
+}
+
+/*
+ * Errors that depend on the machine, rather than on the options, make
+ * the benchmark skip instead of exiting, so that 'perf bench all' goes
+ * on with the next one.
+ */
+static int uring_init(struct submitter *s)
+{
+	struct io_uring_params p;
+	struct uring_sq *sq = &s->sq;
+	struct uring_cq *cq = &s->cq;
+	void *ring;
+
+	memset(&p, 0, sizeof(p));
+	s->ring_fd = io_uring_setup(depth, &p);
+	if (s->ring_fd < 0) {
+		if (errno == ENOSYS)
+			fprintf(stderr, "io_uring is not supported by this kernel\n");
+		else
+			fprintf(stderr, "io_uring_setup: %s\n", strerror(errno));
+		return -1;
+	}
+	s->entries = p.sq_entries;
+
+	sq->ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	ring = mmap(NULL, sq->ring_sz, PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_POPULATE, s->ring_fd, IORING_OFF_SQ_RING);
+	if (ring == MAP_FAILED)
+		goto out_mmap;
+	sq->ring = ring;
+	sq->head = sq->ring + p.sq_off.head;
+	sq->tail = sq->ring + p.sq_off.tail;
+	sq->ring_mask = sq->ring + p.sq_off.ring_mask;
+	sq->array = sq->ring + p.sq_off.array;
+
+	ring = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+		    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		    s->ring_fd, IORING_OFF_SQES);
+	if (ring == MAP_FAILED)
+		goto out_mmap;
+	sq->sqes = ring;
+
+	cq->ring_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	ring = mmap(NULL, cq->ring_sz, PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_POPULATE, s->ring_fd, IORING_OFF_CQ_RING);
+	if (ring == MAP_FAILED)
+		goto out_mmap;
+	cq->ring = ring;
+	cq->head = cq->ring + p.cq_off.head;
+	cq->tail = cq->ring + p.cq_off.tail;
+	cq->ring_mask = cq->ring + p.cq_off.ring_mask;
+	cq->cqes = cq->ring + p.cq_off.cqes;
+	return 0;
+
+out_mmap:
+	fprintf(stderr, "mmap: %s\n", strerror(errno));
+	uring_exit(s);
+	return -1;
+}
+
+static void uring_prep(struct submitter *s, struct io_uring_sqe *sqe,
+		       unsigned int idx)
+{
+	memset(sqe, 0, sizeof(*sqe));
+
+	if (s->fd < 0) {
+		sqe->opcode = IORING_OP_NOP;
+		return;
+	}
+
+	if (fixed_files) {
+		sqe->fd = 0;
+		sqe->flags = IOSQE_FIXED_FILE;
+	} else {
+		sqe->fd = s->fd;
+	}
+
+	if (fixed_bufs) {
+		sqe->opcode = do_write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+		sqe->addr = (unsigned long)s->iovecs[idx].iov_base;
+		sqe->len = block_size;
+		sqe->buf_index = idx;
+	} else {
+		sqe->opcode = do_write ? IORING_OP_WRITEV : IORING_OP_READV;
+		sqe->addr = (unsigned long)&s->iovecs[idx];
+		sqe->len = 1;
+	}
+
+	sqe->off = s->offset;
+	s->offset += block_size;
+	if (s->offset + (off_t)block_size > s->file_size)
+		s->offset = 0;
+}
+
+/*
+ * Fill the whole SQ ring, submit it and wait for all of it to complete.
+ * Returns the number of completed requests, or a negative errno.
+ */
+static int uring_submit_batch(struct submitter *s)
+{
+	struct uring_sq *sq = &s->sq;
+	struct uring_cq *cq = &s->cq;
+	unsigned int tail, head, mask, i, reaped = 0;
+	int ret;
+
+	tail = *sq->tail;
+	mask = *sq->ring_mask;
+	for (i = 0; i < s->entries; i++, tail++) {
+		unsigned int idx = tail & mask;
+
+		uring_prep(s, &sq->sqes[idx], idx);
+		sq->array[idx] = idx;
+	}
+	smp_store_release(sq->tail, tail);
+
+	ret = io_uring_enter(s->ring_fd, s->entries, s->entries,
+			     IORING_ENTER_GETEVENTS);
+	if (ret < 0)
+		return -errno;
+
+	head = *cq->head;
+	mask = *cq->ring_mask;
+	while (reaped < s->entries) {
+		struct io_uring_cqe *cqe;
+
+		if (head == smp_load_acquire(cq->tail)) {
+			ret = io_uring_enter(s->ring_fd, 0, 1, IORING_ENTER_GETEVENTS);
+			if (ret < 0)
+				return -errno;
+			continue;
+		}
+
+		cqe = &cq->cqes[head & mask];
+		if (cqe->res < 0)
+			return cqe->res;
+		head++;
+		reaped++;
+	}
+	smp_store_release(cq->head, head);
+
+	return reaped;
+}
+
+static void *workerfn(void *arg)
+{
+	struct submitter *s = arg;
+	unsigned long ops = 0;
+	int ret;
+
+	pthread_mutex_lock(&thread_lock);
+	threads_starting--;
+	if (!threads_starting)
+		pthread_cond_signal(&thread_parent);
+	pthread_cond_wait(&thread_worker, &thread_lock);
+	pthread_mutex_unlock(&thread_lock);
+
+	do {
+		ret = uring_submit_batch(s);
+		if (ret < 0) {
+			/* stop everybody, the results would be meaningless */
+			s->err = ret;
+			done = true;
+			break;
+		}
+		ops += ret;
+	} while (!done);
+
+	s->ops = ops;
+	return NULL;
+}
+
+static void toggle_done(int sig __maybe_unused,
+			siginfo_t *info __maybe_unused,
+			void *uc __maybe_unused)
+{
+	/* inform all threads that we're done for the day */
+	done = true;
+	gettimeofday(&end, NULL);
+	timersub(&end, &start, &runtime);
+}
+
+static void submitter_exit_rw(struct submitter *s)
+{
+	unsigned int i;
+
+	if (s->iovecs) {
+		for (i = 0; i < s->entries; i++)
+			free(s->iovecs[i].iov_base);
+		zfree(&s->iovecs);
+	}
+	if (s->fd >= 0)
+		close(s->fd);
+	s->fd = -1;
+}
+
+static int submitter_init_rw(struct submitter *s)
+{
+	unsigned int i;
+
+	s->fd = open(file_str, (do_write ? O_WRONLY : O_RDONLY) |
+		     (direct ? O_DIRECT : 0));
+	if (s->fd < 0) {
+		fprintf(stderr, "open %s: %s%s\n", file_str, strerror(errno),
+			errno == ENOENT && !strcmp(file_str, "/dev/nullb0") ?
+			" (load null_blk or use --file)" : "");
+		return -1;
+	}
+
+	s->file_size = lseek(s->fd, 0, SEEK_END);
+	if (s->file_size < (off_t)block_size) {
+		fprintf(stderr, "%s is smaller than the block size\n", file_str);
+		goto out_err;
+	}
+
+	/* Spread the threads over the file */
+	s->offset = (s->file_size / nthreads) * s->tid;
+	s->offset -= s->offset % block_size;
+
+	s->iovecs = calloc(s->entries, sizeof(*s->iovecs));
+	if (!s->iovecs)
+		err(EXIT_FAILURE, "calloc");
+
+	for (i = 0; i < s->entries; i++) {
+		if (posix_memalign(&s->iovecs[i].iov_base, 4096, block_size))
+			err(EXIT_FAILURE, "posix_memalign");
+		memset(s->iovecs[i].iov_base, 0, block_size);
+		s->iovecs[i].iov_len = block_size;
+	}
+
+	if (fixed_files &&
+	    io_uring_register(s->ring_fd, IORING_REGISTER_FILES, &s->fd, 1)) {
+		fprintf(stderr, "io_uring_register(IORING_REGISTER_FILES): %s\n",
+			strerror(errno));
+		goto out_err;
+	}
+
+	if (fixed_bufs &&
+	    io_uring_register(s->ring_fd, IORING_REGISTER_BUFFERS,
+			      s->iovecs, s->entries)) {
+		fprintf(stderr, "io_uring_register(IORING_REGISTER_BUFFERS): %s\n",
+			strerror(errno));
+		goto out_err;
+	}
+	return 0;
+
+out_err:
+	submitter_exit_rw(s);
+	return -1;
+}
+
+static int bench_uring(int argc, const char **argv,
+		       const struct option *options,
+		       const char * const *usage, bool rw)
+{
+	struct sigaction act;
+	struct submitter *submitter;
+	struct perf_cpu_map *cpu;
+	pthread_attr_t thread_attr;
+	struct stats throughput_stats;
+	cpu_set_t cpuset;
+	unsigned int i;
+	int ret, res = 0;
+
+	argc = parse_options(argc, argv, options, usage, 0);
+	if (argc) {
+		usage_with_options(usage, options);
+		exit(EXIT_FAILURE);
+	}
+
+	if (!depth)
+		errx(EXIT_FAILURE, "Invalid depth: 0");
+
+	if (rw) {
+		s64 bs = perf_atoll((char *)(bs_str ?: "4KB"));
+
+		if (bs <= 0)
+			errx(EXIT_FAILURE, "Invalid block size: %s", bs_str);
+		block_size = bs;
+	}
+
+	cpu = perf_cpu_map__new(NULL);
+	if (!cpu)
+		err(EXIT_FAILURE, "calloc");
+
+	sigfillset(&act.sa_mask);
+	act.sa_sigaction = toggle_done;
+	sigaction(SIGINT, &act, NULL);
+
+	if (!nthreads) /* default to the number of CPUs */
+		nthreads = cpu->nr;
+
+	if (!nsecs)
+		nsecs = 1;
+
+	submitter = calloc(nthreads, sizeof(*submitter));
+	if (!submitter)
+		err(EXIT_FAILURE, "calloc");
+
+	for (i = 0; i < nthreads; i++) {
+		submitter[i].tid = i;
+		submitter[i].ring_fd = -1;
+		submitter[i].fd = -1;
+	}
+
+	for (i = 0; i < nthreads; i++) {
+		if (uring_init(&submitter[i]) ||
+		    (rw && submitter_init_rw(&submitter[i]))) {
+			res = -1;
+			goto out_skip;
+		}
+	}
+
+	if (rw)
+		printf("Run summary [PID %d]: %d threads doing %zu byte %s%s%s on %s, depth %d, for %d secs.\n\n",
+		       getpid(), nthreads, block_size,
+		       do_write ? "writes" : "reads",
+		       fixed_files ? ", fixed files" : "",
+		       fixed_bufs ? ", fixed buffers" : "",
+		       file_str, submitter[0].entries, nsecs);
+	else
+		printf("Run summary [PID %d]: %d threads submitting nops, depth %d, for %d secs.\n\n",
+		       getpid(), nthreads, submitter[0].entries, nsecs);
+
+	init_stats(&throughput_stats);
+	pthread_mutex_init(&thread_lock, NULL);
+	pthread_cond_init(&thread_parent, NULL);
+	pthread_cond_init(&thread_worker, NULL);
+
+	/* 'perf bench all' runs nop and rw in the same process */
+	done = false;
+	threads_starting = nthreads;
+	pthread_attr_init(&thread_attr);
+	for (i = 0; i < nthreads; i++) {
+		if (!noaffinity) {
+			CPU_ZERO(&cpuset);
+			CPU_SET(cpu->map[i % cpu->nr], &cpuset);
+
+			ret = pthread_attr_setaffinity_np(&thread_attr, sizeof(cpu_set_t), &cpuset);
+			if (ret)
+				err(EXIT_FAILURE, "pthread_attr_setaffinity_np");
+		}
+
+		ret = pthread_create(&submitter[i].thread, &thread_attr,
+				     workerfn, &submitter[i]);
+		if (ret)
+			err(EXIT_FAILURE, "pthread_create");
+	}
+	pthread_attr_destroy(&thread_attr);
+
+	pthread_mutex_lock(&thread_lock);
+	while (threads_starting)
+		pthread_cond_wait(&thread_parent, &thread_lock);
+	gettimeofday(&start, NULL);
+	pthread_cond_broadcast(&thread_worker);
+	pthread_mutex_unlock(&thread_lock);
+
+	sleep(nsecs);
+	toggle_done(0, NULL, NULL);
+
+	for (i = 0; i < nthreads; i++) {
+		ret = pthread_join(submitter[i].thread, NULL);
+		if (ret)
+			err(EXIT_FAILURE, "pthread_join");
+	}
+
+	pthread_cond_destroy(&thread_parent);
+	pthread_cond_destroy(&thread_worker);
+	pthread_mutex_destroy(&thread_lock);
+
+	for (i = 0; i < nthreads; i++) {
+		if (submitter[i].err && !res) {
+			fprintf(stderr, "io_uring: %s\n",
+				strerror(-submitter[i].err));
+			res = submitter[i].err;
+		}
+	}
+	if (res)
+		goto out_skip;
+
+	for (i = 0; i < nthreads; i++) {
+		unsigned long t = submitter[i].ops / runtime.tv_sec;
+
+		update_stats(&throughput_stats, t);
+		if (!silent)
+			printf("[thread %3d] %ld ops/sec\n", submitter[i].tid, t);
+	}
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("%sAveraged %.0f ops/sec (+- %.2f%%) per thread, %.0f total",
+		       !silent ? "\n" : "", avg_stats(&throughput_stats),
+		       rel_stddev_stats(stddev_stats(&throughput_stats),
+					avg_stats(&throughput_stats)),
+		       avg_stats(&throughput_stats) * nthreads);
+		if (rw)
+			printf(" (%.2f MB/sec)", avg_stats(&throughput_stats) *
+			       nthreads * block_size / (1024 * 1024));
+		printf(", secs = %d\n", (int)runtime.tv_sec);
+		break;
+	case BENCH_FORMAT_SIMPLE:
+		printf("%.0f\n", avg_stats(&throughput_stats) * nthreads);
+		break;
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+	}
+
+out:
+	for (i = 0; i < nthreads; i++) {
+		if (rw)
+			submitter_exit_rw(&submitter[i]);
+		uring_exit(&submitter[i]);
+	}
+	free(submitter);
+	perf_cpu_map__put(cpu);
+	return res;
+
+out_skip:
+	printf("Skipping the benchmark.\n");
+	goto out;
+}
+
+int bench_uring_nop(int argc, const char **argv)
+{
+	return bench_uring(argc, argv, nop_options, bench_uring_nop_usage, false);
+}
+
+int bench_uring_rw(int argc, const char **argv)
+{
+	return bench_uring(argc, argv, rw_options, bench_uring_rw_usage, true);
+}
@@ -0,0 +1,500 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * vm.c
+ *
+ * page-fault: Stress concurrent page faults, on anonymous or file
+ *             backed memory, with or without transparent huge pages.
+ * mmap:       Stress concurrent mmap()/munmap() of the same mm.
+ * mprotect:   Stress concurrent VMA splitting and merging with mprotect().
+ *
+ * All the threads share a single mm, so these mostly measure the
+ * scalability of mmap_sem and of the page table locks.
+ */
+#include <pthread.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <linux/compiler.h>
+#include <linux/kernel.h>
+#include <internal/cpumap.h>
+#include <perf/cpumap.h>
+
+#include "../util/stat.h"
+#include "../util/string2.h"
+#include <subcmd/parse-options.h>
+#include "bench.h"
+
+#include <err.h>
+
+static unsigned int nthreads;
+static unsigned int nsecs = 5;
+static const char *size_str;
+static const char *file_str;
+static bool thp, file_backed, shared_vma, noaffinity, silent;
+
+static struct timeval start, end, runtime;
+static bool done;
+
+static pthread_mutex_t thread_lock;
+static unsigned int threads_starting;
+static pthread_cond_t thread_parent, thread_worker;
+
+static size_t page_size;
+
+struct worker {
+	int		tid;
+	pthread_t	thread;
+	void		*addr;
+	size_t		size;
+	unsigned long	ops;
+	unsigned long	faults;
+};
+
+static const struct option page_fault_options[] = {
+	OPT_UINTEGER('t', "threads", &nthreads, "Specify amount of threads"),
+	OPT_UINTEGER('r', "runtime", &nsecs,    "Specify runtime (in seconds)"),
+	OPT_STRING('s', "size", &size_str, "32MB",
+		   "Specify the memory faulted in by each thread"),
+	OPT_BOOLEAN('H', "thp", &thp, "Fault in transparent huge pages"),
+	OPT_BOOLEAN('F', "file", &file_backed, "Fault in a shared file mapping instead of anonymous memory"),
+	OPT_STRING(0, "file-path", &file_str, "path",
+		   "Directory to create the file in (default: /tmp)"),
+	OPT_BOOLEAN('S', "shared-vma", &shared_vma, "All threads fault in slices of a single VMA"),
+	OPT_BOOLEAN('n', "noaffinity", &noaffinity, "Disables CPU affinity"),
+	OPT_BOOLEAN('q', "silent", &silent, "Silent mode: do not display per-thread data"),
+	OPT_END()
+};
+
+static const struct option mmap_options[] = {
+	OPT_UINTEGER('t', "threads", &nthreads, "Specify amount of threads"),
+	OPT_UINTEGER('r', "runtime", &nsecs,    "Specify runtime (in seconds)"),
+	OPT_STRING('s', "size", &size_str, "4KB",
+		   "Specify the size of each mapping"),
+	OPT_BOOLEAN('n', "noaffinity", &noaffinity, "Disables CPU affinity"),
+	OPT_BOOLEAN('q', "silent", &silent, "Silent mode: do not display per-thread data"),
+	OPT_END()
+};
+
+static const struct option mprotect_options[] = {
+	OPT_UINTEGER('t', "threads", &nthreads, "Specify amount of threads"),
+	OPT_UINTEGER('r', "runtime", &nsecs,    "Specify runtime (in seconds)"),
+	OPT_STRING('s', "size", &size_str, "64KB",
+		   "Specify the size of the region changed by each thread"),
+	OPT_BOOLEAN('n', "noaffinity", &noaffinity, "Disables CPU affinity"),
+	OPT_BOOLEAN('q', "silent", &silent, "Silent mode: do not display per-thread data"),
+	OPT_END()
+};
+
+static const char * const bench_vm_page_fault_usage[] = {
+	"perf bench vm page-fault <options>",
+	NULL
+};
+
+static const char * const bench_vm_mmap_usage[] = {
+	"perf bench vm mmap <options>",
+	NULL
+};
+
+static const char * const bench_vm_mprotect_usage[] = {
+	"perf bench vm mprotect <options>",
+	NULL
+};
+
+static void toggle_done(int sig __maybe_unused,
+			siginfo_t *info __maybe_unused,
+			void *uc __maybe_unused)
+{
+	/* inform all threads that we're done for the day */
+	done = true;
+	gettimeofday(&end, NULL);
+	timersub(&end, &start, &runtime);
+}
+
+static void worker_wait_start(void)
+{
+	pthread_mutex_lock(&thread_lock);
+	threads_starting--;
+	if (!threads_starting)
+		pthread_cond_signal(&thread_parent);
+	pthread_cond_wait(&thread_worker, &thread_lock);
+	pthread_mutex_unlock(&thread_lock);
+}
+
+static unsigned long thread_minflt(void)
+{
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_THREAD, &usage))
+		return 0;
+	return usage.ru_minflt + usage.ru_majflt;
+}
+
+static void *page_fault_workerfn(void *arg)
+{
+	struct worker *w = arg;
+	unsigned long ops = 0, faults;
+	size_t off;
+
+	worker_wait_start();
+
+	faults = thread_minflt();
+	do {
+		for (off = 0; off < w->size; off += page_size, ops++)
+			*((volatile char *)w->addr + off) = 1;
+
+		/* Zap the page tables, so that the next pass faults again */
+		if (madvise(w->addr, w->size, MADV_DONTNEED))
+			err(EXIT_FAILURE, "madvise");
+	} while (!done);
+
+	w->faults = thread_minflt() - faults;
+	w->ops = ops;
+	return NULL;
+}
+
+static void *mmap_workerfn(void *arg)
+{
+	struct worker *w = arg;
+	unsigned long ops = 0;
+	void *addr;
+
+	worker_wait_start();
+
+	do {
+		addr = mmap(NULL, w->size, PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (addr == MAP_FAILED)
+			err(EXIT_FAILURE, "mmap");
+
+		*(volatile char *)addr = 1;
+
+		if (munmap(addr, w->size))
+			err(EXIT_FAILURE, "munmap");
+		ops++;
+	} while (!done);
+
+	w->ops = ops;
+	return NULL;
+}
+
+static void *mprotect_workerfn(void *arg)
+{
+	struct worker *w = arg;
+	unsigned long ops = 0;
+
+	worker_wait_start();
+
+	/* Each call splits the shared VMA, the next one merges it back */
+	do {
+		if (mprotect(w->addr, w->size, PROT_READ))
+			err(EXIT_FAILURE, "mprotect");
+		if (mprotect(w->addr, w->size, PROT_READ | PROT_WRITE))
+			err(EXIT_FAILURE, "mprotect");
+		ops += 2;
+	} while (!done);
+
+	w->ops = ops;
+	return NULL;
+}
+
+static int open_backing_file(size_t size)
+{
+	char path[PATH_MAX];
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/perf-bench-vm-XXXXXX",
+		 file_str ?: "/tmp");
+
+	fd = mkstemp(path);
+	if (fd < 0)
+		err(EXIT_FAILURE, "mkstemp: %s", path);
+	unlink(path);
+
+	if (ftruncate(fd, size))
+		err(EXIT_FAILURE, "ftruncate");
+
+	return fd;
+}
+
+static void *map_region(size_t size, int fd, off_t offset)
+{
+	void *addr;
+
+	if (fd >= 0)
+		addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset);
+	else
+		addr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (addr == MAP_FAILED)
+		err(EXIT_FAILURE, "mmap");
+
+	if (fd < 0 && madvise(addr, size, thp ? MADV_HUGEPAGE : MADV_NOHUGEPAGE))
+		warn("madvise(%s)", thp ? "MADV_HUGEPAGE" : "MADV_NOHUGEPAGE");
+
+	return addr;
+}
+
+static size_t parse_size(const char *str, const char *def)
+{
+	s64 size = perf_atoll((char *)(str ?: def));
+
+	if (size <= 0)
+		errx(EXIT_FAILURE, "Invalid size: %s", str);
+
+	return PERF_ALIGN((size_t)size, page_size);
+}
+
+static int bench_vm_run(const char *name, void *(*workerfn)(void *),
+			struct worker *worker, bool report_faults)
+{
+	struct perf_cpu_map *cpu;
+	pthread_attr_t thread_attr;
+	struct stats throughput_stats, fault_stats;
+	cpu_set_t cpuset;
+	unsigned int i;
+	int ret;
+
+	cpu = perf_cpu_map__new(NULL);
+	if (!cpu)
+		err(EXIT_FAILURE, "calloc");
+
+	init_stats(&throughput_stats);
+	init_stats(&fault_stats);
+	pthread_mutex_init(&thread_lock, NULL);
+	pthread_cond_init(&thread_parent, NULL);
+	pthread_cond_init(&thread_worker, NULL);
+
+	/* 'perf bench all' runs every benchmark in the same process */
+	done = false;
+	threads_starting = nthreads;
+	pthread_attr_init(&thread_attr);
+	for (i = 0; i < nthreads; i++) {
+		worker[i].tid = i;
+
+		if (!noaffinity) {
+			CPU_ZERO(&cpuset);
+			CPU_SET(cpu->map[i % cpu->nr], &cpuset);
+
+			ret = pthread_attr_setaffinity_np(&thread_attr, sizeof(cpu_set_t), &cpuset);
+			if (ret)
+				err(EXIT_FAILURE, "pthread_attr_setaffinity_np");
+		}
+
+		ret = pthread_create(&worker[i].thread, &thread_attr, workerfn, &worker[i]);
+		if (ret)
+			err(EXIT_FAILURE, "pthread_create");
+	}
+	pthread_attr_destroy(&thread_attr);
+
+	pthread_mutex_lock(&thread_lock);
+	while (threads_starting)
+		pthread_cond_wait(&thread_parent, &thread_lock);
+	gettimeofday(&start, NULL);
+	pthread_cond_broadcast(&thread_worker);
+	pthread_mutex_unlock(&thread_lock);
+
+	sleep(nsecs);
+	toggle_done(0, NULL, NULL);
+
+	for (i = 0; i < nthreads; i++) {
+		ret = pthread_join(worker[i].thread, NULL);
+		if (ret)
+			err(EXIT_FAILURE, "pthread_join");
+	}
+
+	pthread_cond_destroy(&thread_parent);
+	pthread_cond_destroy(&thread_worker);
+	pthread_mutex_destroy(&thread_lock);
+
+	for (i = 0; i < nthreads; i++) {
+		unsigned long t = worker[i].ops / runtime.tv_sec;
+		unsigned long f = worker[i].faults / runtime.tv_sec;
+
+		update_stats(&throughput_stats, t);
+		update_stats(&fault_stats, f);
+		if (silent)
+			continue;
+
+		if (report_faults)
+			printf("[thread %3d] %ld %s/sec, %ld faults/sec\n",
+			       worker[i].tid, t, name, f);
+		else
+			printf("[thread %3d] %ld %s/sec\n", worker[i].tid, t, name);
+	}
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("%sAveraged %.0f %s/sec (+- %.2f%%) per thread, %.0f total, secs = %d\n",
+		       !silent ? "\n" : "", avg_stats(&throughput_stats), name,
+		       rel_stddev_stats(stddev_stats(&throughput_stats),
+					avg_stats(&throughput_stats)),
+		       avg_stats(&throughput_stats) * nthreads,
+		       (int)runtime.tv_sec);
+		if (report_faults)
+			printf("Averaged %.0f faults/sec per thread\n",
+			       avg_stats(&fault_stats));
+		break;
+	case BENCH_FORMAT_SIMPLE:
+		printf("%.0f\n", avg_stats(&throughput_stats) * nthreads);
+		break;
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+	}
+
+	perf_cpu_map__put(cpu);
+	return 0;
+}
+
+static void bench_vm_init(int argc, const char **argv,
+			  const struct option *options,
+			  const char * const *usage)
+{
+	struct sigaction act;
+
+	argc = parse_options(argc, argv, options, usage, 0);
+	if (argc) {
+		usage_with_options(usage, options);
+		exit(EXIT_FAILURE);
+	}
+
+	page_size = sysconf(_SC_PAGESIZE);
+
+	if (!nthreads) /* default to the number of CPUs */
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (!nsecs)
+		nsecs = 1;
+
+	sigfillset(&act.sa_mask);
+	act.sa_sigaction = toggle_done;
+	sigaction(SIGINT, &act, NULL);
+}
+
+int bench_vm_page_fault(int argc, const char **argv)
+{
+	struct worker *worker;
+	size_t size;
+	void *addr = NULL;
+	unsigned int i;
+	int fd = -1;
+
+	bench_vm_init(argc, argv, page_fault_options, bench_vm_page_fault_usage);
+
+	size = parse_size(size_str, "32MB");
+	if (thp && file_backed)
+		errx(EXIT_FAILURE, "--thp only applies to anonymous memory");
+
+	worker = calloc(nthreads, sizeof(*worker));
+	if (!worker)
+		err(EXIT_FAILURE, "calloc");
+
+	if (file_backed)
+		fd = open_backing_file(size * nthreads);
+
+	if (shared_vma)
+		addr = map_region(size * nthreads, fd, 0);
+
+	/* Either way, the threads fault in disjoint parts of the file */
+	for (i = 0; i < nthreads; i++) {
+		worker[i].size = size;
+		if (shared_vma)
+			worker[i].addr = addr + i * size;
+		else
+			worker[i].addr = map_region(size, fd, i * size);
+	}
+
+	printf("Run summary [PID %d]: %d threads faulting in %zu KB of %s%s memory each, in %s, for %d secs.\n\n",
+	       getpid(), nthreads, size >> 10, file_backed ? "file" : "anonymous",
+	       thp ? " THP" : "", shared_vma ? "one shared VMA" : "one VMA per thread",
+	       nsecs);
+
+	bench_vm_run("pages", page_fault_workerfn, worker, true);
+
+	if (shared_vma) {
+		munmap(addr, size * nthreads);
+	} else {
+		for (i = 0; i < nthreads; i++)
+			munmap(worker[i].addr, size);
+	}
+	if (fd >= 0)
+		close(fd);
+	free(worker);
+	return 0;
+}
+
+int bench_vm_mmap(int argc, const char **argv)
+{
+	struct worker *worker;
+	size_t size;
+	unsigned int i;
+
+	bench_vm_init(argc, argv, mmap_options, bench_vm_mmap_usage);
+
+	size = parse_size(size_str, "4KB");
+
+	worker = calloc(nthreads, sizeof(*worker));
+	if (!worker)
+		err(EXIT_FAILURE, "calloc");
+
+	for (i = 0; i < nthreads; i++)
+		worker[i].size = size;
+
+	printf("Run summary [PID %d]: %d threads mapping and unmapping %zu KB each, for %d secs.\n\n",
+	       getpid(), nthreads, size >> 10, nsecs);
+
+	bench_vm_run("mmap+munmap", mmap_workerfn, worker, false);
+
+	free(worker);
+	return 0;
+}
+
+int bench_vm_mprotect(int argc, const char **argv)
+{
+	struct worker *worker;
+	size_t size;
+	unsigned int i;
+	void *addr;
+
+	bench_vm_init(argc, argv, mprotect_options, bench_vm_mprotect_usage);
+
+	size = parse_size(size_str, "64KB");
+
+	worker = calloc(nthreads, sizeof(*worker));
+	if (!worker)
+		err(EXIT_FAILURE, "calloc");
+
+	/*
+	 * Leave a guard page between the slices, so that every mprotect()
+	 * splits and merges the VMA of its own slice only.
+	 */
+	addr = mmap(NULL, (size + page_size) * nthreads, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (addr == MAP_FAILED)
+		err(EXIT_FAILURE, "mmap");
+
+	for (i = 0; i < nthreads; i++) {
+		worker[i].addr = addr + i * (size + page_size);
+		worker[i].size = size;
+		if (mprotect(worker[i].addr + size, page_size, PROT_NONE))
+			err(EXIT_FAILURE, "mprotect");
+	}
+
+	printf("Run summary [PID %d]: %d threads changing the protection of %zu KB each, for %d secs.\n\n",
+	       getpid(), nthreads, size >> 10, nsecs);
+
+	bench_vm_run("mprotect", mprotect_workerfn, worker, false);
+
+	munmap(addr, (size + page_size) * nthreads);
+	free(worker);
+	return 0;
+}
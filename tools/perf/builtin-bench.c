@@ -15,6 +15,9 @@
  *  numa  ... NUMA scheduling and MM performance
  *  futex ... Futex performance
  *  epoll ... Event poll performance
+ *  uring ... io_uring performance
+ *  vm    ... Page fault and address space performance
+ *  net   ... Loopback networking performance
  */
 #include <subcmd/parse-options.h>
 #include "builtin.h"
@@ -76,6 +79,29 @@ static struct bench epoll_benchmarks[] = {
 };
 #endif // HAVE_EVENTFD
 
+static struct bench uring_benchmarks[] = {
+	{ "nop",	"Benchmark io_uring submission of nop requests", bench_uring_nop	},
+	{ "rw",		"Benchmark io_uring reads and writes",		bench_uring_rw		},
+	{ "all",	"Run all io_uring benchmarks",			NULL			},
+	{ NULL,		NULL,						NULL			}
+};
+
+static struct bench vm_benchmarks[] = {
+	{ "page-fault",	"Benchmark concurrent page faults",		bench_vm_page_fault	},
+	{ "mmap",	"Benchmark concurrent mmap()/munmap() calls",	bench_vm_mmap		},
+	{ "mprotect",	"Benchmark concurrent mprotect() calls",	bench_vm_mprotect	},
+	{ "all",	"Run all vm benchmarks",			NULL			},
+	{ NULL,		NULL,						NULL			}
+};
+
+static struct bench net_benchmarks[] = {
+	{ "tcp",	"Benchmark TCP over loopback",			bench_net_tcp		},
+	{ "udp",	"Benchmark UDP over loopback",			bench_net_udp		},
+	{ "unix",	"Benchmark UNIX domain stream sockets",		bench_net_unix		},
+	{ "all",	"Run all net benchmarks",			NULL			},
+	{ NULL,		NULL,						NULL			}
+};
+
 struct collection {
 	const char	*name;
 	const char	*summary;
@@ -92,6 +118,9 @@ static struct collection collections[] = {
 #ifdef HAVE_EVENTFD
 	{"epoll",       "Epoll stressing benchmarks",                   epoll_benchmarks        },
 #endif
+	{ "uring",	"io_uring benchmarks",				uring_benchmarks	},
+	{ "vm",		"Page fault and address space benchmarks",	vm_benchmarks		},
+	{ "net",	"Loopback networking benchmarks",		net_benchmarks		},
 	{ "all",	"All benchmarks",				NULL			},
 	{ NULL,		NULL,						NULL			}
 };
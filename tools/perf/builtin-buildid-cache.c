@@ -23,6 +23,7 @@
 #include "util/build-id.h"
 #include "util/session.h"
 #include "util/dso.h"
+#include "util/map.h"
 #include "util/symbol.h"
 #include "util/time-utils.h"
 #include "util/util.h"
@@ -171,6 +172,27 @@ static int build_id_cache__add_kcore(const char *filename, bool force)
 	return 0;
 }
 
+/*
+ * Loading the symbols of a file that is in the cache saves them in its
+ * symbol index, so that the first report using it doesn't parse the ELF.
+ */
+static void build_id_cache__index_file(const char *filename, struct nsinfo *nsi)
+{
+	struct map *map = dso__new_map(filename);
+	struct dso *dso;
+
+	if (!map)
+		return;
+
+	dso = map->dso;
+	dso->nsinfo = nsinfo__get(nsi);
+	if (map__load(map) < 0)
+		pr_debug("Couldn't index the symbols of %s\n", filename);
+
+	map__put(map);
+	dso__put(dso);
+}
+
 static int build_id_cache__add_file(const char *filename, struct nsinfo *nsi)
 {
 	char sbuild_id[SBUILD_ID_SIZE];
@@ -191,6 +213,8 @@ static int build_id_cache__add_file(const char *filename, struct nsinfo *nsi)
 				    false, false);
 	pr_debug("Adding %s %s: %s\n", sbuild_id, filename,
 		 err ? "FAIL" : "Ok");
+	if (!err)
+		build_id_cache__index_file(filename, nsi);
 	return err;
 }
 
@@ -322,6 +346,8 @@ static int build_id_cache__update_file(const char *filename, struct nsinfo *nsi)
 	if (!err)
 		err = build_id_cache__add_s(sbuild_id, filename, nsi, false,
 					    false);
+	if (!err)
+		build_id_cache__index_file(filename, nsi);
 
 	pr_debug("Updating %s %s: %s\n", sbuild_id, filename,
 		 err ? "FAIL" : "Ok");
@@ -46,10 +46,13 @@
 #include "asm/bug.h"
 #include "perf.h"
 
+#include <api/fd/array.h>
+
 #include <errno.h>
 #include <inttypes.h>
 #include <locale.h>
 #include <poll.h>
+#include <pthread.h>
 #include <unistd.h>
 #include <sched.h>
 #include <signal.h>
@@ -75,6 +78,8 @@ struct switch_output {
 	int		 cur_file;
 };
 
+struct record_thread;
+
 struct record {
 	struct perf_tool	tool;
 	struct record_opts	opts;
@@ -95,6 +100,35 @@ struct record {
 	unsigned long long	samples;
 	cpu_set_t		affinity_mask;
 	unsigned long		output_max_size;	/* = 0: unlimited */
+	int			nr_threads;		/* < 0: one per mmap */
+	struct record_thread	*threads;
+	int			thread_ack[2];
+};
+
+/*
+ * In --threads mode every writer thread drains its own group of mmaps
+ * into its own data.N file of the directory, with its own compression
+ * stream. The main thread only writes synthesized events to the header
+ * file and waits for the writers to drain or fail.
+ */
+struct record_thread {
+	pthread_t		 th;
+	struct record		*rec;
+	int			 idx;
+	struct mmap		*maps;
+	int			 nr_mmaps;
+	struct perf_data_file	*file;
+	struct fdarray		 pollfd;
+	int			 ctl_pipe[2];
+	struct zstd_data	 zstd_data;
+	bool			 started;
+	int			 drained;
+	int			 err;
+	u64			 bytes_written;
+	u64			 bytes_transferred;
+	u64			 bytes_compressed;
+	unsigned long long	 samples;
+	unsigned long		 waking;
 };
 
 static volatile int done;
@@ -984,14 +1018,21 @@ static size_t process_comp_header(void *record, size_t increment)
 	return size;
 }
 
+static size_t __zstd_compress(struct zstd_data *zstd_data, void *dst, size_t dst_size,
+			      void *src, size_t src_size)
+{
+	size_t max_record_size = PERF_SAMPLE_MAX_SIZE - sizeof(struct perf_record_compressed) - 1;
+
+	return zstd_compress_stream_to_records(zstd_data, dst, dst_size, src, src_size,
+					       max_record_size, process_comp_header);
+}
+
 static size_t zstd_compress(struct perf_session *session, void *dst, size_t dst_size,
 			    void *src, size_t src_size)
 {
 	size_t compressed;
-	size_t max_record_size = PERF_SAMPLE_MAX_SIZE - sizeof(struct perf_record_compressed) - 1;
 
-	compressed = zstd_compress_stream_to_records(&session->zstd_data, dst, dst_size, src, src_size,
-						     max_record_size, process_comp_header);
+	compressed = __zstd_compress(&session->zstd_data, dst, dst_size, src, src_size);
 
 	session->bytes_transferred += src_size;
 	session->bytes_compressed  += compressed;
@@ -1076,10 +1117,373 @@ static int record__mmap_read_evlist(struct record *rec, struct evlist *evlist,
 	return rc;
 }
 
+static int record__threads_enabled(struct record *rec)
+{
+	return rec->nr_threads != 0;
+}
+
+static int record__thread_pushfn(struct mmap *map, void *to, void *bf, size_t size)
+{
+	struct record_thread *thread = to;
+
+	if (record__comp_enabled(thread->rec)) {
+		thread->bytes_transferred += size;
+		size = __zstd_compress(&thread->zstd_data, map->data, mmap__mmap_len(map), bf, size);
+		thread->bytes_compressed += size;
+		bf   = map->data;
+	}
+
+	thread->samples++;
+
+	if (perf_data_file__write(thread->file, bf, size) < 0) {
+		pr_err("failed to write perf data, error: %m\n");
+		return -1;
+	}
+
+	thread->bytes_written += size;
+	return 0;
+}
+
+static int record__thread_mmap_read(struct record_thread *thread, bool synch)
+{
+	u64 bytes_written = thread->bytes_written;
+	int i;
+
+	for (i = 0; i < thread->nr_mmaps; i++) {
+		struct mmap *map = &thread->maps[i];
+		u64 flush = 0;
+		int rc;
+
+		if (!map->core.base)
+			continue;
+
+		if (synch) {
+			flush = map->core.flush;
+			map->core.flush = 1;
+		}
+		rc = perf_mmap__push(map, thread, record__thread_pushfn);
+		if (synch)
+			map->core.flush = flush;
+		if (rc < 0)
+			return -1;
+	}
+
+	/*
+	 * Mark the round finished in this thread's own output, so that
+	 * the events of every file can be sorted as they are read.
+	 */
+	if (bytes_written != thread->bytes_written) {
+		if (perf_data_file__write(thread->file, &finished_round_event,
+					  sizeof(finished_round_event)) < 0) {
+			pr_err("failed to write perf data, error: %m\n");
+			return -1;
+		}
+		thread->bytes_written += sizeof(finished_round_event);
+	}
+
+	return 0;
+}
+
+static void record__thread_munmap_filtered(struct fdarray *fda, int fd,
+					   void *arg __maybe_unused)
+{
+	struct perf_mmap *map = fda->priv[fd].ptr;
+
+	if (map)
+		perf_mmap__put(map);
+}
+
+static void record__thread_ack(struct record_thread *thread)
+{
+	char ack = 'a';
+
+	if (write(thread->rec->thread_ack[1], &ack, sizeof(ack)) < 0)
+		pr_debug("failed to signal the main thread: %m\n");
+}
+
+static void record__thread_set_affinity(struct record_thread *thread)
+{
+	cpu_set_t mask;
+	int i, nr = 0;
+
+	CPU_ZERO(&mask);
+	for (i = 0; i < thread->nr_mmaps; i++) {
+		int cpu = thread->maps[i].core.cpu;
+
+		if (cpu < 0 || cpu >= CPU_SETSIZE)
+			continue;
+		CPU_SET(cpu, &mask);
+		nr++;
+	}
+
+	/* Per-thread mmaps have no CPU to follow */
+	if (nr)
+		sched_setaffinity(0, sizeof(mask), &mask);
+}
+
+static void *record__thread(void *arg)
+{
+	struct record_thread *thread = arg;
+	struct fdarray *pollfd = &thread->pollfd;
+	int err;
+
+	record__thread_set_affinity(thread);
+
+	for (;;) {
+		unsigned long long hits = thread->samples;
+
+		if (record__thread_mmap_read(thread, false) < 0) {
+			WRITE_ONCE(thread->err, -1);
+			record__thread_ack(thread);
+			return NULL;
+		}
+
+		if (hits != thread->samples)
+			continue;
+
+		err = fdarray__poll(pollfd, -1);
+		if (err < 0 && errno != EINTR) {
+			WRITE_ONCE(thread->err, -errno);
+			record__thread_ack(thread);
+			return NULL;
+		}
+		thread->waking++;
+
+		/* The control pipe always stays the first entry */
+		if (pollfd->entries[0].revents & POLLIN)
+			break;
+
+		if (!thread->drained &&
+		    fdarray__filter(pollfd, POLLERR | POLLHUP,
+				    record__thread_munmap_filtered, NULL) == 1) {
+			WRITE_ONCE(thread->drained, 1);
+			record__thread_ack(thread);
+		}
+	}
+
+	if (record__thread_mmap_read(thread, true) < 0)
+		WRITE_ONCE(thread->err, -1);
+
+	return NULL;
+}
+
+static int record__threads_setup(struct record *rec)
+{
+	struct perf_data *data = &rec->data;
+	struct evlist *evlist = rec->evlist;
+	int i, nr_mmaps = evlist->core.nr_mmaps;
+	int err, per_thread, rem, start = 0;
+
+	if (!record__threads_enabled(rec))
+		return 0;
+
+	if (rec->nr_threads < 0 || rec->nr_threads > nr_mmaps)
+		rec->nr_threads = nr_mmaps;
+
+	rec->threads = calloc(rec->nr_threads, sizeof(*rec->threads));
+	if (!rec->threads)
+		return -ENOMEM;
+
+	err = perf_data__create_dir(data, rec->nr_threads);
+	if (err) {
+		pr_err("Failed to create data directory: %s\n", strerror(-err));
+		zfree(&rec->threads);
+		return err;
+	}
+
+	per_thread = nr_mmaps / rec->nr_threads;
+	rem = nr_mmaps % rec->nr_threads;
+
+	for (i = 0; i < rec->nr_threads; i++) {
+		struct record_thread *thread = &rec->threads[i];
+
+		thread->rec	 = rec;
+		thread->idx	 = i;
+		thread->maps	 = &evlist->mmap[start];
+		thread->nr_mmaps = per_thread + (i < rem);
+		thread->file	 = &data->dir.files[i];
+		thread->ctl_pipe[0] = thread->ctl_pipe[1] = -1;
+		start += thread->nr_mmaps;
+	}
+
+	rec->thread_ack[0] = rec->thread_ack[1] = -1;
+	return 0;
+}
+
+static int record__thread_init_pollfd(struct record_thread *thread)
+{
+	struct fdarray *evlist_pollfd = &thread->rec->evlist->core.pollfd;
+	int i, j, pos;
+
+	fdarray__init(&thread->pollfd, 64);
+
+	pos = fdarray__add(&thread->pollfd, thread->ctl_pipe[0], POLLIN);
+	if (pos < 0)
+		return pos;
+	thread->pollfd.priv[pos].ptr = NULL;
+
+	for (i = 0; i < evlist_pollfd->nr; i++) {
+		void *ptr = evlist_pollfd->priv[i].ptr;
+
+		for (j = 0; j < thread->nr_mmaps; j++) {
+			if (ptr != &thread->maps[j].core)
+				continue;
+
+			pos = fdarray__add(&thread->pollfd, evlist_pollfd->entries[i].fd,
+					   evlist_pollfd->entries[i].events);
+			if (pos < 0)
+				return pos;
+			thread->pollfd.priv[pos].ptr = ptr;
+			break;
+		}
+	}
+
+	return 0;
+}
+
+static int record__threads_start(struct record *rec)
+{
+	sigset_t full, old;
+	int i, err = 0;
+
+	if (!record__threads_enabled(rec))
+		return 0;
+
+	if (pipe(rec->thread_ack) < 0) {
+		pr_err("Failed to create thread ack pipe: %m\n");
+		return -errno;
+	}
+
+	for (i = 0; i < rec->nr_threads; i++) {
+		struct record_thread *thread = &rec->threads[i];
+
+		if (pipe(thread->ctl_pipe) < 0) {
+			pr_err("Failed to create thread control pipe: %m\n");
+			return -errno;
+		}
+
+		err = record__thread_init_pollfd(thread);
+		if (err)
+			return err;
+
+		if (zstd_init(&thread->zstd_data, rec->opts.comp_level) < 0) {
+			pr_err("Compression initialization failed.\n");
+			return -1;
+		}
+	}
+
+	/* Leave all signal handling to the main thread */
+	sigfillset(&full);
+	pthread_sigmask(SIG_SETMASK, &full, &old);
+
+	for (i = 0; i < rec->nr_threads; i++) {
+		struct record_thread *thread = &rec->threads[i];
+
+		err = pthread_create(&thread->th, NULL, record__thread, thread);
+		if (err) {
+			pr_err("Failed to start writer thread %d: %s\n", i, strerror(err));
+			err = -err;
+			break;
+		}
+		thread->started = true;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (!err)
+		pr_debug("started %d writer threads\n", rec->nr_threads);
+
+	return err;
+}
+
+/*
+ * Wait for a writer thread to drain or to fail. Returns a negative error
+ * if one failed, 1 once all of them have drained and 0 otherwise.
+ */
+static int record__threads_wait(struct record *rec)
+{
+	struct pollfd pfd = {
+		.fd	= rec->thread_ack[0],
+		.events	= POLLIN,
+	};
+	int i, drained = 0;
+	char buf[64];
+
+	if (poll(&pfd, 1, -1) > 0 && (pfd.revents & POLLIN)) {
+		if (read(pfd.fd, buf, sizeof(buf)) < 0)
+			return -errno;
+	}
+
+	for (i = 0; i < rec->nr_threads; i++) {
+		struct record_thread *thread = &rec->threads[i];
+		int err = READ_ONCE(thread->err);
+
+		if (err)
+			return err;
+		drained += READ_ONCE(thread->drained);
+	}
+
+	return drained == rec->nr_threads;
+}
+
+static int record__threads_stop(struct record *rec, unsigned long *waking)
+{
+	struct perf_session *session = rec->session;
+	int i, err = 0;
+	char stop = 's';
+
+	if (!rec->threads)
+		return 0;
+
+	for (i = 0; i < rec->nr_threads; i++) {
+		struct record_thread *thread = &rec->threads[i];
+
+		if (thread->started &&
+		    write(thread->ctl_pipe[1], &stop, sizeof(stop)) < 0)
+			pr_debug("failed to stop writer thread %d: %m\n", i);
+	}
+
+	for (i = 0; i < rec->nr_threads; i++) {
+		struct record_thread *thread = &rec->threads[i];
+
+		if (thread->started) {
+			pthread_join(thread->th, NULL);
+			if (!err)
+				err = thread->err;
+		}
+
+		session->bytes_transferred += thread->bytes_transferred;
+		session->bytes_compressed  += thread->bytes_compressed;
+		*waking += thread->waking;
+
+		pr_debug("writer thread %d: %d mmaps, %" PRIu64 " bytes written\n",
+			 thread->idx, thread->nr_mmaps, thread->bytes_written);
+
+		zstd_fini(&thread->zstd_data);
+		fdarray__exit(&thread->pollfd);
+		if (thread->ctl_pipe[0] >= 0) {
+			close(thread->ctl_pipe[0]);
+			close(thread->ctl_pipe[1]);
+		}
+	}
+
+	if (rec->thread_ack[0] >= 0) {
+		close(rec->thread_ack[0]);
+		close(rec->thread_ack[1]);
+	}
+
+	zfree(&rec->threads);
+	return err;
+}
+
 static int record__mmap_read_all(struct record *rec, bool synch)
 {
 	int err;
 
+	/* The writer threads drain the mmaps themselves */
+	if (record__threads_enabled(rec))
+		return 0;
+
 	err = record__mmap_read_evlist(rec, rec->evlist, false, synch);
 	if (err)
 		return err;
@@ -1110,7 +1514,8 @@ static void record__init_features(struct record *rec)
 	if (!(rec->opts.use_clockid && rec->opts.clockid_res_ns))
 		perf_header__clear_feat(&session->header, HEADER_CLOCKID);
 
-	perf_header__clear_feat(&session->header, HEADER_DIR_FORMAT);
+	if (!record__threads_enabled(rec))
+		perf_header__clear_feat(&session->header, HEADER_DIR_FORMAT);
 	if (!record__comp_enabled(rec))
 		perf_header__clear_feat(&session->header, HEADER_COMPRESSED);
 
@@ -1128,6 +1533,8 @@ record__finish_output(struct record *rec)
 
 	rec->session->header.data_size += rec->bytes_written;
 	data->file.size = lseek(perf_data__fd(data), 0, SEEK_CUR);
+	if (record__threads_enabled(rec))
+		perf_data__update_dir(data);
 
 	if (!rec->no_buildid) {
 		process_buildids(rec);
@@ -1441,6 +1848,12 @@ static int __cmd_record(struct record *rec, int argc, const char **argv)
 	fd = perf_data__fd(data);
 	rec->session = session;
 
+	if (record__threads_enabled(rec) && data->is_pipe) {
+		pr_err("--threads is not supported with pipe output.\n");
+		status = -EINVAL;
+		goto out_delete_session;
+	}
+
 	if (zstd_init(&session->zstd_data, rec->opts.comp_level) < 0) {
 		pr_err("Compression initialization failed.\n");
 		return -1;
@@ -1486,6 +1899,10 @@ static int __cmd_record(struct record *rec, int argc, const char **argv)
 	}
 	session->header.env.comp_mmap_len = session->evlist->core.mmap_len;
 
+	err = record__threads_setup(rec);
+	if (err)
+		goto out_child;
+
 	if (rec->opts.kcore) {
 		err = record__kcore_copy(&session->machines.host, data);
 		if (err) {
@@ -1619,6 +2036,10 @@ static int __cmd_record(struct record *rec, int argc, const char **argv)
 		evlist__enable(rec->evlist);
 	}
 
+	err = record__threads_start(rec);
+	if (err)
+		goto out_child;
+
 	trigger_ready(&auxtrace_snapshot_trigger);
 	trigger_ready(&switch_output_trigger);
 	perf_hooks__invoke_record_start();
@@ -1695,17 +2116,26 @@ static int __cmd_record(struct record *rec, int argc, const char **argv)
 		if (hits == rec->samples) {
 			if (done || draining)
 				break;
-			err = evlist__poll(rec->evlist, -1);
-			/*
-			 * Propagate error, only if there's any. Ignore positive
-			 * number of returned events and interrupt error.
-			 */
-			if (err > 0 || (err < 0 && errno == EINTR))
+			if (record__threads_enabled(rec)) {
+				err = record__threads_wait(rec);
+				if (err < 0)
+					goto out_child;
+				if (err)
+					draining = true;
 				err = 0;
-			waking++;
+			} else {
+				err = evlist__poll(rec->evlist, -1);
+				/*
+				 * Propagate error, only if there's any. Ignore positive
+				 * number of returned events and interrupt error.
+				 */
+				if (err > 0 || (err < 0 && errno == EINTR))
+					err = 0;
+				waking++;
 
-			if (evlist__filter_pollfd(rec->evlist, POLLERR | POLLHUP) == 0)
-				draining = true;
+				if (evlist__filter_pollfd(rec->evlist, POLLERR | POLLHUP) == 0)
+					draining = true;
+			}
 		}
 
 		/*
@@ -1723,6 +2153,10 @@ static int __cmd_record(struct record *rec, int argc, const char **argv)
 	trigger_off(&auxtrace_snapshot_trigger);
 	trigger_off(&switch_output_trigger);
 
+	err = record__threads_stop(rec, &waking);
+	if (err)
+		goto out_child;
+
 	if (opts->auxtrace_snapshot_on_exit)
 		record__auxtrace_snapshot_exit(rec);
 
@@ -1741,6 +2175,8 @@ static int __cmd_record(struct record *rec, int argc, const char **argv)
 		record__synthesize_workload(rec, true);
 
 out_child:
+	if (record__threads_stop(rec, &waking) && !err)
+		err = -1;
 	record__mmap_read_all(rec, true);
 	record__aio_mmap_read_sync(rec);
 
@@ -2016,6 +2452,22 @@ static int record__parse_affinity(const struct option *opt, const char *str, int
 	return 0;
 }
 
+static int record__parse_threads(const struct option *opt, const char *str, int unset)
+{
+	int *nr_threads = (int *)opt->value;
+
+	if (unset) {
+		*nr_threads = 0;
+		return 0;
+	}
+
+	*nr_threads = str ? strtol(str, NULL, 0) : -1;
+	if (*nr_threads <= 0)
+		*nr_threads = -1;
+
+	return 0;
+}
+
 static int parse_output_max_size(const struct option *opt,
 				 const char *str, int unset)
 {
@@ -2399,6 +2851,9 @@ static struct option __record_options[] = {
 #endif
 	OPT_CALLBACK(0, "max-size", &record.output_max_size,
 		     "size", "Limit the maximum size of the output file", parse_output_max_size),
+	OPT_CALLBACK_OPTARG(0, "threads", &record.nr_threads, NULL, "n",
+			    "Drain, compress and write the mmaps with <n> threads into a directory (default: one per mmap)",
+			    record__parse_threads),
 	OPT_END()
 };
 
@@ -2611,6 +3066,17 @@ int cmd_record(int argc, const char **argv)
 		rec->opts.comp_level = comp_level_max;
 	pr_debug("comp level: %d\n", rec->opts.comp_level);
 
+	if (record__threads_enabled(rec)) {
+		if (rec->opts.nr_cblocks || rec->switch_output.enabled ||
+		    rec->opts.overwrite || rec->opts.full_auxtrace ||
+		    rec->output_max_size) {
+			pr_err("--threads is incompatible with --aio, --switch-output, --overwrite, --max-size and AUX area tracing\n");
+			err = -EINVAL;
+			goto out;
+		}
+		rec->data.is_dir = true;
+	}
+
 	err = __cmd_record(&record, argc, argv);
 out:
 	evlist__delete(rec->evlist);
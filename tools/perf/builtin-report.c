@@ -13,6 +13,7 @@
 #include "util/annotate.h"
 #include "util/color.h"
 #include "util/dso.h"
+#include "util/dso-preload.h"
 #include <linux/list.h>
 #include <linux/rbtree.h>
 #include <linux/err.h>
@@ -104,6 +105,7 @@ struct report {
 	bool			symbol_ipc;
 	bool			total_cycles_mode;
 	struct block_report	*block_reports;
+	int			nr_symbol_threads;
 };
 
 static int report__config(const char *var, const char *value, void *cb)
@@ -331,6 +333,56 @@ static int process_read_event(struct perf_tool *tool,
 	return 0;
 }
 
+static void report__preload_map(struct machine *machine, union perf_event *event,
+				pid_t pid, pid_t tid, u64 start)
+{
+	u8 cpumode = event->header.misc & PERF_RECORD_MISC_CPUMODE_MASK;
+	struct addr_location al;
+	struct thread *thread;
+
+	if (event->header.misc & PERF_RECORD_MISC_MMAP_DATA)
+		return;
+
+	thread = machine__find_thread(machine, pid, tid);
+	if (!thread)
+		return;
+
+	if (thread__find_map(thread, cpumode, start, &al))
+		dso_preload__queue_map(al.map);
+
+	thread__put(thread);
+}
+
+static int process_mmap_event(struct perf_tool *tool,
+			      union perf_event *event,
+			      struct perf_sample *sample,
+			      struct machine *machine)
+{
+	struct report *rep = container_of(tool, struct report, tool);
+	int err = perf_event__process_mmap(tool, event, sample, machine);
+
+	if (!err && rep->nr_symbol_threads)
+		report__preload_map(machine, event, event->mmap.pid,
+				    event->mmap.tid, event->mmap.start);
+
+	return err;
+}
+
+static int process_mmap2_event(struct perf_tool *tool,
+			       union perf_event *event,
+			       struct perf_sample *sample,
+			       struct machine *machine)
+{
+	struct report *rep = container_of(tool, struct report, tool);
+	int err = perf_event__process_mmap2(tool, event, sample, machine);
+
+	if (!err && rep->nr_symbol_threads)
+		report__preload_map(machine, event, event->mmap2.pid,
+				    event->mmap2.tid, event->mmap2.start);
+
+	return err;
+}
+
 /* For pipe mode, sample_type is not currently set */
 static int report__setup_sample_type(struct report *rep)
 {
@@ -910,7 +962,20 @@ static int __cmd_report(struct report *rep)
 	if (rep->tasks_mode)
 		tasks_setup(rep);
 
+	if (rep->stats_mode || rep->tasks_mode || rep->nr_symbol_threads < 0)
+		rep->nr_symbol_threads = 0;
+
+	if (rep->nr_symbol_threads) {
+		ret = dso_preload__start(rep->nr_symbol_threads);
+		if (ret)
+			return ret;
+	}
+
 	ret = perf_session__process_events(session);
+
+	if (rep->nr_symbol_threads)
+		dso_preload__stop();
+
 	if (ret) {
 		ui__error("failed to process sample\n");
 		return ret;
@@ -1090,8 +1155,8 @@ int cmd_report(int argc, const char **argv)
 	struct report report = {
 		.tool = {
 			.sample		 = process_sample_event,
-			.mmap		 = perf_event__process_mmap,
-			.mmap2		 = perf_event__process_mmap2,
+			.mmap		 = process_mmap_event,
+			.mmap2		 = process_mmap2_event,
 			.comm		 = perf_event__process_comm,
 			.namespaces	 = perf_event__process_namespaces,
 			.exit		 = perf_event__process_exit,
@@ -1259,6 +1324,8 @@ int cmd_report(int argc, const char **argv)
 	OPTS_EVSWITCH(&report.evswitch),
 	OPT_BOOLEAN(0, "total-cycles", &report.total_cycles_mode,
 		    "Sort all blocks by 'Sampled Cycles%'"),
+	OPT_INTEGER(0, "symbol-threads", &report.nr_symbol_threads,
+		    "Load DSO symbols with <n> threads while processing events"),
 	OPT_END()
 	};
 	struct perf_data data = {
@@ -0,0 +1,181 @@
+// SPDX-License-Identifier: GPL-2.0
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/compiler.h>
+#include <linux/list.h>
+#include <linux/zalloc.h>
+
+#include "debug.h"
+#include "dso.h"
+#include "dso-preload.h"
+#include "map.h"
+#include "namespaces.h"
+#include "vdso.h"
+
+struct dso_preload_work {
+	struct list_head	 node;
+	struct map		*map;
+};
+
+static struct {
+	pthread_mutex_t		 lock;
+	pthread_cond_t		 cond;
+	struct list_head	 queue;
+	pthread_t		*threads;
+	int			 nr_threads;
+	int			 nr_ready;
+	int			 err;
+	bool			 stop;
+} preload = {
+	.lock	= PTHREAD_MUTEX_INITIALIZER,
+	.cond	= PTHREAD_COND_INITIALIZER,
+	.queue	= LIST_HEAD_INIT(preload.queue),
+};
+
+static void *dso_preload__worker(void *arg __maybe_unused)
+{
+	struct dso_preload_work *work;
+	int err = 0;
+
+	/*
+	 * setns(CLONE_NEWNS) fails with EINVAL while the fs_struct is
+	 * shared with other threads: give ours up, so that the main
+	 * thread can still enter the mount namespace of the DSOs it
+	 * keeps for itself.
+	 */
+	if (unshare(CLONE_FS))
+		err = errno;
+
+	pthread_mutex_lock(&preload.lock);
+	if (err && !preload.err)
+		preload.err = err;
+	preload.nr_ready++;
+	pthread_cond_broadcast(&preload.cond);
+	pthread_mutex_unlock(&preload.lock);
+
+	if (err)
+		return NULL;
+
+	for (;;) {
+		pthread_mutex_lock(&preload.lock);
+		while (list_empty(&preload.queue) && !preload.stop)
+			pthread_cond_wait(&preload.cond, &preload.lock);
+
+		if (preload.stop) {
+			pthread_mutex_unlock(&preload.lock);
+			break;
+		}
+
+		work = list_first_entry(&preload.queue, struct dso_preload_work, node);
+		list_del_init(&work->node);
+		pthread_mutex_unlock(&preload.lock);
+
+		map__load(work->map);
+		map__put(work->map);
+		free(work);
+	}
+
+	return NULL;
+}
+
+int dso_preload__start(int nr_threads)
+{
+	int i, err;
+
+	preload.threads = calloc(nr_threads, sizeof(*preload.threads));
+	if (!preload.threads)
+		return -ENOMEM;
+
+	preload.stop = false;
+	preload.nr_ready = 0;
+	preload.err = 0;
+
+	for (i = 0; i < nr_threads; i++) {
+		err = pthread_create(&preload.threads[i], NULL, dso_preload__worker, NULL);
+		if (err) {
+			pr_err("Failed to start symbol loading thread: %s\n", strerror(err));
+			dso_preload__stop();
+			return -err;
+		}
+		preload.nr_threads++;
+	}
+
+	/* Don't let the main thread setns() before the workers unshared */
+	pthread_mutex_lock(&preload.lock);
+	while (preload.nr_ready < preload.nr_threads)
+		pthread_cond_wait(&preload.cond, &preload.lock);
+	err = preload.err;
+	pthread_mutex_unlock(&preload.lock);
+
+	if (err) {
+		pr_err("Failed to unshare the symbol loading threads: %s\n", strerror(err));
+		dso_preload__stop();
+		return -err;
+	}
+
+	pr_debug("loading symbols with %d threads\n", nr_threads);
+	return 0;
+}
+
+static bool dso_preload__suitable(struct dso *dso)
+{
+	/*
+	 * Kernel loading updates the kernel maps, which the main thread
+	 * walks without locking, and nsinfo__mountns_enter() saves and
+	 * restores the namespace of the thread group leader, through
+	 * /proc/self: leave both to the main thread.
+	 */
+	if (dso->kernel || dso__is_vdso(dso))
+		return false;
+
+	if (dso->nsinfo && dso->nsinfo->need_setns)
+		return false;
+
+	return !dso__loaded(dso);
+}
+
+void dso_preload__queue_map(struct map *map)
+{
+	struct dso_preload_work *work;
+
+	if (!preload.nr_threads || !dso_preload__suitable(map->dso))
+		return;
+
+	work = malloc(sizeof(*work));
+	if (!work)
+		return;
+
+	work->map = map__get(map);
+
+	pthread_mutex_lock(&preload.lock);
+	list_add_tail(&work->node, &preload.queue);
+	pthread_cond_signal(&preload.cond);
+	pthread_mutex_unlock(&preload.lock);
+}
+
+void dso_preload__stop(void)
+{
+	struct dso_preload_work *work, *tmp;
+	int i;
+
+	pthread_mutex_lock(&preload.lock);
+	preload.stop = true;
+	pthread_cond_broadcast(&preload.cond);
+	pthread_mutex_unlock(&preload.lock);
+
+	for (i = 0; i < preload.nr_threads; i++)
+		pthread_join(preload.threads[i], NULL);
+
+	/* Whatever is left is loaded on demand, as without the workers */
+	list_for_each_entry_safe(work, tmp, &preload.queue, node) {
+		list_del_init(&work->node);
+		map__put(work->map);
+		free(work);
+	}
+
+	zfree(&preload.threads);
+	preload.nr_threads = 0;
+}
@@ -0,0 +1,17 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef __PERF_DSO_PRELOAD_H
+#define __PERF_DSO_PRELOAD_H
+
+struct map;
+
+/*
+ * Load the symbols of the DSOs of new executable maps on a pool of worker
+ * threads, while the main thread keeps processing events. dso__load()
+ * serializes on dso->lock, so a sample resolved against a DSO that is
+ * still being loaded just waits for that one load to finish.
+ */
+int dso_preload__start(int nr_threads);
+void dso_preload__queue_map(struct map *map);
+void dso_preload__stop(void);
+
+#endif /* __PERF_DSO_PRELOAD_H */
@@ -20,6 +20,25 @@ struct thread;
 struct auxtrace;
 struct itrace_synth_opts;
 
+struct decomp {
+	struct decomp *next;
+	u64 file_pos;
+	size_t mmap_len;
+	u64 head;
+	size_t size;
+	char data[];
+};
+
+/*
+ * Decompressed data of one stream of PERF_RECORD_COMPRESSED records: each
+ * file of a directory format perf.data is a separate compression stream.
+ */
+struct decomp_data {
+	struct decomp		*decomp;
+	struct decomp		*decomp_last;
+	struct zstd_data	*zstd_decomp;
+};
+
 struct perf_session {
 	struct perf_header	header;
 	struct machines		machines;
@@ -39,17 +58,8 @@ struct perf_session {
 	u64			bytes_transferred;
 	u64			bytes_compressed;
 	struct zstd_data	zstd_data;
-	struct decomp		*decomp;
-	struct decomp		*decomp_last;
-};
-
-struct decomp {
-	struct decomp *next;
-	u64 file_pos;
-	size_t mmap_len;
-	u64 head;
-	size_t size;
-	char data[];
+	struct decomp_data	decomp_data;
+	struct decomp_data	*active_decomp;
 };
 
 struct perf_tool;
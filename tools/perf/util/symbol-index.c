@@ -0,0 +1,315 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * On-disk symbol index kept in the build-id cache.
+ *
+ * Parsing the ELF symbol tables of large binaries, and demangling their
+ * names, dominates the startup of perf report, script and top. Once the
+ * symbols of a DSO have been loaded, they are dumped next to its cached
+ * binary in <buildid_dir>/.build-id/xx/yyyy/symidx, sorted by address,
+ * so that later sessions can mmap them back without touching the ELF.
+ * The index is keyed by build-id, and records which symbol sources were
+ * there when it was built (see dso__symsrc_key()): it is not used once
+ * the file it was built from changes, or a better one appears.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/kernel.h>
+#include <linux/rbtree.h>
+#include <linux/zalloc.h>
+
+#include "build-id.h"
+#include "debug.h"
+#include "dso.h"
+#include "symbol.h"
+
+#define SYMIDX_MAGIC		"PERFSYMX"
+#define SYMIDX_VERSION		3
+
+#define SYMIDX_F_DEMANGLE	(1U << 0)
+#define SYMIDX_F_ADJUST_SYMBOLS	(1U << 1)
+#define SYMIDX_F_ALLOW_ALIASES	(1U << 2)
+
+#define SYMIDX_NO_NAME		UINT_MAX
+
+struct symidx_header {
+	char	magic[8];
+	u32	version;
+	u32	flags;
+	u32	symtab_type;
+	u32	nr_syms;
+	u64	str_size;
+	u64	text_offset;
+	u64	symsrc_key;	/* the symbol sources it was built from */
+	u32	symsrc_name;	/* offset in the string table, or SYMIDX_NO_NAME */
+	u32	reserved;
+};
+
+struct symidx_entry {
+	u64	start;
+	u64	end;
+	u32	name;		/* offset in the string table */
+	u8	type;
+	u8	binding;
+	u8	arch_sym;
+	u8	reserved;
+};
+
+/* Symbols loaded with different options can't be shared */
+static u32 symidx__flags(void)
+{
+	u32 flags = 0;
+
+	if (symbol_conf.demangle)
+		flags |= SYMIDX_F_DEMANGLE;
+	if (symbol_conf.allow_aliases)
+		flags |= SYMIDX_F_ALLOW_ALIASES;
+	return flags;
+}
+
+static char *dso__symidx_filename(struct dso *dso)
+{
+	char sbuild_id[SBUILD_ID_SIZE];
+	char *linkname, *filename = NULL;
+	struct stat st;
+
+	if (!dso->has_build_id)
+		return NULL;
+
+	build_id__sprintf(dso->build_id, sizeof(dso->build_id), sbuild_id);
+	linkname = build_id_cache__linkname(sbuild_id, NULL, 0);
+	if (!linkname)
+		return NULL;
+
+	/* Only new style caches have a directory to keep the index in */
+	if (!stat(linkname, &st) && S_ISDIR(st.st_mode) &&
+	    asprintf(&filename, "%s/symidx", linkname) < 0)
+		filename = NULL;
+
+	free(linkname);
+	return filename;
+}
+
+static int symidx__load(struct dso *dso, void *buf, size_t size,
+			u64 symsrc_key)
+{
+	struct symidx_header *hdr = buf;
+	struct symidx_entry *entries;
+	const char *strtab;
+	u32 i;
+
+	if (size < sizeof(*hdr) ||
+	    memcmp(hdr->magic, SYMIDX_MAGIC, sizeof(hdr->magic)) ||
+	    hdr->version != SYMIDX_VERSION ||
+	    (hdr->flags & ~SYMIDX_F_ADJUST_SYMBOLS) != symidx__flags())
+		return -EINVAL;
+
+	if (hdr->symsrc_key != symsrc_key)
+		return -ESTALE;
+
+	if ((size - sizeof(*hdr)) / sizeof(*entries) < hdr->nr_syms ||
+	    size - sizeof(*hdr) - hdr->nr_syms * sizeof(*entries) != hdr->str_size ||
+	    !hdr->str_size)
+		return -EINVAL;
+
+	entries = buf + sizeof(*hdr);
+	strtab = (const char *)(entries + hdr->nr_syms);
+	if (strtab[hdr->str_size - 1] != '\0' ||
+	    (hdr->symsrc_name != SYMIDX_NO_NAME &&
+	     hdr->symsrc_name >= hdr->str_size))
+		return -EINVAL;
+
+	for (i = 0; i < hdr->nr_syms; i++) {
+		struct symidx_entry *entry = &entries[i];
+		struct symbol *sym;
+
+		if (entry->name >= hdr->str_size || entry->end < entry->start)
+			goto out_delete;
+
+		sym = symbol__new(entry->start, entry->end - entry->start,
+				  entry->binding, entry->type,
+				  strtab + entry->name);
+		if (!sym)
+			goto out_delete;
+
+		sym->arch_sym = entry->arch_sym;
+		symbols__insert(&dso->symbols, sym);
+	}
+
+	if (hdr->symsrc_name != SYMIDX_NO_NAME && !dso->symsrc_filename) {
+		dso->symsrc_filename = strdup(strtab + hdr->symsrc_name);
+		if (!dso->symsrc_filename)
+			goto out_delete;
+	}
+
+	dso->symtab_type = hdr->symtab_type;
+	dso->adjust_symbols = !!(hdr->flags & SYMIDX_F_ADJUST_SYMBOLS);
+	dso->text_offset = hdr->text_offset;
+	return hdr->nr_syms;
+
+out_delete:
+	symbols__delete(&dso->symbols);
+	return -EINVAL;
+}
+
+/*
+ * Load the symbols of @dso from its index in the build-id cache, if it
+ * was built from the symbol sources summed up in @symsrc_key.
+ * Returns the number of symbols loaded, or <= 0 if there is no usable
+ * index, in which case the caller goes on with the ELF file.
+ */
+int dso__load_symidx(struct dso *dso, u64 symsrc_key)
+{
+	char *filename = dso__symidx_filename(dso);
+	struct stat st;
+	void *buf;
+	int fd, ret = -1;
+
+	if (!filename)
+		return -1;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		goto out_free;
+
+	if (fstat(fd, &st) || !st.st_size)
+		goto out_close;
+
+	buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (buf == MAP_FAILED)
+		goto out_close;
+
+	ret = symidx__load(dso, buf, st.st_size, symsrc_key);
+	if (ret == -ESTALE)
+		pr_debug("Ignoring outdated symbol index %s\n", filename);
+	else if (ret < 0)
+		pr_debug("Ignoring invalid symbol index %s\n", filename);
+	else
+		pr_debug2("Loaded %d symbols of %s from %s\n",
+			  ret, dso->long_name, filename);
+
+	munmap(buf, st.st_size);
+out_close:
+	close(fd);
+out_free:
+	free(filename);
+	return ret;
+}
+
+/*
+ * Save the symbols of @dso to its index, if it has a directory in the
+ * build-id cache. The index is written to a temporary file and renamed,
+ * so that concurrent sessions never see it partially written.  It
+ * replaces any index left over from other options or symbol sources.
+ */
+int dso__save_symidx(struct dso *dso, u64 symsrc_key)
+{
+	struct symidx_header hdr = {
+		.version	= SYMIDX_VERSION,
+		.flags		= symidx__flags(),
+		.symtab_type	= dso->symtab_type,
+		.text_offset	= dso->text_offset,
+		.symsrc_key	= symsrc_key,
+		.symsrc_name	= SYMIDX_NO_NAME,
+	};
+	char *filename, *tmpname = NULL;
+	struct symbol *pos;
+	struct rb_node *nd;
+	FILE *fp = NULL;
+	int fd, err = -1;
+	u32 name = 0;
+
+	memcpy(hdr.magic, SYMIDX_MAGIC, sizeof(hdr.magic));
+	if (dso->adjust_symbols)
+		hdr.flags |= SYMIDX_F_ADJUST_SYMBOLS;
+
+	filename = dso__symidx_filename(dso);
+	if (!filename)
+		return -1;
+
+	if (asprintf(&tmpname, "%s.XXXXXX", filename) < 0) {
+		tmpname = NULL;
+		goto out_free;
+	}
+
+	fd = mkstemp(tmpname);
+	if (fd < 0)
+		goto out_free;
+
+	fp = fdopen(fd, "w");
+	if (!fp) {
+		close(fd);
+		goto out_unlink;
+	}
+
+	symbols__for_each_entry(&dso->symbols, pos, nd) {
+		hdr.nr_syms++;
+		hdr.str_size += pos->namelen + 1;
+	}
+
+	/* The file the symbols came from goes after their names */
+	if (dso->symsrc_filename) {
+		hdr.symsrc_name = hdr.str_size;
+		hdr.str_size += strlen(dso->symsrc_filename) + 1;
+	}
+
+	if (!hdr.nr_syms || hdr.str_size >= SYMIDX_NO_NAME)
+		goto out_unlink;
+
+	if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1)
+		goto out_unlink;
+
+	symbols__for_each_entry(&dso->symbols, pos, nd) {
+		struct symidx_entry entry = {
+			.start	  = pos->start,
+			.end	  = pos->end,
+			.name	  = name,
+			.type	  = pos->type,
+			.binding  = pos->binding,
+			.arch_sym = pos->arch_sym,
+		};
+
+		if (fwrite(&entry, sizeof(entry), 1, fp) != 1)
+			goto out_unlink;
+		name += pos->namelen + 1;
+	}
+
+	symbols__for_each_entry(&dso->symbols, pos, nd) {
+		if (fwrite(pos->name, pos->namelen + 1, 1, fp) != 1)
+			goto out_unlink;
+	}
+
+	if (dso->symsrc_filename &&
+	    fwrite(dso->symsrc_filename, strlen(dso->symsrc_filename) + 1,
+		   1, fp) != 1)
+		goto out_unlink;
+
+	if (fclose(fp)) {
+		fp = NULL;
+		goto out_unlink;
+	}
+	fp = NULL;
+
+	if (rename(tmpname, filename))
+		goto out_unlink;
+
+	pr_debug2("Saved %u symbols of %s to %s\n",
+		  hdr.nr_syms, dso->long_name, filename);
+	err = 0;
+	goto out_free;
+
+out_unlink:
+	if (fp)
+		fclose(fp);
+	unlink(tmpname);
+out_free:
+	free(tmpname);
+	free(filename);
+	return err;
+}
@@ -33,6 +33,7 @@
 #include "namespaces.h"
 #include "header.h"
 #include "path.h"
+#include "vdso.h"
 #include <linux/ctype.h>
 #include <linux/zalloc.h>
 
@@ -1581,6 +1582,55 @@ static int dso__find_perf_map(char *filebuf, size_t bufsz,
 	return rc;
 }
 
+/*
+ * Sum up the symbol sources dso__load() would pick from for @dso: which of
+ * them exist, and the size and modification time of those that do.  The
+ * symbol index is only used while this is unchanged, so that it is rebuilt
+ * when the file it was built from changes, or when a better source, like
+ * debuginfo added to the build-id cache, shows up.
+ */
+static u64 dso__symsrc_key(struct dso *dso, char *root_dir, char *name,
+			   struct nscookie *nsc)
+{
+	u64 key = 0xcbf29ce484222325ULL;	/* FNV-1a */
+	u_int i;
+
+#define SYMSRC_KEY_MIX(val) (key = (key ^ (u64)(val)) * 0x100000001b3ULL)
+	for (i = 0; i < DSO_BINARY_TYPE__SYMTAB_CNT; i++) {
+		enum dso_binary_type symtab_type = binary_type_symtab[i];
+		struct stat st;
+		bool nsexit;
+		int err;
+
+		if (!dso__is_compatible_symtab_type(dso, false, symtab_type))
+			continue;
+
+		if (dso__read_binary_type_filename(dso, symtab_type,
+						   root_dir, name, PATH_MAX))
+			continue;
+
+		nsexit = (symtab_type == DSO_BINARY_TYPE__BUILD_ID_CACHE ||
+		    symtab_type == DSO_BINARY_TYPE__BUILD_ID_CACHE_DEBUGINFO);
+
+		if (nsexit)
+			nsinfo__mountns_exit(nsc);
+		err = stat(name, &st);
+		if (nsexit)
+			nsinfo__mountns_enter(dso->nsinfo, nsc);
+
+		if (err || !S_ISREG(st.st_mode))
+			continue;
+
+		SYMSRC_KEY_MIX(symtab_type);
+		SYMSRC_KEY_MIX(st.st_size);
+		SYMSRC_KEY_MIX(st.st_mtim.tv_sec);
+		SYMSRC_KEY_MIX(st.st_mtim.tv_nsec);
+	}
+#undef SYMSRC_KEY_MIX
+
+	return key;
+}
+
 int dso__load(struct dso *dso, struct map *map)
 {
 	char *name;
@@ -1593,6 +1643,7 @@ int dso__load(struct dso *dso, struct map *map)
 	struct symsrc *syms_ss = NULL, *runtime_ss = NULL;
 	bool kmod;
 	bool perfmap;
+	u64 symsrc_key = 0;
 	unsigned char build_id[BUILD_ID_SIZE];
 	struct nscookie nsc;
 	char newmapname[PATH_MAX];
@@ -1660,6 +1711,21 @@ int dso__load(struct dso *dso, struct map *map)
 		dso__set_build_id(dso, build_id);
 	}
 
+	/*
+	 * A symbol index in the build-id cache spares parsing the ELF.
+	 * Kernel modules and the vdso need their maps adjusted while
+	 * loading, so they always go through the ELF file.
+	 */
+	if (!kmod && !dso__is_vdso(dso) && dso->has_build_id) {
+		symsrc_key = dso__symsrc_key(dso, root_dir, name, &nsc);
+		nsinfo__mountns_exit(&nsc);
+		ret = dso__load_symidx(dso, symsrc_key);
+		nsinfo__mountns_enter(dso->nsinfo, &nsc);
+		if (ret > 0)
+			goto out_free;
+		ret = -1;
+	}
+
 	/*
 	 * Iterate over candidate debug images.
 	 * Keep track of "interesting" ones (those which have a symtab, dynsym,
@@ -1742,6 +1808,12 @@ int dso__load(struct dso *dso, struct map *map)
 		nr_plt = dso__synthesize_plt_symbols(dso, runtime_ss);
 		if (nr_plt > 0)
 			ret += nr_plt;
+
+		if (!kmod && !dso__is_vdso(dso) && dso->has_build_id) {
+			nsinfo__mountns_exit(&nsc);
+			dso__save_symidx(dso, symsrc_key);
+			nsinfo__mountns_enter(dso->nsinfo, &nsc);
+		}
 	}
 
 	for (; ss_pos > 0; ss_pos--)
@@ -0,0 +1,218 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * PR_SET_LAZY_FORK shares the PTE tables of private anonymous memory with
+ * the child on fork: check that both sides keep seeing their own memory
+ * through fork, copy-on-write, mprotect() and munmap() of shared tables.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#ifndef PR_SET_LAZY_FORK
+#define PR_SET_LAZY_FORK	57
+#define PR_GET_LAZY_FORK	58
+#endif
+
+/* Kselftest framework requirement - SKIP code is 4. */
+#define KSFT_SKIP		4
+
+#define PMD_SZ			(2UL << 20)
+#define NR_PMDS			4
+#define MAP_SZ			(NR_PMDS * PMD_SZ)
+
+#define BUG_ON(condition, description)					\
+	do {								\
+		if (condition) {					\
+			fprintf(stderr, "[FAIL]\t%s:%d\t%s:%s\n", __func__, \
+				__LINE__, (description), strerror(errno)); \
+			exit(1);					\
+		}							\
+	} while (0)
+
+static unsigned long page_size;
+
+/* Page n of the mapping holds seed + n */
+static void fill(char *p, size_t start, size_t size, char seed)
+{
+	size_t i;
+
+	for (i = start; i < start + size; i += page_size)
+		p[i] = seed + i / page_size;
+}
+
+static int check(const char *p, size_t start, size_t size, char seed)
+{
+	size_t i;
+
+	for (i = start; i < start + size; i += page_size)
+		if (p[i] != (char)(seed + i / page_size))
+			return -1;
+	return 0;
+}
+
+/* A PMD aligned private anonymous mapping, populated with small pages */
+static char *map_aligned(void)
+{
+	char *p;
+
+	p = mmap(NULL, MAP_SZ + PMD_SZ, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	BUG_ON(p == MAP_FAILED, "mmap()");
+	p = (char *)(((unsigned long)p + PMD_SZ - 1) & ~(PMD_SZ - 1));
+	BUG_ON(madvise(p, MAP_SZ, MADV_NOHUGEPAGE) && errno != EINVAL,
+	       "madvise(MADV_NOHUGEPAGE)");
+	fill(p, 0, MAP_SZ, 'a');
+	return p;
+}
+
+/* Runs fn in a child forked with the tables of p shared, then checks p */
+static void run_child(const char *name, char *p, int (*fn)(char *p))
+{
+	int status;
+	pid_t pid;
+
+	pid = fork();
+	BUG_ON(pid < 0, "fork()");
+	if (!pid)
+		_exit(fn(p));
+
+	BUG_ON(waitpid(pid, &status, 0) != pid, "waitpid()");
+	BUG_ON(!WIFEXITED(status) || WEXITSTATUS(status), name);
+	BUG_ON(check(p, 0, MAP_SZ, 'a'), "child changed the parent's memory");
+	printf("[PASS]\t%s\n", name);
+}
+
+static int child_read(char *p)
+{
+	/* Not inherited: grandchildren copy their tables again */
+	if (prctl(PR_GET_LAZY_FORK, 0, 0, 0, 0) != 0)
+		return 1;
+	return check(p, 0, MAP_SZ, 'a') ? 1 : 0;
+}
+
+static int child_cow(char *p)
+{
+	/* One page of each table, then all of one table */
+	size_t i;
+
+	for (i = 0; i < MAP_SZ; i += PMD_SZ)
+		p[i + page_size] = 'X';
+	fill(p, 0, PMD_SZ, 'b');
+
+	if (check(p, 0, PMD_SZ, 'b'))
+		return 1;
+	for (i = PMD_SZ; i < MAP_SZ; i += PMD_SZ) {
+		if (p[i + page_size] != 'X')
+			return 1;
+		fill(p, i + page_size, page_size, 'a');
+		if (check(p, i, PMD_SZ, 'a'))
+			return 1;
+	}
+	return 0;
+}
+
+static int child_mprotect(char *p)
+{
+	/* Part of one table, then a whole one */
+	if (mprotect(p + page_size, page_size, PROT_READ) ||
+	    mprotect(p + PMD_SZ, PMD_SZ, PROT_READ))
+		return 1;
+	if (check(p, 0, MAP_SZ, 'a'))
+		return 1;
+
+	if (mprotect(p, MAP_SZ, PROT_READ | PROT_WRITE))
+		return 1;
+	fill(p, 0, MAP_SZ, 'c');
+	return check(p, 0, MAP_SZ, 'c') ? 1 : 0;
+}
+
+static int child_munmap(char *p)
+{
+	/* Part of one table, then a whole one */
+	if (munmap(p + page_size, page_size) ||
+	    munmap(p + PMD_SZ, PMD_SZ))
+		return 1;
+	if (check(p, 0, page_size, 'a') ||
+	    check(p, 2 * page_size, PMD_SZ - 2 * page_size, 'a') ||
+	    check(p, 2 * PMD_SZ, 2 * PMD_SZ, 'a'))
+		return 1;
+
+	/* Fault the hole back in: it must come back zeroed */
+	if (mmap(p + PMD_SZ, PMD_SZ, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED)
+		return 1;
+	if (p[PMD_SZ] || p[2 * PMD_SZ - 1])
+		return 1;
+	return munmap(p, MAP_SZ) ? 1 : 0;
+}
+
+/* The parent changes the memory while the child still shares its tables */
+static void parent_cow(char *p)
+{
+	int pipefd[2], status;
+	pid_t pid;
+	char c;
+
+	BUG_ON(pipe(pipefd), "pipe()");
+	pid = fork();
+	BUG_ON(pid < 0, "fork()");
+	if (!pid) {
+		close(pipefd[1]);
+		if (read(pipefd[0], &c, 1) != 1)
+			_exit(1);
+		_exit(check(p, 0, MAP_SZ, 'a') ? 1 : 0);
+	}
+	close(pipefd[0]);
+
+	fill(p, 0, MAP_SZ, 'd');
+	BUG_ON(munmap(p + PMD_SZ, PMD_SZ), "munmap()");
+	BUG_ON(write(pipefd[1], "x", 1) != 1, "write()");
+	close(pipefd[1]);
+
+	BUG_ON(waitpid(pid, &status, 0) != pid, "waitpid()");
+	BUG_ON(!WIFEXITED(status) || WEXITSTATUS(status),
+	       "child saw the parent's writes");
+	BUG_ON(check(p, 0, PMD_SZ, 'd') || check(p, 2 * PMD_SZ, 2 * PMD_SZ, 'd'),
+	       "parent lost its writes");
+	printf("[PASS]\tparent COW\n");
+}
+
+int main(int argc, char **argv)
+{
+	char *p;
+
+	page_size = sysconf(_SC_PAGESIZE);
+
+	if (prctl(PR_SET_LAZY_FORK, 1, 0, 0, 0)) {
+		if (errno == EINVAL || errno == EPERM) {
+			printf("[SKIP]\tlazy fork: %s\n", strerror(errno));
+			return KSFT_SKIP;
+		}
+		BUG_ON(1, "prctl(PR_SET_LAZY_FORK)");
+	}
+	BUG_ON(prctl(PR_GET_LAZY_FORK, 0, 0, 0, 0) != 1,
+	       "prctl(PR_GET_LAZY_FORK)");
+	BUG_ON(prctl(PR_SET_LAZY_FORK, 1, 1, 0, 0) != -1 || errno != EINVAL,
+	       "prctl(PR_SET_LAZY_FORK) with extra arguments");
+
+	p = map_aligned();
+	run_child("fork", p, child_read);
+	run_child("child COW", p, child_cow);
+	run_child("mprotect", p, child_mprotect);
+	run_child("munmap", p, child_munmap);
+	parent_cow(p);
+
+	BUG_ON(prctl(PR_SET_LAZY_FORK, 0, 0, 0, 0), "prctl(PR_SET_LAZY_FORK)");
+	BUG_ON(prctl(PR_GET_LAZY_FORK, 0, 0, 0, 0) != 0,
+	       "prctl(PR_GET_LAZY_FORK)");
+
+	return 0;
+}
@@ -467,6 +467,20 @@ static int uffd_read_msg(int ufd, struct uffd_msg *msg)
 	return 0;
 }
 
+static void wp_range(int ufd, __u64 start, __u64 len, bool wp)
+{
+	struct uffdio_writeprotect prms;
+
+	prms.range.start = start;
+	prms.range.len = len;
+	/* removing the protection also wakes the faulting thread */
+	prms.mode = wp ? UFFDIO_WRITEPROTECT_MODE_WP : 0;
+
+	if (ioctl(ufd, UFFDIO_WRITEPROTECT, &prms))
+		fprintf(stderr, "UFFDIO_WRITEPROTECT failed %d\n", errno),
+			exit(1);
+}
+
 /* Return 1 if page fault handled by us; otherwise 0 */
 static int uffd_handle_page_fault(struct uffd_msg *msg)
 {
@@ -476,6 +490,12 @@ static int uffd_handle_page_fault(struct uffd_msg *msg)
 		fprintf(stderr, "unexpected msg event %u\n",
 			msg->event), exit(1);
 
+	if (msg->arg.pagefault.flags & UFFD_PAGEFAULT_FLAG_WP) {
+		wp_range(uffd, msg->arg.pagefault.address & ~(page_size-1),
+			 page_size, false);
+		return 1;
+	}
+
 	if (bounces & BOUNCE_VERIFY &&
 	    msg->arg.pagefault.flags & UFFD_PAGEFAULT_FLAG_WRITE)
 		fprintf(stderr, "unexpected write fault\n"), exit(1);
@@ -1030,6 +1050,92 @@ static int userfaultfd_sig_test(void)
 	close(uffd);
 	return userfaults != 0;
 }
+/*
+ * Write protect a populated anonymous area and check that the first
+ * write to each page is reported. A child forked without
+ * UFFD_FEATURE_EVENT_FORK loses the registration, so it must not
+ * inherit the protection either: it registers the area for WP with its
+ * own uffd, without protecting anything, and any WP fault it gets on
+ * write is delivered as SIGBUS.
+ */
+static int userfaultfd_wp_test(void)
+{
+	struct uffdio_register uffdio_register;
+	unsigned long userfaults;
+	pthread_t uffd_mon;
+	unsigned long nr;
+	int err;
+	pid_t pid;
+	char c;
+
+	if (test_type != TEST_ANON)
+		return 0;
+
+	printf("testing UFFDIO_WRITEPROTECT: ");
+	fflush(stdout);
+
+	if (uffd_test_ops->release_pages(area_dst))
+		return 1;
+	memset(area_dst, 0x55, nr_pages * page_size);
+
+	if (userfaultfd_open(UFFD_FEATURE_PAGEFAULT_FLAG_WP) < 0)
+		return 1;
+	fcntl(uffd, F_SETFL, uffd_flags | O_NONBLOCK);
+
+	uffdio_register.range.start = (unsigned long) area_dst;
+	uffdio_register.range.len = nr_pages * page_size;
+	uffdio_register.mode = UFFDIO_REGISTER_MODE_WP;
+	if (ioctl(uffd, UFFDIO_REGISTER, &uffdio_register)) {
+		if (errno != EINVAL)
+			fprintf(stderr, "register failure\n"), exit(1);
+		printf("skipped, not supported.\n");
+		close(uffd);
+		return 0;
+	}
+	if (!(uffdio_register.ioctls & ((__u64)1 << _UFFDIO_WRITEPROTECT)))
+		fprintf(stderr,
+			"unexpected missing ioctl for wp\n"), exit(1);
+
+	wp_range(uffd, (unsigned long) area_dst, nr_pages * page_size, true);
+
+	pid = fork();
+	if (pid < 0)
+		perror("fork"), exit(1);
+	if (!pid) {
+		if (userfaultfd_open(UFFD_FEATURE_PAGEFAULT_FLAG_WP |
+				     UFFD_FEATURE_SIGBUS) < 0)
+			exit(1);
+		if (ioctl(uffd, UFFDIO_REGISTER, &uffdio_register))
+			fprintf(stderr, "child register failure\n"), exit(1);
+		memset(area_dst, 0xaa, nr_pages * page_size);
+		exit(0);
+	}
+	waitpid(pid, &err, 0);
+	if (err)
+		fprintf(stderr, "child inherited write protection\n"), exit(1);
+
+	if (pthread_create(&uffd_mon, &attr, uffd_poll_thread, NULL))
+		perror("uffd_poll_thread create"), exit(1);
+
+	for (nr = 0; nr < nr_pages; nr++)
+		area_dst[nr * page_size] = 1;
+
+	if (write(pipefd[1], &c, sizeof(c)) != sizeof(c))
+		perror("pipe write"), exit(1);
+	if (pthread_join(uffd_mon, (void **)&userfaults))
+		return 1;
+
+	for (nr = 0; nr < nr_pages; nr++)
+		if (area_dst[nr * page_size + 1] != 0x55)
+			fprintf(stderr, "nr %lu memory corruption\n", nr),
+				exit(1);
+
+	close(uffd);
+	printf("userfaults: %ld\n", userfaults);
+
+	return userfaults != nr_pages;
+}
+
 static int userfaultfd_stress(void)
 {
 	void *area;
@@ -1220,7 +1326,7 @@ static int userfaultfd_stress(void)
 
 	close(uffd);
 	return userfaultfd_zeropage_test() || userfaultfd_sig_test()
-		|| userfaultfd_events_test();
+		|| userfaultfd_events_test() || userfaultfd_wp_test();
 }
 
 /*